@@ -0,0 +1,185 @@
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+#include "ngx_http_waf_ac.h"
+
+/*
+ * Aho-Corasick 自动机构建与扫描
+ *
+ * 构建流程（配置期，一次性）：
+ *  1. 统计 pattern 中出现的字节，分配等价类（caseless 时按小写折叠）
+ *  2. 在临时表中插入全部 pattern 形成 trie（状态上界 = 总字节数 + 1）
+ *  3. BFS 计算失败链接，并把缺失的转移展开为失败状态的转移（得到完整 DFA）
+ *  4. 按实际状态数把转移表与输出链接拷贝到 pool，释放临时表
+ *
+ * 扫描（运行期）：每字节一次查表；仅在到达带输出状态时沿 dict_link 遍历输出。
+ */
+
+#define WAF_AC_NONE ((uint32_t)-1)
+
+waf_ac_t *waf_ac_compile(ngx_pool_t *pool, ngx_log_t *log, const waf_ac_pattern_t *pats,
+                         ngx_uint_t npats, ngx_flag_t caseless)
+{
+  if (pool == NULL || pats == NULL || npats == 0)
+    return NULL;
+
+  waf_ac_t *ac = ngx_pcalloc(pool, sizeof(waf_ac_t));
+  if (ac == NULL)
+    return NULL;
+  ac->caseless = caseless ? 1 : 0;
+
+  /* 1. 字节等价类 */
+  u_char seen[256];
+  ngx_memzero(seen, sizeof(seen));
+  size_t total = 0;
+  for (ngx_uint_t i = 0; i < npats; i++) {
+    if (pats[i].pattern.data == NULL || pats[i].pattern.len == 0)
+      return NULL;
+    for (size_t k = 0; k < pats[i].pattern.len; k++) {
+      u_char c = pats[i].pattern.data[k];
+      seen[caseless ? ngx_tolower(c) : c] = 1;
+    }
+    total += pats[i].pattern.len;
+    if (pats[i].slot + 1 > ac->nslots)
+      ac->nslots = pats[i].slot + 1;
+  }
+
+  ngx_uint_t ncls = 1; /* 类 0：未出现在任何 pattern 中的字节 */
+  for (ngx_uint_t b = 0; b < 256; b++) {
+    ac->classes[b] = seen[b] ? (uint16_t)ncls++ : 0;
+  }
+  if (caseless) {
+    for (ngx_uint_t b = 'A'; b <= 'Z'; b++) {
+      ac->classes[b] = ac->classes[b | 0x20];
+    }
+  }
+  ac->nclasses = ncls;
+
+  /* 2. trie（临时表，malloc 分配，构建完成后释放） */
+  size_t max_states = total + 1;
+  uint32_t *delta = ngx_alloc(max_states * ncls * sizeof(uint32_t), log);
+  uint32_t *out_head = ngx_calloc(max_states * sizeof(uint32_t), log);
+  uint32_t *fail = ngx_calloc(max_states * sizeof(uint32_t), log);
+  uint32_t *queue = ngx_alloc(max_states * sizeof(uint32_t), log);
+  ac->outputs = ngx_pnalloc(pool, npats * sizeof(waf_ac_output_t));
+  if (delta == NULL || out_head == NULL || fail == NULL || queue == NULL || ac->outputs == NULL) {
+    goto failed;
+  }
+  ngx_memset(delta, 0xff, max_states * ncls * sizeof(uint32_t));
+
+  ngx_uint_t nstates = 1;
+  for (ngx_uint_t i = 0; i < npats; i++) {
+    uint32_t s = 0;
+    for (size_t k = 0; k < pats[i].pattern.len; k++) {
+      uint32_t *edge = &delta[s * ncls + ac->classes[pats[i].pattern.data[k]]];
+      if (*edge == WAF_AC_NONE) {
+        *edge = (uint32_t)nstates++;
+      }
+      s = *edge;
+    }
+    waf_ac_output_t *o = &ac->outputs[i];
+    o->slot = pats[i].slot;
+    o->rule_id = pats[i].rule_id;
+    o->pattern_index = pats[i].pattern_index;
+    o->next = out_head[s];
+    out_head[s] = (uint32_t)(i + 1);
+  }
+  ac->noutputs = npats;
+  ac->nstates = nstates;
+
+  ac->delta = ngx_pnalloc(pool, nstates * ncls * sizeof(uint32_t));
+  ac->out_head = ngx_pnalloc(pool, nstates * sizeof(uint32_t));
+  ac->out_link = ngx_pcalloc(pool, nstates * sizeof(uint32_t));
+  ac->dict_link = ngx_pcalloc(pool, nstates * sizeof(uint32_t));
+  if (ac->delta == NULL || ac->out_head == NULL || ac->out_link == NULL ||
+      ac->dict_link == NULL) {
+    goto failed;
+  }
+
+  /* 3. BFS：失败链接 + 转移展开；失败状态深度更小，必然先于当前状态完成 */
+  ngx_uint_t qh = 0, qt = 0;
+  for (ngx_uint_t c = 0; c < ncls; c++) {
+    uint32_t t = delta[c];
+    if (t == WAF_AC_NONE) {
+      delta[c] = 0;
+    } else {
+      fail[t] = 0;
+      queue[qt++] = t;
+    }
+  }
+  while (qh < qt) {
+    uint32_t s = queue[qh++];
+    uint32_t f = fail[s];
+    ac->out_link[s] = out_head[s] ? s : ac->out_link[f];
+    ac->dict_link[s] = out_head[s] ? ac->out_link[f] : 0;
+    for (ngx_uint_t c = 0; c < ncls; c++) {
+      uint32_t *edge = &delta[s * ncls + c];
+      if (*edge == WAF_AC_NONE) {
+        *edge = delta[f * ncls + c];
+      } else {
+        fail[*edge] = delta[f * ncls + c];
+        queue[qt++] = *edge;
+      }
+    }
+  }
+
+  /* 4. 拷贝到 pool */
+  ngx_memcpy(ac->delta, delta, nstates * ncls * sizeof(uint32_t));
+  ngx_memcpy(ac->out_head, out_head, nstates * sizeof(uint32_t));
+
+  ngx_free(delta);
+  ngx_free(out_head);
+  ngx_free(fail);
+  ngx_free(queue);
+
+  if (log) {
+    ngx_log_error(NGX_LOG_INFO, log, 0,
+                  "waf: ac compiled patterns=%ui states=%ui classes=%ui caseless=%i", npats,
+                  nstates, ncls, caseless);
+  }
+  return ac;
+
+failed:
+  if (delta)
+    ngx_free(delta);
+  if (out_head)
+    ngx_free(out_head);
+  if (fail)
+    ngx_free(fail);
+  if (queue)
+    ngx_free(queue);
+  return NULL;
+}
+
+ngx_uint_t waf_ac_scan(const waf_ac_t *ac, const u_char *data, size_t len, u_char *hits)
+{
+  uint32_t s = 0;
+  return waf_ac_scan_stream(ac, data, len, hits, &s);
+}
+
+ngx_uint_t waf_ac_scan_stream(const waf_ac_t *ac, const u_char *data, size_t len, u_char *hits,
+                              uint32_t *state)
+{
+  if (ac == NULL || data == NULL || len == 0)
+    return 0;
+
+  const uint32_t *delta = ac->delta;
+  const uint16_t *classes = ac->classes;
+  ngx_uint_t ncls = ac->nclasses;
+  ngx_uint_t n = 0;
+  uint32_t s = *state;
+
+  for (size_t i = 0; i < len; i++) {
+    s = delta[s * ncls + classes[data[i]]];
+    for (uint32_t t = ac->out_link[s]; t != 0; t = ac->dict_link[t]) {
+      for (uint32_t o = ac->out_head[t]; o != 0; o = ac->outputs[o - 1].next) {
+        if (hits) {
+          hits[ac->outputs[o - 1].slot] = 1;
+        }
+        n++;
+      }
+    }
+  }
+  *state = s;
+  return n;
+}
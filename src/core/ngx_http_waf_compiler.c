@@ -3,6 +3,7 @@
 #include <ngx_http.h>
 
 #include "ngx_http_waf_compiler.h"
+#include "ngx_http_waf_types.h"
 
 #include <ngx_regex.h>
 #include <uthash/uthash.h>
@@ -54,6 +55,14 @@ static ngx_int_t waf_parse_match(const char *s, size_t len, waf_match_e *out)
     *out = WAF_MATCH_CIDR;
     return NGX_OK;
   }
+  if (len == 5 && ngx_strncasecmp((u_char *)s, (u_char *)"COUNT", 5) == 0) {
+    *out = WAF_MATCH_COUNT;
+    return NGX_OK;
+  }
+  if (len == 6 && ngx_strncasecmp((u_char *)s, (u_char *)"LENGTH", 6) == 0) {
+    *out = WAF_MATCH_LENGTH;
+    return NGX_OK;
+  }
   return NGX_ERROR;
 }
 
@@ -138,6 +147,48 @@ static ngx_int_t waf_copy_tags(ngx_pool_t *pool, yyjson_val *tags_node, ngx_arra
   return NGX_OK;
 }
 
+/* ------------------------ 工具：transform 解析（string|string[] → 位掩码） ------------------------ */
+static ngx_int_t waf_parse_transform_one(yyjson_val *v, ngx_uint_t *mask)
+{
+  static const struct {
+    const char *name;
+    ngx_uint_t bit;
+  } names[] = {{"urlDecode", WAF_TF_URL_DECODE},
+               {"doubleDecode", WAF_TF_DOUBLE_DECODE},
+               {"normalizePath", WAF_TF_NORMALIZE_PATH},
+               {"compressWhitespace", WAF_TF_COMPRESS_WS},
+               {"lowercase", WAF_TF_LOWERCASE}};
+
+  if (!yyjson_is_str(v))
+    return NGX_ERROR;
+  const char *s = yyjson_get_str(v);
+  size_t len = yyjson_get_len(v);
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (len == ngx_strlen(names[i].name) && ngx_strncmp(s, names[i].name, len) == 0) {
+      *mask |= names[i].bit;
+      return NGX_OK;
+    }
+  }
+  return NGX_ERROR;
+}
+
+static ngx_int_t waf_parse_transform(yyjson_val *node, ngx_uint_t *out)
+{
+  *out = 0;
+  if (node == NULL)
+    return NGX_OK;
+  if (!yyjson_is_arr(node))
+    return waf_parse_transform_one(node, out);
+  size_t idx, max;
+  yyjson_val *it;
+  yyjson_arr_foreach(node, idx, max, it)
+  {
+    if (waf_parse_transform_one(it, out) != NGX_OK)
+      return NGX_ERROR;
+  }
+  return NGX_OK;
+}
+
 /* ------------------------ 工具：pattern 复制（string|string[] → array）
  * ------------------------ */
 static ngx_int_t waf_copy_patterns(ngx_pool_t *pool, yyjson_val *pattern_node,
@@ -277,7 +328,107 @@ static void waf_sort_bucket_by_priority_stable(ngx_array_t *bucket)
 }
 
 /* ------------------------ 预编译：REGEX/CIDR ------------------------ */
-static ngx_int_t waf_precompile_regexes(ngx_pool_t *pool, ngx_log_t *log, waf_compiled_rule_t *rule)
+/* ------------------------ 正则驻留缓存 ------------------------ */
+typedef struct {
+  ngx_str_t key;      /* options（1 字节）+ pattern */
+  ngx_regex_t *regex; /* 编译产物（JIT 由 ngx_regex 模块在初始化时统一完成） */
+  UT_hash_handle hh;
+} waf_regex_entry_t;
+
+struct waf_regex_cache_s {
+  ngx_pool_t *pool;
+  waf_regex_entry_t *map;
+  ngx_uint_t compiled; /* 实际编译次数 */
+  ngx_uint_t reused;   /* 命中缓存次数 */
+};
+
+static void waf_regex_cache_cleanup(void *data)
+{
+  waf_regex_cache_t *cache = data;
+  /* 仅释放 uthash 表结构；条目与正则随 pool 回收 */
+  HASH_CLEAR(hh, cache->map);
+}
+
+waf_regex_cache_t *waf_regex_cache_create(ngx_pool_t *pool)
+{
+  waf_regex_cache_t *cache = ngx_pcalloc(pool, sizeof(waf_regex_cache_t));
+  if (cache == NULL)
+    return NULL;
+  ngx_pool_cleanup_t *cln = ngx_pool_cleanup_add(pool, 0);
+  if (cln == NULL)
+    return NULL;
+  cache->pool = pool;
+  cln->handler = waf_regex_cache_cleanup;
+  cln->data = cache;
+  return cache;
+}
+
+void waf_regex_cache_stats(const waf_regex_cache_t *cache, ngx_uint_t *compiled,
+                           ngx_uint_t *reused)
+{
+  *compiled = cache ? cache->compiled : 0;
+  *reused = cache ? cache->reused : 0;
+}
+
+/* 编译单个正则；cache 非空时按 (options, pattern) 复用已编译结果 */
+static ngx_regex_t *waf_regex_intern(ngx_pool_t *pool, ngx_log_t *log, waf_regex_cache_t *cache,
+                                     ngx_uint_t id, ngx_str_t *pattern, ngx_int_t options)
+{
+  size_t klen = pattern->len + 1;
+
+  if (cache) {
+    /* 查找键 [options | pattern] 放在栈上（过长时临时分配），命中缓存时不占用 pool */
+    u_char sbuf[256];
+    u_char *kbuf = klen <= sizeof(sbuf) ? sbuf : ngx_alloc(klen, log ? log : ngx_cycle->log);
+    if (kbuf == NULL)
+      return NULL;
+    kbuf[0] = (u_char)options;
+    ngx_memcpy(kbuf + 1, pattern->data, pattern->len);
+
+    waf_regex_entry_t *found = NULL;
+    HASH_FIND(hh, cache->map, kbuf, klen, found);
+    if (kbuf != sbuf)
+      ngx_free(kbuf);
+    if (found) {
+      cache->reused++;
+      return found->regex;
+    }
+  }
+
+  ngx_regex_compile_t rc;
+  u_char errstr[256];
+  ngx_memzero(&rc, sizeof(rc));
+  rc.pattern = *pattern;
+  rc.pool = cache ? cache->pool : pool;
+  rc.err.len = sizeof(errstr);
+  rc.err.data = errstr;
+  rc.options = options;
+  if (ngx_regex_compile(&rc) != NGX_OK) {
+    if (log) {
+      ngx_log_error(NGX_LOG_ERR, log, 0, "waf: regex compile failed: id=%ui pattern=%V err=%V", id,
+                    pattern, &rc.err);
+    }
+    return NULL;
+  }
+
+  if (cache) {
+    waf_regex_entry_t *e = ngx_pcalloc(cache->pool, sizeof(waf_regex_entry_t));
+    u_char *kbuf = ngx_pnalloc(cache->pool, klen);
+    if (e == NULL || kbuf == NULL)
+      return NULL;
+    kbuf[0] = (u_char)options;
+    ngx_memcpy(kbuf + 1, pattern->data, pattern->len);
+    e->key.data = kbuf;
+    e->key.len = klen;
+    e->regex = rc.regex;
+    HASH_ADD_KEYPTR(hh, cache->map, e->key.data, e->key.len, e);
+    cache->compiled++;
+  }
+  return rc.regex;
+}
+
+static ngx_int_t waf_precompile_regexes(ngx_pool_t *pool, ngx_log_t *log, waf_regex_cache_t *cache,
+                                        waf_compiled_rule_t *rule)
 {
   if (rule->match != WAF_MATCH_REGEX)
     return NGX_OK;
@@ -290,30 +441,91 @@ static ngx_int_t waf_precompile_regexes(ngx_pool_t *pool, ngx_log_t *log, waf_co
     return NGX_ERROR;
 
   ngx_str_t *pats = rule->patterns->elts;
+  ngx_int_t options = rule->caseless ? NGX_REGEX_CASELESS : 0;
   for (ngx_uint_t i = 0; i < n; i++) {
-    ngx_regex_compile_t rc;
-    u_char errstr[256];
-    ngx_memzero(&rc, sizeof(rc));
-    rc.pattern = pats[i];
-    rc.pool = pool;
-    rc.err.len = 0;
-    rc.err.data = errstr;
-    rc.options = rule->caseless ? NGX_REGEX_CASELESS : 0;
-    if (ngx_regex_compile(&rc) != NGX_OK) {
-      if (log) {
-        ngx_log_error(NGX_LOG_ERR, log, 0, "waf: regex compile failed: id=%ui pattern=%V err=%V",
-                      rule->id, &pats[i], &rc.err);
-      }
+    ngx_regex_t *re = waf_regex_intern(pool, log, cache, rule->id, &pats[i], options);
+    if (re == NULL)
       return NGX_ERROR;
-    }
     ngx_regex_t **slot = ngx_array_push(rule->compiled_regexes);
     if (slot == NULL)
       return NGX_ERROR;
-    *slot = rc.regex;
+    *slot = re;
+  }
+  return NGX_OK;
+}
+
+/*
+ * caseless 的 CONTAINS/EXACT 改写为“小写变体 + 大小写敏感匹配”：
+ * pattern 预先 ASCII 小写，运行期与同 target 的其他规则共享请求级小写视图，
+ * AC 分组与 EXACT 集合不再需要逐字节折叠。须在 AC/EXACT/字节位图构建前调用。
+ */
+static ngx_int_t waf_precompile_case_fold(ngx_pool_t *pool, waf_compiled_rule_t *rule)
+{
+  if (!rule->caseless || rule->patterns == NULL ||
+      (rule->match != WAF_MATCH_CONTAINS && rule->match != WAF_MATCH_EXACT))
+    return NGX_OK;
+
+  ngx_str_t *pats = rule->patterns->elts;
+  for (ngx_uint_t i = 0; i < rule->patterns->nelts; i++) {
+    if (pats[i].len == 0)
+      continue;
+    u_char *p = ngx_pnalloc(pool, pats[i].len);
+    if (p == NULL)
+      return NGX_ERROR;
+    ngx_strlow(p, pats[i].data, pats[i].len);
+    pats[i].data = p;
   }
+  rule->caseless = 0;
+  rule->transform |= WAF_TF_LOWERCASE;
   return NGX_OK;
 }
 
+/*
+ * COUNT/LENGTH：pattern 须为单个非负整数，编译为 rule->limit；同时校验 target 组合
+ * - COUNT：ARGS_COMBINED（参数个数）、HEADER（headerName 为 "*" 时为请求头总数，否则为同名头个数）
+ * - LENGTH：URI、ARGS_COMBINED（query 总长）、ARGS_NAME/ARGS_VALUE（最长参数名/值）、BODY、HEADER
+ * 参数长度均按解码前的原始字节计算
+ */
+static ngx_int_t waf_precompile_limit(waf_compiled_rule_t *rule, ngx_http_waf_json_error_t *err)
+{
+  if (!waf_match_is_structural(rule->match))
+    return NGX_OK;
+
+  ngx_uint_t ok;
+  if (rule->match == WAF_MATCH_COUNT) {
+    ok = rule->target == WAF_T_ARGS_COMBINED || rule->target == WAF_T_HEADER;
+  } else {
+    ok = rule->target != WAF_T_CLIENT_IP;
+  }
+  if (!ok) {
+    if (err) {
+      ngx_str_set(&err->message, "COUNT/LENGTH 不支持该 target");
+    }
+    return NGX_ERROR;
+  }
+
+  ngx_str_t *pats = rule->patterns ? rule->patterns->elts : NULL;
+  rule->limit = (pats && rule->patterns->nelts == 1) ? ngx_atoof(pats[0].data, pats[0].len)
+                                                     : NGX_ERROR;
+  if (rule->limit == NGX_ERROR) {
+    if (err) {
+      ngx_str_set(&err->message, "COUNT/LENGTH 的 pattern 必须为单个非负整数");
+    }
+    return NGX_ERROR;
+  }
+  rule->transform = 0;
+  return NGX_OK;
+}
+
+/* EXACT：patterns 构建为哈希集合，运行期 O(1) 查询（caseless 集合按 ASCII 折叠） */
+static ngx_int_t waf_precompile_exact_set(ngx_pool_t *pool, waf_compiled_rule_t *rule)
+{
+  if (rule->match != WAF_MATCH_EXACT || rule->patterns == NULL || rule->patterns->nelts == 0)
+    return NGX_OK;
+  rule->exact_set = waf_strset_create(pool, rule->patterns, rule->caseless);
+  return rule->exact_set ? NGX_OK : NGX_ERROR;
+}
+
 static ngx_int_t waf_parse_cidr_one(ngx_str_t *s, ngx_cidr_t *out)
 {
   ngx_memzero(out, sizeof(*out));
@@ -348,9 +560,1159 @@ static ngx_int_t waf_precompile_cidrs(ngx_pool_t *pool, ngx_log_t *log, waf_comp
   return NGX_OK;
 }
 
+/* ------------------------ 预编译：REGEX 必含字面量因子 ------------------------ */
+/*
+ * 对正则做一次保守的结构分析，得到“任一匹配必然包含其中之一”的字面量集合（OR 语义）：
+ *  - exact：表达式只能匹配的有限字符串集合（NULL 表示无穷/未知）
+ *  - req  ：任一匹配必含其中之一的字面量集合（NULL 表示无要求）
+ * 拼接取最优的连续 exact 段，分支取各分支 req 的并集；可选量词（?、*、{0,}）使要求失效。
+ * 遇到不认识的语法（(?x)、(*VERB)、递归/条件等）整体放弃，规则退化为总是执行正则。
+ */
+#define WAF_RF_MAX_SET 128 /* 单个集合的最大字符串数 */
+#define WAF_RF_MAX_LEN 64  /* 单个字面量的最大长度 */
+#define WAF_RF_MAX_DEPTH 64
+
+typedef struct {
+  ngx_array_t *exact; /* ngx_array_t(ngx_str_t) */
+  ngx_array_t *req;   /* ngx_array_t(ngx_str_t) */
+} waf_rf_info_t;
+
+typedef struct {
+  ngx_pool_t *pool; /* 分析期临时池 */
+  const u_char *p;
+  const u_char *end;
+  ngx_flag_t caseless;
+  ngx_flag_t bail;
+  ngx_flag_t quote; /* 位于 \Q...\E 内：逐字节按字面量处理 */
+  ngx_uint_t depth;
+} waf_rf_ctx_t;
+
+static waf_rf_info_t waf_rf_alt(waf_rf_ctx_t *c);
+
+static ngx_array_t *waf_rf_set_new(waf_rf_ctx_t *c, ngx_uint_t n)
+{
+  ngx_array_t *a = ngx_array_create(c->pool, n > 0 ? n : 1, sizeof(ngx_str_t));
+  if (a == NULL)
+    c->bail = 1;
+  return a;
+}
+
+/* 追加（去重）；超出上限返回 NGX_DECLINED */
+static ngx_int_t waf_rf_set_add(waf_rf_ctx_t *c, ngx_array_t *set, const u_char *s, size_t len)
+{
+  ngx_str_t *e = set->elts;
+  for (ngx_uint_t i = 0; i < set->nelts; i++) {
+    if (e[i].len == len && (len == 0 || ngx_memcmp(e[i].data, s, len) == 0))
+      return NGX_OK;
+  }
+  if (set->nelts >= WAF_RF_MAX_SET || len > WAF_RF_MAX_LEN)
+    return NGX_DECLINED;
+  ngx_str_t *slot = ngx_array_push(set);
+  u_char *d = ngx_pnalloc(c->pool, len > 0 ? len : 1);
+  if (slot == NULL || d == NULL) {
+    c->bail = 1;
+    return NGX_ERROR;
+  }
+  if (len > 0)
+    ngx_memcpy(d, s, len);
+  slot->data = d;
+  slot->len = len;
+  return NGX_OK;
+}
+
+static waf_rf_info_t waf_rf_exact1(waf_rf_ctx_t *c, const u_char *s, size_t len)
+{
+  waf_rf_info_t info = {NULL, NULL};
+  info.exact = waf_rf_set_new(c, 1);
+  if (info.exact != NULL)
+    waf_rf_set_add(c, info.exact, s, len);
+  return info;
+}
+
+/* 集合可作为要求：非空且不含空串 */
+static ngx_flag_t waf_rf_set_usable(const ngx_array_t *set)
+{
+  if (set == NULL || set->nelts == 0)
+    return 0;
+  ngx_str_t *e = set->elts;
+  for (ngx_uint_t i = 0; i < set->nelts; i++) {
+    if (e[i].len == 0)
+      return 0;
+  }
+  return 1;
+}
+
+/* 候选优劣：最短字面量越长越好，其次字符串数越少越好 */
+static ngx_array_t *waf_rf_better(ngx_array_t *a, ngx_array_t *b)
+{
+  if (!waf_rf_set_usable(b))
+    return waf_rf_set_usable(a) ? a : NULL;
+  if (!waf_rf_set_usable(a))
+    return b;
+  size_t amin = (size_t)-1, bmin = (size_t)-1;
+  ngx_str_t *ae = a->elts, *be = b->elts;
+  for (ngx_uint_t i = 0; i < a->nelts; i++)
+    amin = ngx_min(amin, ae[i].len);
+  for (ngx_uint_t i = 0; i < b->nelts; i++)
+    bmin = ngx_min(bmin, be[i].len);
+  if (amin != bmin)
+    return amin > bmin ? a : b;
+  return a->nelts <= b->nelts ? a : b;
+}
+
+/* 笛卡尔积拼接；超限返回 NULL（调用方据此截断连续段） */
+static ngx_array_t *waf_rf_cross(waf_rf_ctx_t *c, ngx_array_t *a, ngx_array_t *b)
+{
+  if (a->nelts * b->nelts > WAF_RF_MAX_SET)
+    return NULL;
+  ngx_array_t *out = waf_rf_set_new(c, a->nelts * b->nelts);
+  if (out == NULL)
+    return NULL;
+  u_char buf[WAF_RF_MAX_LEN];
+  ngx_str_t *ae = a->elts, *be = b->elts;
+  for (ngx_uint_t i = 0; i < a->nelts; i++) {
+    for (ngx_uint_t j = 0; j < b->nelts; j++) {
+      if (ae[i].len + be[j].len > WAF_RF_MAX_LEN)
+        return NULL;
+      ngx_memcpy(buf, ae[i].data, ae[i].len);
+      ngx_memcpy(buf + ae[i].len, be[j].data, be[j].len);
+      if (waf_rf_set_add(c, out, buf, ae[i].len + be[j].len) != NGX_OK)
+        return NULL;
+    }
+  }
+  return out;
+}
+
+/* 并集；超限返回 NULL */
+static ngx_array_t *waf_rf_union(waf_rf_ctx_t *c, ngx_array_t *a, ngx_array_t *b)
+{
+  ngx_array_t *out = waf_rf_set_new(c, a->nelts + b->nelts);
+  if (out == NULL)
+    return NULL;
+  ngx_array_t *src[2] = {a, b};
+  for (ngx_uint_t k = 0; k < 2; k++) {
+    ngx_str_t *e = src[k]->elts;
+    for (ngx_uint_t i = 0; i < src[k]->nelts; i++) {
+      if (waf_rf_set_add(c, out, e[i].data, e[i].len) != NGX_OK)
+        return NULL;
+    }
+  }
+  return out;
+}
+
+static ngx_int_t waf_rf_hex(u_char ch)
+{
+  if (ch >= '0' && ch <= '9')
+    return ch - '0';
+  ch = ngx_tolower(ch);
+  if (ch >= 'a' && ch <= 'f')
+    return ch - 'a' + 10;
+  return -1;
+}
+
+/* 单字节字面量：caseless 下的非 ASCII 字节折叠规则依赖字符表，按未知处理 */
+static waf_rf_info_t waf_rf_byte(waf_rf_ctx_t *c, u_char ch)
+{
+  waf_rf_info_t none = {NULL, NULL};
+  if (c->caseless && ch >= 0x80)
+    return none;
+  return waf_rf_exact1(c, &ch, 1);
+}
+
+/* 跳过字符类 [...]（含 [:alpha:] 与转义） */
+static void waf_rf_skip_class(waf_rf_ctx_t *c)
+{
+  c->p++; /* '[' */
+  if (c->p < c->end && *c->p == '^')
+    c->p++;
+  if (c->p < c->end && *c->p == ']')
+    c->p++;
+  while (c->p < c->end && *c->p != ']') {
+    if (*c->p == '\\' && c->p + 1 < c->end) {
+      c->p += 2;
+    } else if (*c->p == '[' && c->p + 1 < c->end && c->p[1] == ':') {
+      const u_char *q = c->p + 2;
+      while (q + 1 < c->end && !(q[0] == ':' && q[1] == ']'))
+        q++;
+      c->p = (q + 1 < c->end) ? q + 2 : q + 1;
+    } else {
+      c->p++;
+    }
+  }
+  if (c->p >= c->end) {
+    c->bail = 1;
+    return;
+  }
+  c->p++; /* ']' */
+}
+
+/*
+ * 空的 \Q\E 与孤立的 \E 在 PCRE 中被忽略，其后的量词作用于前一个原子；
+ * 已拼接的前一原子无法回退，遇到量词整体放弃
+ */
+static waf_rf_info_t waf_rf_empty(waf_rf_ctx_t *c)
+{
+  waf_rf_info_t none = {NULL, NULL};
+  if (c->p < c->end && (*c->p == '*' || *c->p == '+' || *c->p == '?' || *c->p == '{')) {
+    c->bail = 1;
+    return none;
+  }
+  return waf_rf_exact1(c, (u_char *)"", 0);
+}
+
+/* \Q...\E 内的一个字节：每字节一个原子，\E 后的量词只作用于最后一个字节 */
+static u_char waf_rf_quote_next(waf_rf_ctx_t *c)
+{
+  u_char ch = *c->p++;
+  if (c->p >= c->end) {
+    c->quote = 0;
+  } else if (c->p + 1 < c->end && c->p[0] == '\\' && c->p[1] == 'E') {
+    c->p += 2;
+    c->quote = 0;
+  }
+  return ch;
+}
+
+static waf_rf_info_t waf_rf_quoted(waf_rf_ctx_t *c)
+{
+  return waf_rf_byte(c, waf_rf_quote_next(c));
+}
+
+static waf_rf_info_t waf_rf_escape(waf_rf_ctx_t *c)
+{
+  waf_rf_info_t none = {NULL, NULL};
+  c->p++; /* '\\' */
+  if (c->p >= c->end) {
+    c->bail = 1;
+    return none;
+  }
+  u_char e = *c->p++;
+  switch (e) {
+    case 'b': case 'B': case 'A': case 'z': case 'Z': case 'G': case 'K':
+      return waf_rf_exact1(c, (u_char *)"", 0);
+    case 'E':
+      return waf_rf_empty(c);
+    case 'd': case 'D': case 's': case 'S': case 'w': case 'W': case 'h': case 'H':
+    case 'v': case 'V': case 'R': case 'N': case 'X': case 'C':
+      return none;
+    case 'p': case 'P':
+      if (c->p < c->end && *c->p == '{') {
+        while (c->p < c->end && *c->p != '}')
+          c->p++;
+        if (c->p < c->end)
+          c->p++;
+      } else if (c->p < c->end) {
+        c->p++;
+      }
+      return none;
+    case 'n': return waf_rf_byte(c, '\n');
+    case 'r': return waf_rf_byte(c, '\r');
+    case 't': return waf_rf_byte(c, '\t');
+    case 'f': return waf_rf_byte(c, '\f');
+    case 'e': return waf_rf_byte(c, 0x1b);
+    case 'a': return waf_rf_byte(c, 0x07);
+    case 'c':
+      if (c->p >= c->end) {
+        c->bail = 1;
+        return none;
+      }
+      return waf_rf_byte(c, (u_char)(ngx_toupper(*c->p++) ^ 0x40));
+    case 'x': {
+      ngx_int_t v = 0;
+      if (c->p < c->end && *c->p == '{') {
+        c->p++;
+        while (c->p < c->end && *c->p != '}') {
+          ngx_int_t h = waf_rf_hex(*c->p++);
+          if (h < 0 || v > 0xff) {
+            c->bail = 1;
+            return none;
+          }
+          v = v * 16 + h;
+        }
+        if (c->p >= c->end) {
+          c->bail = 1;
+          return none;
+        }
+        c->p++;
+        return v <= 0xff ? waf_rf_byte(c, (u_char)v) : none;
+      }
+      for (ngx_uint_t k = 0; k < 2 && c->p < c->end && waf_rf_hex(*c->p) >= 0; k++)
+        v = v * 16 + waf_rf_hex(*c->p++);
+      return waf_rf_byte(c, (u_char)v);
+    }
+    case 'Q':
+      if (c->p + 1 < c->end && c->p[0] == '\\' && c->p[1] == 'E') {
+        c->p += 2;
+        return waf_rf_empty(c);
+      }
+      if (c->p >= c->end)
+        return waf_rf_exact1(c, (u_char *)"", 0);
+      c->quote = 1;
+      return waf_rf_quoted(c);
+    default:
+      break;
+  }
+  if (e >= '0' && e <= '9') {
+    /* 反向引用 / 八进制：不做推导 */
+    while (c->p < c->end && *c->p >= '0' && *c->p <= '9')
+      c->p++;
+    return none;
+  }
+  if ((e >= 'a' && e <= 'z') || (e >= 'A' && e <= 'Z')) {
+    /* \g \k \o \u 等：语义复杂或依赖编译选项，整体放弃 */
+    c->bail = 1;
+    return none;
+  }
+  return waf_rf_byte(c, e);
+}
+
+/* 内联标志 (?imsx-imsx) 或 (?imsx-imsx:...)；返回 1 表示非捕获分组 */
+static ngx_int_t waf_rf_flags(waf_rf_ctx_t *c)
+{
+  ngx_flag_t neg = 0;
+  while (c->p < c->end && *c->p != ')' && *c->p != ':') {
+    u_char f = *c->p++;
+    if (f == '-') {
+      neg = 1;
+    } else if (f == 'i') {
+      if (!neg)
+        c->caseless = 1; /* 大小写不敏感是超集，作用域外仍按 caseless 预筛是安全的 */
+    } else if (f == 'x') {
+      if (!neg)
+        c->bail = 1; /* 扩展模式下空白/注释语义不同 */
+    } else if (f != 'm' && f != 's' && f != 'n' && f != 'U' && f != 'J' && f != '^') {
+      c->bail = 1;
+    }
+  }
+  if (c->p >= c->end) {
+    c->bail = 1;
+    return 0;
+  }
+  return (*c->p++ == ':') ? 1 : 0;
+}
+
+static waf_rf_info_t waf_rf_group(waf_rf_ctx_t *c)
+{
+  waf_rf_info_t none = {NULL, NULL};
+  ngx_flag_t lookaround = 0;
+
+  c->p++; /* '(' */
+  if (c->p < c->end && *c->p == '*') {
+    c->bail = 1; /* (*VERB) */
+    return none;
+  }
+  if (c->p < c->end && *c->p == '?') {
+    c->p++;
+    if (c->p >= c->end) {
+      c->bail = 1;
+      return none;
+    }
+    u_char k = *c->p;
+    if (k == ':' || k == '|' || k == '>') {
+      c->p++;
+    } else if (k == '=' || k == '!') {
+      c->p++;
+      lookaround = 1;
+    } else if (k == '<' && c->p + 1 < c->end && (c->p[1] == '=' || c->p[1] == '!')) {
+      c->p += 2;
+      lookaround = 1;
+    } else if (k == '<' || k == '\'' || (k == 'P' && c->p + 1 < c->end && c->p[1] == '<')) {
+      u_char close = (k == '\'') ? '\'' : '>';
+      while (c->p < c->end && *c->p != close)
+        c->p++;
+      if (c->p >= c->end) {
+        c->bail = 1;
+        return none;
+      }
+      c->p++;
+    } else if (k == '#') {
+      while (c->p < c->end && *c->p != ')')
+        c->p++;
+      if (c->p >= c->end) {
+        c->bail = 1;
+        return none;
+      }
+      c->p++;
+      return waf_rf_exact1(c, (u_char *)"", 0);
+    } else if ((k >= 'a' && k <= 'z') || (k >= 'A' && k <= 'Z' && k != 'P' && k != 'R') ||
+               k == '-' || k == '^') {
+      if (!waf_rf_flags(c))
+        return c->bail ? none : waf_rf_exact1(c, (u_char *)"", 0);
+    } else {
+      c->bail = 1; /* 递归、条件、子程序调用等 */
+      return none;
+    }
+  }
+
+  waf_rf_info_t inner = waf_rf_alt(c);
+  if (c->bail)
+    return none;
+  if (c->p >= c->end || *c->p != ')') {
+    c->bail = 1;
+    return none;
+  }
+  c->p++;
+  /* 零宽断言不消耗字符：不对匹配内容作任何要求 */
+  return lookaround ? waf_rf_exact1(c, (u_char *)"", 0) : inner;
+}
+
+/*
+ * 花括号量词：仅 {n} {n,} {n,m} 为量词，解析成功返回 1 并越过 '}'；其余 { 为字面量返回 0。
+ * {,m} 与含空格的写法在 PCRE2 10.43 起才是量词，更早的 PCRE2 与 PCRE1 按字面量匹配，
+ * 两种语义下的推导结果不同，置 bail 整体放弃
+ */
+static ngx_flag_t waf_rf_brace(waf_rf_ctx_t *c, ngx_uint_t *n, ngx_uint_t *m, ngx_flag_t *comma,
+                               ngx_flag_t *has_m)
+{
+  const u_char *s = c->p + 1;
+  const u_char *t = s;
+  while (t < c->end && ((*t >= '0' && *t <= '9') || *t == ',' || *t == ' '))
+    t++;
+  ngx_flag_t has_n = 0;
+  *n = 0;
+  *m = 0;
+  *comma = 0;
+  *has_m = 0;
+  while (s < c->end && *s >= '0' && *s <= '9' && *n <= 65535) {
+    *n = *n * 10 + (*s++ - '0');
+    has_n = 1;
+  }
+  if (s < c->end && *s == ',') {
+    *comma = 1;
+    s++;
+    while (s < c->end && *s >= '0' && *s <= '9' && *m <= 65535) {
+      *m = *m * 10 + (*s++ - '0');
+      *has_m = 1;
+    }
+  }
+  if (s >= c->end || *s != '}' || !has_n) {
+    if (t < c->end && *t == '}' && t > c->p + 1 && (*has_m || t != s))
+      c->bail = 1;
+    return 0;
+  }
+  c->p = s + 1;
+  return 1;
+}
+
+/* 量词：就地改写原子的 exact/req（无量词时不变） */
+static void waf_rf_quantify(waf_rf_ctx_t *c, waf_rf_info_t *atom)
+{
+  if (c->p >= c->end)
+    return;
+  ngx_uint_t min;
+  ngx_flag_t zero_or_one = 0;
+  u_char q = *c->p;
+  if (q == '*') {
+    min = 0;
+    c->p++;
+  } else if (q == '+') {
+    min = 1;
+    c->p++;
+  } else if (q == '?') {
+    min = 0;
+    zero_or_one = 1;
+    c->p++;
+  } else if (q == '{') {
+    ngx_uint_t n, m;
+    ngx_flag_t comma, has_m;
+    if (!waf_rf_brace(c, &n, &m, &comma, &has_m))
+      return;
+    min = n;
+    zero_or_one = (min == 0 && comma && has_m && m == 1) || (min == 0 && !comma);
+    if (min == 1 && (!comma || (has_m && m == 1))) {
+      /* {1} / {1,1}：等价于原子本身 */
+      if (c->p < c->end && (*c->p == '?' || *c->p == '+'))
+        c->p++;
+      return;
+    }
+  } else {
+    return;
+  }
+  if (c->p < c->end && (*c->p == '?' || *c->p == '+'))
+    c->p++; /* 惰性/占有修饰 */
+
+  if (min == 0) {
+    /* 可选：x? 保留为 exact ∪ {""}，其余失去全部要求 */
+    ngx_array_t *exact = NULL;
+    if (zero_or_one && atom->exact) {
+      ngx_array_t *empty = waf_rf_exact1(c, (u_char *)"", 0).exact;
+      exact = empty ? waf_rf_union(c, atom->exact, empty) : NULL;
+    }
+    atom->exact = exact;
+    atom->req = NULL;
+    return;
+  }
+  /* 至少一次：要求保持，确切集合失效 */
+  if (atom->req == NULL && waf_rf_set_usable(atom->exact))
+    atom->req = atom->exact;
+  atom->exact = NULL;
+}
+
+static waf_rf_info_t waf_rf_concat(waf_rf_ctx_t *c)
+{
+  waf_rf_info_t res = {NULL, NULL};
+  ngx_array_t *run = waf_rf_exact1(c, (u_char *)"", 0).exact;
+  ngx_array_t *best = NULL;
+  ngx_flag_t all_exact = 1;
+
+  while (!c->bail && run != NULL && c->p < c->end &&
+         (c->quote || (*c->p != '|' && *c->p != ')'))) {
+    waf_rf_info_t atom = {NULL, NULL};
+    u_char ch = *c->p;
+    if (c->quote) {
+      atom = waf_rf_quoted(c);
+    } else if (ch == '(') {
+      atom = waf_rf_group(c);
+    } else if (ch == '[') {
+      waf_rf_skip_class(c);
+    } else if (ch == '\\') {
+      atom = waf_rf_escape(c);
+    } else if (ch == '.') {
+      c->p++;
+    } else if (ch == '^' || ch == '$') {
+      c->p++;
+      atom = waf_rf_exact1(c, (u_char *)"", 0);
+    } else if (ch == '*' || ch == '+' || ch == '?') {
+      c->bail = 1;
+      break;
+    } else {
+      c->p++;
+      atom = waf_rf_byte(c, ch);
+    }
+    if (c->bail)
+      break;
+    if (!c->quote)
+      waf_rf_quantify(c, &atom); /* \Q 内的 ?*+{ 是字面量 */
+
+    if (atom.exact) {
+      ngx_array_t *next = waf_rf_cross(c, run, atom.exact);
+      if (next == NULL) {
+        /* 超限：截断连续段，从当前原子重新开始 */
+        best = waf_rf_better(best, run);
+        all_exact = 0;
+        next = atom.exact;
+      }
+      run = next;
+    } else {
+      best = waf_rf_better(best, run);
+      best = waf_rf_better(best, atom.req);
+      all_exact = 0;
+      run = waf_rf_exact1(c, (u_char *)"", 0).exact;
+    }
+  }
+  if (c->bail || run == NULL) {
+    c->bail = 1;
+    return res;
+  }
+  res.req = waf_rf_better(best, run);
+  res.exact = all_exact ? run : NULL;
+  return res;
+}
+
+static waf_rf_info_t waf_rf_alt(waf_rf_ctx_t *c)
+{
+  waf_rf_info_t none = {NULL, NULL};
+  if (++c->depth > WAF_RF_MAX_DEPTH) {
+    c->bail = 1;
+    return none;
+  }
+
+  waf_rf_info_t res = waf_rf_concat(c);
+  while (!c->bail && c->p < c->end && *c->p == '|') {
+    c->p++;
+    waf_rf_info_t br = waf_rf_concat(c);
+    if (c->bail)
+      break;
+    res.exact = (res.exact && br.exact) ? waf_rf_union(c, res.exact, br.exact) : NULL;
+    res.req = (res.req && br.req) ? waf_rf_union(c, res.req, br.req) : NULL;
+  }
+  c->depth--;
+  return c->bail ? none : res;
+}
+
+/* 提取单个正则的因子集合；无法提取返回 NULL */
+ngx_array_t *waf_regex_extract_factors(ngx_pool_t *tmp, const ngx_str_t *pattern,
+                                       ngx_flag_t *caseless)
+{
+  waf_rf_ctx_t c;
+  ngx_memzero(&c, sizeof(c));
+  c.pool = tmp;
+  c.p = pattern->data;
+  c.end = pattern->data + pattern->len;
+  c.caseless = *caseless;
+
+  waf_rf_info_t info = waf_rf_alt(&c);
+  if (c.bail || c.p != c.end || !waf_rf_set_usable(info.req))
+    return NULL;
+  *caseless = c.caseless;
+  return info.req;
+}
+
+/* 规则级因子：各 pattern 因子的并集；任一 pattern 无因子则整条规则不做预筛 */
+static ngx_int_t waf_precompile_regex_factors(ngx_pool_t *pool, ngx_log_t *log,
+                                              waf_compiled_rule_t *rule)
+{
+  if (rule->match != WAF_MATCH_REGEX || rule->patterns == NULL || rule->patterns->nelts == 0)
+    return NGX_OK;
+
+  ngx_pool_t *tmp = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, log);
+  if (tmp == NULL)
+    return NGX_ERROR;
+
+  ngx_flag_t caseless = rule->caseless ? 1 : 0;
+  ngx_array_t *all = ngx_array_create(tmp, 8, sizeof(ngx_str_t));
+  ngx_str_t *pats = rule->patterns->elts;
+  for (ngx_uint_t i = 0; all != NULL && i < rule->patterns->nelts; i++) {
+    ngx_array_t *f = waf_regex_extract_factors(tmp, &pats[i], &caseless);
+    if (f == NULL || all->nelts + f->nelts > WAF_RF_MAX_SET) {
+      all = NULL;
+      break;
+    }
+    ngx_str_t *fe = f->elts;
+    for (ngx_uint_t k = 0; k < f->nelts; k++) {
+      ngx_str_t *slot = ngx_array_push(all);
+      if (slot == NULL) {
+        all = NULL;
+        break;
+      }
+      *slot = fe[k];
+    }
+  }
+
+  ngx_int_t rc = NGX_OK;
+  if (all != NULL) {
+    rule->regex_factors = ngx_array_create(pool, all->nelts, sizeof(ngx_str_t));
+    if (rule->regex_factors == NULL) {
+      rc = NGX_ERROR;
+    } else {
+      ngx_str_t *ae = all->elts;
+      for (ngx_uint_t k = 0; k < all->nelts; k++) {
+        ngx_str_t *slot = ngx_array_push(rule->regex_factors);
+        if (slot == NULL || waf_copy_str(pool, (const char *)ae[k].data, ae[k].len, slot) != NGX_OK) {
+          rc = NGX_ERROR;
+          break;
+        }
+      }
+      rule->regex_factors_caseless = caseless;
+    }
+  }
+  if (log && rc == NGX_OK) {
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0, "waf: regex factors id=%ui count=%ui", rule->id,
+                   rule->regex_factors ? rule->regex_factors->nelts : 0);
+  }
+
+  ngx_destroy_pool(tmp);
+  return rc;
+}
+
+/* ------------------------ 预编译：REGEX 最大匹配宽度 ------------------------ */
+/*
+ * 流式请求体检测在 [重叠窗口 | 本块] 上执行 REGEX，只有结论与整体匹配一致的正则可以这样做：
+ *  - 锚点（^ $ \A \z \Z \G \b \B）与环视依赖窗口之外的上下文，在块边界会误命中
+ *  - 反向引用、\X 与无界量词（* + {n,}）的匹配宽度没有上界，超出窗口即漏检
+ * 对正则做一次保守的结构分析得到单次匹配的最大字节数；遇到上述语法或不认识的语法返回 0（不可流式）
+ */
+#define WAF_RW_MAX 65536 /* 超过该宽度按无界处理（远大于任何合理的重叠窗口） */
+
+static size_t waf_rw_alt(waf_rf_ctx_t *c);
+
+static size_t waf_rw_mul(waf_rf_ctx_t *c, size_t w, ngx_uint_t k)
+{
+  if (k != 0 && w > WAF_RW_MAX / k) {
+    c->bail = 1;
+    return 0;
+  }
+  return w * k;
+}
+
+static size_t waf_rw_escape(waf_rf_ctx_t *c)
+{
+  c->p++; /* '\\' */
+  if (c->p >= c->end) {
+    c->bail = 1;
+    return 0;
+  }
+  u_char e = *c->p++;
+  switch (e) {
+    case 'K': case 'E':
+      return 0;
+    case 'd': case 'D': case 's': case 'S': case 'w': case 'W': case 'h': case 'H':
+    case 'v': case 'V': case 'N': case 'C':
+    case 'n': case 'r': case 't': case 'f': case 'e': case 'a':
+      return 1;
+    case 'R':
+      return 2; /* \r\n */
+    case 'p': case 'P':
+      if (c->p < c->end && *c->p == '{') {
+        while (c->p < c->end && *c->p != '}')
+          c->p++;
+      }
+      if (c->p < c->end)
+        c->p++;
+      return 1;
+    case 'c':
+      if (c->p < c->end)
+        c->p++;
+      return 1;
+    case 'x':
+      if (c->p < c->end && *c->p == '{') {
+        while (c->p < c->end && *c->p != '}')
+          c->p++;
+        if (c->p < c->end)
+          c->p++;
+        return 1;
+      }
+      for (ngx_uint_t k = 0; k < 2 && c->p < c->end && waf_rf_hex(*c->p) >= 0; k++)
+        c->p++;
+      return 1;
+    case 'Q':
+      if (c->p + 1 < c->end && c->p[0] == '\\' && c->p[1] == 'E') {
+        c->p += 2;
+        return 0;
+      }
+      if (c->p >= c->end)
+        return 0;
+      c->quote = 1;
+      waf_rf_quote_next(c);
+      return 1;
+    default:
+      break;
+  }
+  if ((e >= '0' && e <= '9') || (e >= 'a' && e <= 'z') || (e >= 'A' && e <= 'Z')) {
+    c->bail = 1; /* 锚点、反向引用、\X、\g \k \o 等 */
+    return 0;
+  }
+  return 1;
+}
+
+static size_t waf_rw_group(waf_rf_ctx_t *c)
+{
+  c->p++; /* '(' */
+  if (c->p < c->end && *c->p == '*') {
+    c->bail = 1;
+    return 0;
+  }
+  if (c->p < c->end && *c->p == '?') {
+    c->p++;
+    if (c->p >= c->end) {
+      c->bail = 1;
+      return 0;
+    }
+    u_char k = *c->p;
+    if (k == ':' || k == '|' || k == '>') {
+      c->p++;
+    } else if (k == '<' && c->p + 1 < c->end && c->p[1] != '=' && c->p[1] != '!') {
+      while (c->p < c->end && *c->p != '>')
+        c->p++;
+      if (c->p >= c->end) {
+        c->bail = 1;
+        return 0;
+      }
+      c->p++;
+    } else if (k == '\'' || (k == 'P' && c->p + 1 < c->end && c->p[1] == '<')) {
+      u_char close = (k == '\'') ? '\'' : '>';
+      c->p += (k == '\'') ? 1 : 2;
+      while (c->p < c->end && *c->p != close)
+        c->p++;
+      if (c->p >= c->end) {
+        c->bail = 1;
+        return 0;
+      }
+      c->p++;
+    } else if (k == '#') {
+      while (c->p < c->end && *c->p != ')')
+        c->p++;
+      if (c->p >= c->end) {
+        c->bail = 1;
+        return 0;
+      }
+      c->p++;
+      return 0;
+    } else if ((k >= 'a' && k <= 'z') || (k >= 'A' && k <= 'Z' && k != 'P' && k != 'R') ||
+               k == '-' || k == '^') {
+      if (!waf_rf_flags(c))
+        return 0;
+    } else {
+      c->bail = 1; /* 环视、递归、条件、子程序调用等 */
+      return 0;
+    }
+  }
+
+  size_t w = waf_rw_alt(c);
+  if (c->bail)
+    return 0;
+  if (c->p >= c->end || *c->p != ')') {
+    c->bail = 1;
+    return 0;
+  }
+  c->p++;
+  return w;
+}
+
+/* 量词：返回原子重复后的最大宽度；无界量词置 bail */
+static size_t waf_rw_quantify(waf_rf_ctx_t *c, size_t w)
+{
+  if (c->p >= c->end)
+    return w;
+  u_char q = *c->p;
+  if (q == '*' || q == '+') {
+    c->bail = 1;
+    return 0;
+  }
+  if (q == '?') {
+    c->p++;
+  } else if (q == '{') {
+    ngx_uint_t n, m;
+    ngx_flag_t comma, has_m;
+    if (!waf_rf_brace(c, &n, &m, &comma, &has_m))
+      return w;
+    if (comma && !has_m) {
+      c->bail = 1;
+      return 0;
+    }
+    w = waf_rw_mul(c, w, comma ? m : n);
+  } else {
+    return w;
+  }
+  if (c->p < c->end && (*c->p == '?' || *c->p == '+'))
+    c->p++; /* 惰性/占有修饰 */
+  return w;
+}
+
+static size_t waf_rw_concat(waf_rf_ctx_t *c)
+{
+  size_t total = 0;
+  while (!c->bail && c->p < c->end && (c->quote || (*c->p != '|' && *c->p != ')'))) {
+    size_t w = 1;
+    u_char ch = *c->p;
+    if (c->quote) {
+      waf_rf_quote_next(c);
+    } else if (ch == '(') {
+      w = waf_rw_group(c);
+    } else if (ch == '[') {
+      waf_rf_skip_class(c);
+    } else if (ch == '\\') {
+      w = waf_rw_escape(c);
+    } else if (ch == '^' || ch == '$' || ch == '*' || ch == '+' || ch == '?') {
+      c->bail = 1;
+    } else {
+      c->p++;
+    }
+    if (c->bail)
+      break;
+    if (!c->quote)
+      w = waf_rw_quantify(c, w);
+    total += w;
+    if (total > WAF_RW_MAX)
+      c->bail = 1;
+  }
+  return total;
+}
+
+static size_t waf_rw_alt(waf_rf_ctx_t *c)
+{
+  if (++c->depth > WAF_RF_MAX_DEPTH) {
+    c->bail = 1;
+    return 0;
+  }
+  size_t w = waf_rw_concat(c);
+  while (!c->bail && c->p < c->end && *c->p == '|') {
+    c->p++;
+    size_t bw = waf_rw_concat(c); /* ngx_max 会对实参求值两次 */
+    w = ngx_max(w, bw);
+  }
+  c->depth--;
+  return w;
+}
+
+/*
+ * 规则级最大匹配宽度：各 pattern 的最大值；negate 规则在窗口上未命中不代表整体未命中，
+ * 与任一 pattern 不可判定一样记为 0
+ */
+void waf_precompile_stream_width(waf_compiled_rule_t *rule)
+{
+  rule->stream_width = 0;
+  if (rule->match != WAF_MATCH_REGEX || rule->negate || rule->patterns == NULL ||
+      rule->patterns->nelts == 0)
+    return;
+
+  size_t width = 0;
+  ngx_str_t *pats = rule->patterns->elts;
+  for (ngx_uint_t i = 0; i < rule->patterns->nelts; i++) {
+    waf_rf_ctx_t c;
+    ngx_memzero(&c, sizeof(c));
+    c.p = pats[i].data;
+    c.end = pats[i].data + pats[i].len;
+    size_t w = waf_rw_alt(&c);
+    if (c.bail || c.p != c.end || w == 0)
+      return;
+    width = ngx_max(width, w);
+  }
+  rule->stream_width = width;
+}
+
+/* 字节类预筛：CONTAINS 取 patterns、REGEX 取因子，各字面量特殊字节集合求交 */
+static void waf_precompile_required_bytes(waf_compiled_rule_t *rule)
+{
+  ngx_array_t *lits = (rule->match == WAF_MATCH_CONTAINS) ? rule->patterns
+                      : (rule->match == WAF_MATCH_REGEX) ? rule->regex_factors
+                                                         : NULL;
+  ngx_memzero(&rule->required_bytes, sizeof(waf_byteset_t));
+  if (lits == NULL || lits->nelts == 0)
+    return;
+
+  ngx_str_t *lv = lits->elts;
+  for (ngx_uint_t i = 0; i < lits->nelts; i++) {
+    waf_byteset_t b;
+    ngx_memzero(&b, sizeof(b));
+    waf_simd_byteset(lv[i].data, lv[i].len, &b);
+    for (ngx_uint_t k = 0; k < 4; k++) {
+      rule->required_bytes.w[k] = (i == 0) ? b.w[k] : (rule->required_bytes.w[k] & b.w[k]);
+    }
+  }
+}
+
+/* ------------------------ CONTAINS/REGEX 因子：按桶构建 Aho-Corasick ------------------------ */
+/* 规则参与 AC 的字面量：CONTAINS 取 patterns，REGEX 取预筛因子；其余（或无因子）返回 NULL */
+static ngx_array_t *waf_ac_rule_literals(const waf_compiled_rule_t *rule, waf_match_e match)
+{
+  if (rule->match != match)
+    return NULL;
+  return (match == WAF_MATCH_REGEX) ? rule->regex_factors : rule->patterns;
+}
+
+static ngx_flag_t waf_ac_rule_caseless(const waf_compiled_rule_t *rule, waf_match_e match)
+{
+  return ((match == WAF_MATCH_REGEX) ? rule->regex_factors_caseless : rule->caseless) ? 1 : 0;
+}
+
+static ngx_uint_t waf_ac_group_key_eq(const waf_compiled_rule_t *rule, waf_match_e match,
+                                      waf_target_e target, ngx_flag_t caseless,
+                                      ngx_uint_t transform, const ngx_str_t *header_name)
+{
+  if (waf_ac_rule_caseless(rule, match) != (caseless ? 1 : 0) || rule->transform != transform)
+    return 0;
+  if (target != WAF_T_HEADER)
+    return 1;
+  return rule->header_name.len == header_name->len &&
+         ngx_strncasecmp(rule->header_name.data, header_name->data, header_name->len) == 0;
+}
+
+static ngx_int_t waf_build_ac_groups(ngx_pool_t *pool, ngx_log_t *log,
+                                     waf_compiled_snapshot_t *snap, waf_phase_e phase,
+                                     waf_target_e target, waf_match_e match)
+{
+  ngx_array_t *bucket = snap->buckets[phase][target];
+  if (bucket == NULL || bucket->nelts == 0)
+    return NGX_OK;
+
+  waf_compiled_rule_t **items = bucket->elts;
+  ngx_uint_t total = 0;
+  for (ngx_uint_t i = 0; i < bucket->nelts; i++) {
+    ngx_array_t *lits = waf_ac_rule_literals(items[i], match);
+    if (lits)
+      total += lits->nelts;
+  }
+  if (total == 0)
+    return NGX_OK;
+
+  ngx_array_t *groups = ngx_array_create(pool, 2, sizeof(waf_ac_group_t));
+  waf_ac_pattern_t *pats = ngx_alloc(total * sizeof(waf_ac_pattern_t), log);
+  if (groups == NULL || pats == NULL) {
+    if (pats)
+      ngx_free(pats);
+    return NGX_ERROR;
+  }
+
+  /* 以首次出现的规则确定分组键，收集同组全部字面量后一次编译 */
+  for (ngx_uint_t i = 0; i < bucket->nelts; i++) {
+    waf_compiled_rule_t *lead = items[i];
+    if (waf_ac_rule_literals(lead, match) == NULL)
+      continue;
+    ngx_flag_t lead_caseless = waf_ac_rule_caseless(lead, match);
+
+    ngx_uint_t built = 0;
+    waf_ac_group_t *gs = groups->elts;
+    for (ngx_uint_t g = 0; g < groups->nelts; g++) {
+      if (waf_ac_group_key_eq(lead, match, target, gs[g].caseless, gs[g].transform,
+                              &gs[g].header_name)) {
+        built = 1;
+        break;
+      }
+    }
+    if (built)
+      continue;
+
+    ngx_uint_t n = 0;
+    for (ngx_uint_t j = i; j < bucket->nelts; j++) {
+      waf_compiled_rule_t *rule = items[j];
+      ngx_array_t *lits = waf_ac_rule_literals(rule, match);
+      if (lits == NULL ||
+          !waf_ac_group_key_eq(rule, match, target, lead_caseless, lead->transform,
+                               &lead->header_name))
+        continue;
+      ngx_str_t *rp = lits->elts;
+      for (ngx_uint_t k = 0; k < lits->nelts; k++) {
+        pats[n].pattern = rp[k];
+        pats[n].slot = j;
+        pats[n].rule_id = rule->id;
+        pats[n].pattern_index = k;
+        n++;
+      }
+    }
+
+    waf_ac_group_t *group = ngx_array_push(groups);
+    if (group == NULL) {
+      ngx_free(pats);
+      return NGX_ERROR;
+    }
+    group->header_name = (target == WAF_T_HEADER) ? lead->header_name : (ngx_str_t)ngx_null_string;
+    group->header_slot = (target == WAF_T_HEADER) ? lead->header_slot : 0;
+    group->caseless = lead_caseless;
+    group->transform = lead->transform;
+    group->ac = waf_ac_compile(pool, log, pats, n, group->caseless);
+    if (group->ac == NULL) {
+      ngx_free(pats);
+      return NGX_ERROR;
+    }
+  }
+
+  ngx_free(pats);
+  if (match == WAF_MATCH_REGEX) {
+    snap->regex_groups[phase][target] = groups;
+  } else {
+    snap->contains_groups[phase][target] = groups;
+  }
+  return NGX_OK;
+}
+
+/* ------------------------ HEADER：请求头名驻留与索引 ------------------------ */
+/* 可直接取自 r->headers_in 字段的常用头（均为首个同名头，与链表顺序查找语义一致） */
+typedef struct {
+  ngx_str_t name;
+  ngx_uint_t offset;
+} waf_well_known_header_t;
+
+static waf_well_known_header_t waf_well_known_headers[] = {
+    {ngx_string("host"), offsetof(ngx_http_headers_in_t, host)},
+    {ngx_string("connection"), offsetof(ngx_http_headers_in_t, connection)},
+    {ngx_string("user-agent"), offsetof(ngx_http_headers_in_t, user_agent)},
+    {ngx_string("referer"), offsetof(ngx_http_headers_in_t, referer)},
+    {ngx_string("content-length"), offsetof(ngx_http_headers_in_t, content_length)},
+    {ngx_string("content-type"), offsetof(ngx_http_headers_in_t, content_type)},
+    {ngx_string("authorization"), offsetof(ngx_http_headers_in_t, authorization)},
+    {ngx_null_string, 0}};
+
+/*
+ * detect 段 BODY 桶能否流式检测：EXACT 需要完整请求体；逐字节的 LOWERCASE 与分块边界无关，
+ * 其余变换（URL 解码、空白压缩等）跨块有状态，均退回整体检测；
+ * 不能在窗口上判定的单条 REGEX（stream_width 为 0）不影响整桶，运行期推迟到读完后整体匹配
+ */
+static ngx_flag_t waf_body_bucket_streamable(const waf_compiled_snapshot_t *snap)
+{
+  ngx_array_t *bucket = snap->buckets[WAF_PHASE_DETECT][WAF_T_BODY];
+  if (bucket == NULL || bucket->nelts == 0)
+    return 0;
+
+  ngx_uint_t content = 0;
+  waf_compiled_rule_t **rules = bucket->elts;
+  for (ngx_uint_t i = 0; i < bucket->nelts; i++) {
+    if (rules[i] == NULL || waf_match_is_structural(rules[i]->match))
+      continue;
+    if (rules[i]->match != WAF_MATCH_CONTAINS && rules[i]->match != WAF_MATCH_REGEX)
+      return 0;
+    if (rules[i]->transform & ~WAF_TF_LOWERCASE)
+      return 0;
+    content++;
+  }
+  return content > 0;
+}
+
+/*
+ * 驻留全部 HEADER 规则引用的头名：去重后分配槽位（rule->header_slot），
+ * well-known 头记录 headers_in 字段偏移，其余头名构建只读 ngx_hash（值 = 槽位 + 1）
+ */
+static ngx_int_t waf_build_header_index(ngx_pool_t *pool, waf_compiled_snapshot_t *snap)
+{
+  snap->header_slots = ngx_array_create(pool, 8, sizeof(waf_header_slot_t));
+  if (snap->header_slots == NULL)
+    return NGX_ERROR;
+
+  ngx_array_t keys;
+  if (ngx_array_init(&keys, pool, 8, sizeof(ngx_hash_key_t)) != NGX_OK)
+    return NGX_ERROR;
+
+  for (ngx_uint_t ph = 0; ph < WAF_PHASE_COUNT; ph++) {
+    ngx_array_t *bucket = snap->buckets[ph][WAF_T_HEADER];
+    if (bucket == NULL)
+      continue;
+    waf_compiled_rule_t **items = bucket->elts;
+    for (ngx_uint_t i = 0; i < bucket->nelts; i++) {
+      waf_compiled_rule_t *rule = items[i];
+      ngx_str_t *hn = &rule->header_name;
+      if (rule->match == WAF_MATCH_COUNT)
+        continue; /* COUNT 直接计数 headers 链表，不占槽位 */
+
+      waf_header_slot_t *hs = snap->header_slots->elts;
+      ngx_uint_t n = snap->header_slots->nelts;
+      ngx_uint_t k;
+      for (k = 0; k < n; k++) {
+        if (hs[k].name.len == hn->len && ngx_strncasecmp(hs[k].name.data, hn->data, hn->len) == 0)
+          break;
+      }
+      rule->header_slot = k;
+      if (k < n)
+        continue;
+
+      waf_header_slot_t *slot = ngx_array_push(snap->header_slots);
+      if (slot == NULL)
+        return NGX_ERROR;
+      slot->name.len = hn->len;
+      slot->name.data = ngx_pnalloc(pool, hn->len ? hn->len : 1);
+      if (slot->name.data == NULL)
+        return NGX_ERROR;
+      ngx_strlow(slot->name.data, hn->data, hn->len);
+      slot->offset = -1;
+
+      for (waf_well_known_header_t *wk = waf_well_known_headers; wk->name.len; wk++) {
+        if (wk->name.len == slot->name.len &&
+            ngx_strncmp(wk->name.data, slot->name.data, slot->name.len) == 0) {
+          slot->offset = (ngx_int_t)wk->offset;
+          break;
+        }
+      }
+      if (slot->offset >= 0)
+        continue;
+
+      ngx_hash_key_t *key = ngx_array_push(&keys);
+      if (key == NULL)
+        return NGX_ERROR;
+      key->key = slot->name;
+      key->key_hash = ngx_hash_key(slot->name.data, slot->name.len);
+      key->value = (void *)(uintptr_t)(k + 1);
+    }
+  }
+
+  snap->header_list_slots = keys.nelts;
+  if (keys.nelts == 0)
+    return NGX_OK;
+
+  ngx_hash_init_t hinit;
+  ngx_memzero(&hinit, sizeof(hinit));
+  hinit.hash = &snap->header_hash;
+  hinit.key = ngx_hash_key_lc;
+  hinit.max_size = 512;
+  hinit.bucket_size = ngx_align(64, ngx_cacheline_size);
+  hinit.name = "waf_header_hash";
+  hinit.pool = pool;
+  hinit.temp_pool = NULL;
+  return ngx_hash_init(&hinit, keys.elts, keys.nelts);
+}
+
 /* ------------------------ 主编译入口 ------------------------ */
 ngx_int_t ngx_http_waf_compile_rules(ngx_pool_t *pool, ngx_log_t *log, yyjson_doc *merged_doc,
-                                     waf_compiled_snapshot_t **out, ngx_http_waf_json_error_t *err)
+                                     waf_regex_cache_t *rcache, waf_compiled_snapshot_t **out,
+                                     ngx_http_waf_json_error_t *err)
 {
   if (out == NULL)
     return NGX_ERROR;
@@ -542,6 +1904,14 @@ ngx_int_t ngx_http_waf_compile_rules(ngx_pool_t *pool, ngx_log_t *log, yyjson_do
           tmp.caseless = (cs && yyjson_is_bool(cs)) ? (yyjson_get_bool(cs) ? 1 : 0) : 0;
         }
 
+        /* transform */
+        if (waf_parse_transform(yyjson_obj_get(r, "transform"), &tmp.transform) != NGX_OK) {
+          if (err) {
+            ngx_str_set(&err->message, "transform 取值非法");
+          }
+          return NGX_ERROR;
+        }
+
         /* negate */
         {
           yyjson_val *ng = yyjson_obj_get(r, "negate");
@@ -564,8 +1934,10 @@ ngx_int_t ngx_http_waf_compile_rules(ngx_pool_t *pool, ngx_log_t *log, yyjson_do
         {
           yyjson_val *sc = yyjson_obj_get(r, "score");
           yyjson_val *pr = yyjson_obj_get(r, "priority");
+          yyjson_val *il = yyjson_obj_get(r, "inspectLimit");
           tmp.score = (sc && yyjson_is_num(sc)) ? (ngx_int_t)yyjson_get_sint(sc) : 10;
           tmp.priority = (pr && yyjson_is_num(pr)) ? (ngx_int_t)yyjson_get_sint(pr) : 0;
+          tmp.inspect_limit = (il && yyjson_is_uint(il)) ? (size_t)yyjson_get_uint(il) : 0;
         }
 
         /* tags[] */
@@ -609,8 +1981,20 @@ ngx_int_t ngx_http_waf_compile_rules(ngx_pool_t *pool, ngx_log_t *log, yyjson_do
         if (waf_bucket_append(pool, snap, slot->phase, slot->target, slot) != NGX_OK)
           return NGX_ERROR;
 
-        /* 预编译 REGEX/CIDR */
-        if (waf_precompile_regexes(pool, log, slot) != NGX_OK)
+        /* 预编译 REGEX/EXACT/CIDR/COUNT/LENGTH */
+        if (waf_precompile_limit(slot, err) != NGX_OK)
+          return NGX_ERROR;
+        if (waf_match_is_structural(slot->match))
+          snap->structural_rules[slot->phase]++;
+        if (waf_precompile_case_fold(pool, slot) != NGX_OK)
+          return NGX_ERROR;
+        if (waf_precompile_regexes(pool, log, rcache, slot) != NGX_OK)
+          return NGX_ERROR;
+        if (waf_precompile_regex_factors(pool, log, slot) != NGX_OK)
+          return NGX_ERROR;
+        waf_precompile_required_bytes(slot);
+        waf_precompile_stream_width(slot);
+        if (waf_precompile_exact_set(pool, slot) != NGX_OK)
           return NGX_ERROR;
         if (waf_precompile_cidrs(pool, log, slot) != NGX_OK)
           return NGX_ERROR;
@@ -668,6 +2052,14 @@ ngx_int_t ngx_http_waf_compile_rules(ngx_pool_t *pool, ngx_log_t *log, yyjson_do
         rule.caseless = (cs && yyjson_is_bool(cs)) ? (yyjson_get_bool(cs) ? 1 : 0) : 0;
       }
 
+      /* transform */
+      if (waf_parse_transform(yyjson_obj_get(r, "transform"), &rule.transform) != NGX_OK) {
+        if (err) {
+          ngx_str_set(&err->message, "transform 取值非法");
+        }
+        return NGX_ERROR;
+      }
+
       /* negate */
       {
         yyjson_val *ng = yyjson_obj_get(r, "negate");
@@ -690,8 +2082,10 @@ ngx_int_t ngx_http_waf_compile_rules(ngx_pool_t *pool, ngx_log_t *log, yyjson_do
       {
         yyjson_val *sc = yyjson_obj_get(r, "score");
         yyjson_val *pr = yyjson_obj_get(r, "priority");
+        yyjson_val *il = yyjson_obj_get(r, "inspectLimit");
         rule.score = (sc && yyjson_is_num(sc)) ? (ngx_int_t)yyjson_get_sint(sc) : 10;
         rule.priority = (pr && yyjson_is_num(pr)) ? (ngx_int_t)yyjson_get_sint(pr) : 0;
+        rule.inspect_limit = (il && yyjson_is_uint(il)) ? (size_t)yyjson_get_uint(il) : 0;
       }
 
       /* tags[] */
@@ -735,8 +2129,20 @@ ngx_int_t ngx_http_waf_compile_rules(ngx_pool_t *pool, ngx_log_t *log, yyjson_do
       if (waf_bucket_append(pool, snap, slot->phase, slot->target, slot) != NGX_OK)
         return NGX_ERROR;
 
-      /* 预编译 REGEX/CIDR */
-      if (waf_precompile_regexes(pool, log, slot) != NGX_OK)
+      /* 预编译 REGEX/EXACT/CIDR/COUNT/LENGTH */
+      if (waf_precompile_limit(slot, err) != NGX_OK)
+        return NGX_ERROR;
+      if (waf_match_is_structural(slot->match))
+        snap->structural_rules[slot->phase]++;
+      if (waf_precompile_case_fold(pool, slot) != NGX_OK)
+        return NGX_ERROR;
+      if (waf_precompile_regexes(pool, log, rcache, slot) != NGX_OK)
+        return NGX_ERROR;
+      if (waf_precompile_regex_factors(pool, log, slot) != NGX_OK)
+        return NGX_ERROR;
+      waf_precompile_required_bytes(slot);
+      waf_precompile_stream_width(slot);
+      if (waf_precompile_exact_set(pool, slot) != NGX_OK)
         return NGX_ERROR;
       if (waf_precompile_cidrs(pool, log, slot) != NGX_OK)
         return NGX_ERROR;
@@ -774,6 +2180,61 @@ ngx_int_t ngx_http_waf_compile_rules(ngx_pool_t *pool, ngx_log_t *log, yyjson_do
     }
   }
 
+  /* CLIENT_IP 阶段：按桶最终顺序构建 CIDR 基数树索引 */
+  {
+    waf_phase_e ip_phases[] = {WAF_PHASE_IP_ALLOW, WAF_PHASE_IP_BLOCK};
+    for (ngx_uint_t k = 0; k < sizeof(ip_phases) / sizeof(ip_phases[0]); k++) {
+      ngx_int_t irc;
+      snap->ip_index[ip_phases[k]] =
+          waf_ip_index_build(pool, log, snap->buckets[ip_phases[k]][WAF_T_CLIENT_IP], &irc);
+      if (irc != NGX_OK) {
+        if (err) {
+          ngx_str_set(&err->message, "CIDR 索引构建失败");
+        }
+        HASH_CLEAR(hh, id_map);
+        return NGX_ERROR;
+      }
+    }
+  }
+
+  /* 驻留 HEADER 规则头名并建立槽位索引（AC 分组需使用槽位） */
+  if (waf_build_header_index(pool, snap) != NGX_OK) {
+    if (err) {
+      ngx_str_set(&err->message, "请求头索引构建失败");
+    }
+    HASH_CLEAR(hh, id_map);
+    return NGX_ERROR;
+  }
+
+  /* 排序定型后：按桶构建 CONTAINS 自动机与 REGEX 因子预筛自动机（槽位依赖桶内最终下标） */
+  for (ngx_uint_t ph = 0; ph < WAF_PHASE_COUNT; ph++) {
+    for (ngx_uint_t t = 0; t <= WAF_T_HEADER; t++) {
+      if (waf_build_ac_groups(pool, log, snap, (waf_phase_e)ph, (waf_target_e)t,
+                              WAF_MATCH_CONTAINS) != NGX_OK) {
+        if (err) {
+          ngx_str_set(&err->message, "CONTAINS 自动机构建失败");
+        }
+        HASH_CLEAR(hh, id_map);
+        return NGX_ERROR;
+      }
+      if (waf_build_ac_groups(pool, log, snap, (waf_phase_e)ph, (waf_target_e)t,
+                              WAF_MATCH_REGEX) != NGX_OK) {
+        if (err) {
+          ngx_str_set(&err->message, "REGEX 因子预筛自动机构建失败");
+        }
+        HASH_CLEAR(hh, id_map);
+        return NGX_ERROR;
+      }
+    }
+  }
+  for (ngx_uint_t ph = 0; ph < WAF_PHASE_COUNT; ph++) {
+    for (ngx_uint_t t = 0; t <= WAF_T_HEADER; t++) {
+      if (snap->buckets[ph][t] != NULL && snap->buckets[ph][t]->nelts > 0)
+        snap->targets[ph] |= WAF_TARGET_BIT(t);
+    }
+  }
+  snap->body_streamable = waf_body_bucket_streamable(snap);
+
   *out = snap;
   if (log) {
     ngx_log_error(NGX_LOG_INFO, log, 0, "waf: compiled rules num=%ui", snap->all_rules->nelts);
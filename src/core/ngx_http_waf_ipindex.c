@@ -0,0 +1,228 @@
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+#include "ngx_http_waf_compiler.h"
+#include "ngx_http_waf_ipindex.h"
+
+/*
+ * CLIENT_IP 阶段 CIDR 索引
+ *
+ * 非取反规则的最小下标传播：
+ *  1. 收集全部 (CIDR, 桶内下标)，按前缀长度升序、下标升序排序
+ *  2. 依次插入：插入前先以网络地址查找已存在的覆盖前缀（均更短，值已是其链上最小下标），
+ *     节点值取 min(自身下标, 覆盖值)；同一前缀重复出现时首次插入的下标最小，后续忽略
+ *  3. 查询时最长前缀匹配到的节点值即覆盖客户端地址的全部前缀中的最小下标
+ */
+
+typedef struct {
+  ngx_cidr_t *cidr;
+  ngx_uint_t index;
+  ngx_uint_t bits;
+} waf_ip_prefix_t;
+
+static ngx_uint_t waf_ip_mask_bits(const u_char *mask, size_t n)
+{
+  ngx_uint_t bits = 0;
+  for (size_t i = 0; i < n; i++) {
+    for (u_char m = mask[i]; m; m <<= 1) {
+      bits++;
+    }
+  }
+  return bits;
+}
+
+static int waf_ip_prefix_cmp(const void *a, const void *b)
+{
+  const waf_ip_prefix_t *pa = a;
+  const waf_ip_prefix_t *pb = b;
+  if (pa->bits != pb->bits)
+    return pa->bits < pb->bits ? -1 : 1;
+  if (pa->index != pb->index)
+    return pa->index < pb->index ? -1 : 1;
+  return 0;
+}
+
+/* 插入单个前缀；min_propagate 时节点值取覆盖前缀与自身下标的较小者 */
+static ngx_int_t waf_ip_tree_insert(ngx_radix_tree_t *tree, ngx_cidr_t *c, uintptr_t value,
+                                    ngx_flag_t min_propagate)
+{
+  ngx_int_t rc;
+
+  if (c->family == AF_INET) {
+    uint32_t key = ntohl(c->u.in.addr);
+    uint32_t mask = ntohl(c->u.in.mask);
+    if (min_propagate) {
+      uintptr_t cover = ngx_radix32tree_find(tree, key);
+      if (cover != NGX_RADIX_NO_VALUE && cover < value)
+        value = cover;
+    }
+    rc = ngx_radix32tree_insert(tree, key, mask, value);
+#if (NGX_HAVE_INET6)
+  } else if (c->family == AF_INET6) {
+    u_char *key = c->u.in6.addr.s6_addr;
+    u_char *mask = c->u.in6.mask.s6_addr;
+    if (min_propagate) {
+      uintptr_t cover = ngx_radix128tree_find(tree, key);
+      if (cover != NGX_RADIX_NO_VALUE && cover < value)
+        value = cover;
+    }
+    rc = ngx_radix128tree_insert(tree, key, mask, value);
+#endif
+  } else {
+    return NGX_OK;
+  }
+
+  return (rc == NGX_OK || rc == NGX_BUSY) ? NGX_OK : NGX_ERROR;
+}
+
+/* 按地址族取（必要时创建）对应的树 */
+static ngx_radix_tree_t *waf_ip_tree_for(ngx_pool_t *pool, ngx_radix_tree_t **tree4,
+                                         ngx_radix_tree_t **tree6, ngx_uint_t family)
+{
+  ngx_radix_tree_t **slot = (family == AF_INET) ? tree4 : tree6;
+  if (*slot == NULL) {
+    *slot = ngx_radix_tree_create(pool, 0);
+  }
+  return *slot;
+}
+
+waf_ip_index_t *waf_ip_index_build(ngx_pool_t *pool, ngx_log_t *log, ngx_array_t *bucket,
+                                   ngx_int_t *rc)
+{
+  *rc = NGX_OK;
+  if (bucket == NULL || bucket->nelts == 0)
+    return NULL;
+
+  waf_compiled_rule_t **items = bucket->elts;
+  ngx_uint_t nprefix = 0, nrules = 0;
+  for (ngx_uint_t i = 0; i < bucket->nelts; i++) {
+    if (items[i] && items[i]->compiled_cidrs) {
+      nrules++;
+      if (!items[i]->negate)
+        nprefix += items[i]->compiled_cidrs->nelts;
+    }
+  }
+  if (nrules == 0)
+    return NULL;
+
+  *rc = NGX_ERROR;
+  waf_ip_index_t *idx = ngx_pcalloc(pool, sizeof(waf_ip_index_t));
+  if (idx == NULL)
+    return NULL;
+
+  waf_ip_prefix_t *prefixes = NULL;
+  if (nprefix > 0) {
+    prefixes = ngx_alloc(nprefix * sizeof(waf_ip_prefix_t), log);
+    if (prefixes == NULL)
+      return NULL;
+  }
+
+  ngx_uint_t n = 0;
+  for (ngx_uint_t i = 0; i < bucket->nelts; i++) {
+    waf_compiled_rule_t *rule = items[i];
+    if (rule == NULL || rule->compiled_cidrs == NULL)
+      continue;
+    ngx_cidr_t *cidrs = rule->compiled_cidrs->elts;
+
+    if (rule->negate) {
+      if (idx->negated == NULL) {
+        idx->negated = ngx_array_create(pool, 1, sizeof(waf_ip_negated_t));
+        if (idx->negated == NULL)
+          goto failed;
+      }
+      waf_ip_negated_t *ng = ngx_array_push(idx->negated);
+      if (ng == NULL)
+        goto failed;
+      ngx_memzero(ng, sizeof(*ng));
+      ng->index = i;
+      for (ngx_uint_t j = 0; j < rule->compiled_cidrs->nelts; j++) {
+        ngx_radix_tree_t *tree = waf_ip_tree_for(pool, &ng->tree4, &ng->tree6, cidrs[j].family);
+        if (tree == NULL || waf_ip_tree_insert(tree, &cidrs[j], 0, 0) != NGX_OK)
+          goto failed;
+      }
+      continue;
+    }
+
+    for (ngx_uint_t j = 0; j < rule->compiled_cidrs->nelts; j++) {
+      prefixes[n].cidr = &cidrs[j];
+      prefixes[n].index = i;
+      prefixes[n].bits = (cidrs[j].family == AF_INET)
+                             ? waf_ip_mask_bits((u_char *)&cidrs[j].u.in.mask, 4)
+#if (NGX_HAVE_INET6)
+                             : waf_ip_mask_bits(cidrs[j].u.in6.mask.s6_addr, 16);
+#else
+                             : 0;
+#endif
+      n++;
+    }
+  }
+
+  if (n > 0) {
+    ngx_qsort(prefixes, n, sizeof(waf_ip_prefix_t), waf_ip_prefix_cmp);
+    for (ngx_uint_t k = 0; k < n; k++) {
+      ngx_radix_tree_t *tree =
+          waf_ip_tree_for(pool, &idx->tree4, &idx->tree6, prefixes[k].cidr->family);
+      if (tree == NULL ||
+          waf_ip_tree_insert(tree, prefixes[k].cidr, (uintptr_t)prefixes[k].index, 1) != NGX_OK)
+        goto failed;
+    }
+  }
+
+  if (prefixes)
+    ngx_free(prefixes);
+  if (log) {
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, log, 0, "waf: ip index rules=%ui prefixes=%ui negated=%ui",
+                   nrules, n, idx->negated ? idx->negated->nelts : 0);
+  }
+  *rc = NGX_OK;
+  return idx;
+
+failed:
+  if (prefixes)
+    ngx_free(prefixes);
+  return NULL;
+}
+
+/* 地址是否落在树中任一前缀内 */
+static ngx_uint_t waf_ip_tree_has(ngx_radix_tree_t *tree4, ngx_radix_tree_t *tree6,
+                                  const waf_ip_addr_t *addr, uintptr_t *value)
+{
+  uintptr_t v = NGX_RADIX_NO_VALUE;
+  if (addr->family == AF_INET) {
+    if (tree4) {
+      uint32_t key;
+      ngx_memcpy(&key, addr->addr, sizeof(key));
+      v = ngx_radix32tree_find(tree4, ntohl(key));
+    }
+#if (NGX_HAVE_INET6)
+  } else if (addr->family == AF_INET6) {
+    if (tree6) {
+      v = ngx_radix128tree_find(tree6, (u_char *)addr->addr);
+    }
+#endif
+  }
+  if (value)
+    *value = v;
+  return v != NGX_RADIX_NO_VALUE;
+}
+
+ngx_uint_t waf_ip_index_lookup(const waf_ip_index_t *idx, const waf_ip_addr_t *addr)
+{
+  if (idx == NULL || addr == NULL || addr->family == 0)
+    return WAF_IP_INDEX_NONE;
+
+  ngx_uint_t best = WAF_IP_INDEX_NONE;
+  uintptr_t v;
+  if (waf_ip_tree_has(idx->tree4, idx->tree6, addr, &v))
+    best = (ngx_uint_t)v;
+
+  /* 取反规则：按桶序，仅需检查下标小于当前最优者的规则 */
+  if (idx->negated) {
+    waf_ip_negated_t *ng = idx->negated->elts;
+    for (ngx_uint_t k = 0; k < idx->negated->nelts && ng[k].index < best; k++) {
+      if (!waf_ip_tree_has(ng[k].tree4, ng[k].tree6, addr, NULL))
+        return ng[k].index;
+    }
+  }
+  return best;
+}
@@ -1,7 +1,6 @@
 #include "ngx_http_waf_log.h"
 #include "ngx_http_waf_module_v2.h"
 #include "ngx_http_waf_utils.h"
-#include <time.h>
 
 /* 外部声明模块（用于获取配置） */
 extern ngx_module_t ngx_http_waf_module;
@@ -9,8 +8,8 @@ extern ngx_module_t ngx_http_waf_module;
 /*
  * ================================================================
  *  完整实现：JSONL 日志系统（M6）
- *  - 使用 yyjson_mut 构建完整 JSON 事件结构
- *  - 输出 JSONL 格式到文件
+ *  - 事件以定长记录追加到 ctx（r->pool），decisive 候选追加时登记
+ *  - flush 时手写序列化直接输出 JSONL 行，不构建 DOM
  *  - 支持 decisive 事件标记与 finalActionType
  * ================================================================
  */
@@ -156,27 +155,26 @@ static const char *waf_attack_type_from_rule_tags(const ngx_array_t *rule_tags)
   return NULL;
 }
 
-static const char *waf_attack_type_from_tags_val(yyjson_mut_val *tags)
+/* 事件记录：首次追加时在 r->pool 创建数组（干净请求不分配） */
+static waf_log_event_t *waf_log_event_push(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
+                                           waf_log_event_type_e type)
 {
-  if (tags == NULL || !yyjson_mut_is_arr(tags)) {
-    return NULL;
-  }
+  waf_log_event_t *ev;
 
-  size_t n = yyjson_mut_arr_size(tags);
-  for (size_t i = 0; i < n; i++) {
-    yyjson_mut_val *it = yyjson_mut_arr_get(tags, i);
-    if (it == NULL || !yyjson_mut_is_str(it)) {
-      continue;
-    }
-    const char *tag = yyjson_mut_get_str(it);
-    size_t tag_len = yyjson_mut_get_len(it);
-    const char *mapped = waf_attack_type_from_tag_slice(tag, tag_len);
-    if (mapped) {
-      return mapped;
+  if (ctx->events == NULL) {
+    ctx->events = ngx_array_create(r->pool, 4, sizeof(waf_log_event_t));
+    if (ctx->events == NULL) {
+      return NULL;
     }
   }
 
-  return NULL;
+  ev = ngx_array_push(ctx->events);
+  if (ev == NULL) {
+    return NULL;
+  }
+  ngx_memzero(ev, sizeof(waf_log_event_t));
+  ev->type = type;
+  return ev;
 }
 
 void waf_log_init_ctx(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx)
@@ -184,13 +182,11 @@ void waf_log_init_ctx(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx)
   if (ctx == NULL || r == NULL)
     return;
 
-  /* 创建 yyjson 文档 */
-  ctx->log_doc = yyjson_mut_doc_new(NULL);
-  yyjson_mut_val *root = yyjson_mut_obj(ctx->log_doc);
-  yyjson_mut_doc_set_root(ctx->log_doc, root);
-
-  /* 创建 events 数组 */
-  ctx->events = yyjson_mut_arr(ctx->log_doc);
+  /* 事件数组延迟到首个事件再创建，干净请求不分配 */
+  ctx->events = NULL;
+  ctx->ev_last_block = 0;
+  ctx->ev_last_bypass = 0;
+  ctx->ev_last_ban = 0;
 
   ctx->effective_level = WAF_LOG_NONE;
   ctx->total_score = 0;
@@ -207,6 +203,7 @@ void waf_log_init_ctx(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx)
   ngx_http_waf_main_conf_t *mcf = ngx_http_get_module_main_conf(r, ngx_http_waf_module);
   ngx_flag_t trust_xff = (mcf != NULL) ? mcf->trust_xff : 0;
   ctx->client_ip = waf_utils_get_client_ip(r, trust_xff);
+  waf_utils_get_client_addr(r, trust_xff, &ctx->client_addr);
 
   /* 记录请求级时间快照（毫秒） */
   ctx->request_now_msec = ngx_current_msec;
@@ -244,62 +241,38 @@ void waf_log_append_rule_event(ngx_http_request_t *r, ngx_http_waf_main_conf_t *
                                const waf_event_details_t *details,
                                waf_log_collect_mode_e collect_mode, waf_log_level_e level)
 {
-  if (ctx == NULL || ctx->log_doc == NULL || ctx->events == NULL)
+  if (ctx == NULL)
     return;
   if (!waf_log_should_collect(mcf, ctx, collect_mode, level))
     return;
 
-  yyjson_mut_doc *doc = ctx->log_doc;
-  yyjson_mut_val *event = yyjson_mut_obj(doc);
+  waf_log_event_t *ev = waf_log_event_push(r, ctx, WAF_LOG_EV_RULE);
+  if (ev == NULL)
+    return;
 
-  yyjson_mut_obj_add_str(doc, event, "type", "rule");
-  yyjson_mut_obj_add_uint(doc, event, "ruleId", rule_id);
-  if (intent_str) {
-    yyjson_mut_obj_add_str(doc, event, "intent", intent_str);
-  }
-  // if (score_delta > 0) {
-    yyjson_mut_obj_add_uint(doc, event, "scoreDelta", score_delta);
-  // }
-  yyjson_mut_obj_add_uint(doc, event, "totalScore", ctx->total_score);
+  ev->rule_id = rule_id;
+  ev->intent = intent_str;
+  ev->score_delta = score_delta;
+  ev->total_score = ctx->total_score;
 
   if (details) {
-    if (details->matched_pattern.len > 0) {
-      yyjson_mut_obj_add_strn(doc, event, "matchedPattern",
-                              (const char *)details->matched_pattern.data,
-                              details->matched_pattern.len);
-      yyjson_mut_obj_add_uint(doc, event, "patternIndex", details->pattern_index);
-    }
-    if (details->target_tag) {
-      yyjson_mut_obj_add_str(doc, event, "target", details->target_tag);
-    }
-    if (details->negate) {
-      yyjson_mut_obj_add_bool(doc, event, "negate", true);
-    }
-
+    ev->pattern = details->matched_pattern;
+    ev->value = details->pattern_index;
+    ev->target = details->target_tag;
+    ev->negate = details->negate ? 1 : 0;
     if (details->rule_tags && details->rule_tags->nelts > 0) {
-      const char *mapped_attack_type = waf_attack_type_from_rule_tags(details->rule_tags);
-      if (mapped_attack_type) {
-        yyjson_mut_obj_add_str(doc, event, "attackType", mapped_attack_type);
-      }
-
-      yyjson_mut_val *tags_arr = yyjson_mut_arr(doc);
-      ngx_str_t *elts = details->rule_tags->elts;
-      for (ngx_uint_t i = 0; i < details->rule_tags->nelts; i++) {
-        if (elts[i].len == 0) {
-          continue;
-        }
-        yyjson_mut_val *sv = yyjson_mut_strn(doc, (const char *)elts[i].data, elts[i].len);
-        if (sv) {
-          yyjson_mut_arr_append(tags_arr, sv);
-        }
-      }
-      if (yyjson_mut_arr_size(tags_arr) > 0) {
-        yyjson_mut_obj_add_val(doc, event, "tags", tags_arr);
-      }
+      ev->tags = details->rule_tags;
+      ev->attack_type = waf_attack_type_from_rule_tags(details->rule_tags);
     }
   }
 
-  yyjson_mut_arr_append(ctx->events, event);
+  /* decisive 候选：追加时登记下标，flush 时无需回扫 */
+  if (intent_str && ngx_strcmp(intent_str, "BLOCK") == 0) {
+    ctx->ev_last_block = ctx->events->nelts;
+  } else if (intent_str && ngx_strcmp(intent_str, "BYPASS") == 0) {
+    ctx->ev_last_bypass = ctx->events->nelts;
+  }
+
   waf_log_raise_effective_level(ctx, level);
 }
 
@@ -308,24 +281,19 @@ void waf_log_append_reputation_event(ngx_http_request_t *r, ngx_http_waf_main_co
                                      const char *reason, waf_log_collect_mode_e collect_mode,
                                      waf_log_level_e level)
 {
-  if (ctx == NULL || ctx->log_doc == NULL || ctx->events == NULL)
+  if (ctx == NULL)
     return;
   if (!waf_log_should_collect(mcf, ctx, collect_mode, level))
     return;
 
-  yyjson_mut_doc *doc = ctx->log_doc;
-  yyjson_mut_val *event = yyjson_mut_obj(doc);
+  waf_log_event_t *ev = waf_log_event_push(r, ctx, WAF_LOG_EV_REPUTATION);
+  if (ev == NULL)
+    return;
 
-  yyjson_mut_obj_add_str(doc, event, "type", "reputation");
-  // if (score_delta >= 0) {
-    yyjson_mut_obj_add_uint(doc, event, "scoreDelta", score_delta);
-  // }
-  yyjson_mut_obj_add_uint(doc, event, "totalScore", ctx->total_score);
-  if (reason) {
-    yyjson_mut_obj_add_str(doc, event, "reason", reason);
-  }
+  ev->score_delta = score_delta;
+  ev->total_score = ctx->total_score;
+  ev->text = reason;
 
-  yyjson_mut_arr_append(ctx->events, event);
   waf_log_raise_effective_level(ctx, level);
 }
 
@@ -334,7 +302,7 @@ void waf_log_append_window_reset_event(ngx_http_request_t *r, ngx_http_waf_main_
                                        ngx_msec_t window_start_ms, ngx_msec_t window_end_ms,
                                        waf_log_collect_mode_e collect_mode, waf_log_level_e level)
 {
-  if (ctx == NULL || ctx->log_doc == NULL || ctx->events == NULL)
+  if (ctx == NULL)
     return;
 
   if (prev_score == 0)
@@ -343,17 +311,14 @@ void waf_log_append_window_reset_event(ngx_http_request_t *r, ngx_http_waf_main_
   if (!waf_log_should_collect(mcf, ctx, collect_mode, level))
     return;
 
-  yyjson_mut_doc *doc = ctx->log_doc;
-  yyjson_mut_val *event = yyjson_mut_obj(doc);
+  waf_log_event_t *ev = waf_log_event_push(r, ctx, WAF_LOG_EV_WINDOW_RESET);
+  if (ev == NULL)
+    return;
 
-  yyjson_mut_obj_add_str(doc, event, "type", "reputation_window_reset");
-  yyjson_mut_obj_add_uint(doc, event, "prevScore", prev_score);
-  yyjson_mut_obj_add_uint(doc, event, "windowStartMs", (ngx_uint_t)window_start_ms);
-  yyjson_mut_obj_add_uint(doc, event, "windowEndMs", (ngx_uint_t)window_end_ms);
-  yyjson_mut_obj_add_str(doc, event, "reason", "window_expired");
-  yyjson_mut_obj_add_str(doc, event, "category", "reputation/dyn_block");
+  ev->value = prev_score;
+  ev->start_ms = window_start_ms;
+  ev->end_ms = window_end_ms;
 
-  yyjson_mut_arr_append(ctx->events, event);
   waf_log_raise_effective_level(ctx, level);
 }
 
@@ -361,18 +326,40 @@ void waf_log_append_ban_event(ngx_http_request_t *r, ngx_http_waf_main_conf_t *m
                               ngx_http_waf_ctx_t *ctx, ngx_msec_t window,
                               waf_log_collect_mode_e collect_mode, waf_log_level_e level)
 {
-  if (ctx == NULL || ctx->log_doc == NULL || ctx->events == NULL)
+  if (ctx == NULL)
+    return;
+  if (!waf_log_should_collect(mcf, ctx, collect_mode, level))
+    return;
+
+  waf_log_event_t *ev = waf_log_event_push(r, ctx, WAF_LOG_EV_BAN);
+  if (ev == NULL)
+    return;
+
+  ev->value = (ngx_uint_t)window;
+  ctx->ev_last_ban = ctx->events->nelts;
+
+  waf_log_raise_effective_level(ctx, level);
+}
+
+void waf_log_append_limit_event(ngx_http_request_t *r, ngx_http_waf_main_conf_t *mcf,
+                                ngx_http_waf_ctx_t *ctx, const char *limit, ngx_uint_t rule_id,
+                                const char *target_tag, const char *verdict,
+                                waf_log_collect_mode_e collect_mode, waf_log_level_e level)
+{
+  if (ctx == NULL)
     return;
   if (!waf_log_should_collect(mcf, ctx, collect_mode, level))
     return;
 
-  yyjson_mut_doc *doc = ctx->log_doc;
-  yyjson_mut_val *event = yyjson_mut_obj(doc);
+  waf_log_event_t *ev = waf_log_event_push(r, ctx, WAF_LOG_EV_LIMIT);
+  if (ev == NULL)
+    return;
 
-  yyjson_mut_obj_add_str(doc, event, "type", "ban");
-  yyjson_mut_obj_add_uint(doc, event, "window", (ngx_uint_t)window);
+  ev->text = limit;
+  ev->rule_id = rule_id;
+  ev->target = target_tag;
+  ev->verdict = verdict;
 
-  yyjson_mut_arr_append(ctx->events, event);
   waf_log_raise_effective_level(ctx, level);
 }
 
@@ -406,225 +393,695 @@ void waf_log_flush(ngx_http_request_t *r, ngx_http_waf_main_conf_t *mcf,
                 ctx->total_score, &r->uri);
 }
 
-static void waf_log_write_jsonl(ngx_http_request_t *r, ngx_http_waf_main_conf_t *mcf,
-                                 ngx_http_waf_ctx_t *ctx, const char *jsonl)
+/*
+ * ================================================================
+ *  JSONL 序列化：不建 DOM，按字段顺序直接写入 r->pool 上的可增长缓冲
+ *  - comma 标记当前层是否已有成员，key/值/开闭括号据此补逗号
+ *  - 任一步分配失败置 failed，后续写入全部跳过，由调用方丢弃整行
+ * ================================================================
+ */
+
+typedef struct {
+  ngx_pool_t *pool;
+  u_char *start;
+  u_char *pos;
+  u_char *end;
+  unsigned comma : 1;
+  unsigned failed : 1;
+} waf_log_out_t;
+
+static ngx_flag_t waf_log_out_reserve(waf_log_out_t *o, size_t n)
 {
-  if (mcf == NULL || jsonl == NULL)
-    return;
+  if (o->failed)
+    return 0;
+  if ((size_t)(o->end - o->pos) >= n)
+    return 1;
 
-  /* 检查是否配置了日志路径 */
-  ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
-                "waf: write_jsonl_to_file called, json_log_path.len=%uz", mcf->json_log_path.len);
-  if (mcf->json_log_path.len == 0) {
-    ngx_log_error(NGX_LOG_INFO, r->connection->log, 0, "waf: json_log_path not configured, skipping JSONL write");
-    return; /* 未配置日志文件 */
+  size_t used = (size_t)(o->pos - o->start);
+  size_t size = 2 * (size_t)(o->end - o->start);
+  if (size < used + n) {
+    size = used + n;
   }
 
-  /* 使用 master 打开的 open_files 句柄（worker 复用 fd；USR1 可重开） */
-  if (mcf->json_log_of == NULL || mcf->json_log_of->fd == NGX_INVALID_FILE) {
-    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                  "waf: json_log open_file handle invalid for %V", &mcf->json_log_path);
+  u_char *p = ngx_pnalloc(o->pool, size);
+  if (p == NULL) {
+    o->failed = 1;
+    return 0;
+  }
+  if (used) {
+    ngx_memcpy(p, o->start, used);
+  }
+  o->start = p;
+  o->pos = p + used;
+  o->end = p + size;
+  return 1;
+}
+
+static void waf_log_out_raw(waf_log_out_t *o, const void *data, size_t len)
+{
+  if (!waf_log_out_reserve(o, len))
     return;
+  o->pos = ngx_cpymem(o->pos, data, len);
+}
+
+static void waf_log_out_sep(waf_log_out_t *o)
+{
+  if (o->comma) {
+    waf_log_out_raw(o, ",", 1);
   }
+}
 
-  size_t len = ngx_strlen(jsonl);
-  ssize_t n = ngx_write_fd(mcf->json_log_of->fd, (void *)jsonl, len);
-  if (n != (ssize_t)len) {
-    ngx_log_error(NGX_LOG_ERR, r->connection->log, ngx_errno,
-                  "waf: failed to write json_log, expected %uz bytes, wrote %z", len, n);
+/*
+ * 字符串转义（与 yyjson 默认输出一致："、\ 与控制字符转义，'/' 与非 ASCII 原样）；
+ * 非法 UTF-8 字节替换为 �，保证整行仍是合法 JSON
+ */
+u_char *waf_log_json_escape(u_char *p, const u_char *s, size_t len)
+{
+  static const u_char hex[] = "0123456789ABCDEF";
+  const u_char *end = s + len;
+
+  while (s < end) {
+    u_char c = *s;
+
+    if (c >= 0x80) {
+      size_t n = (c >= 0xc2 && c <= 0xdf) ? 2 : (c >= 0xe0 && c <= 0xef) ? 3
+               : (c >= 0xf0 && c <= 0xf4) ? 4 : 0;
+      ngx_flag_t ok = (n != 0 && (size_t)(end - s) >= n);
+      for (size_t k = 1; ok && k < n; k++) {
+        ok = ((s[k] & 0xc0) == 0x80);
+      }
+      /* 过长编码、代理区与超出 U+10FFFF 的序列 */
+      if (ok && n >= 3) {
+        u_char c1 = s[1];
+        ok = !((c == 0xe0 && c1 < 0xa0) || (c == 0xed && c1 > 0x9f) ||
+               (c == 0xf0 && c1 < 0x90) || (c == 0xf4 && c1 > 0x8f));
+      }
+      if (ok) {
+        p = ngx_cpymem(p, s, n);
+        s += n;
+      } else {
+        p = ngx_cpymem(p, "\\ufffd", 6);
+        s++;
+      }
+      continue;
+    }
+
+    switch (c) {
+      case '"':  *p++ = '\\'; *p++ = '"';  break;
+      case '\\': *p++ = '\\'; *p++ = '\\'; break;
+      case '\b': *p++ = '\\'; *p++ = 'b';  break;
+      case '\f': *p++ = '\\'; *p++ = 'f';  break;
+      case '\n': *p++ = '\\'; *p++ = 'n';  break;
+      case '\r': *p++ = '\\'; *p++ = 'r';  break;
+      case '\t': *p++ = '\\'; *p++ = 't';  break;
+      default:
+        if (c < 0x20) {
+          p = ngx_cpymem(p, "\\u00", 4);
+          *p++ = hex[c >> 4];
+          *p++ = hex[c & 0x0f];
+        } else {
+          *p++ = c;
+        }
+        break;
+    }
+    s++;
   }
-  ngx_write_fd(mcf->json_log_of->fd, (void *)"\n", 1);
+
+  return p;
 }
 
-/* 在最终落盘前集中判定并标记 decisive 事件 */
-static void waf_log_mark_decisive_on_flush(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx)
+static void waf_log_out_strn(waf_log_out_t *o, const u_char *s, size_t len)
 {
-  if (ctx == NULL || ctx->events == NULL || ctx->decisive_set)
+  waf_log_out_sep(o);
+  /* 最坏情况每字节展开为 6 字节（\u00XX / �） */
+  if (!waf_log_out_reserve(o, len * 6 + 2))
     return;
+  *o->pos++ = '"';
+  o->pos = waf_log_json_escape(o->pos, s, len);
+  *o->pos++ = '"';
+  o->comma = 1;
+}
 
-  yyjson_mut_doc *doc = ctx->log_doc;
-  size_t n = yyjson_mut_arr_size(ctx->events);
-  if (n == 0)
+static void waf_log_out_str(waf_log_out_t *o, const char *s)
+{
+  waf_log_out_strn(o, (const u_char *)s, ngx_strlen(s));
+}
+
+static void waf_log_out_uint(waf_log_out_t *o, ngx_uint_t v)
+{
+  waf_log_out_sep(o);
+  if (!waf_log_out_reserve(o, NGX_INT_T_LEN))
     return;
+  o->pos = ngx_sprintf(o->pos, "%ui", v);
+  o->comma = 1;
+}
 
-  /* BYPASS：选择最后一条 intent=BYPASS 的规则事件 */
-  if (ctx->final_action == WAF_FINAL_BYPASS) {
-    ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
-                  "waf-debug: decisive marking for BYPASS, events=%uz", (size_t)n);
-    for (ngx_int_t i = (ngx_int_t)n - 1; i >= 0; i--) {
-      yyjson_mut_val *ev = yyjson_mut_arr_get(ctx->events, (size_t)i);
-      yyjson_mut_val *type = yyjson_mut_obj_get(ev, "type");
-      yyjson_mut_val *intent = yyjson_mut_obj_get(ev, "intent");
-      const char *type_str = type ? yyjson_mut_get_str(type) : NULL;
-      const char *intent_str = intent ? yyjson_mut_get_str(intent) : NULL;
-      if (type_str && ngx_strcmp(type_str, "rule") == 0 &&
-          intent_str && ngx_strcmp(intent_str, "BYPASS") == 0) {
-        yyjson_mut_obj_add_bool(doc, ev, "decisive", true);
-        ctx->decisive_set = 1;
-        ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
-                      "waf-debug: decisive set at index=%i type=BYPASS", (ngx_int_t)i);
-        return;
-      }
-    }
+static void waf_log_out_true(waf_log_out_t *o)
+{
+  waf_log_out_sep(o);
+  waf_log_out_raw(o, "true", 4);
+  o->comma = 1;
+}
+
+/* key 为代码内字面量（仅 ASCII 字母），无需转义 */
+static void waf_log_out_key(waf_log_out_t *o, const char *key)
+{
+  size_t len = ngx_strlen(key);
+
+  waf_log_out_sep(o);
+  if (!waf_log_out_reserve(o, len + 3))
     return;
+  *o->pos++ = '"';
+  o->pos = ngx_cpymem(o->pos, key, len);
+  *o->pos++ = '"';
+  *o->pos++ = ':';
+  o->comma = 0;
+}
+
+static void waf_log_out_open(waf_log_out_t *o, u_char c)
+{
+  waf_log_out_sep(o);
+  waf_log_out_raw(o, &c, 1);
+  o->comma = 0;
+}
+
+static void waf_log_out_close(waf_log_out_t *o, u_char c)
+{
+  waf_log_out_raw(o, &c, 1);
+  o->comma = 1;
+}
+
+/* 输出一个事件对象（字段顺序与 JSONL 规范一致；decisive 追加在末尾） */
+static void waf_log_out_event(waf_log_out_t *o, const waf_log_event_t *ev, ngx_flag_t decisive)
+{
+  waf_log_out_open(o, '{');
+
+  switch (ev->type) {
+    case WAF_LOG_EV_RULE:
+      waf_log_out_key(o, "type");
+      waf_log_out_str(o, "rule");
+      waf_log_out_key(o, "ruleId");
+      waf_log_out_uint(o, ev->rule_id);
+      if (ev->intent) {
+        waf_log_out_key(o, "intent");
+        waf_log_out_str(o, ev->intent);
+      }
+      waf_log_out_key(o, "scoreDelta");
+      waf_log_out_uint(o, ev->score_delta);
+      waf_log_out_key(o, "totalScore");
+      waf_log_out_uint(o, ev->total_score);
+      if (ev->pattern.len > 0) {
+        waf_log_out_key(o, "matchedPattern");
+        waf_log_out_strn(o, ev->pattern.data, ev->pattern.len);
+        waf_log_out_key(o, "patternIndex");
+        waf_log_out_uint(o, ev->value);
+      }
+      if (ev->target) {
+        waf_log_out_key(o, "target");
+        waf_log_out_str(o, ev->target);
+      }
+      if (ev->negate) {
+        waf_log_out_key(o, "negate");
+        waf_log_out_true(o);
+      }
+      if (ev->attack_type) {
+        waf_log_out_key(o, "attackType");
+        waf_log_out_str(o, ev->attack_type);
+      }
+      if (ev->tags) {
+        ngx_str_t *elts = ev->tags->elts;
+        ngx_flag_t opened = 0;
+        for (ngx_uint_t i = 0; i < ev->tags->nelts; i++) {
+          if (elts[i].len == 0) {
+            continue;
+          }
+          if (!opened) {
+            waf_log_out_key(o, "tags");
+            waf_log_out_open(o, '[');
+            opened = 1;
+          }
+          waf_log_out_strn(o, elts[i].data, elts[i].len);
+        }
+        if (opened) {
+          waf_log_out_close(o, ']');
+        }
+      }
+      break;
+
+    case WAF_LOG_EV_REPUTATION:
+      waf_log_out_key(o, "type");
+      waf_log_out_str(o, "reputation");
+      waf_log_out_key(o, "scoreDelta");
+      waf_log_out_uint(o, ev->score_delta);
+      waf_log_out_key(o, "totalScore");
+      waf_log_out_uint(o, ev->total_score);
+      if (ev->text) {
+        waf_log_out_key(o, "reason");
+        waf_log_out_str(o, ev->text);
+      }
+      break;
+
+    case WAF_LOG_EV_WINDOW_RESET:
+      waf_log_out_key(o, "type");
+      waf_log_out_str(o, "reputation_window_reset");
+      waf_log_out_key(o, "prevScore");
+      waf_log_out_uint(o, ev->value);
+      waf_log_out_key(o, "windowStartMs");
+      waf_log_out_uint(o, (ngx_uint_t)ev->start_ms);
+      waf_log_out_key(o, "windowEndMs");
+      waf_log_out_uint(o, (ngx_uint_t)ev->end_ms);
+      waf_log_out_key(o, "reason");
+      waf_log_out_str(o, "window_expired");
+      waf_log_out_key(o, "category");
+      waf_log_out_str(o, "reputation/dyn_block");
+      break;
+
+    case WAF_LOG_EV_BAN:
+      waf_log_out_key(o, "type");
+      waf_log_out_str(o, "ban");
+      waf_log_out_key(o, "window");
+      waf_log_out_uint(o, ev->value);
+      break;
+
+    case WAF_LOG_EV_LIMIT:
+      waf_log_out_key(o, "type");
+      waf_log_out_str(o, "inspect_limit");
+      waf_log_out_key(o, "limit");
+      waf_log_out_str(o, ev->text);
+      waf_log_out_key(o, "ruleId");
+      waf_log_out_uint(o, ev->rule_id);
+      if (ev->target) {
+        waf_log_out_key(o, "target");
+        waf_log_out_str(o, ev->target);
+      }
+      waf_log_out_key(o, "verdict");
+      waf_log_out_str(o, ev->verdict);
+      break;
   }
 
-  /* 仅在最终动作为 BLOCK 时选择 decisive */
-  if (ctx->final_action != WAF_FINAL_BLOCK) {
-    return;
+  if (decisive) {
+    waf_log_out_key(o, "decisive");
+    waf_log_out_true(o);
   }
 
-  /* 动态封禁：优先选择最后一条 ban 事件（从后往前） */
-  if (ctx->final_action_type == WAF_FINAL_ACTION_TYPE_BLOCK_BY_DYNAMIC_BLOCK) {
-    ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
-                  "waf-debug: decisive marking for DYNAMIC_BLOCK, events=%uz", (size_t)n);
-    for (ngx_int_t i = (ngx_int_t)n - 1; i >= 0; i--) {
-      yyjson_mut_val *ev = yyjson_mut_arr_get(ctx->events, (size_t)i);
-      yyjson_mut_val *type = yyjson_mut_obj_get(ev, "type");
-      const char *type_str = type ? yyjson_mut_get_str(type) : NULL;
-      if (type_str && ngx_strcmp(type_str, "ban") == 0) {
-        yyjson_mut_obj_add_bool(doc, ev, "decisive", true);
-        ctx->decisive_set = 1;
-        ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
-                      "waf-debug: decisive set at index=%i type=ban", (ngx_int_t)i);
-        return;
+  waf_log_out_close(o, '}');
+}
+
+/* 可选 GeoIP 变量：存在且非空时输出 */
+static void waf_log_out_variable(waf_log_out_t *o, ngx_http_request_t *r, const char *key,
+                                 ngx_str_t *name)
+{
+  ngx_uint_t hash = ngx_hash_key(name->data, name->len);
+  ngx_http_variable_value_t *v = ngx_http_get_variable(r, name, hash);
+  if (v && !v->not_found && v->valid && v->len > 0) {
+    waf_log_out_key(o, key);
+    waf_log_out_strn(o, v->data, v->len);
+  }
+}
+
+/*
+ * ================================================================
+ *  每 worker 写缓冲（waf_json_log ... buffer=<size> [flush=<time>]）
+ *  - 只缓冲整行，一批一次 write；文件以 O_APPEND 打开，批次之间不会交错
+ *  - 写满、flush 定时器到期、USR1 重开（open_file->flush）与 worker 退出时落盘
+ *  - 配置期创建并挂在 json_log_of->data 上，fork 后各 worker 各有一份
+ *  - threads=<pool>：写满/到期的批次交给线程池写盘，在途批次数受 threads_queue 限制；
+ *    队列满时按 overflow=drop（丢弃新行并计数）或 overflow=block（事件循环内同步写）处置
+ * ================================================================
+ */
+
+typedef struct waf_log_buf_s waf_log_buf_t;
+
+#if (NGX_THREADS)
+/* 线程池写盘批次：缓冲与 task 均在配置期预分配，空闲链长度即队列上限 */
+typedef struct waf_log_batch_s {
+  struct waf_log_batch_s *next;
+  ngx_thread_task_t *task;
+  waf_log_buf_t *buf;
+  u_char *start;
+  size_t len;
+  ngx_fd_t fd;  /* 投递时 dup 的句柄：USR1 关闭旧 fd 不影响在途批次，线程内写完即关闭 */
+  ssize_t n;
+  ngx_err_t err;
+} waf_log_batch_t;
+#endif
+
+struct waf_log_buf_s {
+  u_char *start;
+  u_char *pos;
+  u_char *last;
+  size_t size;
+  ngx_msec_t flush;     /* 0 表示不设定时器，仅写满/重开/退出时落盘 */
+  ngx_event_t event;    /* flush 定时器 */
+  ngx_open_file_t *file;
+#if (NGX_THREADS)
+  ngx_thread_pool_t *thread_pool; /* NULL 表示在事件循环内同步写 */
+  waf_log_batch_t *free;          /* 空闲批次 */
+  ngx_flag_t block;               /* overflow=block */
+  ngx_flag_t pending;             /* 队列满时未能落盘，待批次完成后补投 */
+  ngx_uint_t dropped;             /* 累计丢弃行数（overflow=drop） */
+  ngx_uint_t dropped_reported;    /* 已在 error_log 中报告的丢弃行数 */
+#endif
+};
+
+static void waf_log_write_fd(ngx_open_file_t *file, u_char *data, size_t len, ngx_log_t *log)
+{
+  ssize_t n = ngx_write_fd(file->fd, data, len);
+  if (n != (ssize_t)len) {
+    ngx_log_error(NGX_LOG_ERR, log, ngx_errno,
+                  "waf: failed to write json_log \"%V\", expected %uz bytes, wrote %z",
+                  &file->name, len, n);
+  }
+}
+
+#if (NGX_THREADS)
+
+static void waf_log_batch_thread_handler(void *data, ngx_log_t *log)
+{
+  waf_log_batch_t *b = data;
+
+  b->n = ngx_write_fd(b->fd, b->start, b->len);
+  b->err = (b->n == -1) ? ngx_errno : 0;
+  (void)ngx_close_file(b->fd);
+  (void)log;
+}
+
+static ngx_int_t waf_log_post_batch(waf_log_buf_t *buf, ngx_log_t *log);
+
+/* 批次完成（事件循环线程）：报告写盘错误与丢弃计数，归还空闲链并补投积压 */
+static void waf_log_batch_done(ngx_event_t *ev)
+{
+  waf_log_batch_t *b = ev->data;
+  waf_log_buf_t *buf = b->buf;
+
+  if (b->n != (ssize_t)b->len) {
+    ngx_log_error(NGX_LOG_ERR, ev->log, b->err,
+                  "waf: failed to write json_log \"%V\", expected %uz bytes, wrote %z",
+                  &buf->file->name, b->len, b->n);
+  }
+
+  b->next = buf->free;
+  buf->free = b;
+
+  if (buf->dropped != buf->dropped_reported) {
+    ngx_log_error(NGX_LOG_WARN, ev->log, 0,
+                  "waf: json_log queue full, dropped %ui lines (total %ui)",
+                  buf->dropped - buf->dropped_reported, buf->dropped);
+    buf->dropped_reported = buf->dropped;
+  }
+
+  if (buf->pending && buf->pos > buf->start) {
+    buf->pending = 0;
+    (void)waf_log_post_batch(buf, ev->log);
+  }
+}
+
+/* 把当前缓冲交给线程池并换上空闲批次的缓冲；NGX_DECLINED 表示队列已满 */
+static ngx_int_t waf_log_post_batch(waf_log_buf_t *buf, ngx_log_t *log)
+{
+  waf_log_batch_t *b = buf->free;
+  u_char *p;
+
+  if (b == NULL) {
+    return NGX_DECLINED;
+  }
+
+  b->fd = dup(buf->file->fd);
+  if (b->fd == NGX_INVALID_FILE) {
+    ngx_log_error(NGX_LOG_ALERT, log, ngx_errno, "waf: dup() json_log fd failed");
+    return NGX_ERROR;
+  }
+
+  b->len = (size_t)(buf->pos - buf->start);
+  p = b->start;
+  b->start = buf->start;
+
+  if (ngx_thread_task_post(buf->thread_pool, b->task) != NGX_OK) {
+    (void)ngx_close_file(b->fd);
+    b->start = p;
+    return NGX_ERROR;
+  }
+
+  buf->free = b->next;
+  buf->start = p;
+  buf->pos = p;
+  buf->last = p + buf->size;
+  return NGX_OK;
+}
+
+#endif
+
+/* 同步落盘缓冲中的整行（USR1 重开前与 worker 退出时调用，亦为线程池不可用时的回退） */
+static void waf_log_file_flush(ngx_open_file_t *file, ngx_log_t *log)
+{
+  waf_log_buf_t *buf = file->data;
+
+  if (buf->pos > buf->start) {
+    waf_log_write_fd(file, buf->start, (size_t)(buf->pos - buf->start), log);
+    buf->pos = buf->start;
+  }
+
+  if (buf->event.timer_set) {
+    ngx_del_timer(&buf->event);
+  }
+}
+
+/*
+ * 写满/定时器到期时落盘：有线程池则投递，否则同步写
+ * 返回 NGX_DECLINED 表示队列已满且 overflow=drop，缓冲保持原样
+ */
+static ngx_int_t waf_log_buf_flush(waf_log_buf_t *buf, ngx_log_t *log)
+{
+  if (buf->pos == buf->start) {
+    return NGX_OK;
+  }
+
+#if (NGX_THREADS)
+  if (buf->thread_pool) {
+    ngx_int_t rc = waf_log_post_batch(buf, log);
+    if (rc == NGX_OK) {
+      if (buf->event.timer_set) {
+        ngx_del_timer(&buf->event);
       }
+      return NGX_OK;
+    }
+    if (rc == NGX_DECLINED && !buf->block) {
+      buf->pending = 1;
+      return NGX_DECLINED;
     }
-    /* 未找到ban事件则继续走规则回退逻辑 */
   }
+#endif
 
-  /* 规则阻断：按照 blockRuleId 精确匹配，否则回退到最后一条 BLOCK 规则事件 */
-  if (ctx->final_action_type == WAF_FINAL_ACTION_TYPE_BLOCK_BY_RULE && ctx->block_rule_id > 0) {
-    ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
-                  "waf-debug: decisive marking for BLOCK_BY_RULE ruleId=%ui events=%uz",
-                  (ngx_uint_t)ctx->block_rule_id, (size_t)n);
-    for (ngx_int_t i = (ngx_int_t)n - 1; i >= 0; i--) {
-      yyjson_mut_val *ev = yyjson_mut_arr_get(ctx->events, (size_t)i);
-      yyjson_mut_val *type = yyjson_mut_obj_get(ev, "type");
-      yyjson_mut_val *intent = yyjson_mut_obj_get(ev, "intent");
-      yyjson_mut_val *rid = yyjson_mut_obj_get(ev, "ruleId");
-      const char *type_str = type ? yyjson_mut_get_str(type) : NULL;
-      const char *intent_str = intent ? yyjson_mut_get_str(intent) : NULL;
-      ngx_uint_t rule_id = rid ? (ngx_uint_t)yyjson_mut_get_uint(rid) : 0;
-      if (type_str && ngx_strcmp(type_str, "rule") == 0 &&
-          intent_str && ngx_strcmp(intent_str, "BLOCK") == 0 &&
-          rule_id == ctx->block_rule_id) {
-        yyjson_mut_obj_add_bool(doc, ev, "decisive", true);
-        ctx->decisive_set = 1;
-        ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
-                      "waf-debug: decisive set at index=%i type=BLOCK ruleId=%ui",
-                      (ngx_int_t)i, (ngx_uint_t)rule_id);
-        return;
-      }
+  waf_log_file_flush(buf->file, log);
+  return NGX_OK;
+}
+
+static void waf_log_flush_handler(ngx_event_t *ev)
+{
+  waf_log_buf_t *buf = ev->data;
+
+  (void)waf_log_buf_flush(buf, ev->log);
+}
+
+char *waf_log_buffer_init(ngx_conf_t *cf, ngx_http_waf_main_conf_t *mcf)
+{
+  ngx_open_file_t *file = mcf->json_log_of;
+  waf_log_buf_t *buf;
+
+  if (file->data != NULL) {
+    /* 同一文件已被其他缓冲日志（如 access_log buffer=）占用 */
+    if (file->flush != waf_log_file_flush) {
+      ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                         "waf: json_log \"%V\" is already buffered by another log",
+                         &file->name);
+      return NGX_CONF_ERROR;
     }
+    return NGX_CONF_OK;
   }
 
-  /* 回退：选择最后一条 intent=BLOCK 的规则事件（从后往前） */
-  for (ngx_int_t i = (ngx_int_t)n - 1; i >= 0; i--) {
-    yyjson_mut_val *ev = yyjson_mut_arr_get(ctx->events, (size_t)i);
-    yyjson_mut_val *type = yyjson_mut_obj_get(ev, "type");
-    yyjson_mut_val *intent = yyjson_mut_obj_get(ev, "intent");
-    const char *type_str = type ? yyjson_mut_get_str(type) : NULL;
-    const char *intent_str = intent ? yyjson_mut_get_str(intent) : NULL;
-    if (type_str && ngx_strcmp(type_str, "rule") == 0 &&
-        intent_str && ngx_strcmp(intent_str, "BLOCK") == 0) {
-      yyjson_mut_obj_add_bool(doc, ev, "decisive", true);
-      ctx->decisive_set = 1;
-      ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
-                    "waf-debug: decisive set at index=%i type=BLOCK(last)", (ngx_int_t)i);
-      return;
+  buf = ngx_pcalloc(cf->pool, sizeof(waf_log_buf_t));
+  if (buf == NULL) {
+    return NGX_CONF_ERROR;
+  }
+  buf->size = mcf->json_log_buffer;
+  buf->start = ngx_pnalloc(cf->pool, buf->size);
+  if (buf->start == NULL) {
+    return NGX_CONF_ERROR;
+  }
+  buf->pos = buf->start;
+  buf->last = buf->start + buf->size;
+  buf->file = file;
+
+  buf->flush = mcf->json_log_flush;
+  if (buf->flush) {
+    buf->event.data = buf;
+    buf->event.handler = waf_log_flush_handler;
+    buf->event.log = &cf->cycle->new_log;
+    buf->event.cancelable = 1;
+  }
+
+#if (NGX_THREADS)
+  buf->thread_pool = mcf->json_log_thread_pool;
+  buf->block = mcf->json_log_overflow_block;
+  for (ngx_uint_t i = 0; buf->thread_pool && i < mcf->json_log_threads_queue; i++) {
+    ngx_thread_task_t *task = ngx_thread_task_alloc(cf->pool, sizeof(waf_log_batch_t));
+    if (task == NULL) {
+      return NGX_CONF_ERROR;
+    }
+    waf_log_batch_t *b = task->ctx;
+    b->task = task;
+    b->buf = buf;
+    b->start = ngx_pnalloc(cf->pool, buf->size);
+    if (b->start == NULL) {
+      return NGX_CONF_ERROR;
     }
+    task->handler = waf_log_batch_thread_handler;
+    task->event.handler = waf_log_batch_done;
+    task->event.data = b;
+    task->event.log = &cf->cycle->new_log;
+    b->next = buf->free;
+    buf->free = b;
   }
+#endif
+
+  file->flush = waf_log_file_flush;
+  file->data = buf;
+  return NGX_CONF_OK;
 }
 
-void waf_log_flush_final(ngx_http_request_t *r, ngx_http_waf_main_conf_t *mcf,
-                         ngx_http_waf_loc_conf_t *lcf, ngx_http_waf_ctx_t *ctx,
-                         const char *final_action_hint)
+void waf_log_exit_process(ngx_cycle_t *cycle)
 {
-  if (r == NULL || ctx == NULL)
+  ngx_http_waf_main_conf_t *mcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_waf_module);
+
+  if (mcf == NULL || mcf->json_log_of == NULL || mcf->json_log_of->data == NULL ||
+      mcf->json_log_of->flush != waf_log_file_flush) {
     return;
-  if (ctx->log_flushed)
+  }
+
+#if (NGX_THREADS)
+  waf_log_buf_t *buf = mcf->json_log_of->data;
+  if (buf->dropped) {
+    ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                  "waf: json_log dropped %ui lines in this worker", buf->dropped);
+  }
+#endif
+
+  /* 退出时不再投递，残留行同步写出（在途批次由线程池退出前处理完） */
+  waf_log_file_flush(mcf->json_log_of, cycle->log);
+}
+
+static void waf_log_write_jsonl(ngx_http_request_t *r, ngx_http_waf_main_conf_t *mcf,
+                                 ngx_http_waf_ctx_t *ctx, u_char *line, size_t len)
+{
+  if (mcf == NULL || line == NULL)
     return;
 
-  if (ctx->log_doc == NULL) {
-    /* 未初始化，仅输出error_log */
-    ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
-                  "waf-final: hint=%s final_status=%ui final_action=%ui "
-                  "level=%s total_score=%ui uri=\"%V\"",
-                  (final_action_hint ? final_action_hint : ""), ctx->final_status,
-                  ctx->final_action, waf_log_level_str(ctx->effective_level), ctx->total_score,
-                  &r->uri);
-    ctx->log_flushed = 1;
+  /* 检查是否配置了日志路径 */
+  if (mcf->json_log_path.len == 0) {
+    ngx_log_error(NGX_LOG_INFO, r->connection->log, 0, "waf: json_log_path not configured, skipping JSONL write");
+    return; /* 未配置日志文件 */
+  }
+
+  /* 使用 master 打开的 open_files 句柄（worker 复用 fd；USR1 可重开） */
+  ngx_open_file_t *file = mcf->json_log_of;
+  if (file == NULL || file->fd == NGX_INVALID_FILE) {
+    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                  "waf: json_log open_file handle invalid for %V", &mcf->json_log_path);
+    return;
+  }
+
+  /* 未启用缓冲：line 已含结尾换行，整行一次写入 */
+  if (mcf->json_log_buffer == 0 || file->flush != waf_log_file_flush) {
+    waf_log_write_fd(file, line, len, r->connection->log);
     return;
   }
 
-  yyjson_mut_doc *doc = ctx->log_doc;
-  yyjson_mut_val *root = yyjson_mut_doc_get_root(doc);
+  waf_log_buf_t *buf = file->data;
 
-  /* 1. 时间戳（ISO 8601格式） */
-  time_t now = time(NULL);
-  struct tm tm;
-  gmtime_r(&now, &tm);
-  char time_buf[64];
-  strftime(time_buf, sizeof(time_buf), "%Y-%m-%dT%H:%M:%SZ", &tm);
-  yyjson_mut_obj_add_str(doc, root, "time", time_buf);
+  /* 放不下则先落盘已缓冲的整行；队列满且 overflow=drop 时丢弃本行 */
+  if (len > (size_t)(buf->last - buf->pos)) {
+    if (waf_log_buf_flush(buf, r->connection->log) == NGX_DECLINED) {
+#if (NGX_THREADS)
+      buf->dropped++;
+#endif
+      return;
+    }
+  }
 
-  /* 2. 客户端IP（网络序 → 文本） */
-  ngx_str_t ip_text = waf_utils_ip_to_str(ctx->client_ip, r->pool);
-  if (ip_text.len > 0) {
-    yyjson_mut_obj_add_strn(doc, root, "clientIp", (const char *)ip_text.data, ip_text.len);
+  /* 超过缓冲容量的单行直接写出 */
+  if (len > (size_t)(buf->last - buf->pos)) {
+    waf_log_write_fd(file, line, len, r->connection->log);
+    return;
   }
 
-  /* 3. 请求方法 */
-  yyjson_mut_obj_add_strn(doc, root, "method", (const char *)r->method_name.data,
-                          r->method_name.len);
+  buf->pos = ngx_cpymem(buf->pos, line, len);
 
-  /* 4. Host */
-  if (r->headers_in.host && r->headers_in.host->value.len > 0) {
-    yyjson_mut_obj_add_strn(doc, root, "host", 
-                            (const char *)r->headers_in.host->value.data,
-                            r->headers_in.host->value.len);
+  if (buf->flush && !buf->event.timer_set) {
+    ngx_add_timer(&buf->event, buf->flush);
   }
+}
 
-  /* 4.1 GeoIP Data (Optional) */
-  /* Country Code */
-  {
-      ngx_str_t name = ngx_string("geoip2_data_country_code");
-      ngx_uint_t key = ngx_hash_key(name.data, name.len);
-      ngx_http_variable_value_t *v = ngx_http_get_variable(r, &name, key);
-      if (v && !v->not_found && v->valid && v->len > 0) {
-          yyjson_mut_obj_add_strn(doc, root, "country", (const char *)v->data, v->len);
-      }
+/*
+ * 判定 decisive 事件（返回下标+1，0 表示无）：候选已在追加时登记，
+ * 仅 blockRuleId 与最后一条 BLOCK 事件不一致时按整数比较回扫
+ */
+static ngx_uint_t waf_log_pick_decisive(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx)
+{
+  if (ctx->events == NULL || ctx->events->nelts == 0)
+    return 0;
+
+  /* BYPASS：最后一条 intent=BYPASS 的规则事件 */
+  if (ctx->final_action == WAF_FINAL_BYPASS) {
+    return ctx->ev_last_bypass;
   }
-  /* Province */
-  {
-      ngx_str_t name = ngx_string("geoip2_data_subdivision_name");
-      ngx_uint_t key = ngx_hash_key(name.data, name.len);
-      ngx_http_variable_value_t *v = ngx_http_get_variable(r, &name, key);
-      if (v && !v->not_found && v->valid && v->len > 0) {
-          yyjson_mut_obj_add_strn(doc, root, "province", (const char *)v->data, v->len);
-      }
+
+  /* 仅在最终动作为 BLOCK 时选择 decisive */
+  if (ctx->final_action != WAF_FINAL_BLOCK) {
+    return 0;
+  }
+
+  /* 动态封禁：优先最后一条 ban 事件，未找到则走规则回退 */
+  if (ctx->final_action_type == WAF_FINAL_ACTION_TYPE_BLOCK_BY_DYNAMIC_BLOCK &&
+      ctx->ev_last_ban) {
+    return ctx->ev_last_ban;
   }
-  /* City */
-  {
-      ngx_str_t name = ngx_string("geoip2_data_city_name");
-      ngx_uint_t key = ngx_hash_key(name.data, name.len);
-      ngx_http_variable_value_t *v = ngx_http_get_variable(r, &name, key);
-      if (v && !v->not_found && v->valid && v->len > 0) {
-          yyjson_mut_obj_add_strn(doc, root, "city", (const char *)v->data, v->len);
+
+  /* 规则阻断：按照 blockRuleId 精确匹配，否则回退到最后一条 BLOCK 规则事件 */
+  if (ctx->final_action_type == WAF_FINAL_ACTION_TYPE_BLOCK_BY_RULE && ctx->block_rule_id > 0 &&
+      ctx->ev_last_block) {
+    waf_log_event_t *evs = ctx->events->elts;
+    for (ngx_uint_t i = ctx->ev_last_block; i > 0; i--) {
+      waf_log_event_t *ev = &evs[i - 1];
+      if (ev->type == WAF_LOG_EV_RULE && ev->rule_id == ctx->block_rule_id && ev->intent &&
+          ngx_strcmp(ev->intent, "BLOCK") == 0) {
+        return i;
       }
+    }
   }
 
-  /* 5. URI */
-  yyjson_mut_obj_add_strn(doc, root, "uri", (const char *)r->uri.data, r->uri.len);
+  return ctx->ev_last_block;
+}
 
-  /* 6. events 数组 */
-  if (ctx->events) {
-    yyjson_mut_obj_add_val(doc, root, "events", ctx->events);
-  }
+void waf_log_flush_final(ngx_http_request_t *r, ngx_http_waf_main_conf_t *mcf,
+                         ngx_http_waf_loc_conf_t *lcf, ngx_http_waf_ctx_t *ctx,
+                         const char *final_action_hint)
+{
+  if (r == NULL || ctx == NULL)
+    return;
+  if (ctx->log_flushed)
+    return;
 
-  /* 在最终输出前集中判定并标记 decisive 事件 */
-  waf_log_mark_decisive_on_flush(r, ctx);
+  waf_log_event_t *evs = (ctx->events != NULL) ? ctx->events->elts : NULL;
+  ngx_uint_t nevents = (ctx->events != NULL) ? ctx->events->nelts : 0;
+
+  /* 在最终输出前集中判定 decisive 事件 */
+  ngx_uint_t decisive = waf_log_pick_decisive(r, ctx);
+  if (decisive) {
+    ctx->decisive_set = 1;
+    ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
+                  "waf-debug: decisive set at index=%ui type=%ui", decisive - 1,
+                  (ngx_uint_t)evs[decisive - 1].type);
+  }
 
   /* attackType：用于大屏/审计聚合（优先基于 decisive 规则事件的 tags 推断） */
   const char *attack_type = NULL;
@@ -648,62 +1105,21 @@ void waf_log_flush_final(ngx_http_request_t *r, ngx_http_waf_main_conf_t *mcf,
       break;
   }
 
-  if (attack_type == NULL && ctx->events) {
+  if (attack_type == NULL && nevents > 0) {
     /* BLOCK_BY_RULE：优先按 blockRuleId 精确匹配对应的规则事件 */
     if (ctx->final_action_type == WAF_FINAL_ACTION_TYPE_BLOCK_BY_RULE && ctx->block_rule_id > 0) {
-      size_t n = yyjson_mut_arr_size(ctx->events);
-      for (ngx_int_t i = (ngx_int_t)n - 1; i >= 0; i--) {
-        yyjson_mut_val *ev = yyjson_mut_arr_get(ctx->events, (size_t)i);
-        if (ev == NULL) {
-          continue;
-        }
-
-        yyjson_mut_val *type = yyjson_mut_obj_get(ev, "type");
-        const char *type_str = type ? yyjson_mut_get_str(type) : NULL;
-        if (type_str == NULL || ngx_strcmp(type_str, "rule") != 0) {
-          continue;
-        }
-
-        yyjson_mut_val *rid = yyjson_mut_obj_get(ev, "ruleId");
-        if (rid && yyjson_mut_is_uint(rid) && (ngx_uint_t)yyjson_mut_get_uint(rid) == ctx->block_rule_id) {
-          yyjson_mut_val *atype = yyjson_mut_obj_get(ev, "attackType");
-          if (atype && yyjson_mut_is_str(atype)) {
-            attack_type = yyjson_mut_get_str(atype);
-          }
-          if (attack_type == NULL) {
-            yyjson_mut_val *tags = yyjson_mut_obj_get(ev, "tags");
-            attack_type = waf_attack_type_from_tags_val(tags);
-          }
+      for (ngx_uint_t i = nevents; i > 0; i--) {
+        if (evs[i - 1].type == WAF_LOG_EV_RULE && evs[i - 1].rule_id == ctx->block_rule_id) {
+          attack_type = evs[i - 1].attack_type;
           break;
         }
       }
     }
 
-    /* 回退：使用 decisive 规则事件的 tags 推断 */
-    size_t n = yyjson_mut_arr_size(ctx->events);
-    for (ngx_int_t i = (ngx_int_t)n - 1; i >= 0; i--) {
-      yyjson_mut_val *ev = yyjson_mut_arr_get(ctx->events, (size_t)i);
-      if (ev == NULL) {
-        continue;
-      }
-      yyjson_mut_val *dec = yyjson_mut_obj_get(ev, "decisive");
-      if (dec == NULL || !yyjson_mut_is_true(dec)) {
-        continue;
-      }
-
-      yyjson_mut_val *type = yyjson_mut_obj_get(ev, "type");
-      const char *type_str = type ? yyjson_mut_get_str(type) : NULL;
-      if (type_str && ngx_strcmp(type_str, "rule") == 0) {
-        yyjson_mut_val *atype = yyjson_mut_obj_get(ev, "attackType");
-        if (atype && yyjson_mut_is_str(atype)) {
-          attack_type = yyjson_mut_get_str(atype);
-        }
-        if (attack_type == NULL) {
-          yyjson_mut_val *tags = yyjson_mut_obj_get(ev, "tags");
-          attack_type = waf_attack_type_from_tags_val(tags);
-        }
-      }
-      break;
+    /* decisive 规则事件的推断结果优先 */
+    if (decisive && evs[decisive - 1].type == WAF_LOG_EV_RULE &&
+        evs[decisive - 1].attack_type != NULL) {
+      attack_type = evs[decisive - 1].attack_type;
     }
   }
 
@@ -713,62 +1129,119 @@ void waf_log_flush_final(ngx_http_request_t *r, ngx_http_waf_main_conf_t *mcf,
     attack_type = "OTHER";
   }
 
-  if (attack_type) {
-    yyjson_mut_obj_add_str(doc, root, "attackType", attack_type);
-  }
   /* 保存到 ctx，供 $waf_attack_type 与 access_log 使用 */
   ctx->attack_type = attack_type;
 
-  /* 7. finalAction */
-  yyjson_mut_obj_add_str(doc, root, "finalAction", waf_final_action_str(ctx->final_action));
+  /* 检查日志级别是否需要输出：不落盘则不序列化 */
+  ngx_flag_t should_log = 0;
+  if (ctx->final_action == WAF_FINAL_BLOCK || ctx->final_action == WAF_FINAL_BYPASS) {
+    /* BLOCK/BYPASS 强制输出（decisive events） */
+    should_log = 1;
+  } else if (mcf && mcf->json_log_level != (ngx_uint_t)WAF_LOG_NONE) {
+    /* 根据配置级别判断 */
+    if ((ngx_int_t)ctx->effective_level >= (ngx_int_t)mcf->json_log_level) {
+      should_log = 1;
+    }
+  }
 
-  /* 8. finalActionType */
-  yyjson_mut_obj_add_str(doc, root, "finalActionType",
-                         waf_final_action_type_str(ctx->final_action_type));
+  if (should_log && mcf && mcf->json_log_path.len > 0) {
+    waf_log_out_t out;
+    ngx_memzero(&out, sizeof(out));
+    out.pool = r->pool;
+    (void)waf_log_out_reserve(&out, 512 + 256 * nevents + r->uri.len);
+
+    waf_log_out_open(&out, '{');
+
+    /* 1. 时间戳（ISO 8601格式，取缓存时间，不发起系统调用） */
+    ngx_tm_t tm;
+    u_char time_buf[sizeof("1970-01-01T00:00:00Z")];
+    ngx_gmtime(ngx_time(), &tm);
+    u_char *tp = ngx_sprintf(time_buf, "%4d-%02d-%02dT%02d:%02d:%02dZ", tm.ngx_tm_year,
+                             tm.ngx_tm_mon, tm.ngx_tm_mday, tm.ngx_tm_hour, tm.ngx_tm_min,
+                             tm.ngx_tm_sec);
+    waf_log_out_key(&out, "time");
+    waf_log_out_strn(&out, time_buf, (size_t)(tp - time_buf));
+
+    /* 2. 客户端IP（网络序 → 文本） */
+    ngx_str_t ip_text = waf_utils_ip_to_str(ctx->client_ip, r->pool);
+    if (ip_text.len > 0) {
+      waf_log_out_key(&out, "clientIp");
+      waf_log_out_strn(&out, ip_text.data, ip_text.len);
+    }
 
-  /* 9. currentGlobalAction（记录当前请求的全局策略） */
-  if (lcf != NULL) {
-    const char *global_action = (lcf->default_action == WAF_DEFAULT_ACTION_BLOCK) ? "BLOCK" : "LOG";
-    yyjson_mut_obj_add_str(doc, root, "currentGlobalAction", global_action);
-  }
+    /* 3. 请求方法 */
+    waf_log_out_key(&out, "method");
+    waf_log_out_strn(&out, r->method_name.data, r->method_name.len);
 
-  /* 10. blockRuleId（仅BLOCK_BY_RULE时） */
-  if (ctx->final_action_type == WAF_FINAL_ACTION_TYPE_BLOCK_BY_RULE && ctx->block_rule_id > 0) {
-    yyjson_mut_obj_add_uint(doc, root, "blockRuleId", ctx->block_rule_id);
-  }
+    /* 4. Host */
+    if (r->headers_in.host && r->headers_in.host->value.len > 0) {
+      waf_log_out_key(&out, "host");
+      waf_log_out_strn(&out, r->headers_in.host->value.data, r->headers_in.host->value.len);
+    }
 
-  /* 11. status */
-  if (ctx->final_status > 0) {
-    yyjson_mut_obj_add_uint(doc, root, "status", ctx->final_status);
-  }
+    /* 4.1 GeoIP Data (Optional) */
+    ngx_str_t geo_country = ngx_string("geoip2_data_country_code");
+    ngx_str_t geo_province = ngx_string("geoip2_data_subdivision_name");
+    ngx_str_t geo_city = ngx_string("geoip2_data_city_name");
+    waf_log_out_variable(&out, r, "country", &geo_country);
+    waf_log_out_variable(&out, r, "province", &geo_province);
+    waf_log_out_variable(&out, r, "city", &geo_city);
+
+    /* 5. URI */
+    waf_log_out_key(&out, "uri");
+    waf_log_out_strn(&out, r->uri.data, r->uri.len);
+
+    /* 6. events 数组 */
+    waf_log_out_key(&out, "events");
+    waf_log_out_open(&out, '[');
+    for (ngx_uint_t i = 0; i < nevents; i++) {
+      waf_log_out_event(&out, &evs[i], decisive == i + 1);
+    }
+    waf_log_out_close(&out, ']');
 
-  /* 12. level（顶层日志级别，文本） */
-  yyjson_mut_obj_add_str(doc, root, "level", waf_log_level_str(ctx->effective_level));
+    if (attack_type) {
+      waf_log_out_key(&out, "attackType");
+      waf_log_out_str(&out, attack_type);
+    }
 
-  /* 输出 JSONL */
-  yyjson_write_err werr;
-  char *json = yyjson_mut_write_opts(doc, YYJSON_WRITE_NOFLAG, NULL, NULL, &werr);
-  if (json) {
-    /* 检查日志级别是否需要输出 */
-    ngx_flag_t should_log = 0;
-    if (ctx->final_action == WAF_FINAL_BLOCK || ctx->final_action == WAF_FINAL_BYPASS) {
-      /* BLOCK/BYPASS 强制输出（decisive events） */
-      should_log = 1;
-    } else if (mcf && mcf->json_log_level != (ngx_uint_t)WAF_LOG_NONE) {
-      /* 根据配置级别判断 */
-      if ((ngx_int_t)ctx->effective_level >= (ngx_int_t)mcf->json_log_level) {
-        should_log = 1;
-      }
+    /* 7. finalAction */
+    waf_log_out_key(&out, "finalAction");
+    waf_log_out_str(&out, waf_final_action_str(ctx->final_action));
+
+    /* 8. finalActionType */
+    waf_log_out_key(&out, "finalActionType");
+    waf_log_out_str(&out, waf_final_action_type_str(ctx->final_action_type));
+
+    /* 9. currentGlobalAction（记录当前请求的全局策略） */
+    if (lcf != NULL) {
+      waf_log_out_key(&out, "currentGlobalAction");
+      waf_log_out_str(&out, (lcf->default_action == WAF_DEFAULT_ACTION_BLOCK) ? "BLOCK" : "LOG");
     }
 
-    if (should_log) {
-      waf_log_write_jsonl(r, mcf, ctx, json);
+    /* 10. blockRuleId（仅BLOCK_BY_RULE时） */
+    if (ctx->final_action_type == WAF_FINAL_ACTION_TYPE_BLOCK_BY_RULE && ctx->block_rule_id > 0) {
+      waf_log_out_key(&out, "blockRuleId");
+      waf_log_out_uint(&out, ctx->block_rule_id);
     }
 
-    free(json);
-  } else {
-    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, "waf: failed to serialize JSON: code=%ui",
-                  (ngx_uint_t)werr.code);
+    /* 11. status */
+    if (ctx->final_status > 0) {
+      waf_log_out_key(&out, "status");
+      waf_log_out_uint(&out, ctx->final_status);
+    }
+
+    /* 12. level（顶层日志级别，文本） */
+    waf_log_out_key(&out, "level");
+    waf_log_out_str(&out, waf_log_level_str(ctx->effective_level));
+
+    waf_log_out_close(&out, '}');
+    waf_log_out_raw(&out, "\n", 1);
+
+    if (!out.failed) {
+      waf_log_write_jsonl(r, mcf, ctx, out.start, (size_t)(out.pos - out.start));
+    } else {
+      ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, "waf: failed to serialize JSON: no memory");
+    }
   }
 
   /* 输出 error_log 摘要（可选） */
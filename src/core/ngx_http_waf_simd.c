@@ -0,0 +1,406 @@
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+#include "ngx_http_waf_simd.h"
+
+/*
+ * 字符串匹配内核
+ *
+ * contains（首尾字节筛选）：
+ *  1. 将 needle 首字节、尾字节分别广播为向量 F、L
+ *  2. 每轮取 hay[i..i+W) 与 hay[i+nl-1..i+nl-1+W) 两个窗口，分别与 F、L 比较后按位与
+ *  3. 掩码中每个置位即候选起点，仅对候选做中间字节校验
+ *  4. 剩余不足一个窗口的尾部交给标量实现
+ *
+ * caseless 折叠：t = v + (0x80 - 'A') 后有符号比较 t < -128 + 26 即得大写掩码，
+ * 与 0x20 按位与后 OR 回原值；非字母（含 >= 0x80 字节）保持不变。
+ *
+ * byteset（特殊字节位图）：同样以偏移后的有符号比较得到数字掩码（v - '0' < 10）与
+ * 字母掩码（(v | 0x20) - 'a' < 26），取反即特殊字节掩码；掩码为 0 的块整体跳过，
+ * 其余仅对置位字节逐个登记。
+ *
+ * find2（转义定位）：两字节分别广播后比较、按位或，movemask 取最低置位即首个位置。
+ * url_decode 以 find2 跳过无转义的整段（整段 memmove），只在 '%'/'+' 处逐字节处理。
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define WAF_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+typedef ngx_uint_t (*waf_simd_contains_pt)(const u_char *hay, size_t hay_len,
+                                           const u_char *needle, size_t needle_len,
+                                           ngx_flag_t caseless);
+typedef ngx_uint_t (*waf_simd_equals_pt)(const u_char *a, const u_char *b, size_t len,
+                                         ngx_flag_t caseless);
+typedef void (*waf_simd_byteset_pt)(const u_char *data, size_t len, waf_byteset_t *set);
+typedef size_t (*waf_simd_find2_pt)(const u_char *data, size_t len, u_char a, u_char b);
+
+/* ------------------------ 标量实现 ------------------------ */
+
+static ngx_inline ngx_uint_t waf_scalar_eq(const u_char *a, const u_char *b, size_t len,
+                                           ngx_flag_t caseless)
+{
+  if (!caseless)
+    return ngx_memcmp(a, b, len) == 0;
+  for (size_t i = 0; i < len; i++) {
+    if (ngx_tolower(a[i]) != ngx_tolower(b[i]))
+      return 0;
+  }
+  return 1;
+}
+
+static ngx_uint_t waf_scalar_contains(const u_char *h, size_t hl, const u_char *n, size_t nl,
+                                      ngx_flag_t caseless)
+{
+  if (nl == 0)
+    return 1;
+  if (hl < nl)
+    return 0;
+  u_char first = caseless ? ngx_tolower(n[0]) : n[0];
+  for (size_t i = 0; i + nl <= hl; i++) {
+    u_char hc = caseless ? ngx_tolower(h[i]) : h[i];
+    if (hc == first && waf_scalar_eq(h + i + 1, n + 1, nl - 1, caseless))
+      return 1;
+  }
+  return 0;
+}
+
+static ngx_uint_t waf_scalar_equals(const u_char *a, const u_char *b, size_t len,
+                                    ngx_flag_t caseless)
+{
+  return waf_scalar_eq(a, b, len, caseless);
+}
+
+static void waf_scalar_byteset(const u_char *data, size_t len, waf_byteset_t *set)
+{
+  for (size_t i = 0; i < len; i++) {
+    u_char c = data[i];
+    if ((u_char)(c - '0') < 10 || (u_char)((c | 0x20) - 'a') < 26)
+      continue;
+    waf_byteset_add(set, c);
+  }
+}
+
+static size_t waf_scalar_find2(const u_char *data, size_t len, u_char a, u_char b)
+{
+  for (size_t i = 0; i < len; i++) {
+    if (data[i] == a || data[i] == b)
+      return i;
+  }
+  return len;
+}
+
+#if (WAF_SIMD_X86)
+
+/* ------------------------ SSE4.2（16 字节窗口） ------------------------ */
+
+__attribute__((target("sse4.2"))) static ngx_inline __m128i waf_sse_fold(__m128i v)
+{
+  __m128i t = _mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - 'A')));
+  __m128i upper = _mm_cmplt_epi8(t, _mm_set1_epi8((char)(-128 + 26)));
+  return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+__attribute__((target("sse4.2"))) static ngx_uint_t
+waf_sse42_contains(const u_char *h, size_t hl, const u_char *n, size_t nl, ngx_flag_t caseless)
+{
+  if (nl == 0)
+    return 1;
+  if (hl < nl)
+    return 0;
+
+  u_char fc = caseless ? ngx_tolower(n[0]) : n[0];
+  u_char lc = caseless ? ngx_tolower(n[nl - 1]) : n[nl - 1];
+  __m128i first = _mm_set1_epi8((char)fc);
+  __m128i last = _mm_set1_epi8((char)lc);
+
+  size_t i = 0;
+  for (; i + nl - 1 + 16 <= hl; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(h + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(h + i + nl - 1));
+    if (caseless) {
+      a = waf_sse_fold(a);
+      b = waf_sse_fold(b);
+    }
+    unsigned mask = (unsigned)_mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+    while (mask) {
+      unsigned bit = (unsigned)__builtin_ctz(mask);
+      if (nl <= 2 || waf_scalar_eq(h + i + bit + 1, n + 1, nl - 2, caseless))
+        return 1;
+      mask &= mask - 1;
+    }
+  }
+  return waf_scalar_contains(h + i, hl - i, n, nl, caseless);
+}
+
+__attribute__((target("sse4.2"))) static ngx_uint_t
+waf_sse42_equals(const u_char *a, const u_char *b, size_t len, ngx_flag_t caseless)
+{
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+    __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+    if (caseless) {
+      va = waf_sse_fold(va);
+      vb = waf_sse_fold(vb);
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) != 0xFFFF)
+      return 0;
+  }
+  return waf_scalar_eq(a + i, b + i, len - i, caseless);
+}
+
+__attribute__((target("sse4.2"))) static void waf_sse42_byteset(const u_char *data, size_t len,
+                                                               waf_byteset_t *set)
+{
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+    __m128i d = _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - '0'))),
+                               _mm_set1_epi8((char)(-128 + 10)));
+    __m128i a = _mm_cmplt_epi8(
+        _mm_add_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8((char)(0x80 - 'a'))),
+        _mm_set1_epi8((char)(-128 + 26)));
+    unsigned mask = (unsigned)_mm_movemask_epi8(_mm_or_si128(d, a)) ^ 0xFFFFu;
+    while (mask) {
+      waf_byteset_add(set, data[i + (unsigned)__builtin_ctz(mask)]);
+      mask &= mask - 1;
+    }
+  }
+  waf_scalar_byteset(data + i, len - i, set);
+}
+
+__attribute__((target("sse4.2"))) static size_t waf_sse42_find2(const u_char *data, size_t len,
+                                                                u_char a, u_char b)
+{
+  __m128i va = _mm_set1_epi8((char)a);
+  __m128i vb = _mm_set1_epi8((char)b);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+    unsigned mask = (unsigned)_mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+    if (mask)
+      return i + (unsigned)__builtin_ctz(mask);
+  }
+  return i + waf_scalar_find2(data + i, len - i, a, b);
+}
+
+/* ------------------------ AVX2（32 字节窗口） ------------------------ */
+
+__attribute__((target("avx2"))) static ngx_inline __m256i waf_avx2_fold(__m256i v)
+{
+  __m256i t = _mm256_add_epi8(v, _mm256_set1_epi8((char)(0x80 - 'A')));
+  __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(-128 + 26)), t);
+  return _mm256_or_si256(v, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2"))) static ngx_uint_t
+waf_avx2_contains(const u_char *h, size_t hl, const u_char *n, size_t nl, ngx_flag_t caseless)
+{
+  if (nl == 0)
+    return 1;
+  if (hl < nl)
+    return 0;
+
+  u_char fc = caseless ? ngx_tolower(n[0]) : n[0];
+  u_char lc = caseless ? ngx_tolower(n[nl - 1]) : n[nl - 1];
+  __m256i first = _mm256_set1_epi8((char)fc);
+  __m256i last = _mm256_set1_epi8((char)lc);
+
+  size_t i = 0;
+  for (; i + nl - 1 + 32 <= hl; i += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(h + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(h + i + nl - 1));
+    if (caseless) {
+      a = waf_avx2_fold(a);
+      b = waf_avx2_fold(b);
+    }
+    uint32_t mask = (uint32_t)_mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+    while (mask) {
+      unsigned bit = (unsigned)__builtin_ctz(mask);
+      if (nl <= 2 || waf_scalar_eq(h + i + bit + 1, n + 1, nl - 2, caseless))
+        return 1;
+      mask &= mask - 1;
+    }
+  }
+  /* 尾部不足 32 字节：交给 16 字节窗口与标量收尾 */
+  return waf_sse42_contains(h + i, hl - i, n, nl, caseless);
+}
+
+__attribute__((target("avx2"))) static ngx_uint_t
+waf_avx2_equals(const u_char *a, const u_char *b, size_t len, ngx_flag_t caseless)
+{
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+    __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+    if (caseless) {
+      va = waf_avx2_fold(va);
+      vb = waf_avx2_fold(vb);
+    }
+    if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)) != 0xFFFFFFFFu)
+      return 0;
+  }
+  return waf_sse42_equals(a + i, b + i, len - i, caseless);
+}
+
+__attribute__((target("avx2"))) static void waf_avx2_byteset(const u_char *data, size_t len,
+                                                            waf_byteset_t *set)
+{
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+    __m256i d = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(-128 + 10)),
+                                  _mm256_add_epi8(v, _mm256_set1_epi8((char)(0x80 - '0'))));
+    __m256i a = _mm256_cmpgt_epi8(
+        _mm256_set1_epi8((char)(-128 + 26)),
+        _mm256_add_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)),
+                        _mm256_set1_epi8((char)(0x80 - 'a'))));
+    uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(_mm256_or_si256(d, a));
+    while (mask) {
+      waf_byteset_add(set, data[i + (unsigned)__builtin_ctz(mask)]);
+      mask &= mask - 1;
+    }
+  }
+  waf_sse42_byteset(data + i, len - i, set);
+}
+
+__attribute__((target("avx2"))) static size_t waf_avx2_find2(const u_char *data, size_t len,
+                                                              u_char a, u_char b)
+{
+  __m256i va = _mm256_set1_epi8((char)a);
+  __m256i vb = _mm256_set1_epi8((char)b);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+    uint32_t mask = (uint32_t)_mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+    if (mask)
+      return i + (unsigned)__builtin_ctz(mask);
+  }
+  return i + waf_sse42_find2(data + i, len - i, a, b);
+}
+
+#endif /* WAF_SIMD_X86 */
+
+/* ------------------------ 运行期派发 ------------------------ */
+
+static waf_simd_contains_pt waf_simd_contains_impl = waf_scalar_contains;
+static waf_simd_equals_pt waf_simd_equals_impl = waf_scalar_equals;
+static waf_simd_byteset_pt waf_simd_byteset_impl = waf_scalar_byteset;
+static waf_simd_find2_pt waf_simd_find2_impl = waf_scalar_find2;
+static const char *waf_simd_name = "scalar";
+
+void waf_simd_init(ngx_log_t *log)
+{
+#if (WAF_SIMD_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    waf_simd_contains_impl = waf_avx2_contains;
+    waf_simd_equals_impl = waf_avx2_equals;
+    waf_simd_byteset_impl = waf_avx2_byteset;
+    waf_simd_find2_impl = waf_avx2_find2;
+    waf_simd_name = "avx2";
+  } else if (__builtin_cpu_supports("sse4.2")) {
+    waf_simd_contains_impl = waf_sse42_contains;
+    waf_simd_equals_impl = waf_sse42_equals;
+    waf_simd_byteset_impl = waf_sse42_byteset;
+    waf_simd_find2_impl = waf_sse42_find2;
+    waf_simd_name = "sse4.2";
+  }
+#endif
+  if (log) {
+    ngx_log_error(NGX_LOG_INFO, log, 0, "waf: string match kernel=%s", waf_simd_name);
+  }
+}
+
+const char *waf_simd_kernel_name(void)
+{
+  return waf_simd_name;
+}
+
+ngx_uint_t waf_simd_contains(const u_char *hay, size_t hay_len, const u_char *needle,
+                             size_t needle_len, ngx_flag_t caseless)
+{
+  return waf_simd_contains_impl(hay, hay_len, needle, needle_len, caseless);
+}
+
+ngx_uint_t waf_simd_equals(const u_char *a, const u_char *b, size_t len, ngx_flag_t caseless)
+{
+  return waf_simd_equals_impl(a, b, len, caseless);
+}
+
+void waf_simd_byteset(const u_char *data, size_t len, waf_byteset_t *set)
+{
+  waf_simd_byteset_impl(data, len, set);
+}
+
+size_t waf_simd_find2(const u_char *data, size_t len, u_char a, u_char b)
+{
+  return waf_simd_find2_impl(data, len, a, b);
+}
+
+static ngx_inline ngx_uint_t waf_hex_value(u_char c)
+{
+  if ((u_char)(c - '0') < 10)
+    return c - '0';
+  c |= 0x20;
+  if ((u_char)(c - 'a') < 6)
+    return c - 'a' + 10;
+  return 0x100;
+}
+
+size_t waf_simd_url_decode(u_char *dst, const u_char *src, size_t len, ngx_flag_t plus,
+                           size_t *consumed)
+{
+  u_char *d = dst;
+  u_char alt = plus ? '+' : '%';
+  size_t i = 0;
+
+  while (i < len) {
+    size_t run = waf_simd_find2_impl(src + i, len - i, '%', alt);
+    if (run) {
+      if (d != src + i)
+        ngx_memmove(d, src + i, run);
+      d += run;
+      i += run;
+      if (i >= len)
+        break;
+    }
+
+    if (src[i] == '+') {
+      *d++ = ' ';
+      i++;
+      continue;
+    }
+
+    /*
+     * '%'：非法/截断序列的处理与 ngx_unescape_uri(type=0) 一致；
+     * 末尾未完整的 "%" / "%X"：consumed 为 NULL 时丢弃，否则停在 '%' 处留给下一块
+     */
+    if (i + 1 >= len)
+      break;
+    ngx_uint_t hi = waf_hex_value(src[i + 1]);
+    if (hi > 0xf) {
+      /* 首位非法：丢弃 '%'，该字节按字面输出且不再开启转义 */
+      *d++ = (plus && src[i + 1] == '+') ? ' ' : src[i + 1];
+      i += 2;
+      continue;
+    }
+    if (i + 2 >= len)
+      break;
+    ngx_uint_t lo = waf_hex_value(src[i + 2]);
+    if (lo <= 0xf) {
+      *d++ = (u_char)((hi << 4) | lo);
+    }
+    /* 次位非法：三个字节一并丢弃 */
+    i += 3;
+  }
+  if (consumed)
+    *consumed = i;
+  return (size_t)(d - dst);
+}
@@ -0,0 +1,74 @@
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+#include "ngx_http_waf_simd.h"
+#include "ngx_http_waf_strset.h"
+
+/*
+ * EXACT 字符串集合
+ *
+ * 哈希：FNV-1a（caseless 时逐字节 ngx_tolower 后参与计算），
+ * 比较：长度相等后交给 waf_simd_equals（与 ngx_http_waf_equals_ci 语义一致）。
+ */
+
+static ngx_uint_t waf_strset_hash(const u_char *p, size_t len, ngx_flag_t caseless)
+{
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; i++) {
+    h ^= caseless ? ngx_tolower(p[i]) : p[i];
+    h *= 1099511628211ULL;
+  }
+  return (ngx_uint_t)(h ^ (h >> 32));
+}
+
+waf_strset_t *waf_strset_create(ngx_pool_t *pool, const ngx_array_t *strs, ngx_flag_t caseless)
+{
+  if (pool == NULL || strs == NULL || strs->nelts == 0)
+    return NULL;
+
+  ngx_uint_t cap = 4;
+  while (cap < strs->nelts * 2)
+    cap <<= 1;
+
+  waf_strset_t *set = ngx_pcalloc(pool, sizeof(waf_strset_t));
+  if (set == NULL)
+    return NULL;
+  set->slots = ngx_pcalloc(pool, cap * sizeof(ngx_str_t));
+  if (set->slots == NULL)
+    return NULL;
+  set->mask = cap - 1;
+  set->caseless = caseless ? 1 : 0;
+
+  ngx_str_t *e = strs->elts;
+  for (ngx_uint_t i = 0; i < strs->nelts; i++) {
+    if (e[i].data == NULL)
+      continue;
+    ngx_uint_t k = waf_strset_hash(e[i].data, e[i].len, set->caseless) & set->mask;
+    for (;; k = (k + 1) & set->mask) {
+      ngx_str_t *s = &set->slots[k];
+      if (s->data == NULL) {
+        *s = e[i];
+        set->nelts++;
+        break;
+      }
+      if (s->len == e[i].len && waf_simd_equals(s->data, e[i].data, s->len, set->caseless))
+        break; /* 重复元素 */
+    }
+  }
+  return set;
+}
+
+ngx_uint_t waf_strset_contains(const waf_strset_t *set, const ngx_str_t *subject)
+{
+  if (set == NULL || subject == NULL || subject->data == NULL)
+    return 0;
+  ngx_uint_t k = waf_strset_hash(subject->data, subject->len, set->caseless) & set->mask;
+  for (;; k = (k + 1) & set->mask) {
+    const ngx_str_t *s = &set->slots[k];
+    if (s->data == NULL)
+      return 0;
+    if (s->len == subject->len &&
+        waf_simd_equals(s->data, subject->data, s->len, set->caseless))
+      return 1;
+  }
+}
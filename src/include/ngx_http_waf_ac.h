@@ -0,0 +1,66 @@
+#ifndef NGX_HTTP_WAF_AC_H
+#define NGX_HTTP_WAF_AC_H
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+/*
+ * ================================================================
+ *  Aho-Corasick 多模式匹配（编译期构建、运行期只读）
+ *  - 字母表压缩：仅为 pattern 中出现过的字节分配等价类，其余字节归入类 0
+ *  - caseless 自动机在等价类映射阶段完成大小写折叠，扫描时无需 tolower
+ *  - 完整 DFA（失败转移已展开）：每个输入字节恰好一次查表
+ * ================================================================
+ */
+
+/* 编译输入：单个 pattern 及其命中时要置位的槽位 */
+typedef struct {
+  ngx_str_t pattern;        /* 非空字面量 */
+  ngx_uint_t slot;          /* 命中时置位 hits[slot]（如：规则在桶内的下标） */
+  ngx_uint_t rule_id;       /* 回溯用：所属规则 ID */
+  ngx_uint_t pattern_index; /* 回溯用：规则 patterns[] 内的下标 */
+} waf_ac_pattern_t;
+
+/* 终态输出项（同一终态的多个输出以 next 串联） */
+typedef struct {
+  ngx_uint_t slot;
+  ngx_uint_t rule_id;
+  ngx_uint_t pattern_index;
+  uint32_t next; /* 下一输出项下标+1；0 表示结束 */
+} waf_ac_output_t;
+
+typedef struct {
+  ngx_uint_t nstates;      /* 状态数（0 为根） */
+  ngx_uint_t nclasses;     /* 字节等价类个数 */
+  ngx_uint_t nslots;       /* hits[] 需要的最小长度（max slot + 1） */
+  ngx_flag_t caseless;     /* 是否大小写不敏感 */
+  uint16_t classes[256];   /* 字节 → 等价类 */
+  uint32_t *delta;         /* nstates * nclasses 转移表 */
+  uint32_t *out_head;      /* 状态自身输出链表头（下标+1；0 表示无） */
+  uint32_t *out_link;      /* 最近的、带输出的后缀状态（含自身；0 表示无） */
+  uint32_t *dict_link;     /* 带输出状态沿失败链的下一个带输出状态（0 表示无） */
+  waf_ac_output_t *outputs;
+  ngx_uint_t noutputs;
+} waf_ac_t;
+
+/*
+ * 编译自动机（配置期调用，结果分配在 pool）
+ * 返回：成功返回自动机；pattern 为空或失败返回 NULL
+ */
+waf_ac_t *waf_ac_compile(ngx_pool_t *pool, ngx_log_t *log, const waf_ac_pattern_t *pats,
+                         ngx_uint_t npats, ngx_flag_t caseless);
+
+/*
+ * 单遍扫描 subject，为每个出现的 pattern 置位 hits[slot] = 1
+ * 返回：本次扫描命中的输出次数（0 表示无任何 pattern 出现）
+ */
+ngx_uint_t waf_ac_scan(const waf_ac_t *ac, const u_char *data, size_t len, u_char *hits);
+
+/*
+ * 分块扫描：从 *state 出发扫描 data，结束时写回自动机状态（首块传 0）
+ * 跨块边界的 pattern 与整段扫描一样命中
+ */
+ngx_uint_t waf_ac_scan_stream(const waf_ac_t *ac, const u_char *data, size_t len, u_char *hits,
+                              uint32_t *state);
+
+#endif /* NGX_HTTP_WAF_AC_H */
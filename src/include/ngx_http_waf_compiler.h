@@ -1,6 +1,10 @@
 #ifndef NGX_HTTP_WAF_COMPILER_H
 #define NGX_HTTP_WAF_COMPILER_H
 
+#include "ngx_http_waf_ac.h"
+#include "ngx_http_waf_ipindex.h"
+#include "ngx_http_waf_simd.h"
+#include "ngx_http_waf_strset.h"
 #include "ngx_http_waf_module_v2.h"
 
 /*
@@ -16,9 +20,14 @@ typedef enum {
   WAF_MATCH_CONTAINS = 0,
   WAF_MATCH_EXACT,
   WAF_MATCH_REGEX,
-  WAF_MATCH_CIDR
+  WAF_MATCH_CIDR,
+  WAF_MATCH_COUNT, /* 结构性：参数个数 / 请求头个数超过上限 */
+  WAF_MATCH_LENGTH /* 结构性：URI/参数/请求头/请求体长度超过上限 */
 } waf_match_e;
 
+/* COUNT/LENGTH 只做整数比较，不扫描内容 */
+#define waf_match_is_structural(m) ((m) == WAF_MATCH_COUNT || (m) == WAF_MATCH_LENGTH)
+
 /* 规则目标 */
 typedef enum {
   WAF_T_CLIENT_IP = 0,
@@ -49,9 +58,11 @@ typedef struct {
   ngx_uint_t id;         /* 规则 ID */
   waf_target_e target;   /* 目标 */
   ngx_str_t header_name; /* 当 target=HEADER 时有效 */
+  ngx_uint_t header_slot; /* 当 target=HEADER 时有效：头名驻留槽位（snapshot->header_slots 下标） */
   waf_match_e match;     /* 匹配类型 */
   ngx_array_t *patterns; /* ngx_array_t(ngx_str_t)，OR 语义 */
   ngx_flag_t caseless;   /* 是否大小写不敏感 */
+  ngx_uint_t transform;  /* WAF_TF_* 位掩码：匹配前对 subject 应用的变换（caseless CONTAINS/EXACT 折叠为 LOWERCASE） */
   ngx_flag_t negate;     /* 是否取反（命中即不命中，未命中即命中） */
   waf_action_e action;   /* 动作 */
   waf_phase_e phase;     /* 执行段（由显式 phase 或 target+action 推断） */
@@ -61,8 +72,49 @@ typedef struct {
   /* 预编译产物 */
   ngx_array_t *compiled_regexes; /* ngx_array_t(ngx_regex_t*)，仅 REGEX */
   ngx_array_t *compiled_cidrs;   /* ngx_array_t(ngx_cidr_t)，仅 CIDR */
+  waf_strset_t *exact_set;       /* patterns 哈希集合，仅 EXACT */
+  /*
+   * REGEX 字面量因子（OR 语义）：任一正则命中时 subject 必然包含其中至少一个因子。
+   * NULL 表示无法提取（如 `.*`、反向引用），该规则的正则总是执行。
+   */
+  ngx_array_t *regex_factors;          /* ngx_array_t(ngx_str_t)，仅 REGEX */
+  ngx_flag_t regex_factors_caseless;   /* 因子是否按大小写不敏感匹配（含 (?i) 内联标志） */
+  /*
+   * 字节类预筛（CONTAINS/REGEX）：任一命中的 subject 都必然包含的特殊字节集合，
+   * 取各 pattern（REGEX 为各因子）特殊字节集合的交集；为空表示不做预筛
+   */
+  waf_byteset_t required_bytes;
+  size_t inspect_limit; /* REGEX 单次匹配最多检测的字节数（inspectLimit，0=仅受 location 限额约束） */
+  /*
+   * REGEX 单次匹配的最大字节数（流式请求体检测据此判断能否在重叠窗口上匹配）；
+   * 0 表示不可在窗口上判定（锚点/环视/反向引用/无界量词/negate），流式检测时退回整体匹配
+   */
+  size_t stream_width;
+  off_t limit; /* COUNT/LENGTH 上限（pattern 唯一元素解析而来），度量值大于该值即命中 */
 } waf_compiled_rule_t;
 
+/*
+ * 多模式匹配组：同一 (phase, target, caseless, transform) 桶内的全部 CONTAINS pattern（或 REGEX 字面量因子）
+ * 共享一个 Aho-Corasick 自动机；HEADER 目标再按 headerName 细分（各规则的 subject 不同）。
+ * 自动机输出槽位 = 规则在桶内的下标，运行期一次扫描即得到整桶规则的命中情况。
+ */
+typedef struct {
+  ngx_str_t header_name; /* 仅 target=HEADER 时有效 */
+  ngx_uint_t header_slot; /* 仅 target=HEADER 时有效 */
+  ngx_flag_t caseless;
+  ngx_uint_t transform; /* 扫描的请求级变体（WAF_TF_*） */
+  waf_ac_t *ac;
+} waf_ac_group_t;
+
+/* HEADER 规则引用的请求头名（小写、去重），下标即 header_slot */
+typedef struct {
+  ngx_str_t name;
+  ngx_int_t offset; /* well-known 头：ngx_http_headers_in_t 中 ngx_table_elt_t* 字段偏移；-1 需遍历链表 */
+} waf_header_slot_t;
+
+/* target 位（waf_compiled_snapshot_t.targets） */
+#define WAF_TARGET_BIT(t) ((ngx_uint_t)1 << (t))
+
 /* 编译期快照：包含全部规则与按 phase/target 的分桶索引 */
 typedef struct waf_compiled_snapshot_s {
   ngx_pool_t *pool;       /* 归属内存池（通常为配置期 pool） */
@@ -72,13 +124,60 @@ typedef struct waf_compiled_snapshot_s {
 
   /* 分桶：简单起见，每个桶保存指向 all_rules 元素的指针数组 */
   ngx_array_t *buckets[WAF_PHASE_COUNT][8]; /* 8=目标种类上限（与 waf_target_e 对齐） */
+
+  /* 与 buckets 一一对应的 CONTAINS 匹配组：ngx_array_t(waf_ac_group_t)，桶内无 CONTAINS 时为 NULL */
+  ngx_array_t *contains_groups[WAF_PHASE_COUNT][8];
+
+  /* 与 buckets 一一对应的 REGEX 因子预筛组（结构同上，槽位 = 规则桶内下标），无可预筛规则时为 NULL */
+  ngx_array_t *regex_groups[WAF_PHASE_COUNT][8];
+
+  /* 请求头索引：请求期一次遍历 headers 链表（仅非 well-known 头）即得到全部 HEADER 取值 */
+  ngx_array_t *header_slots;    /* ngx_array_t(waf_header_slot_t) */
+  ngx_hash_t header_hash;       /* 非 well-known 小写头名 → 槽位 + 1 */
+  ngx_uint_t header_list_slots; /* 非 well-known 槽数，0 表示无需遍历链表 */
+
+  /* CLIENT_IP 阶段（IP_ALLOW/IP_BLOCK）CIDR 基数树索引，桶内无 CIDR 规则时为 NULL */
+  waf_ip_index_t *ip_index[WAF_PHASE_COUNT];
+
+  /* 各段 COUNT/LENGTH 规则数；detect 段非 0 时先于内容规则单独评估一遍 */
+  ngx_uint_t structural_rules[WAF_PHASE_COUNT];
+
+  /* 各段非空桶的 target 位掩码：运行期据此跳过整段与请求体读取 */
+  ngx_uint_t targets[WAF_PHASE_COUNT];
+
+  /* detect 段 BODY 桶可按分块流式检测（内容规则仅 CONTAINS/REGEX，变换至多 LOWERCASE） */
+  ngx_flag_t body_streamable;
 } waf_compiled_snapshot_t;
 
+/*
+ * 正则驻留缓存：同一配置周期内 (pattern, options) 相同的正则只编译（及 JIT）一次，
+ * 供多目标展开的规则副本与继承同一规则文件的各 location 共享。分配于配置周期 pool。
+ */
+typedef struct waf_regex_cache_s waf_regex_cache_t;
+
+waf_regex_cache_t *waf_regex_cache_create(ngx_pool_t *pool);
+
+/* 统计：实际编译次数与复用次数 */
+void waf_regex_cache_stats(const waf_regex_cache_t *cache, ngx_uint_t *compiled,
+                           ngx_uint_t *reused);
+
 /*
  * 编译入口：将 M1 产出的 yyjson_doc 编译为快照
+ * - rcache 可为 NULL（不做正则驻留）
  * 返回：成功 NGX_OK；失败 NGX_ERROR（err 若非空则填充）
  */
 ngx_int_t ngx_http_waf_compile_rules(ngx_pool_t *pool, ngx_log_t *log, yyjson_doc *merged_doc,
-                                     waf_compiled_snapshot_t **out, ngx_http_waf_json_error_t *err);
+                                     waf_regex_cache_t *rcache, waf_compiled_snapshot_t **out,
+                                     ngx_http_waf_json_error_t *err);
+
+/*
+ * 正则静态分析（预编译内部使用，tests/ 直接调用做对照测试）
+ * - waf_regex_extract_factors：单个正则的字面量因子集合（OR 语义），无法提取返回 NULL；
+ *   caseless 入参为规则级标志，遇 (?i) 时置 1
+ * - waf_precompile_stream_width：按 patterns 计算 rule->stream_width
+ */
+ngx_array_t *waf_regex_extract_factors(ngx_pool_t *tmp, const ngx_str_t *pattern,
+                                       ngx_flag_t *caseless);
+void waf_precompile_stream_width(waf_compiled_rule_t *rule);
 
 #endif /* NGX_HTTP_WAF_COMPILER_H */
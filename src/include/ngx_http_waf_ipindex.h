@@ -0,0 +1,49 @@
+#ifndef NGX_HTTP_WAF_IPINDEX_H
+#define NGX_HTTP_WAF_IPINDEX_H
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+/*
+ * ================================================================
+ *  CLIENT_IP 阶段 CIDR 索引（编译期构建、运行期只读）
+ *  - 基于 nginx 基数树（ngx_radix32tree / ngx_radix128tree），IPv4 与 IPv6 各一棵
+ *  - 语义与按桶顺序逐条匹配一致：返回“首条判定命中”的规则桶内下标
+ *    * 非取反规则：节点值 = 覆盖该前缀的全部规则中最小的桶内下标，一次最长前缀查找即得
+ *    * 取反规则（未命中即命中）：每条规则单独一棵成员树，按桶序检查
+ * ================================================================
+ */
+
+#define WAF_IP_INDEX_NONE ((ngx_uint_t)-1)
+
+/* 客户端地址（网络字节序；AF_INET 仅使用前 4 字节，family 为 0 表示无效） */
+typedef struct {
+  ngx_uint_t family;
+  u_char addr[16];
+} waf_ip_addr_t;
+
+/* 取反规则的成员树 */
+typedef struct {
+  ngx_uint_t index;        /* 规则桶内下标 */
+  ngx_radix_tree_t *tree4; /* 可为 NULL（规则无 IPv4 CIDR） */
+  ngx_radix_tree_t *tree6; /* 可为 NULL（规则无 IPv6 CIDR） */
+} waf_ip_negated_t;
+
+typedef struct {
+  ngx_radix_tree_t *tree4; /* 非取反规则：前缀 → 最小桶内下标；可为 NULL */
+  ngx_radix_tree_t *tree6;
+  ngx_array_t *negated;    /* ngx_array_t(waf_ip_negated_t)，按桶内下标升序；可为 NULL */
+} waf_ip_index_t;
+
+/*
+ * 构建索引（配置期调用，结果分配在 pool）
+ * 参数：bucket 为 ngx_array_t(waf_compiled_rule_t *)，仅使用带 compiled_cidrs 的规则
+ * 返回：成功返回索引（桶内无 CIDR 规则时返回 NULL 且 *rc = NGX_OK）；失败 *rc = NGX_ERROR
+ */
+waf_ip_index_t *waf_ip_index_build(ngx_pool_t *pool, ngx_log_t *log, ngx_array_t *bucket,
+                                   ngx_int_t *rc);
+
+/* 查询：返回首条判定命中（已应用 negate）的规则桶内下标；无命中返回 WAF_IP_INDEX_NONE */
+ngx_uint_t waf_ip_index_lookup(const waf_ip_index_t *idx, const waf_ip_addr_t *addr);
+
+#endif /* NGX_HTTP_WAF_IPINDEX_H */
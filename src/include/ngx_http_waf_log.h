@@ -2,6 +2,8 @@
 #define NGX_HTTP_WAF_LOG_H
 
 #include "ngx_http_waf_module_v2.h"
+#include "ngx_http_waf_ipindex.h"
+#include "ngx_http_waf_simd.h"
 #include "ngx_http_waf_types.h"
 #include <ngx_core.h>
 #include <ngx_http.h>
@@ -40,9 +42,53 @@ typedef enum {
   WAF_FINAL_ACTION_TYPE_BLOCK_BY_DYNAMIC_BLOCK
 } waf_final_action_type_e;
 
+/* 请求级目标变体（变换缓存条目）：同一 (target, slot, transform) 每请求至多计算一次 */
+typedef struct {
+  ngx_uint_t target;    /* waf_target_e；ARGS_NAME/ARGS_VALUE 共用 ARGS_NAME 条目 */
+  ngx_uint_t slot;      /* HEADER 槽位，其余为 0 */
+  ngx_uint_t transform; /* WAF_TF_* 组合（非 0） */
+  ngx_str_t value;      /* 变换结果（ARGS_NAME/ARGS_VALUE 不使用） */
+  ngx_array_t *args;    /* ARGS_NAME/ARGS_VALUE：变换后的参数表 ngx_array_t(waf_arg_t) */
+} waf_variant_t;
+
+/* 事件类型（JSONL events[].type） */
+typedef enum {
+  WAF_LOG_EV_RULE = 0,      /* "rule" */
+  WAF_LOG_EV_REPUTATION,    /* "reputation" */
+  WAF_LOG_EV_WINDOW_RESET,  /* "reputation_window_reset" */
+  WAF_LOG_EV_BAN,           /* "ban" */
+  WAF_LOG_EV_LIMIT          /* "inspect_limit" */
+} waf_log_event_type_e;
+
+/*
+ * 事件记录：追加时只填定长字段，字符串均为引用（字面量或配置/请求期内有效的内存），
+ * flush 时由手写序列化器直接输出为 JSONL 行
+ */
+typedef struct {
+  waf_log_event_type_e type;
+  ngx_uint_t rule_id;       /* rule / inspect_limit */
+  ngx_uint_t score_delta;   /* rule / reputation */
+  ngx_uint_t total_score;   /* rule / reputation：追加时的累计分 */
+  ngx_uint_t value;         /* rule：patternIndex；window_reset：prevScore；ban：window */
+  ngx_msec_t start_ms;      /* window_reset */
+  ngx_msec_t end_ms;        /* window_reset */
+  const char *intent;       /* rule："BLOCK"|"BYPASS"|"LOG" */
+  const char *target;       /* rule / inspect_limit */
+  const char *text;         /* reputation：reason；inspect_limit：limit */
+  const char *verdict;      /* inspect_limit */
+  const char *attack_type;  /* rule：由 tags 推断 */
+  ngx_str_t pattern;        /* rule：matchedPattern */
+  ngx_array_t *tags;        /* rule：规则 tags（ngx_array_t(ngx_str_t)） */
+  unsigned negate : 1;      /* rule */
+} waf_log_event_t;
+
 typedef struct ngx_http_waf_ctx_s {
-  yyjson_mut_doc *log_doc;          /* JSONL文档（请求创建，flush时写入） */
-  yyjson_mut_val *events;           /* events数组 */
+  /* 事件记录 ngx_array_t(waf_log_event_t)：首个事件时于 r->pool 创建，NULL 表示无事件 */
+  ngx_array_t *events;
+  /* decisive 候选（追加时登记，下标+1，0 表示无）：最后一条 BLOCK/BYPASS 规则事件、最后一条 ban 事件 */
+  ngx_uint_t ev_last_block;
+  ngx_uint_t ev_last_bypass;
+  ngx_uint_t ev_last_ban;
   waf_log_level_e effective_level;  /* 本次请求的整体日志级别 */
   ngx_uint_t total_score;           /* 动态信誉累计分 */
   ngx_uint_t final_status;          /* 最终 HTTP 状态（若有） */
@@ -55,8 +101,60 @@ typedef struct ngx_http_waf_ctx_s {
   unsigned decisive_set : 1;        /* 是否已设置decisive事件（同一请求最多一个） */
   /* 客户端IP（用于动态封禁、日志记录，网络字节序uint32_t） */
   ngx_uint_t client_ip;
+  /* 客户端地址（IPv4/IPv6，用于 CLIENT_IP 阶段 CIDR 索引查询） */
+  waf_ip_addr_t client_addr;
   /* 请求级时间快照（毫秒），用于统一本请求内的计时语义 */
   ngx_msec_t request_now_msec;
+  /* 请求级 query 参数表（ngx_array_t(waf_arg_t)），首个 ARGS 规则时解析，NULL 表示尚未解析 */
+  ngx_array_t *args;
+  waf_args_stats_t args_stats;      /* 与 args 同时统计的结构性度量 */
+  /* 请求级 ARGS_COMBINED 视图（整串 +→空格 与 %XX 解码），首次使用时计算 */
+  ngx_str_t args_combined;
+  unsigned args_combined_ready : 1; /* 是否已计算 */
+  unsigned args_combined_ok : 1;    /* 解码成功 */
+  /* 检测限额：检测视图被 waf_inspect_limit 截断的 target 位（WAF_TARGET_BIT，HEADER 见 header_clipped） */
+  ngx_uint_t limit_clipped;
+  ngx_uint_t limit_reported;        /* 已上报的 WAF_LIMIT_* 位 */
+  /* 请求级变换缓存：ngx_array_t(waf_variant_t)，首个声明 transform 的规则时创建 */
+  ngx_array_t *variants;
+  /* 请求级请求体缓存：首个 BODY 规则时收集/解码一次，之后全部 BODY 规则共享 */
+  ngx_str_t body_raw;               /* 原始请求体（连续、只读：可能直接引用缓冲或 mmap 临时文件） */
+  ngx_str_t body_view;              /* 检测视图：form-urlencoded 为解码结果，否则同 body_raw */
+  unsigned body_collected : 1;      /* 是否已尝试收集 */
+  unsigned body_available : 1;      /* 收集成功且视图可用 */
+  /* 请求级请求头取值表（按快照 header_slots 下标），首个 HEADER 规则时构建，NULL 表示尚未构建 */
+  ngx_str_t *headers;
+  u_char *header_clipped;           /* 与 headers 同下标：该头的检测视图已被截断 */
+  /* 请求级特殊字节位图（字节类预筛）：按 target 下标首次使用时扫描一次，ready 为已扫描位掩码 */
+  waf_byteset_t target_bytes[8];
+  ngx_uint_t target_bytes_ready;
+  /* HEADER 按槽位各一份位图（与 headers 同下标），NULL 表示尚未分配 */
+  waf_byteset_t *header_bytes;
+  u_char *header_bytes_ready;
+  /* detect 段续跑位置：时间片让出时保存（target、桶内规则下标、该桶的预扫描命中表） */
+  ngx_uint_t detect_target;
+  ngx_uint_t detect_rule;
+  u_char *detect_contains_hits;
+  u_char *detect_regex_hits;
+  unsigned detect_structural_done : 1; /* COUNT/LENGTH 预评估已完成 */
+  unsigned detect_ev_ready : 1;        /* detect_ev 已初始化并登记 pool cleanup */
+  unsigned detect_yielded : 1;         /* 已让出、续跑事件待触发（期间写事件处理器为空处理器） */
+  ngx_event_t detect_ev;               /* 续跑事件（投递到下一轮事件循环） */
+  /*
+   * BODY 规则预先算出的结果（线程池卸载或流式检测，按 BODY 桶下标）：
+   * negate 前的命中（WAF_BODY_APPLIED 表示流式阶段已处置）/ 触达的 WAF_LIMIT_* 位；NULL 表示就地检测
+   */
+  u_char *body_matched;
+  u_char *body_limits;
+  /* BODY 预筛结果（流式检测或缓冲链预扫描，按 BODY 桶下标）：CONTAINS / 因子命中，NULL 表示无 */
+  u_char *body_contains_hits;
+  u_char *body_regex_hits;
+  unsigned body_view_needed : 1;   /* 预扫描后仍有规则需要完整检测视图（EXACT 或通过预筛的 REGEX） */
+  unsigned body_offload_tried : 1; /* 已判定是否卸载（每请求一次） */
+  unsigned body_offload_busy : 1;  /* 任务执行中（期间忽略写事件） */
+  /* 流式请求体检测状态（请求体过滤器中逐块推进），NULL 表示未启用 */
+  struct waf_body_stream_s *body_stream;
+  unsigned body_stream_done : 1; /* 请求体已读完，结果已写入 body_matched */
 
 } ngx_http_waf_ctx_t;
 
@@ -107,6 +205,12 @@ void waf_log_append_ban_event(ngx_http_request_t *r, ngx_http_waf_main_conf_t *m
                               ngx_http_waf_ctx_t *ctx, ngx_msec_t window,
                               waf_log_collect_mode_e collect_mode, waf_log_level_e level);
 
+/* 记录检测限额事件（limit："inspectBytes" | "pcre"；verdict："open" | "closed"） */
+void waf_log_append_limit_event(ngx_http_request_t *r, ngx_http_waf_main_conf_t *mcf,
+                                ngx_http_waf_ctx_t *ctx, const char *limit, ngx_uint_t rule_id,
+                                const char *target_tag, const char *verdict,
+                                waf_log_collect_mode_e collect_mode, waf_log_level_e level);
+
 /* 完整性接口：一定附加事件并提升 effective_level */
 void waf_log_append_event_complete(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
                                    waf_log_level_e level);
@@ -123,6 +227,18 @@ void waf_log_flush_final(ngx_http_request_t *r, ngx_http_waf_main_conf_t *mcf,
                          ngx_http_waf_loc_conf_t *lcf, ngx_http_waf_ctx_t *ctx,
                          const char *final_action_hint /* "BLOCK"|"BYPASS"|"ALLOW"|NULL */);
 
+/* waf_json_log buffer=：配置期创建每 worker 写缓冲并挂到 json_log_of（可重复调用） */
+char *waf_log_buffer_init(ngx_conf_t *cf, ngx_http_waf_main_conf_t *mcf);
+
+/* worker 退出：落盘写缓冲中残留的整行 */
+void waf_log_exit_process(ngx_cycle_t *cycle);
+
+/*
+ * JSON 字符串内容转义（不含引号），返回写入末尾；p 至少需 len * 6 字节。
+ * 输出与 yyjson 默认写出一致，非法 UTF-8 字节替换为 \ufffd
+ */
+u_char *waf_log_json_escape(u_char *p, const u_char *s, size_t len);
+
 #ifdef __cplusplus
 }
 #endif
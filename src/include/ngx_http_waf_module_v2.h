@@ -4,6 +4,8 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#include "ngx_http_waf_types.h"
+
 /*
  * v2 公共头文件入口
  * - 仅放置对外可见的最小类型/结构/函数声明
@@ -45,9 +47,22 @@ typedef struct yyjson_mut_doc yyjson_mut_doc;
  * - 0 表示不限制深度（仍执行环检测）
  * - >0 表示包含根在内的最大递归层级
  */
+/*
+ * files：可为 NULL；非空时按读取顺序追加入口及全部 extends 文件的绝对路径（ngx_str_t）
+ */
 yyjson_doc *ngx_http_waf_json_load_and_merge(ngx_pool_t *pool, ngx_log_t *log,
                                              const ngx_str_t *base_dir, const ngx_str_t *entry_path,
-                                             ngx_uint_t max_depth, ngx_http_waf_json_error_t *err);
+                                             ngx_uint_t max_depth, ngx_array_t *files,
+                                             ngx_http_waf_json_error_t *err);
+
+/* 解析入口文件绝对路径（与 load_and_merge 的解析规则一致，不读取文件） */
+ngx_int_t ngx_http_waf_json_resolve_entry(ngx_pool_t *pool, ngx_log_t *log,
+                                          const ngx_str_t *base_dir, const ngx_str_t *entry_path,
+                                          ngx_str_t *out_abs);
+
+/* 对文件列表（路径 + 内容）计算 64 位指纹，用于判定规则输入是否一致 */
+ngx_int_t ngx_http_waf_json_fingerprint(ngx_pool_t *pool, ngx_log_t *log, ngx_array_t *files,
+                                        uint64_t *out);
 
 /* 常用工具（骨架） */
 /* 将相对路径按 base_dir 解析为绝对路径；结果分配在 pool */
@@ -57,6 +72,23 @@ ngx_int_t ngx_http_waf_join_path(ngx_pool_t *pool, const ngx_str_t *base_dir, co
 /* 提取路径的目录部分（不包含末尾文件名），结果分配在 pool */
 ngx_int_t ngx_http_waf_dirname(ngx_pool_t *pool, const ngx_str_t *path, ngx_str_t *out_dir);
 
+/*
+ * 快照缓存条目：键为 (入口绝对路径, extends 深度, 入口及 extends 文件内容指纹)，
+ * 键相同的 location 共享同一份合并文档与编译快照
+ */
+typedef struct {
+  ngx_str_t path;     /* 解析后的入口绝对路径 */
+  ngx_uint_t depth;   /* json_extends_max_depth */
+  uint64_t hash;      /* ngx_http_waf_json_fingerprint 结果 */
+  ngx_array_t *files; /* ngx_str_t：加载时实际读取的文件 */
+  yyjson_doc *doc;
+  struct waf_compiled_snapshot_s *snapshot;
+  ngx_pool_t *pool;   /* 快照专用 pool（随 cf->pool 清理销毁） */
+  size_t mem;         /* 快照 pool 已用字节（小块） */
+  ngx_uint_t large;   /* 快照 pool 大块分配数 */
+  ngx_uint_t refs;    /* 引用该快照的 location 数 */
+} waf_snapshot_cache_entry_t;
+
 /* v2 main conf（Nginx 指令承载处） */
 typedef struct {
   /* 0 表示不限；>0 表示包含根在内的最大 extends 深度 */
@@ -68,6 +100,15 @@ typedef struct {
   ngx_uint_t json_log_level; /* debug|info|alert|error|off */
   /* 由 master 在启动/USR1 时统一打开，worker 复用 fd（通过 cycle->open_files） */
   ngx_open_file_t *json_log_of;
+  /* 每 worker 写缓冲（waf_json_log ... buffer=<size> [flush=<time>]），0 表示逐行直写 */
+  size_t json_log_buffer;
+  ngx_msec_t json_log_flush; /* 缓冲最长滞留时间，0 表示不设定时器 */
+  /* 线程池写盘（threads=<pool> [queue=<n>] [overflow=drop|block]），需同时配置 buffer= */
+#if (NGX_THREADS)
+  ngx_thread_pool_t *json_log_thread_pool; /* NULL=事件循环内同步写 */
+#endif
+  ngx_uint_t json_log_threads_queue;  /* 在途批次上限（默认4） */
+  ngx_flag_t json_log_overflow_block; /* 队列满：0=丢弃新行并计数，1=同步写（阻塞事件循环） */
   /* 动态信誉共享内存（M2.5：创建 zone；M5：执法） */
   ngx_str_t shm_zone_raw;   /* 兼容保留：若通过字符串配置 */
   ngx_shm_zone_t *shm_zone; /* 共享内存区句柄（M2.5 初始化） */
@@ -79,10 +120,24 @@ typedef struct {
   ngx_msec_t dyn_block_duration;  /* 封禁时长（毫秒，默认1800000=30分钟） */
   /* M5全局运维指令（MAIN级，不继承） */
   ngx_flag_t trust_xff;                /* waf_trust_xff on|off（默认off） */
+  /* 配置周期级正则驻留缓存（首个编译规则的 location 创建，随 cf->pool 回收） */
+  struct waf_regex_cache_s *regex_cache;
+  /* 配置周期级快照缓存：ngx_array_t(waf_snapshot_cache_entry_t)；首次编译时创建 */
+  ngx_array_t *snapshot_cache;
+  ngx_uint_t snapshot_locations; /* 挂载快照的 location 数（含复用） */
 } ngx_http_waf_main_conf_t;
 
+struct ngx_http_waf_loc_conf_s;
+
+/* 与请求体无关的流水线阶段（ip_allow/ip_deny/reputation_base_add/uri_allow） */
+typedef waf_rc_e (*ngx_http_waf_stage_pt)(ngx_http_request_t *r, ngx_http_waf_main_conf_t *mcf,
+                                          struct ngx_http_waf_loc_conf_s *lcf,
+                                          ngx_http_waf_ctx_t *ctx);
+
+#define WAF_STAGE_MAX 4
+
 /* v2 loc conf（可在 http/server/location 级配置与继承） */
-typedef struct {
+typedef struct ngx_http_waf_loc_conf_s {
   /* 0 表示不限；>0 表示包含根在内的最大 extends 深度；未设置时为
    * NGX_CONF_UNSET_UINT */
   ngx_uint_t json_extends_max_depth;
@@ -96,10 +151,49 @@ typedef struct {
   /* 编译期只读快照（M2 完成后填充）；允许为空 */
   struct waf_compiled_snapshot_s *compiled;
 
+  /* 快照缓存条目（多个 location 可指向同一条目）；允许为空 */
+  waf_snapshot_cache_entry_t *snapshot_entry;
+
   /* M5运维指令（HTTP/SRV/LOC，可继承） */
   ngx_flag_t waf_enable;       /* waf on|off（默认on） */
   ngx_flag_t dyn_block_enable; /* waf_dynamic_block_enable on|off（默认off，方案C） */
   waf_default_action_e default_action; /* waf_default_action BLOCK|LOG（默认BLOCK） */
+
+  /* 检测限额（HTTP/SRV/LOC，可继承） */
+  size_t inspect_limit;     /* waf_inspect_limit：每个 target 最多检测的字节数（默认0=不限） */
+  size_t inspect_body_tail; /* waf_inspect_body_tail：BODY 超限时保留的尾部字节数（默认0=只取头部） */
+  ngx_uint_t pcre_match_limit; /* waf_pcre_match_limit（默认0=PCRE 默认值） */
+  ngx_uint_t pcre_depth_limit; /* waf_pcre_depth_limit（默认0=PCRE 默认值） */
+  ngx_uint_t limit_verdict;    /* waf_limit_verdict open|closed（waf_limit_verdict_e，默认open） */
+
+  /* detect 段时间片：任一预算用尽即让出事件循环，下一轮从断点续跑（均为0=不切片） */
+  ngx_msec_t detect_slice_time; /* waf_detect_slice_time：单片最长耗时 */
+  size_t detect_slice_bytes;    /* waf_detect_slice_bytes：单片最多检测的字节数 */
+
+  /* BODY 规则线程池卸载（waf_detect_thread_pool <name>|off [min_body=<size>]） */
+#if (NGX_THREADS)
+  ngx_thread_pool_t *detect_thread_pool; /* NULL=不卸载 */
+#endif
+  size_t detect_thread_min_body; /* 检测视图达到该字节数才卸载（默认1m） */
+
+  /* 流式请求体检测：边读边测，命中即拦截，无需整体拼接请求体 */
+  ngx_flag_t body_stream;    /* waf_body_stream on|off（默认off） */
+  size_t body_stream_window; /* waf_body_stream_window：REGEX 跨块重叠窗口（默认4k） */
+
+  /*
+   * 阶段计划（merge 时按快照与开关编排，见 ngx_http_waf_build_stage_plan）：
+   * stages 仅含有规则/已启用的阶段，detect_targets 为 detect 段需要的 target 位（WAF_TARGET_BIT）；
+   * 两者皆空时 access handler 不分配 ctx 直接放行
+   */
+  ngx_http_waf_stage_pt stages[WAF_STAGE_MAX];
+  ngx_uint_t stage_count;
+  ngx_uint_t detect_targets;
 } ngx_http_waf_loc_conf_t;
 
+/* 按合并后的配置与快照编排 location 的阶段计划（merge_loc_conf 末尾调用） */
+void ngx_http_waf_build_stage_plan(ngx_http_waf_loc_conf_t *lcf);
+
+/* 输出快照缓存统计（唯一快照数、挂载 location 数、内存） */
+void ngx_http_waf_snapshot_report(ngx_conf_t *cf);
+
 #endif /* NGX_HTTP_WAF_MODULE_V2_H */
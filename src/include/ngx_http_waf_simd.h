@@ -0,0 +1,69 @@
+#ifndef NGX_HTTP_WAF_SIMD_H
+#define NGX_HTTP_WAF_SIMD_H
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+/*
+ * ================================================================
+ *  字符串匹配内核（SIMD + 运行期 CPU 派发）
+ *  - x86：按 CPU 特性选择 AVX2 / SSE4.2 实现，其余平台与旧 CPU 使用标量实现
+ *  - contains：以 needle 首/尾字节批量筛选候选位置，再逐字节校验
+ *  - caseless：向量内对 'A'..'Z' 做 OR 0x20 折叠，与 ngx_tolower 语义一致（仅 ASCII）
+ * ================================================================
+ */
+
+/* 256 位字节集合：bit b 置位表示字节 b 出现 */
+typedef struct {
+  uint64_t w[4];
+} waf_byteset_t;
+
+#define waf_byteset_add(set, b) ((set)->w[(u_char)(b) >> 6] |= (uint64_t)1 << ((u_char)(b) & 63))
+
+/* req 中的字节是否全部出现在 have 中 */
+static ngx_inline ngx_uint_t waf_byteset_covers(const waf_byteset_t *have, const waf_byteset_t *req)
+{
+  return ((req->w[0] & ~have->w[0]) | (req->w[1] & ~have->w[1]) | (req->w[2] & ~have->w[2]) |
+          (req->w[3] & ~have->w[3])) == 0;
+}
+
+static ngx_inline ngx_uint_t waf_byteset_empty(const waf_byteset_t *set)
+{
+  return (set->w[0] | set->w[1] | set->w[2] | set->w[3]) == 0;
+}
+
+/* 探测 CPU 特性并选定内核（配置期调用一次；未调用时使用标量实现） */
+void waf_simd_init(ngx_log_t *log);
+
+/* 当前选定的内核名称："avx2" | "sse4.2" | "scalar" */
+const char *waf_simd_kernel_name(void);
+
+/* hay 中是否包含 needle（needle 为空视为命中） */
+ngx_uint_t waf_simd_contains(const u_char *hay, size_t hay_len, const u_char *needle,
+                             size_t needle_len, ngx_flag_t caseless);
+
+/* 等长两段内存是否相等 */
+ngx_uint_t waf_simd_equals(const u_char *a, const u_char *b, size_t len, ngx_flag_t caseless);
+
+/*
+ * 将 data 中出现的非字母数字字节（[0-9A-Za-z] 以外）并入 set
+ * - 仅记录特殊字节：字母数字几乎总会出现，对预筛没有区分度
+ * - 向量实现按块判定，纯字母数字块整体跳过
+ */
+void waf_simd_byteset(const u_char *data, size_t len, waf_byteset_t *set);
+
+/* data 中首个等于 a 或 b 的字节偏移；均未出现返回 len */
+size_t waf_simd_find2(const u_char *data, size_t len, u_char a, u_char b);
+
+/*
+ * 单遍 URL 解码（%XX；plus 为真时 '+' 转空格），返回输出长度（不超过 len）
+ * - 无转义的片段以 find2 定位后整段搬移；dst 可与 src 相同（原地解码）
+ * - 非法/截断的 '%' 序列与 ngx_unescape_uri(type=0) 处理一致
+ * - consumed 为 NULL：src 为完整输入，末尾截断的 "%" / "%X" 丢弃；
+ *   非 NULL：src 为分块输入的一段，在末尾截断的转义前停止并写回已消费的字节数，
+ *   剩余字节（至多 2 个）与下一块拼接后继续解码，结果与整体解码逐字节一致
+ */
+size_t waf_simd_url_decode(u_char *dst, const u_char *src, size_t len, ngx_flag_t plus,
+                           size_t *consumed);
+
+#endif /* NGX_HTTP_WAF_SIMD_H */
@@ -0,0 +1,32 @@
+#ifndef NGX_HTTP_WAF_STRSET_H
+#define NGX_HTTP_WAF_STRSET_H
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+/*
+ * ================================================================
+ *  EXACT 字符串集合（编译期构建、运行期只读）
+ *  - 开放寻址（线性探测），容量为 2 的幂且装载因子 <= 0.5
+ *  - caseless 集合在哈希与比较时均按 ASCII 折叠，查询时无需拷贝/转小写
+ *  - 元素指向调用方提供的字符串（通常为规则 patterns，生命周期与 pool 相同）
+ * ================================================================
+ */
+
+typedef struct {
+  ngx_str_t *slots;    /* 容量 mask + 1；data == NULL 表示空槽 */
+  ngx_uint_t mask;     /* 容量 - 1 */
+  ngx_uint_t nelts;    /* 去重后的元素个数 */
+  ngx_flag_t caseless; /* 是否大小写不敏感 */
+} waf_strset_t;
+
+/*
+ * 构建集合（配置期调用，结果分配在 pool）
+ * 返回：成功返回集合；strs 为空或失败返回 NULL
+ */
+waf_strset_t *waf_strset_create(ngx_pool_t *pool, const ngx_array_t *strs, ngx_flag_t caseless);
+
+/* 查询 subject 是否为集合元素（O(1) 期望） */
+ngx_uint_t waf_strset_contains(const waf_strset_t *set, const ngx_str_t *subject);
+
+#endif /* NGX_HTTP_WAF_STRSET_H */
@@ -18,6 +18,40 @@ typedef enum { WAF_FINAL_NONE = 0,
                WAF_FINAL_BLOCK = 1,
                WAF_FINAL_BYPASS = 2 } waf_final_action_e;
 
+/*
+ * 目标变换（规则 transform 字段，按位组合）
+ * 运行期按固定顺序应用：URL 解码（1 或 2 次）→ 路径归一 → 空白压缩 → 小写
+ */
+#define WAF_TF_URL_DECODE 0x01     /* urlDecode：在默认检测视图上再做一次 %XX 解码 */
+#define WAF_TF_DOUBLE_DECODE 0x02  /* doubleDecode：连续两次 %XX 解码 */
+#define WAF_TF_NORMALIZE_PATH 0x04 /* normalizePath：'\\'→'/'、合并 '//'、消解 '.'/'..' 段 */
+#define WAF_TF_COMPRESS_WS 0x08    /* compressWhitespace：连续空白压缩为单个空格 */
+#define WAF_TF_LOWERCASE 0x10      /* lowercase：ASCII 小写折叠 */
+
+/* 检测限额触达种类（按位）：由 detect/uri_allow 按规则处置，只归属检测对象被截断或触达限额的规则 */
+#define WAF_LIMIT_INSPECT 0x01 /* 检测字节数超限：仅检测了窗口内的部分 */
+#define WAF_LIMIT_PCRE 0x02    /* PCRE match/depth limit 触达：该正则按未命中处理 */
+
+/*
+ * ctx->body_matched 取值（0/1 为 negate 前的命中）：
+ * - APPLIED：流式检测阶段已提前处置的规则（detect 续跑时跳过）
+ * - DEFERRED：不能在流式窗口上判定的 REGEX，detect 续跑时在完整检测视图上匹配
+ */
+#define WAF_BODY_APPLIED 2
+#define WAF_BODY_DEFERRED 3
+
+/* 限额触达时的处置（waf_limit_verdict） */
+typedef enum {
+  WAF_LIMIT_VERDICT_OPEN = 0, /* fail-open：按已检测部分的结果继续，仅记录事件 */
+  WAF_LIMIT_VERDICT_CLOSED    /* fail-closed：记录事件并拦截 */
+} waf_limit_verdict_e;
+
+/* 参数表结构性度量：解析 query 时一并统计（按解码前原始字节），供 LENGTH 规则 O(1) 比较 */
+typedef struct {
+  size_t name_max;  /* 最长参数名 */
+  size_t value_max; /* 最长参数值 */
+} waf_args_stats_t;
+
 /* 前置声明 ctx（实际定义在日志模块头中） */
 struct ngx_http_waf_ctx_s;
 typedef struct ngx_http_waf_ctx_s ngx_http_waf_ctx_t;
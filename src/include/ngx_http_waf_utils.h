@@ -13,6 +13,11 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#include "ngx_http_waf_ac.h"
+#include "ngx_http_waf_ipindex.h"
+#include "ngx_http_waf_strset.h"
+#include "ngx_http_waf_types.h"
+
 /*
  * 获取客户端IP地址（网络字节序的uint32_t）
  *
@@ -27,6 +32,15 @@
  */
 ngx_uint_t waf_utils_get_client_ip(ngx_http_request_t *r, ngx_flag_t trust_xff);
 
+/*
+ * 获取客户端地址（IPv4/IPv6，网络字节序），来源优先级同 waf_utils_get_client_ip
+ *
+ * 行为：
+ *  - IPv4-mapped IPv6 地址归一为 IPv4
+ *  - 无法获取时 out->family = 0
+ */
+void waf_utils_get_client_addr(ngx_http_request_t *r, ngx_flag_t trust_xff, waf_ip_addr_t *out);
+
 /*
  * 将uint32_t IP（网络字节序）转换为点分十进制字符串
  *
@@ -85,9 +99,18 @@ ngx_uint_t ngx_http_waf_equals_ci(const ngx_str_t *a, const ngx_str_t *b, ngx_fl
 /* 获取解码后的完整 query 字符串（使用 r->pool 分配） */
 ngx_int_t ngx_http_waf_get_decoded_args_combined(ngx_http_request_t *r, ngx_str_t *out);
 
-/* 收集请求体为连续内存（支持内存缓冲与临时文件） */
+/*
+ * 收集请求体为连续内存（支持内存缓冲与临时文件）
+ * 单个内存缓冲直接引用、整体在临时文件时只读 mmap，均不复制；结果只读，不保证以 '\0' 结尾
+ */
 ngx_int_t ngx_http_waf_collect_request_body(ngx_http_request_t *r, ngx_str_t *body_str);
 
+/*
+ * 只读映射文件区间 [offset, offset+size)（起点按页对齐），映射随 pool 释放
+ * 返回：区间首字节；失败返回 NULL（已记录日志，调用方可回退为 ngx_read_file）
+ */
+u_char *ngx_http_waf_map_file(ngx_pool_t *pool, ngx_file_t *file, off_t offset, size_t size);
+
 /* 对 application/x-www-form-urlencoded 进行 URL 解码 */
 ngx_int_t ngx_http_waf_decode_form_urlencoded(ngx_pool_t *pool, const ngx_str_t *in,
                                               ngx_str_t *out);
@@ -101,16 +124,67 @@ ngx_uint_t ngx_http_waf_get_header(ngx_http_request_t *r, const ngx_str_t *name,
  * ================================================================
  */
 
-/* 遍历 query args，按 name/value 精确匹配（大小写可选）；使用请求级内存池 */
-ngx_uint_t ngx_http_waf_args_iter_exact(const ngx_str_t *args, ngx_flag_t match_name,
-                                        ngx_flag_t caseless, ngx_array_t *patterns,
-                                        ngx_pool_t *pool);
+/* 单个 query 参数（已 +→空格 与 %XX 解码；片段不含 '%'/'+' 时零拷贝指向原 args 缓冲） */
+typedef struct {
+  ngx_str_t name;
+  ngx_str_t value;
+  unsigned has_value : 1; /* 是否带 '='（不带的参数不参与 ARGS_VALUE 匹配） */
+} waf_arg_t;
+
+/*
+ * 一次性解析 query 为参数表 ngx_array_t(waf_arg_t)，供整个请求的 ARGS 规则共享
+ * stats 非 NULL 时同时统计最长参数名/值（参数个数即参数表 nelts）
+ */
+ngx_int_t ngx_http_waf_parse_args(ngx_pool_t *pool, const ngx_str_t *args, ngx_array_t **out,
+                                  waf_args_stats_t *stats);
 
-/* 遍历 query args 进行模式匹配（contains/regex）；使用请求级内存池 */
-ngx_uint_t ngx_http_waf_args_iter_match(const ngx_str_t *args, ngx_flag_t match_name,
+/* 遍历参数表，按 name/value 精确匹配（EXACT 哈希集合） */
+ngx_uint_t ngx_http_waf_args_iter_exact(const ngx_array_t *args, ngx_flag_t match_name,
+                                        const waf_strset_t *set);
+
+/*
+ * 正则执行状态（PCRE2 match context + match data）
+ * - 事件循环线程共用模块内的每 worker 实例；线程池任务须各自创建，不可共享
+ */
+typedef struct waf_regex_exec_s waf_regex_exec_t;
+
+/* 在 pool 上创建执行状态（PCRE2 资源随 pool 销毁释放）；失败返回 NULL */
+waf_regex_exec_t *ngx_http_waf_regex_exec_create(ngx_pool_t *pool);
+
+/* 正则执行限额（字段为 0 表示不限/使用 PCRE 默认值） */
+typedef struct {
+  ngx_uint_t match_limit; /* PCRE match limit */
+  ngx_uint_t depth_limit; /* PCRE depth（PCRE1 为 recursion）limit */
+  size_t max_bytes;       /* 单次匹配最多检测的 subject 字节数（取头部） */
+  waf_regex_exec_t *exec; /* 执行状态；NULL 使用每 worker 实例（仅限事件循环线程） */
+} waf_regex_limits_t;
+
+/* 遍历参数表进行模式匹配（contains/regex；regex 的 lim/limit_hit 语义同 ngx_http_waf_regex_any_match） */
+ngx_uint_t ngx_http_waf_args_iter_match(const ngx_array_t *args, ngx_flag_t match_name,
                                         ngx_flag_t caseless, ngx_array_t *patterns,
                                         ngx_array_t *regexes, ngx_flag_t is_regex,
-                                        ngx_pool_t *pool);
+                                        const waf_regex_limits_t *lim, ngx_uint_t *limit_hit);
+
+/* 遍历参数表，对每个 name/value 做一次 AC 扫描并置位 hits */
+void ngx_http_waf_args_iter_ac(const ngx_array_t *args, ngx_flag_t match_name, const waf_ac_t *ac,
+                               u_char *hits);
+
+/*
+ * ================================================================
+ *  目标变换工具
+ * ================================================================
+ */
+
+/*
+ * 按 WAF_TF_* 组合变换 in（顺序见 ngx_http_waf_types.h），结果写入 out
+ * - 无需改动时零拷贝返回 in；否则分配于 pool
+ */
+ngx_int_t ngx_http_waf_transform(ngx_pool_t *pool, ngx_uint_t transform, const ngx_str_t *in,
+                                 ngx_str_t *out);
+
+/* 对参数表的 name/value 逐一变换，生成新参数表 ngx_array_t(waf_arg_t) */
+ngx_int_t ngx_http_waf_transform_args(ngx_pool_t *pool, ngx_uint_t transform,
+                                      const ngx_array_t *in, ngx_array_t **out);
 
 /*
  * ================================================================
@@ -118,7 +192,12 @@ ngx_uint_t ngx_http_waf_args_iter_match(const ngx_str_t *args, ngx_flag_t match_
  * ================================================================
  */
 
-/* REGEX 任意命中（数组中任一正则匹配即返回1） */
-ngx_uint_t ngx_http_waf_regex_any_match(ngx_array_t *regexes, const ngx_str_t *subject);
+/*
+ * REGEX 任意命中（数组中任一正则匹配即返回1）
+ * - lim 非 NULL 时按限额执行：PCRE 限额经每 worker 复用的 match context 生效
+ * - 未命中且结果受限额影响（subject 被截断 / PCRE 限额触达）时，对应 WAF_LIMIT_* 位或入 *limit_hit
+ */
+ngx_uint_t ngx_http_waf_regex_any_match(ngx_array_t *regexes, const ngx_str_t *subject,
+                                        const waf_regex_limits_t *lim, ngx_uint_t *limit_hit);
 
 #endif /* NGX_HTTP_WAF_UTILS_H */
@@ -75,6 +75,7 @@ typedef struct {
   ngx_array_t *stack; /* 环检测：元素类型 ngx_str_t */
   ngx_str_t jsons_root;
   yyjson_mut_doc *out_doc;
+  ngx_array_t *files; /* 可为 NULL；记录实际读取的文件绝对路径（ngx_str_t） */
 } waf_merge_ctx_t;
 
 /* ------------------------ 工具函数 ------------------------ */
@@ -741,7 +742,9 @@ static ngx_int_t waf_match_validate(const char *s, size_t len)
   return (ngx_strncmp(s, "CONTAINS", len) == 0 && len == ngx_strlen("CONTAINS")) ||
          (ngx_strncmp(s, "EXACT", len) == 0 && len == ngx_strlen("EXACT")) ||
          (ngx_strncmp(s, "REGEX", len) == 0 && len == ngx_strlen("REGEX")) ||
-         (ngx_strncmp(s, "CIDR", len) == 0 && len == ngx_strlen("CIDR"));
+         (ngx_strncmp(s, "CIDR", len) == 0 && len == ngx_strlen("CIDR")) ||
+         (ngx_strncmp(s, "COUNT", len) == 0 && len == ngx_strlen("COUNT")) ||
+         (ngx_strncmp(s, "LENGTH", len) == 0 && len == ngx_strlen("LENGTH"));
 }
 
 /*
@@ -767,6 +770,20 @@ static ngx_int_t waf_phase_validate(const char *s, size_t len)
          (ngx_strncmp(s, "detect", len) == 0 && len == ngx_strlen("detect"));
 }
 
+/*
+ * 函数: waf_transform_validate
+ * 作用: 校验 transform 单项取值是否合法
+ */
+static ngx_int_t waf_transform_validate(const char *s, size_t len)
+{
+  return (ngx_strncmp(s, "urlDecode", len) == 0 && len == ngx_strlen("urlDecode")) ||
+         (ngx_strncmp(s, "doubleDecode", len) == 0 && len == ngx_strlen("doubleDecode")) ||
+         (ngx_strncmp(s, "normalizePath", len) == 0 && len == ngx_strlen("normalizePath")) ||
+         (ngx_strncmp(s, "compressWhitespace", len) == 0 &&
+          len == ngx_strlen("compressWhitespace")) ||
+         (ngx_strncmp(s, "lowercase", len) == 0 && len == ngx_strlen("lowercase"));
+}
+
 /*
  * 函数: waf_copy_tags_array
  * 作用: 复制并校验 tags 字段（必须为字符串数组）
@@ -891,7 +908,8 @@ static ngx_int_t waf_validate_additional_properties(waf_merge_ctx_t *ctx, yyjson
 {
   static const char *allowed[] = {"id", "tags", "phase", "target",
                                   "headerName", "match", "pattern", "caseless",
-                                  "negate", "action", "score", "priority"};
+                                  "negate", "action", "score", "priority", "transform",
+                                  "inspectLimit"};
   size_t allow_count = sizeof(allowed) / sizeof(allowed[0]);
 
   yyjson_obj_iter it = yyjson_obj_iter_with(rule);
@@ -1039,11 +1057,37 @@ static ngx_int_t waf_parse_rule(waf_merge_ctx_t *ctx, yyjson_val *src_rule, waf_
     return waf_json_set_error(ctx, file, base_pointer, "caseless 必须为布尔值");
   }
 
+  /* transform：字符串或字符串数组，取值见 waf_transform_validate */
+  yyjson_val *transform_node = yyjson_obj_get(src_rule, "transform");
+  if (transform_node) {
+    if (yyjson_is_str(transform_node)) {
+      if (!waf_transform_validate(yyjson_get_str(transform_node), yyjson_get_len(transform_node))) {
+        return waf_json_set_error(ctx, file, base_pointer, "transform 取值非法");
+      }
+    } else if (yyjson_is_arr(transform_node)) {
+      size_t idx, max;
+      yyjson_val *it;
+      yyjson_arr_foreach(transform_node, idx, max, it)
+      {
+        if (!yyjson_is_str(it) || !waf_transform_validate(yyjson_get_str(it), yyjson_get_len(it))) {
+          return waf_json_set_error(ctx, file, base_pointer, "transform 数组元素取值非法");
+        }
+      }
+    } else {
+      return waf_json_set_error(ctx, file, base_pointer, "transform 必须为字符串或字符串数组");
+    }
+  }
+
   yyjson_val *negate_node = yyjson_obj_get(src_rule, "negate");
   if (negate_node && !yyjson_is_bool(negate_node)) {
     return waf_json_set_error(ctx, file, base_pointer, "negate 必须为布尔值");
   }
 
+  yyjson_val *inspect_node = yyjson_obj_get(src_rule, "inspectLimit");
+  if (inspect_node && !yyjson_is_uint(inspect_node)) {
+    return waf_json_set_error(ctx, file, base_pointer, "inspectLimit 必须为非负整数");
+  }
+
   yyjson_val *score_node = yyjson_obj_get(src_rule, "score");
   if (score_node && !yyjson_is_num(score_node)) {
     return waf_json_set_error(ctx, file, base_pointer, "score 必须为数字");
@@ -1149,6 +1193,14 @@ static ngx_int_t waf_parse_rule(waf_merge_ctx_t *ctx, yyjson_val *src_rule, waf_
     }
   }
 
+  if (transform_node) {
+    yyjson_mut_val *k = yyjson_mut_str(ctx->out_doc, "transform");
+    yyjson_mut_val *v = yyjson_val_mut_copy(ctx->out_doc, transform_node);
+    if (!k || !v || !yyjson_mut_obj_add(rule_mut, k, v)) {
+      return waf_json_set_error(ctx, file, base_pointer, "写入 transform 失败");
+    }
+  }
+
   if (negate_node) {
     yyjson_mut_val *k = yyjson_mut_str(ctx->out_doc, "negate");
     yyjson_mut_val *v = yyjson_is_true(negate_node) ? yyjson_mut_true(ctx->out_doc)
@@ -1158,6 +1210,14 @@ static ngx_int_t waf_parse_rule(waf_merge_ctx_t *ctx, yyjson_val *src_rule, waf_
     }
   }
 
+  if (inspect_node) {
+    yyjson_mut_val *k = yyjson_mut_str(ctx->out_doc, "inspectLimit");
+    yyjson_mut_val *v = yyjson_mut_uint(ctx->out_doc, yyjson_get_uint(inspect_node));
+    if (!k || !v || !yyjson_mut_obj_add(rule_mut, k, v)) {
+      return waf_json_set_error(ctx, file, base_pointer, "写入 inspectLimit 失败");
+    }
+  }
+
   if (score_node) {
     yyjson_mut_val *k = yyjson_mut_str(ctx->out_doc, "score");
     yyjson_mut_val *v;
@@ -1573,6 +1633,16 @@ static ngx_int_t waf_collect_rules(waf_merge_ctx_t *ctx, const ngx_str_t *abs_pa
                               &reader_err.message);
   }
 
+  if (ctx->files) {
+    ngx_str_t *f = ngx_array_push(ctx->files);
+    if (f == NULL) {
+      yyjson_doc_free(doc);
+      ctx->stack->nelts--;
+      return waf_json_set_error(ctx, abs_path, NULL, "内存不足");
+    }
+    *f = *abs_path;
+  }
+
   yyjson_val *root = yyjson_doc_get_root(doc);
   if (!root || !yyjson_is_obj(root)) {
     yyjson_doc_free(doc);
@@ -1833,7 +1903,8 @@ static ngx_int_t waf_collect_rules(waf_merge_ctx_t *ctx, const ngx_str_t *abs_pa
  */
 yyjson_doc *ngx_http_waf_json_load_and_merge(ngx_pool_t *pool, ngx_log_t *log,
                                              const ngx_str_t *base_dir, const ngx_str_t *entry_path,
-                                             ngx_uint_t max_depth, ngx_http_waf_json_error_t *err)
+                                             ngx_uint_t max_depth, ngx_array_t *files,
+                                             ngx_http_waf_json_error_t *err)
 {
   if (pool == NULL || entry_path == NULL) {
     return NULL;
@@ -1845,6 +1916,7 @@ yyjson_doc *ngx_http_waf_json_load_and_merge(ngx_pool_t *pool, ngx_log_t *log,
   ctx.log = log;
   ctx.err = err;
   ctx.max_depth = max_depth;
+  ctx.files = files;
 
   if (base_dir) {
     ctx.jsons_root = *base_dir;
@@ -1941,3 +2013,73 @@ yyjson_doc *ngx_http_waf_json_load_and_merge(ngx_pool_t *pool, ngx_log_t *log,
   yyjson_mut_doc_free(ctx.out_doc);
   return final_doc;
 }
+
+/*
+ * 函数: ngx_http_waf_json_resolve_entry
+ * 作用: 按与 load_and_merge 相同的规则解析入口文件绝对路径（不读取文件）
+ */
+ngx_int_t ngx_http_waf_json_resolve_entry(ngx_pool_t *pool, ngx_log_t *log,
+                                          const ngx_str_t *base_dir, const ngx_str_t *entry_path,
+                                          ngx_str_t *out_abs)
+{
+  ngx_str_t root = {0, NULL};
+  if (base_dir) {
+    root = *base_dir;
+  }
+  return ngx_http_waf_resolve_path(pool, log, &root, base_dir, entry_path, out_abs, NULL);
+}
+
+/*
+ * 函数: ngx_http_waf_json_fingerprint
+ * 作用: 按顺序对文件路径与内容计算 64 位 FNV-1a 指纹（仅读取字节，不做 JSON 解析）
+ */
+ngx_int_t ngx_http_waf_json_fingerprint(ngx_pool_t *pool, ngx_log_t *log, ngx_array_t *files,
+                                        uint64_t *out)
+{
+  uint64_t h = 14695981039346656037ULL;
+  u_char buf[8192];
+
+  ngx_str_t *f = files ? files->elts : NULL;
+  ngx_uint_t n = files ? files->nelts : 0;
+  for (ngx_uint_t i = 0; i < n; i++) {
+    for (size_t k = 0; k < f[i].len; k++) {
+      h = (h ^ f[i].data[k]) * 1099511628211ULL;
+    }
+    h = (h ^ 0) * 1099511628211ULL;
+
+    u_char *path_c = ngx_pnalloc(pool, f[i].len + 1);
+    if (path_c == NULL) {
+      return NGX_ERROR;
+    }
+    ngx_memcpy(path_c, f[i].data, f[i].len);
+    path_c[f[i].len] = '\0';
+
+    ngx_fd_t fd = ngx_open_file(path_c, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+    if (fd == NGX_INVALID_FILE) {
+      if (log) {
+        ngx_log_error(NGX_LOG_ERR, log, ngx_errno, ngx_open_file_n " \"%V\" failed", &f[i]);
+      }
+      return NGX_ERROR;
+    }
+    for (;;) {
+      ssize_t r = ngx_read_fd(fd, buf, sizeof(buf));
+      if (r == -1) {
+        if (log) {
+          ngx_log_error(NGX_LOG_ERR, log, ngx_errno, ngx_read_fd_n " \"%V\" failed", &f[i]);
+        }
+        ngx_close_file(fd);
+        return NGX_ERROR;
+      }
+      if (r == 0) {
+        break;
+      }
+      for (ssize_t k = 0; k < r; k++) {
+        h = (h ^ buf[k]) * 1099511628211ULL;
+      }
+    }
+    ngx_close_file(fd);
+  }
+
+  *out = h;
+  return NGX_OK;
+}
@@ -21,11 +21,13 @@ static char *ngx_http_waf_set_shm_zone(ngx_conf_t *cf, ngx_command_t *cmd, void
 /* 自定义 setter：解析 waf_json_log_level debug|info|alert|error|off */
 static char *ngx_http_waf_set_json_log_level(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
-/* 自定义 setter：解析 waf_json_log 路径并展开为绝对路径 */
+/* 自定义 setter：解析 waf_json_log 路径（展开为绝对路径）与 buffer=/flush= */
 static char *ngx_http_waf_set_json_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
 /* 自定义 setter：解析 waf_default_action block|log，允许同级后者覆盖前者 */
 static char *ngx_http_waf_set_default_action(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_http_waf_set_limit_verdict(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_http_waf_set_detect_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
 /* 主配置 */
 void *ngx_http_waf_create_main_conf(ngx_conf_t *cf)
@@ -83,6 +85,218 @@ char *ngx_http_waf_init_main_conf(ngx_conf_t *cf, void *conf)
   return NGX_CONF_OK;
 }
 
+/* ------------------------ 快照缓存（配置周期级） ------------------------ */
+
+static void waf_snapshot_doc_cleanup(void *data)
+{
+  yyjson_doc_free(data);
+}
+
+static void waf_snapshot_pool_cleanup(void *data)
+{
+  ngx_destroy_pool(data);
+}
+
+/* 统计快照 pool 占用：小块按已用字节累加，大块仅计数（nginx 不记录其大小） */
+static void waf_snapshot_pool_usage(ngx_pool_t *pool, size_t *mem, ngx_uint_t *large)
+{
+  size_t bytes = 0;
+  ngx_uint_t n = 0;
+  for (ngx_pool_t *p = pool; p; p = p->d.next) {
+    bytes += (size_t)(p->d.last - (u_char *)p);
+  }
+  for (ngx_pool_large_t *l = pool->large; l; l = l->next) {
+    if (l->alloc)
+      n++;
+  }
+  *mem = bytes;
+  *large = n;
+}
+
+/* 查找路径与深度相同、且入口及 extends 文件内容指纹未变的缓存条目 */
+static waf_snapshot_cache_entry_t *waf_snapshot_cache_find(ngx_conf_t *cf,
+                                                           ngx_http_waf_main_conf_t *mcf,
+                                                           const ngx_str_t *abs, ngx_uint_t depth)
+{
+  if (mcf->snapshot_cache == NULL)
+    return NULL;
+
+  waf_snapshot_cache_entry_t *e = mcf->snapshot_cache->elts;
+  for (ngx_uint_t i = 0; i < mcf->snapshot_cache->nelts; i++) {
+    if (e[i].depth != depth || e[i].path.len != abs->len ||
+        ngx_memcmp(e[i].path.data, abs->data, abs->len) != 0)
+      continue;
+    uint64_t h;
+    if (ngx_http_waf_json_fingerprint(cf->temp_pool, cf->log, e[i].files, &h) == NGX_OK &&
+        h == e[i].hash)
+      return &e[i];
+  }
+  return NULL;
+}
+
+/* 加载、编译并登记新快照（快照分配在专用 pool，便于统计与整体回收） */
+static waf_snapshot_cache_entry_t *waf_snapshot_cache_add(ngx_conf_t *cf,
+                                                          ngx_http_waf_main_conf_t *mcf,
+                                                          ngx_http_waf_loc_conf_t *conf,
+                                                          const ngx_str_t *abs)
+{
+  ngx_http_waf_json_error_t err;
+  ngx_memzero(&err, sizeof(err));
+
+  ngx_array_t *files = ngx_array_create(cf->pool, 4, sizeof(ngx_str_t));
+  if (files == NULL)
+    return NULL;
+
+  yyjson_doc *doc = ngx_http_waf_json_load_and_merge(
+      cf->pool, cf->log, (mcf->jsons_dir.len != 0) ? &mcf->jsons_dir : NULL,
+      &conf->rules_json_path, conf->json_extends_max_depth, files, &err);
+  if (doc == NULL) {
+    ngx_log_error(NGX_LOG_ERR, cf->log, 0,
+                  "waf: failed to load rules_json %V: file=%V ptr=%V msg=%V",
+                  &conf->rules_json_path, &err.file, &err.json_pointer, &err.message);
+    return NULL;
+  }
+
+  ngx_pool_t *pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, cf->log);
+  if (pool == NULL) {
+    yyjson_doc_free(doc);
+    return NULL;
+  }
+  ngx_pool_cleanup_t *cln = ngx_pool_cleanup_add(cf->pool, 0);
+  if (cln == NULL) {
+    ngx_destroy_pool(pool);
+    yyjson_doc_free(doc);
+    return NULL;
+  }
+  cln->handler = waf_snapshot_pool_cleanup;
+  cln->data = pool;
+
+  cln = ngx_pool_cleanup_add(pool, 0);
+  if (cln == NULL) {
+    yyjson_doc_free(doc);
+    return NULL;
+  }
+  cln->handler = waf_snapshot_doc_cleanup;
+  cln->data = doc;
+
+  yyjson_val *root = yyjson_doc_get_root(doc);
+  yyjson_val *rules = root ? yyjson_obj_get(root, "rules") : NULL;
+  size_t cnt = (rules && yyjson_is_arr(rules)) ? yyjson_arr_size(rules) : 0;
+  ngx_log_error(NGX_LOG_INFO, cf->log, 0, "waf: merged rules %uz from %V (depth=%ui)",
+                (ngx_uint_t)cnt, &conf->rules_json_path, conf->json_extends_max_depth);
+
+#if defined(WAF_DEBUG_FINAL_DOC)
+  /* 输出 final_doc（单行 JSON，调试专用；生产默认关闭） */
+  size_t out_len = 0;
+  yyjson_write_err werr;
+  char *json = yyjson_write_opts(doc, /*flags=*/0, /*alc=*/NULL, &out_len, &werr);
+  if (json) {
+    ngx_log_error(NGX_LOG_INFO, cf->log, 0, "waf: final_doc: %s", json);
+    free(json);
+  } else {
+    ngx_log_error(NGX_LOG_WARN, cf->log, 0, "waf: final_doc dump failed: code=%ui",
+                  (ngx_uint_t)werr.code);
+  }
+#endif
+
+  /* M2：调用编译器生成只读快照 */
+  if (mcf->regex_cache == NULL) {
+    mcf->regex_cache = waf_regex_cache_create(cf->pool);
+    if (mcf->regex_cache == NULL)
+      return NULL;
+  }
+  waf_compiled_snapshot_t *snap = NULL;
+  if (ngx_http_waf_compile_rules(pool, cf->log, doc, mcf->regex_cache, &snap, &err) != NGX_OK) {
+    ngx_log_error(NGX_LOG_ERR, cf->log, 0, "waf: compile failed: file=%V ptr=%V msg=%V",
+                  &err.file, &err.json_pointer, &err.message);
+    return NULL;
+  }
+
+  ngx_uint_t re_compiled, re_reused;
+  waf_regex_cache_stats(mcf->regex_cache, &re_compiled, &re_reused);
+  ngx_log_error(NGX_LOG_INFO, cf->log, 0, "waf: regex cache compiled=%ui reused=%ui",
+                re_compiled, re_reused);
+
+  if (mcf->snapshot_cache == NULL) {
+    mcf->snapshot_cache = ngx_array_create(cf->pool, 4, sizeof(waf_snapshot_cache_entry_t));
+    if (mcf->snapshot_cache == NULL)
+      return NULL;
+  }
+  waf_snapshot_cache_entry_t *e = ngx_array_push(mcf->snapshot_cache);
+  if (e == NULL)
+    return NULL;
+  ngx_memzero(e, sizeof(*e));
+  e->path = *abs;
+  e->depth = conf->json_extends_max_depth;
+  e->files = files;
+  e->doc = doc;
+  e->snapshot = snap;
+  e->pool = pool;
+  if (ngx_http_waf_json_fingerprint(cf->temp_pool, cf->log, files, &e->hash) != NGX_OK) {
+    mcf->snapshot_cache->nelts--;
+    return NULL;
+  }
+  waf_snapshot_pool_usage(pool, &e->mem, &e->large);
+  return e;
+}
+
+/* 为 location 挂载快照：输入相同则复用，否则加载编译 */
+static ngx_int_t waf_snapshot_attach(ngx_conf_t *cf, ngx_http_waf_main_conf_t *mcf,
+                                     ngx_http_waf_loc_conf_t *prev, ngx_http_waf_loc_conf_t *conf)
+{
+  waf_snapshot_cache_entry_t *e = NULL;
+
+  /* 继承父级同一路径与深度：本周期内父级刚完成加载，直接复用 */
+  if (prev->snapshot_entry && conf->rules_json_path.data == prev->rules_json_path.data &&
+      conf->json_extends_max_depth == prev->json_extends_max_depth) {
+    e = prev->snapshot_entry;
+  }
+
+  if (e == NULL) {
+    ngx_str_t abs;
+    if (ngx_http_waf_json_resolve_entry(cf->pool, cf->log,
+                                        (mcf->jsons_dir.len != 0) ? &mcf->jsons_dir : NULL,
+                                        &conf->rules_json_path, &abs) != NGX_OK) {
+      ngx_log_error(NGX_LOG_ERR, cf->log, 0, "waf: failed to resolve rules_json %V",
+                    &conf->rules_json_path);
+      return NGX_ERROR;
+    }
+    e = waf_snapshot_cache_find(cf, mcf, &abs, conf->json_extends_max_depth);
+    if (e == NULL) {
+      e = waf_snapshot_cache_add(cf, mcf, conf, &abs);
+      if (e == NULL)
+        return NGX_ERROR;
+    }
+  }
+
+  e->refs++;
+  mcf->snapshot_locations++;
+  conf->snapshot_entry = e;
+  conf->rules_doc = e->doc;
+  conf->compiled = e->snapshot;
+  return NGX_OK;
+}
+
+/* 输出本配置周期的快照统计（postconfiguration 调用；nginx -t 与 reload 均可见） */
+void ngx_http_waf_snapshot_report(ngx_conf_t *cf)
+{
+  ngx_http_waf_main_conf_t *mcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_waf_module);
+  if (mcf == NULL || mcf->snapshot_cache == NULL)
+    return;
+
+  size_t mem = 0;
+  ngx_uint_t large = 0;
+  waf_snapshot_cache_entry_t *e = mcf->snapshot_cache->elts;
+  for (ngx_uint_t i = 0; i < mcf->snapshot_cache->nelts; i++) {
+    mem += e[i].mem;
+    large += e[i].large;
+  }
+  ngx_log_error(NGX_LOG_NOTICE, cf->log, 0,
+                "waf: %ui unique rule snapshots for %ui locations, memory %uzKB (+%ui large "
+                "allocations)",
+                mcf->snapshot_cache->nelts, mcf->snapshot_locations, mem / 1024, large);
+}
+
 /* loc 配置 */
 void *ngx_http_waf_create_loc_conf(ngx_conf_t *cf)
 {
@@ -98,6 +312,23 @@ void *ngx_http_waf_create_loc_conf(ngx_conf_t *cf)
   lcf->waf_enable = NGX_CONF_UNSET;
   lcf->dyn_block_enable = NGX_CONF_UNSET; /* 方案C：动态封禁开关（LOC级） */
   lcf->default_action = (waf_default_action_e)NGX_CONF_UNSET; /* waf_default_action（LOC级） */
+  /* 检测限额 */
+  lcf->inspect_limit = NGX_CONF_UNSET_SIZE;
+  lcf->inspect_body_tail = NGX_CONF_UNSET_SIZE;
+  lcf->pcre_match_limit = NGX_CONF_UNSET_UINT;
+  lcf->pcre_depth_limit = NGX_CONF_UNSET_UINT;
+  lcf->limit_verdict = NGX_CONF_UNSET_UINT;
+  /* detect 段时间片 */
+  lcf->detect_slice_time = NGX_CONF_UNSET_MSEC;
+  lcf->detect_slice_bytes = NGX_CONF_UNSET_SIZE;
+  /* BODY 规则线程池卸载 */
+#if (NGX_THREADS)
+  lcf->detect_thread_pool = NGX_CONF_UNSET_PTR;
+#endif
+  lcf->detect_thread_min_body = NGX_CONF_UNSET_SIZE;
+  /* 流式请求体检测 */
+  lcf->body_stream = NGX_CONF_UNSET;
+  lcf->body_stream_window = NGX_CONF_UNSET_SIZE;
   return lcf;
 }
 
@@ -127,66 +358,43 @@ char *ngx_http_waf_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
                                : WAF_DEFAULT_ACTION_BLOCK;
   }
 
-  /* 合并完成后按最终 max_depth 尝试解析规则（存根：仅调用接口并记录错误） */
-  if (conf->rules_json_path.len != 0) {
-    ngx_http_waf_json_error_t err;
-    err.file.len = 0;
-    err.file.data = NULL;
-    err.json_pointer.len = 0;
-    err.json_pointer.data = NULL;
-    err.message.len = 0;
-    err.message.data = NULL;
-
-    conf->rules_doc = ngx_http_waf_json_load_and_merge(
-        cf->pool, cf->log, (mcf && mcf->jsons_dir.len != 0) ? &mcf->jsons_dir : NULL,
-        &conf->rules_json_path, conf->json_extends_max_depth, &err);
-    if (conf->rules_doc == NULL) {
-      ngx_log_error(NGX_LOG_ERR, cf->log, 0,
-                    "waf: failed to load rules_json %V: file=%V ptr=%V msg=%V",
-                    &conf->rules_json_path, &err.file, &err.json_pointer, &err.message);
-      return NGX_CONF_ERROR;
-    } else {
-      yyjson_val *root = yyjson_doc_get_root(conf->rules_doc);
-      yyjson_val *rules = root ? yyjson_obj_get(root, "rules") : NULL;
-      size_t cnt = (rules && yyjson_is_arr(rules)) ? yyjson_arr_size(rules) : 0;
-      ngx_log_error(NGX_LOG_INFO, cf->log, 0, "waf: merged rules %uz from %V (depth=%ui)",
-                    (ngx_uint_t)cnt, &conf->rules_json_path, conf->json_extends_max_depth);
+  /* 检测限额合并 */
+  ngx_conf_merge_size_value(conf->inspect_limit, prev->inspect_limit, 0);
+  ngx_conf_merge_size_value(conf->inspect_body_tail, prev->inspect_body_tail, 0);
+  ngx_conf_merge_uint_value(conf->pcre_match_limit, prev->pcre_match_limit, 0);
+  ngx_conf_merge_uint_value(conf->pcre_depth_limit, prev->pcre_depth_limit, 0);
+  ngx_conf_merge_uint_value(conf->limit_verdict, prev->limit_verdict, WAF_LIMIT_VERDICT_OPEN);
+  if (conf->inspect_limit && conf->inspect_body_tail > conf->inspect_limit) {
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "waf: waf_inspect_body_tail must not exceed waf_inspect_limit");
+    return NGX_CONF_ERROR;
+  }
 
-#if defined(WAF_DEBUG_FINAL_DOC)
-      /* 输出 final_doc（单行 JSON，调试专用；生产默认关闭） */
-      size_t out_len = 0;
-      yyjson_write_err werr;
-      char *json = yyjson_write_opts(conf->rules_doc, /*flags=*/0, /*alc=*/NULL, &out_len, &werr);
-      if (json) {
-        ngx_log_error(NGX_LOG_INFO, cf->log, 0, "waf: final_doc: %s", json);
-        free(json);
-      } else {
-        ngx_log_error(NGX_LOG_WARN, cf->log, 0, "waf: final_doc dump failed: code=%ui",
-                      (ngx_uint_t)werr.code);
-      }
+  /* detect 段时间片合并（0=不切片） */
+  ngx_conf_merge_msec_value(conf->detect_slice_time, prev->detect_slice_time, 0);
+  ngx_conf_merge_size_value(conf->detect_slice_bytes, prev->detect_slice_bytes, 0);
+
+  /* BODY 规则线程池卸载合并（默认关闭） */
+#if (NGX_THREADS)
+  ngx_conf_merge_ptr_value(conf->detect_thread_pool, prev->detect_thread_pool, NULL);
 #endif
+  ngx_conf_merge_size_value(conf->detect_thread_min_body, prev->detect_thread_min_body,
+                            1024 * 1024);
 
-      /* M2：调用编译器生成只读快照并挂载到 lcf */
-      {
-        waf_compiled_snapshot_t *snap = NULL;
-        ngx_http_waf_json_error_t c_err;
-        c_err.file.len = 0;
-        c_err.file.data = NULL;
-        c_err.json_pointer.len = 0;
-        c_err.json_pointer.data = NULL;
-        c_err.message.len = 0;
-        c_err.message.data = NULL;
-        if (ngx_http_waf_compile_rules(cf->pool, cf->log, conf->rules_doc, &snap, &c_err) !=
-            NGX_OK) {
-          ngx_log_error(NGX_LOG_ERR, cf->log, 0, "waf: compile failed: file=%V ptr=%V msg=%V",
-                        &c_err.file, &c_err.json_pointer, &c_err.message);
-          return NGX_CONF_ERROR;
-        }
-        conf->compiled = snap;
-      }
+  /* 流式请求体检测合并（默认关闭，窗口4k） */
+  ngx_conf_merge_value(conf->body_stream, prev->body_stream, 0);
+  ngx_conf_merge_size_value(conf->body_stream_window, prev->body_stream_window, 4096);
+
+  /* 合并完成后按最终 max_depth 挂载快照（输入相同的 location 共享同一份） */
+  if (conf->rules_json_path.len != 0 && mcf) {
+    if (waf_snapshot_attach(cf, mcf, prev, conf) != NGX_OK) {
+      return NGX_CONF_ERROR;
     }
   }
 
+  /* 快照与开关均已定型：编排阶段计划 */
+  ngx_http_waf_build_stage_plan(conf);
+
   return NGX_CONF_OK;
 }
 
@@ -227,7 +435,7 @@ ngx_command_t ngx_http_waf_commands[] = {
     },
     {
       ngx_string("waf_json_log"),
-      NGX_HTTP_MAIN_CONF | NGX_CONF_TAKE1,
+      NGX_HTTP_MAIN_CONF | NGX_CONF_1MORE,
       ngx_http_waf_set_json_log,
       NGX_HTTP_MAIN_CONF_OFFSET,
       0,
@@ -260,6 +468,92 @@ ngx_command_t ngx_http_waf_commands[] = {
       NULL
     },
 
+    /* 检测限额（LOC级，可继承） */
+    {
+      ngx_string("waf_inspect_limit"),
+      NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_waf_loc_conf_t, inspect_limit),
+      NULL
+    },
+    {
+      ngx_string("waf_inspect_body_tail"),
+      NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_waf_loc_conf_t, inspect_body_tail),
+      NULL
+    },
+    {
+      ngx_string("waf_pcre_match_limit"),
+      NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_waf_loc_conf_t, pcre_match_limit),
+      NULL
+    },
+    {
+      ngx_string("waf_pcre_depth_limit"),
+      NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_waf_loc_conf_t, pcre_depth_limit),
+      NULL
+    },
+    {
+      ngx_string("waf_limit_verdict"),
+      NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+      ngx_http_waf_set_limit_verdict,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_waf_loc_conf_t, limit_verdict),
+      NULL
+    },
+
+    /* detect 段时间片（LOC级，可继承） */
+    {
+      ngx_string("waf_detect_slice_time"),
+      NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_waf_loc_conf_t, detect_slice_time),
+      NULL
+    },
+    {
+      ngx_string("waf_detect_slice_bytes"),
+      NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_waf_loc_conf_t, detect_slice_bytes),
+      NULL
+    },
+    {
+      ngx_string("waf_detect_thread_pool"),
+      NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE12,
+      ngx_http_waf_set_detect_thread_pool,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL
+    },
+
+    /* 流式请求体检测（LOC级，可继承） */
+    {
+      ngx_string("waf_body_stream"),
+      NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_waf_loc_conf_t, body_stream),
+      NULL
+    },
+    {
+      ngx_string("waf_body_stream_window"),
+      NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_waf_loc_conf_t, body_stream_window),
+      NULL
+    },
+
     /* M5全局运维指令（MAIN级，不可继承） */
     {
       ngx_string("waf_trust_xff"),
@@ -356,22 +650,25 @@ static char *ngx_http_waf_set_shm_zone(ngx_conf_t *cf, ngx_command_t *cmd, void
   return NGX_CONF_OK;
 }
 
-/* 解析 waf_json_log 路径并展开为绝对路径（相对 Nginx Prefix） */
+/*
+ * 解析 waf_json_log <path>|off [buffer=<size>] [flush=<time>]
+ *                  [threads=<pool> [queue=<n>] [overflow=drop|block]]
+ * 路径展开为绝对路径（相对 Nginx Prefix）；buffer/flush 语义同 access_log
+ */
 static char *ngx_http_waf_set_json_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
   ngx_http_waf_main_conf_t *mcf = conf;
   ngx_str_t *value;
-
-
-  if (cf->args->nelts != 2) {
-    return "invalid number of arguments";
-  }
+  ngx_flag_t threads = 0;
 
   value = cf->args->elts;
   mcf->json_log_path = value[1];
 
   /* 支持 off 关闭：不注册 open_files，后续写入将跳过 */
   if (mcf->json_log_path.len == 3 && ngx_strncasecmp(mcf->json_log_path.data, (u_char*)"off", 3) == 0) {
+    if (cf->args->nelts != 2) {
+      return "invalid number of arguments";
+    }
     mcf->json_log_path.len = 0;
     mcf->json_log_path.data = NULL;
     mcf->json_log_of = NULL;
@@ -380,6 +677,93 @@ static char *ngx_http_waf_set_json_log(ngx_conf_t *cf, ngx_command_t *cmd, void
     return NGX_CONF_OK;
   }
 
+  for (ngx_uint_t i = 2; i < cf->args->nelts; i++) {
+    ngx_str_t s;
+
+    if (value[i].len > sizeof("buffer=") - 1 &&
+        ngx_strncmp(value[i].data, "buffer=", sizeof("buffer=") - 1) == 0) {
+      s.data = value[i].data + sizeof("buffer=") - 1;
+      s.len = value[i].len - (sizeof("buffer=") - 1);
+      ssize_t size = ngx_parse_size(&s);
+      if (size == NGX_ERROR || size == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "waf: invalid buffer size \"%V\"", &s);
+        return NGX_CONF_ERROR;
+      }
+      mcf->json_log_buffer = (size_t)size;
+      continue;
+    }
+
+    if (value[i].len > sizeof("flush=") - 1 &&
+        ngx_strncmp(value[i].data, "flush=", sizeof("flush=") - 1) == 0) {
+      s.data = value[i].data + sizeof("flush=") - 1;
+      s.len = value[i].len - (sizeof("flush=") - 1);
+      ngx_int_t flush = ngx_parse_time(&s, 0);
+      if (flush == NGX_ERROR || flush == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "waf: invalid flush time \"%V\"", &s);
+        return NGX_CONF_ERROR;
+      }
+      mcf->json_log_flush = (ngx_msec_t)flush;
+      continue;
+    }
+
+    if (value[i].len > sizeof("threads=") - 1 &&
+        ngx_strncmp(value[i].data, "threads=", sizeof("threads=") - 1) == 0) {
+#if (NGX_THREADS)
+      s.data = value[i].data + sizeof("threads=") - 1;
+      s.len = value[i].len - (sizeof("threads=") - 1);
+      mcf->json_log_thread_pool = ngx_thread_pool_add(cf, &s);
+      if (mcf->json_log_thread_pool == NULL) {
+        return NGX_CONF_ERROR;
+      }
+      threads = 1;
+      continue;
+#else
+      ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                         "waf: waf_json_log threads= requires nginx built with --with-threads");
+      return NGX_CONF_ERROR;
+#endif
+    }
+
+    if (value[i].len > sizeof("queue=") - 1 &&
+        ngx_strncmp(value[i].data, "queue=", sizeof("queue=") - 1) == 0) {
+      ngx_int_t n = ngx_atoi(value[i].data + sizeof("queue=") - 1,
+                             value[i].len - (sizeof("queue=") - 1));
+      if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "waf: invalid queue \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+      }
+      mcf->json_log_threads_queue = (ngx_uint_t)n;
+      continue;
+    }
+
+    if (value[i].len == sizeof("overflow=drop") - 1 &&
+        ngx_strncmp(value[i].data, "overflow=drop", value[i].len) == 0) {
+      mcf->json_log_overflow_block = 0;
+      continue;
+    }
+    if (value[i].len == sizeof("overflow=block") - 1 &&
+        ngx_strncmp(value[i].data, "overflow=block", value[i].len) == 0) {
+      mcf->json_log_overflow_block = 1;
+      continue;
+    }
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "waf: invalid waf_json_log parameter \"%V\"", &value[i]);
+    return NGX_CONF_ERROR;
+  }
+
+  if (mcf->json_log_flush && mcf->json_log_buffer == 0) {
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "waf: waf_json_log flush= requires buffer=");
+    return NGX_CONF_ERROR;
+  }
+  if (threads && mcf->json_log_buffer == 0) {
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "waf: waf_json_log threads= requires buffer=");
+    return NGX_CONF_ERROR;
+  }
+  if (mcf->json_log_threads_queue == 0) {
+    mcf->json_log_threads_queue = 4;
+  }
+
   /* 展开为绝对路径（相对于 Nginx Prefix） */
   if (ngx_conf_full_name(cf->cycle, &mcf->json_log_path, 0) != NGX_OK) {
     return NGX_CONF_ERROR;
@@ -398,6 +782,10 @@ static char *ngx_http_waf_set_json_log(ngx_conf_t *cf, ngx_command_t *cmd, void
       return NGX_CONF_ERROR;
     }
     /* 具体 open 标志由 Nginx 在 master 阶段统一处理，这里无需设置 */
+
+    if (mcf->json_log_buffer && waf_log_buffer_init(cf, mcf) != NGX_CONF_OK) {
+      return NGX_CONF_ERROR;
+    }
   }
 
   (void)cmd;
@@ -464,3 +852,86 @@ static char *ngx_http_waf_set_default_action(ngx_conf_t *cf, ngx_command_t *cmd,
   (void)cmd;
   return NGX_CONF_OK;
 }
+
+/* 解析 waf_limit_verdict open|closed */
+static char *ngx_http_waf_set_limit_verdict(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+  ngx_http_waf_loc_conf_t *lcf = conf;
+  ngx_str_t *value = cf->args->elts;
+
+  if (lcf->limit_verdict != NGX_CONF_UNSET_UINT) {
+    return "is duplicate";
+  }
+
+  if (value[1].len == 4 && ngx_strncasecmp(value[1].data, (u_char *)"open", 4) == 0) {
+    lcf->limit_verdict = WAF_LIMIT_VERDICT_OPEN;
+  } else if (value[1].len == 6 && ngx_strncasecmp(value[1].data, (u_char *)"closed", 6) == 0) {
+    lcf->limit_verdict = WAF_LIMIT_VERDICT_CLOSED;
+  } else {
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "waf: invalid waf_limit_verdict \"%V\", must be: open|closed", &value[1]);
+    return NGX_CONF_ERROR;
+  }
+
+  (void)cmd;
+  return NGX_CONF_OK;
+}
+
+/* 解析 waf_detect_thread_pool <name>|off [min_body=<size>] */
+static char *ngx_http_waf_set_detect_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+  ngx_http_waf_loc_conf_t *lcf = conf;
+  ngx_str_t *value = cf->args->elts;
+
+  if (value[1].len == 3 && ngx_strncmp(value[1].data, "off", 3) == 0) {
+    if (cf->args->nelts != 2) {
+      return "invalid number of arguments";
+    }
+#if (NGX_THREADS)
+    if (lcf->detect_thread_pool != NGX_CONF_UNSET_PTR) {
+      return "is duplicate";
+    }
+    lcf->detect_thread_pool = NULL;
+#endif
+    (void)cmd;
+    return NGX_CONF_OK;
+  }
+
+#if (NGX_THREADS)
+  if (lcf->detect_thread_pool != NGX_CONF_UNSET_PTR) {
+    return "is duplicate";
+  }
+  lcf->detect_thread_pool = ngx_thread_pool_add(cf, &value[1]);
+  if (lcf->detect_thread_pool == NULL) {
+    return NGX_CONF_ERROR;
+  }
+
+  for (ngx_uint_t i = 2; i < cf->args->nelts; i++) {
+    if (value[i].len > sizeof("min_body=") - 1 &&
+        ngx_strncmp(value[i].data, "min_body=", sizeof("min_body=") - 1) == 0) {
+      ngx_str_t s;
+      s.data = value[i].data + sizeof("min_body=") - 1;
+      s.len = value[i].len - (sizeof("min_body=") - 1);
+      ssize_t size = ngx_parse_size(&s);
+      if (size == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "waf: invalid min_body \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+      }
+      lcf->detect_thread_min_body = (size_t)size;
+      continue;
+    }
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "waf: invalid waf_detect_thread_pool parameter \"%V\"", &value[i]);
+    return NGX_CONF_ERROR;
+  }
+
+  (void)cmd;
+  return NGX_CONF_OK;
+#else
+  ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                     "waf: waf_detect_thread_pool requires nginx built with --with-threads");
+  (void)lcf;
+  (void)cmd;
+  return NGX_CONF_ERROR;
+#endif
+}
@@ -15,11 +15,13 @@ extern ngx_module_t ngx_http_waf_module; /* 前置声明，供 ngx_http_get_modu
 
 /* 异步请求体读取回调前置声明 */
 static void ngx_http_waf_post_read_body_handler(ngx_http_request_t *r);
+static void ngx_http_waf_detect_resume_handler(ngx_event_t *ev);
 
 /* STUB 接口（M2.5）：日志与动作 */
 #include "ngx_http_waf_action.h"
 #include "ngx_http_waf_compiler.h"
 #include "ngx_http_waf_log.h"
+#include "ngx_http_waf_simd.h"
 #include "ngx_http_waf_stage.h"
 #include "ngx_http_waf_utils.h"
 #include <ngx_regex.h>
@@ -234,60 +236,30 @@ static waf_rc_e waf_stage_ip_allow(ngx_http_request_t *r, ngx_http_waf_main_conf
 
   /* 获取ip_allow阶段的规则桶（CLIENT_IP是target[0]） */
   ngx_array_t *rules = lcf->compiled->buckets[WAF_PHASE_IP_ALLOW][0];
-  if (rules == NULL || rules->nelts == 0) {
+  waf_ip_index_t *idx = lcf->compiled->ip_index[WAF_PHASE_IP_ALLOW];
+  if (rules == NULL || rules->nelts == 0 || idx == NULL) {
     return WAF_RC_CONTINUE;
   }
 
-  /* 使用ctx中已提取的客户端IP（尊重trust_xff配置） */
-  in_addr_t client_addr = ctx->client_ip;
-  if (client_addr == 0) {
-    /* 无效IP（如IPv6或解析失败），跳过检测 */
+  /* 基数树一次查找：得到首条判定命中（已应用 negate）的规则；地址无效时不命中 */
+  ngx_uint_t hit = waf_ip_index_lookup(idx, &ctx->client_addr);
+  if (hit == WAF_IP_INDEX_NONE) {
     return WAF_RC_CONTINUE;
   }
 
-  /* 遍历规则匹配CIDR */
-  waf_compiled_rule_t **rule_ptrs = rules->elts;
-  for (ngx_uint_t i = 0; i < rules->nelts; i++) {
-    waf_compiled_rule_t *rule = rule_ptrs[i];
-    if (rule == NULL || rule->compiled_cidrs == NULL) {
-      continue;
-    }
-
-    ngx_cidr_t *cidrs = rule->compiled_cidrs->elts;
-    ngx_uint_t matched = 0;
-
-    for (ngx_uint_t j = 0; j < rule->compiled_cidrs->nelts; j++) {
-      if (cidrs[j].family == AF_INET) {
-        if ((client_addr & cidrs[j].u.in.mask) == cidrs[j].u.in.addr) {
-          matched = 1;
-          break;
-        }
-      }
-    }
-
-    /* 应用negate */
-    ngx_uint_t matched_pre = matched;
-    if (rule->negate) {
-      matched = matched ? 0 : 1;
-    }
-
-    ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
-                  "waf-debug: ip_allow check rule=%ui matchedPre=%ui negate=%ui matchedFinal=%ui action=%ui",
-                  (ngx_uint_t)rule->id, matched_pre, (ngx_uint_t)rule->negate, matched, (ngx_uint_t)rule->action);
-
-    if (!matched) {
-      continue;
-    }
-
-    /* 命中ip_allow规则：BYPASS */
-    if (rule->action == WAF_ACT_BYPASS) {
-      waf_event_details_t det = {0};
-      det.target_tag = "clientIp";
-      det.negate = rule->negate;
-      det.rule_tags = rule->tags;
-      waf_final_action_type_e hint = WAF_FINAL_ACTION_TYPE_BYPASS_BY_IP_WHITELIST;
-      return waf_enforce_bypass(r, mcf, lcf, ctx, rule->id, &det, &hint);
-    }
+  waf_compiled_rule_t *rule = ((waf_compiled_rule_t **)rules->elts)[hit];
+  ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
+                "waf-debug: ip_allow hit rule=%ui negate=%ui action=%ui",
+                (ngx_uint_t)rule->id, (ngx_uint_t)rule->negate, (ngx_uint_t)rule->action);
+
+  /* 命中ip_allow规则：BYPASS */
+  if (rule->action == WAF_ACT_BYPASS) {
+    waf_event_details_t det = {0};
+    det.target_tag = "clientIp";
+    det.negate = rule->negate;
+    det.rule_tags = rule->tags;
+    waf_final_action_type_e hint = WAF_FINAL_ACTION_TYPE_BYPASS_BY_IP_WHITELIST;
+    return waf_enforce_bypass(r, mcf, lcf, ctx, rule->id, &det, &hint);
   }
 
   return WAF_RC_CONTINUE;
@@ -302,63 +274,33 @@ static waf_rc_e waf_stage_ip_deny(ngx_http_request_t *r, ngx_http_waf_main_conf_
 
   /* 获取ip_block阶段的规则桶（CLIENT_IP是target[0]） */
   ngx_array_t *rules = lcf->compiled->buckets[WAF_PHASE_IP_BLOCK][0];
-  if (rules == NULL || rules->nelts == 0) {
+  waf_ip_index_t *idx = lcf->compiled->ip_index[WAF_PHASE_IP_BLOCK];
+  if (rules == NULL || rules->nelts == 0 || idx == NULL) {
     return WAF_RC_CONTINUE;
   }
 
-  /* 使用ctx中已提取的客户端IP（尊重trust_xff配置） */
-  in_addr_t client_addr = ctx->client_ip;
-  if (client_addr == 0) {
-    /* 无效IP（如IPv6或解析失败），跳过检测 */
+  /* 基数树一次查找：得到首条判定命中（已应用 negate）的规则；地址无效时不命中 */
+  ngx_uint_t hit = waf_ip_index_lookup(idx, &ctx->client_addr);
+  if (hit == WAF_IP_INDEX_NONE) {
     return WAF_RC_CONTINUE;
   }
 
-  /* 遍历规则匹配CIDR */
-  waf_compiled_rule_t **rule_ptrs = rules->elts;
-  for (ngx_uint_t i = 0; i < rules->nelts; i++) {
-    waf_compiled_rule_t *rule = rule_ptrs[i];
-    if (rule == NULL || rule->compiled_cidrs == NULL) {
-      continue;
-    }
-
-    ngx_cidr_t *cidrs = rule->compiled_cidrs->elts;
-    ngx_uint_t matched = 0;
-
-    for (ngx_uint_t j = 0; j < rule->compiled_cidrs->nelts; j++) {
-      if (cidrs[j].family == AF_INET) {
-        if ((client_addr & cidrs[j].u.in.mask) == cidrs[j].u.in.addr) {
-          matched = 1;
-          break;
-        }
-      }
-    }
-
-    /* 应用negate */
-    ngx_uint_t matched_pre = matched;
-    if (rule->negate) {
-      matched = matched ? 0 : 1;
-    }
-
-    ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
-                  "waf-debug: ip_deny check rule=%ui matchedPre=%ui negate=%ui matchedFinal=%ui action=%ui",
-                  (ngx_uint_t)rule->id, matched_pre, (ngx_uint_t)rule->negate, matched, (ngx_uint_t)rule->action);
-
-    if (!matched) {
-      continue;
-    }
-
-    /* 命中ip_deny规则：BLOCK */
-    if (rule->action == WAF_ACT_DENY) {
-      waf_event_details_t det = (waf_event_details_t){0};
-      det.target_tag = "clientIp";
-      det.negate = rule->negate;
-      det.rule_tags = rule->tags;
-      /* 通过 hint 明确最终动作类型为 IP 黑名单阻断 */
-      waf_final_action_type_e hint = WAF_FINAL_ACTION_TYPE_BLOCK_BY_IP_BLACKLIST;
-      waf_rc_e rc = waf_enforce_block_hint(r, mcf, lcf, ctx, NGX_HTTP_FORBIDDEN, rule->id,
-                               (ngx_uint_t)(rule->score > 0 ? rule->score : 0), &det, &hint);
-      return rc;
-    }
+  waf_compiled_rule_t *rule = ((waf_compiled_rule_t **)rules->elts)[hit];
+  ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
+                "waf-debug: ip_deny hit rule=%ui negate=%ui action=%ui",
+                (ngx_uint_t)rule->id, (ngx_uint_t)rule->negate, (ngx_uint_t)rule->action);
+
+  /* 命中ip_deny规则：BLOCK */
+  if (rule->action == WAF_ACT_DENY) {
+    waf_event_details_t det = (waf_event_details_t){0};
+    det.target_tag = "clientIp";
+    det.negate = rule->negate;
+    det.rule_tags = rule->tags;
+    /* 通过 hint 明确最终动作类型为 IP 黑名单阻断 */
+    waf_final_action_type_e hint = WAF_FINAL_ACTION_TYPE_BLOCK_BY_IP_BLACKLIST;
+    waf_rc_e rc = waf_enforce_block_hint(r, mcf, lcf, ctx, NGX_HTTP_FORBIDDEN, rule->id,
+                             (ngx_uint_t)(rule->score > 0 ? rule->score : 0), &det, &hint);
+    return rc;
   }
 
   return WAF_RC_CONTINUE;
@@ -393,6 +335,591 @@ static waf_rc_e waf_stage_reputation_base_add(ngx_http_request_t *r, ngx_http_wa
   return waf_enforce_base_add(r, mcf, lcf, ctx, base_score);
 }
 
+/*
+ * location 检测字节限额（waf_inspect_limit）：超出时截取头部窗口，返回 1 表示已截断
+ * 截断按检测对象记录（ctx->limit_clipped / ctx->header_clipped），只由以该对象为 subject 的规则处置
+ */
+static ngx_flag_t waf_inspect_clip(ngx_http_request_t *r, ngx_str_t *s)
+{
+  ngx_http_waf_loc_conf_t *lcf = ngx_http_get_module_loc_conf(r, ngx_http_waf_module);
+  if (lcf->inspect_limit && s->len > lcf->inspect_limit) {
+    s->len = lcf->inspect_limit;
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * 请求体检测窗口：超出 waf_inspect_limit 时取头部 (limit - tail) 字节与尾部 tail 字节拼接
+ * - tail 为 0 时零拷贝截取头部；否则窗口分配于 r->pool
+ */
+static ngx_int_t waf_inspect_body_window(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
+                                         const ngx_str_t *in, ngx_str_t *out)
+{
+  ngx_http_waf_loc_conf_t *lcf = ngx_http_get_module_loc_conf(r, ngx_http_waf_module);
+  *out = *in;
+  if (lcf->inspect_limit == 0 || in->len <= lcf->inspect_limit) {
+    return NGX_OK;
+  }
+  ctx->limit_clipped |= WAF_TARGET_BIT(WAF_T_BODY);
+
+  size_t tail = lcf->inspect_body_tail;
+  if (tail == 0) {
+    out->len = lcf->inspect_limit;
+    return NGX_OK;
+  }
+  size_t head = lcf->inspect_limit - tail;
+  u_char *p = ngx_pnalloc(r->pool, lcf->inspect_limit);
+  if (p == NULL) {
+    return NGX_ERROR;
+  }
+  ngx_memcpy(p, in->data, head);
+  ngx_memcpy(p + head, in->data + in->len - tail, tail);
+  out->data = p;
+  out->len = lcf->inspect_limit;
+  return NGX_OK;
+}
+
+/* 请求级参数表：首次使用时解析 r->args，此后本请求全部 ARGS 规则共享（失败返回 NULL） */
+static ngx_array_t *waf_ctx_args(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx)
+{
+  if (ctx->args == NULL) {
+    if (ngx_http_waf_parse_args(r->pool, &r->args, &ctx->args, &ctx->args_stats) != NGX_OK) {
+      ctx->args = NULL;
+      return NULL;
+    }
+    /* 检测限额逐个作用于 name/value；args_stats 仍为原始长度，LENGTH 规则不受影响 */
+    waf_arg_t *arg = ctx->args->elts;
+    for (ngx_uint_t k = 0; k < ctx->args->nelts; k++) {
+      if (waf_inspect_clip(r, &arg[k].name)) {
+        ctx->limit_clipped |= WAF_TARGET_BIT(WAF_T_ARGS_NAME);
+      }
+      if (waf_inspect_clip(r, &arg[k].value)) {
+        ctx->limit_clipped |= WAF_TARGET_BIT(WAF_T_ARGS_VALUE);
+      }
+    }
+  }
+  return ctx->args;
+}
+
+/*
+ * 请求级请求体视图：首个 BODY 规则时收集并按 Content-Type 解码一次，结果缓存于 ctx
+ * - ctx->body_raw 为原始请求体，ctx->body_view 为检测视图（form-urlencoded 时为解码结果）
+ * - 检测视图取自 waf_inspect_limit/waf_inspect_body_tail 的头尾窗口，body_raw 保持完整
+ * - 返回 1 表示视图可用；无请求体或收集失败返回 0（视为空 BODY，失败只告警一次）
+ */
+/* application/x-www-form-urlencoded 请求体的检测视图为 +→空格 与 %XX 解码结果 */
+static ngx_flag_t waf_body_is_form(ngx_http_request_t *r)
+{
+  return r->headers_in.content_type &&
+         r->headers_in.content_type->value.len >= sizeof("application/x-www-form-urlencoded") - 1 &&
+         ngx_strncasecmp(r->headers_in.content_type->value.data,
+                         (u_char *)"application/x-www-form-urlencoded",
+                         sizeof("application/x-www-form-urlencoded") - 1) == 0;
+}
+
+static ngx_uint_t waf_ctx_body(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx)
+{
+  if (ctx->body_collected) {
+    return ctx->body_available;
+  }
+  ctx->body_collected = 1;
+
+  if (r->request_body == NULL || r->request_body->bufs == NULL) {
+    return 0;
+  }
+  if (ngx_http_waf_collect_request_body(r, &ctx->body_raw) != NGX_OK) {
+    ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                  "waf: collect_request_body failed; treat as empty BODY");
+    return 0;
+  }
+
+  ngx_str_t window;
+  if (waf_inspect_body_window(r, ctx, &ctx->body_raw, &window) != NGX_OK) {
+    return 0;
+  }
+
+  ctx->body_view = window;
+  if (waf_body_is_form(r)) {
+    ngx_str_t decoded_body;
+    if (ngx_http_waf_decode_form_urlencoded(r->pool, &window, &decoded_body) == NGX_OK) {
+      ctx->body_view = decoded_body;
+    }
+  }
+  ctx->body_available = 1;
+  return 1;
+}
+
+/*
+ * 请求级请求头取值表：按快照 header_slots 下标索引，首个 HEADER 规则时构建
+ * - well-known 头直接取 r->headers_in 对应字段；其余头一次遍历 headers 链表，经驻留哈希定位槽位
+ * - 同名头取首个（与逐条链表查找语义一致）；缺失的头 data 为 NULL；失败返回 NULL
+ */
+static ngx_str_t *waf_ctx_headers(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
+                                  waf_compiled_snapshot_t *snap)
+{
+  if (ctx->headers != NULL) {
+    return ctx->headers;
+  }
+
+  ngx_uint_t n = snap->header_slots ? snap->header_slots->nelts : 0;
+  ngx_str_t *vals = ngx_pcalloc(r->pool, (n ? n : 1) * sizeof(ngx_str_t));
+  u_char *clipped = ngx_pcalloc(r->pool, n ? n : 1);
+  if (vals == NULL || clipped == NULL) {
+    return NULL;
+  }
+
+  waf_header_slot_t *hs = n ? snap->header_slots->elts : NULL;
+  for (ngx_uint_t k = 0; k < n; k++) {
+    if (hs[k].offset >= 0) {
+      ngx_table_elt_t *h = *(ngx_table_elt_t **)((u_char *)&r->headers_in + hs[k].offset);
+      if (h != NULL) {
+        vals[k] = h->value;
+      }
+    }
+  }
+
+  ngx_uint_t pending = snap->header_list_slots;
+  ngx_list_part_t *part = &r->headers_in.headers.part;
+  ngx_table_elt_t *h = part->elts;
+  for (ngx_uint_t i = 0; pending > 0; i++) {
+    if (i >= part->nelts) {
+      if (part->next == NULL)
+        break;
+      part = part->next;
+      h = part->elts;
+      i = 0;
+      if (part->nelts == 0)
+        continue;
+    }
+    uintptr_t slot = (uintptr_t)ngx_hash_find(&snap->header_hash, h[i].hash, h[i].lowcase_key,
+                                              h[i].key.len);
+    if (slot == 0 || vals[slot - 1].data != NULL) {
+      continue;
+    }
+    vals[slot - 1] = h[i].value;
+    pending--;
+  }
+
+  for (ngx_uint_t k = 0; k < n; k++) {
+    clipped[k] = (u_char)waf_inspect_clip(r, &vals[k]);
+  }
+
+  ctx->header_clipped = clipped;
+  ctx->headers = vals;
+  return vals;
+}
+
+/* 请求级 ARGS_COMBINED 视图：首次使用时解码；解码失败或为空返回 NULL（视为不命中） */
+static ngx_str_t *waf_ctx_args_combined(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx)
+{
+  if (!ctx->args_combined_ready) {
+    ctx->args_combined_ready = 1;
+    ctx->args_combined_ok =
+        (ngx_http_waf_get_decoded_args_combined(r, &ctx->args_combined) == NGX_OK) ? 1 : 0;
+    if (ctx->args_combined_ok && waf_inspect_clip(r, &ctx->args_combined)) {
+      ctx->limit_clipped |= WAF_TARGET_BIT(WAF_T_ARGS_COMBINED);
+    }
+  }
+  return (ctx->args_combined_ok && ctx->args_combined.len > 0) ? &ctx->args_combined : NULL;
+}
+
+/* 变换缓存查找；未命中时登记空条目（value/args 由调用方填充），分配失败返回 NULL */
+static waf_variant_t *waf_ctx_variant_slot(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
+                                           ngx_uint_t target, ngx_uint_t slot,
+                                           ngx_uint_t transform, ngx_uint_t *found)
+{
+  if (ctx->variants == NULL) {
+    ctx->variants = ngx_array_create(r->pool, 4, sizeof(waf_variant_t));
+    if (ctx->variants == NULL) {
+      return NULL;
+    }
+  }
+  waf_variant_t *v = ctx->variants->elts;
+  for (ngx_uint_t k = 0; k < ctx->variants->nelts; k++) {
+    if (v[k].target == target && v[k].slot == slot && v[k].transform == transform) {
+      *found = 1;
+      return &v[k];
+    }
+  }
+  waf_variant_t *nv = ngx_array_push(ctx->variants);
+  if (nv == NULL) {
+    return NULL;
+  }
+  ngx_memzero(nv, sizeof(*nv));
+  nv->target = target;
+  nv->slot = slot;
+  nv->transform = transform;
+  *found = 0;
+  return nv;
+}
+
+/*
+ * 请求级目标变体：按 (target, slot, transform) 惰性计算并缓存于 ctx，每请求至多计算一次
+ * - base 为该 target 的默认检测视图；transform 为 0 时直接返回 base
+ */
+static ngx_int_t waf_ctx_variant(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx, ngx_uint_t target,
+                                 ngx_uint_t slot, ngx_uint_t transform, const ngx_str_t *base,
+                                 ngx_str_t *out)
+{
+  if (transform == 0) {
+    *out = *base;
+    return NGX_OK;
+  }
+  ngx_uint_t found;
+  waf_variant_t *v = waf_ctx_variant_slot(r, ctx, target, slot, transform, &found);
+  if (v == NULL) {
+    return NGX_ERROR;
+  }
+  if (!found && ngx_http_waf_transform(r->pool, transform, base, &v->value) != NGX_OK) {
+    ctx->variants->nelts--;
+    return NGX_ERROR;
+  }
+  *out = v->value;
+  return NGX_OK;
+}
+
+/* ARGS_NAME/ARGS_VALUE 的变体参数表（name/value 一并变换）；失败返回 NULL */
+static ngx_array_t *waf_ctx_args_variant(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
+                                         ngx_uint_t transform)
+{
+  ngx_array_t *args = waf_ctx_args(r, ctx);
+  if (args == NULL || transform == 0) {
+    return args;
+  }
+  ngx_uint_t found;
+  waf_variant_t *v = waf_ctx_variant_slot(r, ctx, WAF_T_ARGS_NAME, 0, transform, &found);
+  if (v == NULL) {
+    return NULL;
+  }
+  if (!found && ngx_http_waf_transform_args(r->pool, transform, args, &v->args) != NGX_OK) {
+    ctx->variants->nelts--;
+    return NULL;
+  }
+  return v->args;
+}
+
+/* 请求头计数：name 为 "*" 时为总数（按链表分段累加），否则为同名头个数 */
+static ngx_uint_t waf_header_count(ngx_http_request_t *r, const ngx_str_t *name)
+{
+  ngx_uint_t all = (name->len == 1 && name->data[0] == '*');
+  ngx_uint_t n = 0;
+  for (ngx_list_part_t *part = &r->headers_in.headers.part; part; part = part->next) {
+    if (all) {
+      n += part->nelts;
+      continue;
+    }
+    ngx_table_elt_t *h = part->elts;
+    for (ngx_uint_t i = 0; i < part->nelts; i++) {
+      if (h[i].key.len == name->len &&
+          ngx_strncasecmp(h[i].key.data, name->data, name->len) == 0) {
+        n++;
+      }
+    }
+  }
+  return n;
+}
+
+/*
+ * 结构性规则（COUNT/LENGTH）：取整数度量与 rule->limit 比较，超过即命中
+ * - 参数度量来自请求级参数表解析时的统计；BODY 优先取 Content-Length，分块请求才读取请求体
+ * - 返回 1/0；度量获取失败返回 NGX_ERROR
+ */
+static ngx_int_t waf_structural_match(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
+                                      waf_compiled_snapshot_t *snap, waf_compiled_rule_t *rule)
+{
+  off_t v = 0;
+
+  switch (rule->target) {
+    case WAF_T_URI:
+      v = (off_t)r->uri.len;
+      break;
+    case WAF_T_ARGS_COMBINED:
+      if (rule->match == WAF_MATCH_LENGTH) {
+        v = (off_t)r->args.len;
+        break;
+      }
+      /* fall through */
+    case WAF_T_ARGS_NAME:
+    case WAF_T_ARGS_VALUE: {
+      ngx_array_t *args = waf_ctx_args(r, ctx);
+      if (args == NULL) {
+        return NGX_ERROR;
+      }
+      v = (rule->target == WAF_T_ARGS_COMBINED) ? (off_t)args->nelts
+          : (rule->target == WAF_T_ARGS_NAME)   ? (off_t)ctx->args_stats.name_max
+                                                : (off_t)ctx->args_stats.value_max;
+      break;
+    }
+    case WAF_T_BODY:
+      if (r->headers_in.content_length_n >= 0) {
+        v = r->headers_in.content_length_n;
+      } else if (waf_ctx_body(r, ctx)) {
+        v = (off_t)ctx->body_raw.len;
+      }
+      break;
+    case WAF_T_HEADER:
+      if (rule->match == WAF_MATCH_COUNT) {
+        v = (off_t)waf_header_count(r, &rule->header_name);
+      } else {
+        ngx_str_t *hv = waf_ctx_headers(r, ctx, snap);
+        if (hv == NULL) {
+          return NGX_ERROR;
+        }
+        v = (off_t)hv[rule->header_slot].len;
+      }
+      break;
+    default:
+      return 0;
+  }
+  return v > rule->limit;
+}
+
+/*
+ * 桶级 AC 预扫描：每个 subject 只扫描一遍，即得到整桶规则的命中结果
+ * - groups 为 contains_groups（CONTAINS pattern）或 regex_groups（REGEX 字面量因子）
+ * - 返回 hits[]（长度 = 桶内规则数，按桶内下标置位），分配于 r->pool
+ * - URI/ARGS_COMBINED/BODY 使用调用方给出的 subject（默认检测视图）；ARGS_NAME/ARGS_VALUE 逐参数扫描；
+ *   HEADER 按分组请求头取值扫描（缺失的头视为空串，不会命中）
+ * - 分组声明了 transform 时扫描对应的请求级变体
+ */
+static u_char *waf_ac_prescan(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
+                              waf_compiled_snapshot_t *snap, ngx_array_t *groups,
+                              waf_phase_e phase, waf_target_e target, const ngx_str_t *subject)
+{
+  ngx_array_t *bucket = snap->buckets[phase][target];
+  u_char *hits = ngx_pcalloc(r->pool, bucket && bucket->nelts ? bucket->nelts : 1);
+  if (hits == NULL) {
+    return NULL;
+  }
+
+  if (groups == NULL) {
+    return hits;
+  }
+
+  ngx_array_t *args = NULL;
+  if (target == WAF_T_ARGS_NAME || target == WAF_T_ARGS_VALUE) {
+    args = waf_ctx_args(r, ctx);
+    if (args == NULL) {
+      return NULL;
+    }
+  }
+
+  waf_ac_group_t *g = groups->elts;
+  for (ngx_uint_t k = 0; k < groups->nelts; k++) {
+    switch (target) {
+      case WAF_T_HEADER: {
+        ngx_str_t *hv = waf_ctx_headers(r, ctx, snap);
+        if (hv == NULL) {
+          return NULL;
+        }
+        if (hv[g[k].header_slot].data != NULL) {
+          ngx_str_t v;
+          if (waf_ctx_variant(r, ctx, WAF_T_HEADER, g[k].header_slot, g[k].transform,
+                              &hv[g[k].header_slot], &v) != NGX_OK) {
+            return NULL;
+          }
+          waf_ac_scan(g[k].ac, v.data, v.len, hits);
+        }
+        break;
+      }
+      case WAF_T_ARGS_NAME:
+      case WAF_T_ARGS_VALUE: {
+        ngx_array_t *ga = g[k].transform ? waf_ctx_args_variant(r, ctx, g[k].transform) : args;
+        if (ga == NULL) {
+          return NULL;
+        }
+        ngx_http_waf_args_iter_ac(ga, target == WAF_T_ARGS_NAME, g[k].ac, hits);
+        break;
+      }
+      default:
+        if (subject != NULL) {
+          ngx_str_t v;
+          if (waf_ctx_variant(r, ctx, target, 0, g[k].transform, subject, &v) != NGX_OK) {
+            return NULL;
+          }
+          waf_ac_scan(g[k].ac, v.data, v.len, hits);
+        }
+        break;
+    }
+  }
+  return hits;
+}
+
+static u_char *waf_contains_prescan(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
+                                    waf_compiled_snapshot_t *snap, waf_phase_e phase,
+                                    waf_target_e target, const ngx_str_t *subject)
+{
+  return waf_ac_prescan(r, ctx, snap, snap->contains_groups[phase][target], phase, target,
+                        subject);
+}
+
+/*
+ * REGEX 字面量因子预筛：判断第 i 条规则的正则是否需要执行
+ * - 规则无因子（无法提取）时恒需执行；否则桶内首次调用时做一次因子扫描（*hits 惰性分配）
+ * - 返回 1 需执行，0 可跳过（subject 不含任一必含因子，正则必不命中），NGX_ERROR 分配失败
+ */
+static ngx_int_t waf_regex_candidate(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
+                                     waf_compiled_snapshot_t *snap, waf_phase_e phase,
+                                     waf_target_e target, const ngx_str_t *subject,
+                                     waf_compiled_rule_t *rule, ngx_uint_t i, u_char **hits)
+{
+  if (rule->regex_factors == NULL) {
+    return 1;
+  }
+  if (*hits == NULL) {
+    *hits = waf_ac_prescan(r, ctx, snap, snap->regex_groups[phase][target], phase, target,
+                           subject);
+    if (*hits == NULL) {
+      return NGX_ERROR;
+    }
+  }
+  return (*hits)[i] ? 1 : 0;
+}
+
+/*
+ * 字节类预筛：规则要求的特殊字节未全部出现在 subject 中时，CONTAINS/REGEX 必不命中
+ * - 位图按 target 首次使用时扫描一次（ARGS_NAME/ARGS_VALUE 为全部参数名/值的并集，HEADER 按槽位）
+ * - subject 为 NULL 时（ARGS_NAME/ARGS_VALUE）使用 ctx->args
+ * - 返回 1 需继续匹配，0 可直接判定未命中；分配失败时不做预筛
+ */
+static ngx_uint_t waf_bytes_candidate(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
+                                      waf_compiled_snapshot_t *snap, waf_compiled_rule_t *rule,
+                                      const ngx_str_t *subject)
+{
+  /* 位图基于默认检测视图；除小写外的变换会改变特殊字节，此时不做预筛 */
+  if (waf_byteset_empty(&rule->required_bytes) || (rule->transform & ~WAF_TF_LOWERCASE)) {
+    return 1;
+  }
+
+  waf_byteset_t *have;
+  if (rule->target == WAF_T_HEADER) {
+    ngx_uint_t n = snap->header_slots ? snap->header_slots->nelts : 0;
+    if (rule->header_slot >= n || subject == NULL) {
+      return 1;
+    }
+    if (ctx->header_bytes == NULL) {
+      ctx->header_bytes = ngx_pcalloc(r->pool, n * sizeof(waf_byteset_t));
+      ctx->header_bytes_ready = ngx_pcalloc(r->pool, n);
+      if (ctx->header_bytes == NULL || ctx->header_bytes_ready == NULL) {
+        ctx->header_bytes = NULL;
+        return 1;
+      }
+    }
+    have = &ctx->header_bytes[rule->header_slot];
+    if (!ctx->header_bytes_ready[rule->header_slot]) {
+      waf_simd_byteset(subject->data, subject->len, have);
+      ctx->header_bytes_ready[rule->header_slot] = 1;
+    }
+    return waf_byteset_covers(have, &rule->required_bytes);
+  }
+
+  have = &ctx->target_bytes[rule->target];
+  if (!(ctx->target_bytes_ready & ((ngx_uint_t)1 << rule->target))) {
+    if (subject != NULL) {
+      waf_simd_byteset(subject->data, subject->len, have);
+    } else if (ctx->args != NULL) {
+      waf_arg_t *a = ctx->args->elts;
+      for (ngx_uint_t k = 0; k < ctx->args->nelts; k++) {
+        if (rule->target == WAF_T_ARGS_NAME) {
+          waf_simd_byteset(a[k].name.data, a[k].name.len, have);
+        } else if (a[k].has_value) {
+          waf_simd_byteset(a[k].value.data, a[k].value.len, have);
+        }
+      }
+    } else {
+      return 1;
+    }
+    ctx->target_bytes_ready |= (ngx_uint_t)1 << rule->target;
+  }
+  return waf_byteset_covers(have, &rule->required_bytes);
+}
+
+/* 限额事件的 target 标签 */
+static const char *waf_limit_target_tag(ngx_uint_t target)
+{
+  switch (target) {
+    case WAF_T_URI:
+      return "uri";
+    case WAF_T_ARGS_COMBINED:
+      return "args";
+    case WAF_T_ARGS_NAME:
+      return "argsName";
+    case WAF_T_ARGS_VALUE:
+      return "argsValue";
+    case WAF_T_HEADER:
+      return "header";
+    case WAF_T_BODY:
+      return "body";
+    default:
+      return NULL;
+  }
+}
+
+/* 规则的检测对象是否被 waf_inspect_limit 截断（结构性规则按原始度量计算，不受影响） */
+static ngx_uint_t waf_limit_clipped(ngx_http_waf_ctx_t *ctx, waf_compiled_rule_t *rule)
+{
+  if (waf_match_is_structural(rule->match)) {
+    return 0;
+  }
+  if (rule->target == WAF_T_HEADER) {
+    return (ctx->header_clipped != NULL && ctx->header_clipped[rule->header_slot])
+               ? WAF_LIMIT_INSPECT
+               : 0;
+  }
+  return (ctx->limit_clipped & WAF_TARGET_BIT(rule->target)) ? WAF_LIMIT_INSPECT : 0;
+}
+
+/*
+ * 检测限额处置：rule 的检测对象被截断，或其正则触达 PCRE 限额（hit）时调用；
+ * 每种限额每请求只上报一次 inspect_limit 事件，事件与拦截均归属 rule 本身
+ * - waf_limit_verdict open：仅记录，按已检测部分的结果继续
+ * - waf_limit_verdict closed：以当前规则拦截；BYPASS 规则不拦截，只检测了部分内容的白名单按未命中处理
+ * - *limited 置 1 表示 closed 下本条规则的命中不可采信
+ */
+static waf_rc_e waf_limit_apply(ngx_http_request_t *r, ngx_http_waf_main_conf_t *mcf,
+                                ngx_http_waf_loc_conf_t *lcf, ngx_http_waf_ctx_t *ctx,
+                                waf_compiled_rule_t *rule, ngx_uint_t hit, ngx_uint_t *limited)
+{
+  *limited = 0;
+  ngx_uint_t pending = hit | waf_limit_clipped(ctx, rule);
+  if (pending == 0) {
+    return WAF_RC_CONTINUE;
+  }
+
+  ngx_uint_t closed = (lcf->limit_verdict == WAF_LIMIT_VERDICT_CLOSED);
+  const char *verdict = closed ? "closed" : "open";
+  const char *tag = waf_limit_target_tag(rule->target);
+  ngx_uint_t fresh = pending & ~ctx->limit_reported;
+  ctx->limit_reported |= pending;
+
+  if (fresh & WAF_LIMIT_INSPECT) {
+    waf_log_append_limit_event(r, mcf, ctx, "inspectBytes", rule->id, tag, verdict,
+                               WAF_LOG_COLLECT_ALWAYS, WAF_LOG_ALERT);
+  }
+  if (fresh & WAF_LIMIT_PCRE) {
+    waf_log_append_limit_event(r, mcf, ctx, "pcre", rule->id, tag, verdict,
+                               WAF_LOG_COLLECT_ALWAYS, WAF_LOG_ALERT);
+  }
+  if (fresh) {
+    ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                  "waf: inspection limit reached rule=%ui kinds=%ui verdict=%s",
+                  (ngx_uint_t)rule->id, fresh, verdict);
+  }
+
+  if (!closed) {
+    return WAF_RC_CONTINUE;
+  }
+  *limited = 1;
+  if (rule->action == WAF_ACT_BYPASS) {
+    return WAF_RC_CONTINUE;
+  }
+  waf_event_details_t det = {0};
+  det.target_tag = tag;
+  det.rule_tags = rule->tags;
+  return waf_enforce_block(r, mcf, lcf, ctx, NGX_HTTP_FORBIDDEN, rule->id, 0, &det);
+}
+
 static waf_rc_e waf_stage_uri_allow(ngx_http_request_t *r, ngx_http_waf_main_conf_t *mcf,
                                     ngx_http_waf_loc_conf_t *lcf, ngx_http_waf_ctx_t *ctx)
 {
@@ -406,8 +933,17 @@ static waf_rc_e waf_stage_uri_allow(ngx_http_request_t *r, ngx_http_waf_main_con
     return WAF_RC_CONTINUE;
   }
 
-  /* 获取请求URI */
-  ngx_str_t *uri = &r->uri;
+  /* 获取请求URI（默认检测视图，受 waf_inspect_limit 约束；规则声明 transform 时取对应变体） */
+  ngx_str_t uri_view = r->uri;
+  if (waf_inspect_clip(r, &uri_view)) {
+    ctx->limit_clipped |= WAF_TARGET_BIT(WAF_T_URI);
+  }
+  ngx_str_t *uri = &uri_view;
+
+  /* CONTAINS 命中表（首条 CONTAINS 规则时对 URI 一次性扫描） */
+  u_char *contains_hits = NULL;
+  /* REGEX 因子命中表（首条带因子的 REGEX 规则时扫描） */
+  u_char *regex_hits = NULL;
 
   /* 遍历规则匹配 */
   waf_compiled_rule_t **rule_ptrs = rules->elts;
@@ -418,388 +954,1511 @@ static waf_rc_e waf_stage_uri_allow(ngx_http_request_t *r, ngx_http_waf_main_con
     }
 
     ngx_uint_t matched = 0;
+    ngx_uint_t hit = 0; /* 本条规则触达的 WAF_LIMIT_* 位 */
+    waf_regex_limits_t lim = {lcf->pcre_match_limit, lcf->pcre_depth_limit, rule->inspect_limit};
+    ngx_str_t subj;
+    if (waf_ctx_variant(r, ctx, WAF_T_URI, 0, rule->transform, uri, &subj) != NGX_OK) {
+      return WAF_RC_ERROR;
+    }
 
     /* 根据match类型进行匹配 */
-    if (rule->match == WAF_MATCH_CONTAINS) {
-      /* CONTAINS模式：子串匹配 */
-      if (rule->patterns && rule->patterns->nelts > 0) {
-        ngx_str_t *pats = rule->patterns->elts;
-        for (ngx_uint_t j = 0; j < rule->patterns->nelts; j++) {
-          if (ngx_http_waf_contains_ci(uri, &pats[j], rule->caseless)) {
-            matched = 1;
-            break;
-          }
-        }
+    if (waf_match_is_structural(rule->match)) {
+      ngx_int_t sm = waf_structural_match(r, ctx, lcf->compiled, rule);
+      if (sm == NGX_ERROR) {
+        return WAF_RC_ERROR;
       }
-    } else if (rule->match == WAF_MATCH_EXACT) {
-      /* EXACT模式：精确匹配 */
-      if (rule->patterns && rule->patterns->nelts > 0) {
-        ngx_str_t *pats = rule->patterns->elts;
-        for (ngx_uint_t j = 0; j < rule->patterns->nelts; j++) {
-          if (ngx_http_waf_equals_ci(uri, &pats[j], rule->caseless)) {
-            matched = 1;
-            break;
-          }
+      matched = (ngx_uint_t)sm;
+    } else if (rule->match == WAF_MATCH_CONTAINS) {
+      /* CONTAINS模式：子串匹配（桶级 AC 自动机） */
+      if (contains_hits == NULL) {
+        contains_hits = waf_contains_prescan(r, ctx, lcf->compiled, WAF_PHASE_URI_ALLOW, WAF_T_URI, uri);
+        if (contains_hits == NULL) {
+          return WAF_RC_ERROR;
         }
       }
+      matched = contains_hits[i];
+    } else if (rule->match == WAF_MATCH_EXACT) {
+      /* EXACT模式：精确匹配（编译期哈希集合） */
+      matched = waf_strset_contains(rule->exact_set, &subj);
     } else if (rule->match == WAF_MATCH_REGEX) {
       /* REGEX模式：正则匹配 */
       if (rule->compiled_regexes && rule->compiled_regexes->nelts > 0) {
-        matched = ngx_http_waf_regex_any_match(rule->compiled_regexes, uri);
+        ngx_int_t cand = waf_regex_candidate(r, ctx, lcf->compiled, WAF_PHASE_URI_ALLOW, WAF_T_URI, uri,
+                                             rule, i, &regex_hits);
+        if (cand == NGX_ERROR) {
+          return WAF_RC_ERROR;
+        }
+        if (cand) {
+          matched = ngx_http_waf_regex_any_match(rule->compiled_regexes, &subj, &lim, &hit);
+        }
       }
     }
 
+    /* uri_allow 只产生 BYPASS：限额只记录不拦截，closed 下截断的白名单按未命中处理 */
+    ngx_uint_t limited = 0;
+    waf_rc_e lrc = waf_limit_apply(r, mcf, lcf, ctx, rule, hit, &limited);
+    if (lrc != WAF_RC_CONTINUE) {
+      return lrc;
+    }
+
     /* 应用negate */
     ngx_uint_t matched_pre = matched;
     if (rule->negate) {
       matched = matched ? 0 : 1;
     }
+    if (limited && rule->action == WAF_ACT_BYPASS) {
+      matched = 0;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
+                  "waf-debug: uri_allow check rule=%ui matchedPre=%ui negate=%ui matchedFinal=%ui action=%ui",
+                  (ngx_uint_t)rule->id, matched_pre, (ngx_uint_t)rule->negate, matched, (ngx_uint_t)rule->action);
+
+    if (!matched) {
+      continue;
+    }
+
+    /* 命中uri_allow规则：BYPASS */
+    if (rule->action == WAF_ACT_BYPASS) {
+      waf_event_details_t det = {0};
+      det.target_tag = "uri";
+      det.negate = rule->negate;
+      det.rule_tags = rule->tags;
+      waf_final_action_type_e hint = WAF_FINAL_ACTION_TYPE_BYPASS_BY_URI_WHITELIST;
+      return waf_enforce_bypass(r, mcf, lcf, ctx, rule->id, &det, &hint);
+    }
+  }
+
+  return WAF_RC_CONTINUE;
+}
+
+/*
+ * detect 段单条规则命中后的处置：应用 negate 后按 action 执法，返回 WAF_RC_CONTINUE 表示继续遍历
+ * hit 为本条规则评估期间触达的 WAF_LIMIT_* 位（PCRE 限额、规则级 inspect_limit）
+ */
+static waf_rc_e waf_detect_apply(ngx_http_request_t *r, ngx_http_waf_main_conf_t *mcf,
+                                 ngx_http_waf_loc_conf_t *lcf, ngx_http_waf_ctx_t *ctx,
+                                 waf_compiled_rule_t *rule, ngx_uint_t matched, ngx_uint_t hit)
+{
+  /* 本条规则的检测对象截断或评估期间触达的限额先行处置（closed 时直接拦截） */
+  ngx_uint_t limited = 0;
+  waf_rc_e lrc = waf_limit_apply(r, mcf, lcf, ctx, rule, hit, &limited);
+  if (lrc != WAF_RC_CONTINUE) {
+    return lrc;
+  }
+
+  /* 应用 negate */
+  if (rule->negate) {
+    matched = matched ? 0 : 1;
+  }
+  if (limited && rule->action == WAF_ACT_BYPASS) {
+    matched = 0;
+  }
+
+  if (!matched) {
+    return WAF_RC_CONTINUE;
+  }
+
+  /* 命中后执法：DENY/BYPASS/LOG */
+  switch (rule->action) {
+    case WAF_ACT_DENY: {
+      ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
+                    "waf-debug: enforce DENY rule=%ui target=%ui negate=%ui",
+                    (ngx_uint_t)rule->id, (ngx_uint_t)rule->target, (ngx_uint_t)rule->negate);
+      waf_event_details_t det = {0};
+      det.target_tag = (rule->target == WAF_T_URI)
+                            ? "uri"
+                            : (rule->target == WAF_T_ARGS_COMBINED)
+                                  ? "args"
+                                  : (rule->target == WAF_T_ARGS_NAME)
+                                        ? "argsName"
+                                  : (rule->target == WAF_T_ARGS_VALUE)
+                                              ? "argsValue"
+                                              : (rule->target == WAF_T_HEADER)
+                                                    ? (const char *)"header"
+                                                    : NULL;
+      det.negate = rule->negate;
+      det.rule_tags = rule->tags;
+
+      waf_rc_e rc = waf_enforce_block(r, mcf, lcf, ctx, NGX_HTTP_FORBIDDEN, rule->id,
+                                      (ngx_uint_t)(rule->score > 0 ? rule->score : 0), &det);
+      if (rc == WAF_RC_BLOCK || rc == WAF_RC_BYPASS || rc == WAF_RC_ERROR) {
+        return rc;
+      }
+      /* 继续遍历后续规则 */
+      break;
+    }
+    case WAF_ACT_BYPASS: {
+      ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
+                    "waf-debug: enforce BYPASS rule=%ui target=%ui negate=%ui",
+                    (ngx_uint_t)rule->id, (ngx_uint_t)rule->target, (ngx_uint_t)rule->negate);
+      waf_event_details_t det2 = {0};
+      det2.target_tag = (rule->target == WAF_T_URI)
+                            ? "uri"
+                            : (rule->target == WAF_T_ARGS_COMBINED)
+                                  ? "args"
+                                  : (rule->target == WAF_T_ARGS_NAME)
+                                        ? "argsName"
+                                        : (rule->target == WAF_T_ARGS_VALUE)
+                                              ? "argsValue"
+                                              : (rule->target == WAF_T_HEADER)
+                                                    ? (const char *)"header"
+                                                    : NULL;
+      det2.negate = rule->negate;
+      det2.rule_tags = rule->tags;
+      waf_final_action_type_e bypass_hint = WAF_FINAL_ACTION_TYPE_BYPASS_BY_URI_WHITELIST;
+
+      waf_rc_e rc = waf_enforce_bypass(r, mcf, lcf, ctx, rule->id, &det2, &bypass_hint);
+      if (rc == WAF_RC_BLOCK || rc == WAF_RC_BYPASS || rc == WAF_RC_ERROR) {
+        return rc;
+      }
+      /* 继续遍历后续规则 */
+      break;
+    }
+    case WAF_ACT_LOG:
+    default: {
+      ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
+                    "waf-debug: enforce LOG rule=%ui target=%ui negate=%ui",
+                    (ngx_uint_t)rule->id, (ngx_uint_t)rule->target, (ngx_uint_t)rule->negate);
+      waf_event_details_t det3 = {0};
+      det3.target_tag = (rule->target == WAF_T_URI)
+                            ? "uri"
+                            : (rule->target == WAF_T_ARGS_COMBINED)
+                                  ? "args"
+                                  : (rule->target == WAF_T_ARGS_NAME)
+                                        ? "argsName"
+                                        : (rule->target == WAF_T_ARGS_VALUE)
+                                              ? "argsValue"
+                                              : (rule->target == WAF_T_HEADER)
+                                                    ? (const char *)"header"
+                                                    : NULL;
+      det3.negate = rule->negate;
+      det3.rule_tags = rule->tags;
+
+      waf_enforce_log(r, mcf, lcf, ctx, rule->id,
+                      (ngx_uint_t)(rule->score > 0 ? rule->score : 0), &det3);
+      /* 继续遍历后续规则 */
+      break;
+    }
+  }
+
+  return WAF_RC_CONTINUE;
+}
+
+/* 时间片计时：ngx_current_msec 在一轮事件循环内不前进，需直接读取时钟 */
+static ngx_msec_t waf_slice_clock(void)
+{
+#if (NGX_HAVE_CLOCK_MONOTONIC)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ngx_msec_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#else
+  struct timeval tv;
+  ngx_gettimeofday(&tv);
+  return (ngx_msec_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#endif
+}
+
+/* 请求在让出期间被终止时，随请求 pool 销毁撤销尚未触发的续跑事件 */
+static void waf_detect_ev_cleanup(void *data)
+{
+  ngx_event_t *ev = data;
+  if (ev->posted) {
+    ngx_delete_posted_event(ev);
+  }
+  if (ev->timer_set) {
+    ngx_del_timer(ev);
+  }
+}
+
+/*
+ * detect 段让出：续跑事件投递到下一轮事件循环（同一轮的 posted 队列会被立即清空，故用 next 队列），
+ * 并持有一个 r->main->count 保证请求存活，续跑时归还
+ * - 让出期间写事件处理器换成空处理器：否则续跑前到达的写事件会经 ngx_http_core_run_phases
+ *   重入 access 阶段，再次执行各阶段并重复投递/计数；续跑时恢复
+ */
+static waf_rc_e waf_detect_yield(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx)
+{
+  if (ctx->detect_yielded) {
+    return WAF_RC_ASYNC; /* 续跑事件已在队列中，不重复持有引用 */
+  }
+
+  if (!ctx->detect_ev_ready) {
+    ngx_pool_cleanup_t *cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+      return WAF_RC_ERROR;
+    }
+    cln->handler = waf_detect_ev_cleanup;
+    cln->data = &ctx->detect_ev;
+    ctx->detect_ev.handler = ngx_http_waf_detect_resume_handler;
+    ctx->detect_ev.data = r;
+    ctx->detect_ev.log = r->connection->log;
+    ctx->detect_ev_ready = 1;
+  }
+
+  r->main->count++;
+  ctx->detect_yielded = 1;
+  r->write_event_handler = ngx_http_request_empty_handler;
+#if (nginx_version >= 1017005)
+  ngx_post_event(&ctx->detect_ev, &ngx_posted_next_events);
+#else
+  ngx_add_timer(&ctx->detect_ev, 1);
+#endif
+  return WAF_RC_ASYNC;
+}
+
+/*
+ * detect 段：可续跑
+ * - 配置 waf_detect_slice_time / waf_detect_slice_bytes 时，预算用尽即在规则边界保存
+ *   (target, 规则下标, 预扫描命中表) 到 ctx 并返回 WAF_RC_ASYNC，下一轮事件循环从断点继续
+ * - 每片至少评估一条规则，保证推进；单条规则内部（一次 AC/PCRE 扫描）不可切分
+ */
+static waf_rc_e waf_stage_detect_bundle(ngx_http_request_t *r, ngx_http_waf_main_conf_t *mcf,
+                                        ngx_http_waf_loc_conf_t *lcf, ngx_http_waf_ctx_t *ctx)
+{
+  /* 最小实现：遍历 detect 段 buckets，支持
+   * URI/ARGS_COMBINED/ARGS_NAME/ARGS_VALUE/HEADER 的 CONTAINS/REGEX 匹配 */
+  if (lcf == NULL || lcf->compiled == NULL) {
+    return WAF_RC_CONTINUE;
+  }
+
+  waf_compiled_snapshot_t *snap = lcf->compiled;
+  if (snap->targets[WAF_PHASE_DETECT] == 0) {
+    return WAF_RC_CONTINUE;
+  }
+
+  /*
+   * 各 target 的默认检测视图与变体均缓存在 ctx：
+   * 预扫描（AC/因子/字节位图）传入默认视图 base，按规则/分组的 transform 取变体；
+   * EXACT/REGEX 直接匹配变体 subj
+   */
+
+  /* COUNT/LENGTH 规则先行：仅整数比较，超限请求在内容扫描（及请求体读取）前即可拦截 */
+  if (snap->structural_rules[WAF_PHASE_DETECT] && !ctx->detect_structural_done) {
+    for (ngx_uint_t target = 0; target <= WAF_T_HEADER; target++) {
+      ngx_array_t *bucket = snap->buckets[WAF_PHASE_DETECT][target];
+      if (bucket == NULL)
+        continue;
+      waf_compiled_rule_t **rules = bucket->elts;
+      for (ngx_uint_t i = 0; i < bucket->nelts; i++) {
+        if (rules[i] == NULL || !waf_match_is_structural(rules[i]->match))
+          continue;
+        ngx_int_t sm = waf_structural_match(r, ctx, snap, rules[i]);
+        if (sm == NGX_ERROR) {
+          return WAF_RC_ERROR;
+        }
+        waf_rc_e rc = waf_detect_apply(r, mcf, lcf, ctx, rules[i], (ngx_uint_t)sm, 0);
+        if (rc != WAF_RC_CONTINUE) {
+          return rc;
+        }
+      }
+    }
+  }
+  ctx->detect_structural_done = 1;
+
+  /* 流式请求体检测进行中：先评估 BODY 之前的 target（此时不切片，让出即表示停在 BODY） */
+  ngx_flag_t streaming = (ctx->body_stream != NULL && !ctx->body_stream_done);
+
+  /* 本片预算（续跑时重新计起） */
+  ngx_msec_t slice_start = lcf->detect_slice_time ? waf_slice_clock() : 0;
+  size_t slice_bytes = 0;
+  ngx_uint_t slice_evaluated = 0;
+
+  /* 遍历 detect 段各 target 的桶（结构性规则已在上面评估；续跑时从断点开始） */
+  for (ngx_uint_t target = ctx->detect_target; target <= WAF_T_HEADER; target++) {
+    ngx_array_t *bucket = snap->buckets[WAF_PHASE_DETECT][target];
+    if (bucket == NULL || bucket->nelts == 0)
+      continue;
+
+    /* BODY 及其后的 target 待请求体读完、流式结果就绪后从这里续跑 */
+    if (streaming && target == WAF_T_BODY) {
+      ctx->detect_target = target;
+      ctx->detect_rule = 0;
+      ctx->detect_contains_hits = NULL;
+      ctx->detect_regex_hits = NULL;
+      return WAF_RC_ASYNC;
+    }
+
+    ngx_uint_t start = 0;
+    /* CONTAINS 命中表：桶内首条 CONTAINS 规则触发一次性预扫描 */
+    u_char *contains_hits = NULL;
+    /* REGEX 因子命中表：桶内首条带因子的 REGEX 规则触发一次性预扫描 */
+    u_char *regex_hits = NULL;
+    if (target == ctx->detect_target) {
+      start = ctx->detect_rule;
+      contains_hits = ctx->detect_contains_hits;
+      regex_hits = ctx->detect_regex_hits;
+    }
+    if (target == WAF_T_BODY) {
+      /* 流式检测或缓冲链预扫描已得到的 AC/因子命中 */
+      contains_hits = contains_hits ? contains_hits : ctx->body_contains_hits;
+      regex_hits = regex_hits ? regex_hits : ctx->body_regex_hits;
+    }
+
+    waf_compiled_rule_t **rules = bucket->elts;
+    for (ngx_uint_t i = start; i < bucket->nelts; i++) {
+      waf_compiled_rule_t *rule = rules[i];
+      if (rule == NULL)
+        continue;
+      if (waf_match_is_structural(rule->match))
+        continue;
+
+      /* 预算用尽：在规则边界保存断点并让出 */
+      if (slice_evaluated > 0 && !streaming &&
+          ((lcf->detect_slice_bytes && slice_bytes >= lcf->detect_slice_bytes) ||
+           (lcf->detect_slice_time &&
+            waf_slice_clock() - slice_start >= lcf->detect_slice_time))) {
+        ctx->detect_target = target;
+        ctx->detect_rule = i;
+        ctx->detect_contains_hits = contains_hits;
+        ctx->detect_regex_hits = regex_hits;
+        return waf_detect_yield(r, ctx);
+      }
+      slice_evaluated++;
+
+      ngx_uint_t matched = 0;
+      ngx_uint_t hit = 0;   /* 本条规则触达的 WAF_LIMIT_* 位 */
+      size_t charge = 0; /* 本条规则检测的字节数（计入 waf_detect_slice_bytes） */
+      waf_regex_limits_t lim = {lcf->pcre_match_limit, lcf->pcre_depth_limit, rule->inspect_limit};
+
+      switch (rule->target) {
+        case WAF_T_URI: {
+          ngx_str_t base = r->uri;
+          if (waf_inspect_clip(r, &base)) {
+            ctx->limit_clipped |= WAF_TARGET_BIT(WAF_T_URI);
+          }
+          if (!waf_bytes_candidate(r, ctx, snap, rule, &base)) {
+            break;
+          }
+          charge = base.len;
+          ngx_str_t subj;
+          if (waf_ctx_variant(r, ctx, WAF_T_URI, 0, rule->transform, &base, &subj) != NGX_OK) {
+            return WAF_RC_ERROR;
+          }
+          if (rule->match == WAF_MATCH_CONTAINS) {
+            if (contains_hits == NULL) {
+              contains_hits = waf_contains_prescan(r, ctx, snap, WAF_PHASE_DETECT, rule->target, &base);
+              if (contains_hits == NULL) {
+                return WAF_RC_ERROR;
+              }
+            }
+            matched = contains_hits[i];
+          } else if (rule->match == WAF_MATCH_EXACT) {
+            matched = waf_strset_contains(rule->exact_set, &subj);
+          } else if (rule->match == WAF_MATCH_REGEX) {
+            ngx_int_t cand = waf_regex_candidate(r, ctx, snap, WAF_PHASE_DETECT, rule->target, &base,
+                                                 rule, i, &regex_hits);
+            if (cand == NGX_ERROR) {
+              return WAF_RC_ERROR;
+            }
+            matched = cand ? ngx_http_waf_regex_any_match(rule->compiled_regexes, &subj, &lim, &hit)
+                           : 0;
+          }
+          break;
+        }
+
+        case WAF_T_ARGS_COMBINED: {
+          ngx_str_t *combined = waf_ctx_args_combined(r, ctx);
+          if (combined == NULL) {
+            matched = 0;
+            break;
+          }
+          ngx_str_t base = *combined;
+          if (!waf_bytes_candidate(r, ctx, snap, rule, &base)) {
+            break;
+          }
+          charge = base.len;
+          ngx_str_t subj;
+          if (waf_ctx_variant(r, ctx, WAF_T_ARGS_COMBINED, 0, rule->transform, &base, &subj) !=
+              NGX_OK) {
+            return WAF_RC_ERROR;
+          }
+          if (rule->match == WAF_MATCH_CONTAINS) {
+            if (contains_hits == NULL) {
+              contains_hits = waf_contains_prescan(r, ctx, snap, WAF_PHASE_DETECT, rule->target, &base);
+              if (contains_hits == NULL) {
+                return WAF_RC_ERROR;
+              }
+            }
+            matched = contains_hits[i];
+          } else if (rule->match == WAF_MATCH_EXACT) {
+            matched = waf_strset_contains(rule->exact_set, &subj);
+          } else if (rule->match == WAF_MATCH_REGEX) {
+            ngx_int_t cand = waf_regex_candidate(r, ctx, snap, WAF_PHASE_DETECT, rule->target, &base,
+                                                 rule, i, &regex_hits);
+            if (cand == NGX_ERROR) {
+              return WAF_RC_ERROR;
+            }
+            matched = cand ? ngx_http_waf_regex_any_match(rule->compiled_regexes, &subj, &lim, &hit)
+                           : 0;
+          }
+          break;
+        }
+
+        case WAF_T_ARGS_NAME: {
+          if (waf_ctx_args(r, ctx) == NULL) {
+            return WAF_RC_ERROR;
+          }
+          if (!waf_bytes_candidate(r, ctx, snap, rule, NULL)) {
+            break;
+          }
+          charge = r->args.len;
+          ngx_array_t *args = waf_ctx_args_variant(r, ctx, rule->transform);
+          if (args == NULL) {
+            return WAF_RC_ERROR;
+          }
+          if (rule->match == WAF_MATCH_CONTAINS) {
+            if (contains_hits == NULL) {
+              contains_hits = waf_contains_prescan(r, ctx, snap, WAF_PHASE_DETECT, rule->target, NULL);
+              if (contains_hits == NULL) {
+                return WAF_RC_ERROR;
+              }
+            }
+            matched = contains_hits[i];
+          } else if (rule->match == WAF_MATCH_EXACT) {
+            matched = ngx_http_waf_args_iter_exact(args, /*match_name=*/1, rule->exact_set);
+          } else {
+            ngx_int_t cand = 1;
+            if (rule->match == WAF_MATCH_REGEX) {
+              cand = waf_regex_candidate(r, ctx, snap, WAF_PHASE_DETECT, rule->target, NULL, rule, i,
+                                         &regex_hits);
+              if (cand == NGX_ERROR) {
+                return WAF_RC_ERROR;
+              }
+            }
+            if (cand) {
+              matched = ngx_http_waf_args_iter_match(args, /*match_name=*/1, rule->caseless,
+                                                     rule->patterns, rule->compiled_regexes,
+                                                     (rule->match == WAF_MATCH_REGEX), &lim,
+                                                     &hit);
+            }
+          }
+          break;
+        }
+
+        case WAF_T_ARGS_VALUE: {
+          if (waf_ctx_args(r, ctx) == NULL) {
+            return WAF_RC_ERROR;
+          }
+          if (!waf_bytes_candidate(r, ctx, snap, rule, NULL)) {
+            break;
+          }
+          charge = r->args.len;
+          ngx_array_t *args = waf_ctx_args_variant(r, ctx, rule->transform);
+          if (args == NULL) {
+            return WAF_RC_ERROR;
+          }
+          if (rule->match == WAF_MATCH_CONTAINS) {
+            if (contains_hits == NULL) {
+              contains_hits = waf_contains_prescan(r, ctx, snap, WAF_PHASE_DETECT, rule->target, NULL);
+              if (contains_hits == NULL) {
+                return WAF_RC_ERROR;
+              }
+            }
+            matched = contains_hits[i];
+          } else if (rule->match == WAF_MATCH_EXACT) {
+            matched = ngx_http_waf_args_iter_exact(args, /*match_name=*/0, rule->exact_set);
+          } else {
+            ngx_int_t cand = 1;
+            if (rule->match == WAF_MATCH_REGEX) {
+              cand = waf_regex_candidate(r, ctx, snap, WAF_PHASE_DETECT, rule->target, NULL, rule, i,
+                                         &regex_hits);
+              if (cand == NGX_ERROR) {
+                return WAF_RC_ERROR;
+              }
+            }
+            if (cand) {
+              matched = ngx_http_waf_args_iter_match(args, /*match_name=*/0, rule->caseless,
+                                                     rule->patterns, rule->compiled_regexes,
+                                                     (rule->match == WAF_MATCH_REGEX), &lim,
+                                                     &hit);
+            }
+          }
+          break;
+        }
+
+        case WAF_T_HEADER: {
+          /* 缺失的 HEADER 视为空串以参与匹配（支持 ^$ 白名单 + negate 逻辑） */
+          ngx_str_t *hvals = waf_ctx_headers(r, ctx, snap);
+          if (hvals == NULL) {
+            return WAF_RC_ERROR;
+          }
+          ngx_str_t hv = hvals[rule->header_slot];
+          if (hv.data == NULL) {
+            hv.data = (u_char *)"";
+            hv.len = 0;
+          }
+          if (!waf_bytes_candidate(r, ctx, snap, rule, &hv)) {
+            break;
+          }
+          charge = hv.len;
+          ngx_str_t subj;
+          if (waf_ctx_variant(r, ctx, WAF_T_HEADER, rule->header_slot, rule->transform, &hv,
+                              &subj) != NGX_OK) {
+            return WAF_RC_ERROR;
+          }
+          if (rule->match == WAF_MATCH_CONTAINS) {
+            if (contains_hits == NULL) {
+              contains_hits = waf_contains_prescan(r, ctx, snap, WAF_PHASE_DETECT, rule->target, NULL);
+              if (contains_hits == NULL) {
+                return WAF_RC_ERROR;
+              }
+            }
+            matched = contains_hits[i];
+          } else if (rule->match == WAF_MATCH_EXACT) {
+            matched = waf_strset_contains(rule->exact_set, &subj);
+          } else if (rule->match == WAF_MATCH_REGEX) {
+            ngx_int_t cand = waf_regex_candidate(r, ctx, snap, WAF_PHASE_DETECT, rule->target, NULL,
+                                                 rule, i, &regex_hits);
+            if (cand == NGX_ERROR) {
+              return WAF_RC_ERROR;
+            }
+            matched = cand ? ngx_http_waf_regex_any_match(rule->compiled_regexes, &subj, &lim, &hit)
+                           : 0;
+            /* 特判：空串与 ^$ */
+            if (!matched && subj.len == 0 && rule->patterns && rule->patterns->nelts > 0) {
+              ngx_str_t *pats = rule->patterns->elts;
+              for (ngx_uint_t k = 0; k < rule->patterns->nelts; k++) {
+                if (pats[k].len == 2 && pats[k].data && pats[k].data[0] == '^' && pats[k].data[1] == '$') {
+                  matched = 1;
+                  break;
+                }
+              }
+            }
+          }
+          break;
+        }
+
+        case WAF_T_CLIENT_IP: {
+          /* CLIENT_IP 匹配由专门阶段处理（IP allow/deny），此处跳过 */
+          matched = 0;
+          break;
+        }
+
+        case WAF_T_BODY: {
+          if (ctx->body_matched != NULL && ctx->body_matched[i] != WAF_BODY_DEFERRED) {
+            /* 已在线程池或流式阶段完成匹配：此处只取结果，处置仍按桶序在事件循环线程进行 */
+            if (ctx->body_matched[i] == WAF_BODY_APPLIED) {
+              continue;
+            }
+            matched = ctx->body_matched[i];
+            hit = ctx->body_limits[i];
+            break;
+          }
+          /*
+           * 预筛结果已就绪（流式阶段推迟的 REGEX，或缓冲链预扫描）：先用字节位图与 AC/因子命中判定，
+           * CONTAINS 直接得出结论，其余通过预筛后才构建完整检测视图
+           */
+          if (ctx->body_regex_hits != NULL) {
+            if (!waf_bytes_candidate(r, ctx, snap, rule, NULL)) {
+              break;
+            }
+            if (rule->match == WAF_MATCH_CONTAINS) {
+              matched = contains_hits[i];
+              break;
+            }
+            if (rule->match == WAF_MATCH_REGEX && rule->regex_factors != NULL && !regex_hits[i]) {
+              break;
+            }
+          }
+          if (!waf_ctx_body(r, ctx)) {
+            matched = 0;
+            break;
+          }
+          ngx_str_t body_view = ctx->body_view;
+          if (!waf_bytes_candidate(r, ctx, snap, rule, &body_view)) {
+            break;
+          }
+          charge = body_view.len;
+          ngx_str_t subj;
+          if (waf_ctx_variant(r, ctx, WAF_T_BODY, 0, rule->transform, &body_view, &subj) !=
+              NGX_OK) {
+            return WAF_RC_ERROR;
+          }
+          if (rule->match == WAF_MATCH_CONTAINS) {
+            if (contains_hits == NULL) {
+              contains_hits = waf_contains_prescan(r, ctx, snap, WAF_PHASE_DETECT, rule->target, &body_view);
+              if (contains_hits == NULL) {
+                return WAF_RC_ERROR;
+              }
+            }
+            matched = contains_hits[i];
+          } else if (rule->match == WAF_MATCH_EXACT) {
+            matched = waf_strset_contains(rule->exact_set, &subj);
+          } else if (rule->match == WAF_MATCH_REGEX) {
+            ngx_int_t cand = waf_regex_candidate(r, ctx, snap, WAF_PHASE_DETECT, rule->target, &body_view,
+                                                 rule, i, &regex_hits);
+            if (cand == NGX_ERROR) {
+              return WAF_RC_ERROR;
+            }
+            matched = cand ? ngx_http_waf_regex_any_match(rule->compiled_regexes, &subj, &lim, &hit)
+                           : 0;
+          }
+          break;
+        }
+
+        default: {
+          matched = 0;
+          break;
+        }
+      }
+
+      slice_bytes += charge;
+
+      waf_rc_e rc = waf_detect_apply(r, mcf, lcf, ctx, rule, matched, hit);
+      if (rc != WAF_RC_CONTINUE) {
+        return rc;
+      }
+    }
+  }
+
+  return WAF_RC_CONTINUE;
+}
+
+#if (NGX_THREADS)
+
+/*
+ * BODY 规则线程池任务：只读快照 + 任务私有 pool 中的检测视图副本，不触碰请求 ctx
+ * - 与事件循环线程的 BODY 分支等价：字节类预筛、变换变体、AC/因子预扫描、EXACT、REGEX（含限额）
+ * - 输出为各规则 negate 前的命中与限额位，写入请求 pool 中预先分配的数组
+ */
+typedef struct {
+  ngx_http_request_t *r;
+  waf_compiled_snapshot_t *snap;
+  ngx_pool_t *pool;       /* 任务私有：视图副本、变体、命中表、PCRE 执行状态 */
+  ngx_str_t body;         /* 检测视图副本 */
+  ngx_array_t *variants;  /* ngx_array_t(waf_variant_t)，仅 BODY */
+  ngx_uint_t match_limit;
+  ngx_uint_t depth_limit;
+  u_char *matched;
+  u_char *limits;
+  ngx_int_t rc;
+} waf_body_task_t;
+
+static ngx_int_t waf_body_task_variant(waf_body_task_t *t, ngx_uint_t transform, ngx_str_t *out)
+{
+  if (transform == 0) {
+    *out = t->body;
+    return NGX_OK;
+  }
+  waf_variant_t *v = t->variants->elts;
+  for (ngx_uint_t k = 0; k < t->variants->nelts; k++) {
+    if (v[k].transform == transform) {
+      *out = v[k].value;
+      return NGX_OK;
+    }
+  }
+  waf_variant_t *nv = ngx_array_push(t->variants);
+  if (nv == NULL) {
+    return NGX_ERROR;
+  }
+  ngx_memzero(nv, sizeof(*nv));
+  nv->target = WAF_T_BODY;
+  nv->transform = transform;
+  if (ngx_http_waf_transform(t->pool, transform, &t->body, &nv->value) != NGX_OK) {
+    t->variants->nelts--;
+    return NGX_ERROR;
+  }
+  *out = nv->value;
+  return NGX_OK;
+}
+
+static u_char *waf_body_task_prescan(waf_body_task_t *t, ngx_array_t *groups, ngx_uint_t n)
+{
+  u_char *hits = ngx_pcalloc(t->pool, n);
+  if (hits == NULL || groups == NULL) {
+    return hits;
+  }
+  waf_ac_group_t *g = groups->elts;
+  for (ngx_uint_t k = 0; k < groups->nelts; k++) {
+    ngx_str_t v;
+    if (waf_body_task_variant(t, g[k].transform, &v) != NGX_OK) {
+      return NULL;
+    }
+    waf_ac_scan(g[k].ac, v.data, v.len, hits);
+  }
+  return hits;
+}
+
+/* 线程池中执行 */
+static void waf_body_task_handler(void *data, ngx_log_t *log)
+{
+  waf_body_task_t *t = data;
+  ngx_array_t *bucket = t->snap->buckets[WAF_PHASE_DETECT][WAF_T_BODY];
+  waf_compiled_rule_t **rules = bucket->elts;
+  ngx_uint_t n = bucket->nelts;
+
+  t->rc = NGX_ERROR;
+  t->variants = ngx_array_create(t->pool, 2, sizeof(waf_variant_t));
+  waf_regex_limits_t lim = {t->match_limit, t->depth_limit, 0, NULL};
+  lim.exec = ngx_http_waf_regex_exec_create(t->pool);
+  if (t->variants == NULL || lim.exec == NULL) {
+    return;
+  }
+
+  waf_byteset_t have;
+  ngx_memzero(&have, sizeof(have));
+  waf_simd_byteset(t->body.data, t->body.len, &have);
+
+  u_char *contains_hits =
+      waf_body_task_prescan(t, t->snap->contains_groups[WAF_PHASE_DETECT][WAF_T_BODY], n);
+  u_char *regex_hits =
+      waf_body_task_prescan(t, t->snap->regex_groups[WAF_PHASE_DETECT][WAF_T_BODY], n);
+  if (contains_hits == NULL || regex_hits == NULL) {
+    return;
+  }
+
+  for (ngx_uint_t i = 0; i < n; i++) {
+    waf_compiled_rule_t *rule = rules[i];
+    if (rule == NULL || waf_match_is_structural(rule->match)) {
+      continue;
+    }
+    if (!waf_byteset_empty(&rule->required_bytes) && !(rule->transform & ~WAF_TF_LOWERCASE) &&
+        !waf_byteset_covers(&have, &rule->required_bytes)) {
+      continue;
+    }
+    ngx_str_t subj;
+    if (waf_body_task_variant(t, rule->transform, &subj) != NGX_OK) {
+      return;
+    }
+    if (rule->match == WAF_MATCH_CONTAINS) {
+      t->matched[i] = contains_hits[i];
+    } else if (rule->match == WAF_MATCH_EXACT) {
+      t->matched[i] = (u_char)waf_strset_contains(rule->exact_set, &subj);
+    } else if (rule->match == WAF_MATCH_REGEX) {
+      if (rule->regex_factors != NULL && !regex_hits[i]) {
+        continue;
+      }
+      ngx_uint_t hit = 0;
+      lim.max_bytes = rule->inspect_limit;
+      t->matched[i] =
+          (u_char)ngx_http_waf_regex_any_match(rule->compiled_regexes, &subj, &lim, &hit);
+      t->limits[i] = (u_char)hit;
+    }
+  }
+
+  t->rc = NGX_OK;
+  (void)log;
+}
+
+/* 任务完成（事件循环线程）：回收私有 pool，挂上结果后经写事件处理器继续请求 */
+static void waf_body_task_done(ngx_event_t *ev)
+{
+  waf_body_task_t *t = ev->data;
+  ngx_http_request_t *r = t->r;
+  ngx_connection_t *c = r->connection;
+  ngx_http_waf_ctx_t *ctx = ngx_http_get_module_ctx(r, ngx_http_waf_module);
+
+  r->main->blocked--;
+  ctx->body_offload_busy = 0;
+  ngx_destroy_pool(t->pool);
+
+  if (t->rc == NGX_OK) {
+    ctx->body_matched = t->matched;
+    ctx->body_limits = t->limits;
+  } else {
+    ngx_log_error(NGX_LOG_WARN, c->log, 0, "waf: body thread task failed; inspect inline");
+  }
+
+  /* 请求在任务期间被终止时，nginx 已把写事件处理器换成 finalizer */
+  r->write_event_handler(r);
+  ngx_http_run_posted_requests(c);
+}
+
+/* 任务期间的写事件处理器：完成前的写事件一律忽略 */
+static void ngx_http_waf_body_offload_handler(ngx_http_request_t *r)
+{
+  ngx_http_waf_ctx_t *ctx = ngx_http_get_module_ctx(r, ngx_http_waf_module);
+  if (ctx->body_offload_busy) {
+    return;
+  }
+  r->write_event_handler = ngx_http_core_run_phases;
+  ngx_http_waf_post_read_body_handler(r);
+}
+
+/*
+ * 按需把 BODY 桶的匹配卸载到 waf_detect_thread_pool
+ * - 仅当配置了线程池、BODY 桶非空且检测视图不小于 min_body 时投递
+ * - 返回 NGX_AGAIN 表示已投递（r->main->blocked 持有至完成），NGX_DECLINED 表示就地检测
+ */
+static ngx_int_t waf_body_offload(ngx_http_request_t *r, ngx_http_waf_loc_conf_t *lcf,
+                                  ngx_http_waf_ctx_t *ctx)
+{
+  if (lcf == NULL || lcf->detect_thread_pool == NULL || lcf->compiled == NULL ||
+      ctx->body_stream != NULL) {
+    return NGX_DECLINED;
+  }
+  ngx_array_t *bucket = lcf->compiled->buckets[WAF_PHASE_DETECT][WAF_T_BODY];
+  if (bucket == NULL || bucket->nelts == 0) {
+    return NGX_DECLINED;
+  }
+  if (ctx->body_regex_hits != NULL && !ctx->body_view_needed) {
+    return NGX_DECLINED; /* 缓冲链预扫描已得出全部结论，无需构建检测视图 */
+  }
+  if (!waf_ctx_body(r, ctx) || ctx->body_view.len < lcf->detect_thread_min_body) {
+    return NGX_DECLINED;
+  }
+
+  ngx_thread_task_t *task = ngx_thread_task_alloc(r->pool, sizeof(waf_body_task_t));
+  if (task == NULL) {
+    return NGX_DECLINED;
+  }
+  waf_body_task_t *t = task->ctx;
+  t->r = r;
+  t->snap = lcf->compiled;
+  t->match_limit = lcf->pcre_match_limit;
+  t->depth_limit = lcf->pcre_depth_limit;
+  t->matched = ngx_pcalloc(r->pool, bucket->nelts);
+  t->limits = ngx_pcalloc(r->pool, bucket->nelts);
+  t->pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, r->connection->log);
+  if (t->matched == NULL || t->limits == NULL || t->pool == NULL) {
+    if (t->pool) {
+      ngx_destroy_pool(t->pool);
+    }
+    return NGX_DECLINED;
+  }
+  t->body.len = ctx->body_view.len;
+  t->body.data = ngx_pnalloc(t->pool, t->body.len);
+  if (t->body.data == NULL) {
+    ngx_destroy_pool(t->pool);
+    return NGX_DECLINED;
+  }
+  ngx_memcpy(t->body.data, ctx->body_view.data, t->body.len);
+
+  task->handler = waf_body_task_handler;
+  task->event.handler = waf_body_task_done;
+  task->event.data = t;
+
+  if (ngx_thread_task_post(lcf->detect_thread_pool, task) != NGX_OK) {
+    ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                  "waf: body thread task post failed; inspect inline");
+    ngx_destroy_pool(t->pool);
+    return NGX_DECLINED;
+  }
+
+  r->main->blocked++;
+  ctx->body_offload_busy = 1;
+  r->write_event_handler = ngx_http_waf_body_offload_handler;
+  return NGX_AGAIN;
+}
+
+#endif
+
+/*
+ * 流式请求体检测（waf_body_stream on）：请求体过滤器逐块推进，BODY 桶结果在读完时即已就绪
+ * - CONTAINS 与 REGEX 因子的 AC 状态跨块延续，跨块边界的字面量与整体扫描一样命中
+ * - 最大匹配宽度不超过窗口的 REGEX 在 [上一块尾部 window 字节 | 本块] 上执行，其余读完后整体匹配
+ * - 内存只与窗口和单块大小相关；可提前拦截的 DENY 规则命中后不再读取剩余请求体
+ */
+typedef struct waf_body_stream_s {
+  ngx_http_request_t *r;
+  ngx_http_waf_main_conf_t *mcf;
+  ngx_http_waf_loc_conf_t *lcf;
+  ngx_array_t *bucket;
+  ngx_flag_t prescan;       /* 缓冲链预扫描：只推进字节位图与 AC 状态，不执行 REGEX、不保留窗口 */
+  ngx_uint_t cut;           /* 桶内首条 BYPASS 内容规则下标：仅其之前的 DENY 规则可提前拦截 */
+  ngx_flag_t form;          /* 检测视图需 +→空格 与 %XX 解码 */
+  ngx_flag_t lower;         /* 有规则/分组扫描 LOWERCASE 变体，需维护小写副本 */
+  ngx_flag_t fresh;         /* 本块出现新命中，待检查提前拦截 */
+  u_char *matched;          /* negate 前的命中（读完后即 ctx->body_matched） */
+  u_char *limits;           /* 触达的 WAF_LIMIT_* 位（读完后即 ctx->body_limits） */
+  u_char *contains_hits;    /* CONTAINS 命中（跨块累积） */
+  u_char *regex_hits;       /* REGEX 因子命中（跨块累积） */
+  uint32_t *contains_state; /* 各 CONTAINS 组的自动机状态 */
+  uint32_t *regex_state;    /* 各因子组的自动机状态 */
+  waf_byteset_t have;       /* 已检测字节的特殊字节位图（跨块累积） */
+  off_t raw;                /* 已收到的原始字节数 */
+  off_t seen;               /* 已检测的视图字节数 */
+  /* waf_inspect_limit：头部之后的原始字节只保留最后 tail_size 字节（环形），读完后补测 */
+  ngx_flag_t limited;
+  size_t head;
+  u_char *tail;
+  size_t tail_size;
+  size_t tail_len;
+  size_t tail_pos;
+  /* form 解码：跨块未完整的 %XX 前缀 */
+  u_char carry[2];
+  size_t carry_len;
+  u_char *dec;
+  size_t dec_size;
+  /* 检测缓冲 [重叠窗口 | 本块] 及其小写副本（预扫描时 low 为 WAF_BODY_PIECE 字节的分段小写缓冲） */
+  u_char *buf;
+  u_char *low;
+  size_t buf_size;
+  size_t win;
+} waf_body_stream_t;
+
+/* 缓冲扩容：保留前 keep 字节；块大小受 client_body_buffer_size 约束，扩容次数有限 */
+static u_char *waf_body_stream_grow(ngx_pool_t *pool, u_char *old, size_t keep, size_t size)
+{
+  u_char *p = ngx_pnalloc(pool, size);
+  if (p == NULL) {
+    return NULL;
+  }
+  if (keep) {
+    ngx_memcpy(p, old, keep);
+  }
+  if (old) {
+    ngx_pfree(pool, old);
+  }
+  return p;
+}
+
+static void waf_body_stream_groups(ngx_array_t *groups, uint32_t *state, const u_char *seg,
+                                   const u_char *low, size_t len, u_char *hits)
+{
+  if (groups == NULL) {
+    return;
+  }
+  waf_ac_group_t *g = groups->elts;
+  for (ngx_uint_t k = 0; k < groups->nelts; k++) {
+    const u_char *p = (g[k].transform & WAF_TF_LOWERCASE) ? low : seg;
+    waf_ac_scan_stream(g[k].ac, p, len, hits, &state[k]);
+  }
+}
+
+/*
+ * REGEX 规则能否在 [重叠窗口 | 本块] 上判定：最大匹配宽度有界且不超过窗口（见 stream_width）；
+ * 其余 REGEX 规则（锚点、环视、无界宽度、negate）在请求体读完后于完整检测视图上匹配
+ */
+static ngx_flag_t waf_body_stream_windowed(waf_body_stream_t *st, waf_compiled_rule_t *rule)
+{
+  return rule->stream_width != 0 && rule->stream_width <= st->lcf->body_stream_window;
+}
+
+/* 预扫描的分段大小：小写副本与 form 解码只经过该大小的缓冲，原始字节（含 mmap 文件段）就地扫描 */
+#define WAF_BODY_PIECE 8192
+
+/* 预扫描一段视图字节：就地累积特殊字节位图并推进各 AC 分组状态 */
+static void waf_body_stream_prescan(waf_body_stream_t *st, const u_char *data, size_t len)
+{
+  waf_compiled_snapshot_t *snap = st->lcf->compiled;
+  ngx_array_t *cg = snap->contains_groups[WAF_PHASE_DETECT][WAF_T_BODY];
+  ngx_array_t *rg = snap->regex_groups[WAF_PHASE_DETECT][WAF_T_BODY];
+
+  waf_simd_byteset(data, len, &st->have);
+  size_t step = st->lower ? WAF_BODY_PIECE : len;
+  for (size_t off = 0; off < len; off += step) {
+    size_t n = ngx_min(len - off, step);
+    if (st->lower) {
+      ngx_strlow(st->low, (u_char *)data + off, n);
+    }
+    waf_body_stream_groups(cg, st->contains_state, data + off, st->low, n, st->contains_hits);
+    waf_body_stream_groups(rg, st->regex_state, data + off, st->low, n, st->regex_hits);
+  }
+}
+
+/* 检测一段视图字节：推进 AC 状态，对未命中的 REGEX 规则在重叠窗口上执行一次 */
+static waf_rc_e waf_body_stream_scan(waf_body_stream_t *st, const u_char *data, size_t len)
+{
+  if (len == 0) {
+    return WAF_RC_CONTINUE;
+  }
+  if (st->prescan) {
+    waf_body_stream_prescan(st, data, len);
+    st->seen += (off_t)len;
+    return WAF_RC_CONTINUE;
+  }
+  ngx_pool_t *pool = st->r->pool;
+  size_t need = st->win + len;
+  if (need > st->buf_size) {
+    st->buf = waf_body_stream_grow(pool, st->buf, st->win, need);
+    st->low = waf_body_stream_grow(pool, st->low, 0, need);
+    if (st->buf == NULL || st->low == NULL) {
+      return WAF_RC_ERROR;
+    }
+    st->buf_size = need;
+  }
+  ngx_memcpy(st->buf + st->win, data, len);
+  if (st->lower) {
+    ngx_strlow(st->low, st->buf, need);
+  }
+
+  u_char *seg = st->buf + st->win;
+  waf_simd_byteset(seg, len, &st->have);
+  waf_compiled_snapshot_t *snap = st->lcf->compiled;
+  waf_body_stream_groups(snap->contains_groups[WAF_PHASE_DETECT][WAF_T_BODY], st->contains_state,
+                         seg, st->low + st->win, len, st->contains_hits);
+  waf_body_stream_groups(snap->regex_groups[WAF_PHASE_DETECT][WAF_T_BODY], st->regex_state, seg,
+                         st->low + st->win, len, st->regex_hits);
+
+  off_t from = st->seen - (off_t)st->win; /* buf[0] 在检测视图中的偏移 */
+  waf_regex_limits_t lim = {st->lcf->pcre_match_limit, st->lcf->pcre_depth_limit, 0, NULL};
+  waf_compiled_rule_t **rules = st->bucket->elts;
+  for (ngx_uint_t i = 0; i < st->bucket->nelts; i++) {
+    waf_compiled_rule_t *rule = rules[i];
+    if (rule == NULL || waf_match_is_structural(rule->match) || st->matched[i]) {
+      continue;
+    }
+    if (rule->match == WAF_MATCH_CONTAINS) {
+      if (st->contains_hits[i]) {
+        st->matched[i] = 1;
+        st->fresh = 1;
+      }
+      continue;
+    }
+    if (!waf_body_stream_windowed(st, rule)) {
+      continue;
+    }
+    if (!waf_byteset_empty(&rule->required_bytes) &&
+        !waf_byteset_covers(&st->have, &rule->required_bytes)) {
+      continue;
+    }
+    if (rule->regex_factors != NULL && !st->regex_hits[i]) {
+      continue;
+    }
+    ngx_str_t subj;
+    subj.data = (rule->transform & WAF_TF_LOWERCASE) ? st->low : st->buf;
+    subj.len = need;
+    if (rule->inspect_limit) {
+      if (st->seen + (off_t)len > (off_t)rule->inspect_limit) {
+        st->limits[i] |= WAF_LIMIT_INSPECT;
+      }
+      if (from >= (off_t)rule->inspect_limit) {
+        continue;
+      }
+      subj.len = ngx_min(need, (size_t)((off_t)rule->inspect_limit - from));
+    }
+    ngx_uint_t hit = 0;
+    if (ngx_http_waf_regex_any_match(rule->compiled_regexes, &subj, &lim, &hit)) {
+      st->matched[i] = 1;
+      st->limits[i] = 0;
+      st->fresh = 1;
+    } else {
+      st->limits[i] |= (u_char)hit;
+    }
+  }
+
+  size_t keep = ngx_min(need, st->lcf->body_stream_window);
+  ngx_memmove(st->buf, st->buf + need - keep, keep);
+  st->win = keep;
+  st->seen += (off_t)len;
+  return WAF_RC_CONTINUE;
+}
+
+/*
+ * form 视图：+→空格 与 %XX 解码；非末块时解码停在块尾未完整的转义前，
+ * 由解码器报告的未消费字节（而非按块尾字节猜测）留到下一块，结果与切分位置无关
+ */
+static waf_rc_e waf_body_stream_decode(waf_body_stream_t *st, const u_char *p, size_t len,
+                                       ngx_flag_t last)
+{
+  if (!st->form) {
+    return waf_body_stream_scan(st, p, len);
+  }
+  if (st->prescan && len > WAF_BODY_PIECE) {
+    /* 预扫描：大段（如 mmap 文件段）分段解码，解码缓冲不随段大小增长 */
+    for (size_t off = 0; off < len; off += WAF_BODY_PIECE) {
+      size_t piece = ngx_min(len - off, WAF_BODY_PIECE);
+      waf_rc_e rc = waf_body_stream_decode(st, p + off, piece, last && off + piece == len);
+      if (rc != WAF_RC_CONTINUE) {
+        return rc;
+      }
+    }
+    return WAF_RC_CONTINUE;
+  }
+  size_t n = st->carry_len + len;
+  if (n == 0) {
+    return WAF_RC_CONTINUE;
+  }
+  if (n > st->dec_size) {
+    st->dec = waf_body_stream_grow(st->r->pool, st->dec, 0, n);
+    if (st->dec == NULL) {
+      return WAF_RC_ERROR;
+    }
+    st->dec_size = n;
+  }
+  ngx_memcpy(st->dec, st->carry, st->carry_len);
+  if (len) {
+    ngx_memcpy(st->dec + st->carry_len, p, len);
+  }
+
+  /* 原地解码只写入已消费区间之前，未消费的块尾字节保持原样 */
+  size_t used = n;
+  size_t out = waf_simd_url_decode(st->dec, st->dec, n, 1, last ? NULL : &used);
+  st->carry_len = n - used;
+  ngx_memcpy(st->carry, st->dec + used, st->carry_len);
+  return waf_body_stream_scan(st, st->dec, out);
+}
+
+/* 头部之后的原始字节写入尾部环形缓冲（只保留最后 tail_size 字节） */
+static void waf_body_stream_ring(waf_body_stream_t *st, const u_char *p, size_t len)
+{
+  if (st->tail_size == 0 || len == 0) {
+    return;
+  }
+  if (len >= st->tail_size) {
+    ngx_memcpy(st->tail, p + len - st->tail_size, st->tail_size);
+    st->tail_pos = 0;
+    st->tail_len = st->tail_size;
+    return;
+  }
+  size_t first = ngx_min(len, st->tail_size - st->tail_pos);
+  ngx_memcpy(st->tail + st->tail_pos, p, first);
+  ngx_memcpy(st->tail, p + first, len - first);
+  st->tail_pos = (st->tail_pos + len) % st->tail_size;
+  st->tail_len = ngx_min(st->tail_len + len, st->tail_size);
+}
+
+/* 一块原始请求体：waf_inspect_limit 的头部直接检测，其余进入尾部缓冲 */
+static waf_rc_e waf_body_stream_raw(waf_body_stream_t *st, const u_char *p, size_t len)
+{
+  size_t n = len;
+  if (st->limited) {
+    n = (st->raw >= (off_t)st->head) ? 0 : ngx_min(len, (size_t)((off_t)st->head - st->raw));
+    waf_body_stream_ring(st, p + n, len - n);
+  }
+  st->raw += (off_t)len;
+  if (st->limited && st->raw > (off_t)st->lcf->inspect_limit) {
+    ngx_http_waf_ctx_t *ctx = ngx_http_get_module_ctx(st->r, ngx_http_waf_module);
+    ctx->limit_clipped |= WAF_TARGET_BIT(WAF_T_BODY);
+  }
+  return waf_body_stream_decode(st, p, n, 0);
+}
+
+/*
+ * 按桶序提前处置新命中的 DENY 规则（negate 规则须读完才能定论，不提前）
+ * 仅限首条 BYPASS 内容规则之前：其余未定论规则只可能追加拦截或日志，不会改变拦截结论
+ */
+static waf_rc_e waf_body_stream_settle(waf_body_stream_t *st)
+{
+  if (!st->fresh) {
+    return WAF_RC_CONTINUE;
+  }
+  st->fresh = 0;
+
+  ngx_http_waf_ctx_t *ctx = ngx_http_get_module_ctx(st->r, ngx_http_waf_module);
+  waf_compiled_rule_t **rules = st->bucket->elts;
+  for (ngx_uint_t i = 0; i < st->cut; i++) {
+    waf_compiled_rule_t *rule = rules[i];
+    if (st->matched[i] != 1 || rule->negate || rule->action != WAF_ACT_DENY) {
+      continue;
+    }
+    waf_rc_e rc = waf_detect_apply(st->r, st->mcf, st->lcf, ctx, rule, 1, st->limits[i]);
+    if (rc != WAF_RC_CONTINUE) {
+      return rc;
+    }
+    st->matched[i] = WAF_BODY_APPLIED;
+  }
+  return WAF_RC_CONTINUE;
+}
+
+/* 预扫描后仍需完整检测视图的规则：EXACT，以及通过字节类与因子预筛的 REGEX */
+static ngx_flag_t waf_body_stream_needs_view(waf_body_stream_t *st)
+{
+  waf_compiled_rule_t **rules = st->bucket->elts;
+  for (ngx_uint_t i = 0; i < st->bucket->nelts; i++) {
+    waf_compiled_rule_t *rule = rules[i];
+    if (rule == NULL || waf_match_is_structural(rule->match) ||
+        rule->match == WAF_MATCH_CONTAINS) {
+      continue;
+    }
+    if (rule->match == WAF_MATCH_REGEX) {
+      if (!waf_byteset_empty(&rule->required_bytes) && !(rule->transform & ~WAF_TF_LOWERCASE) &&
+          !waf_byteset_covers(&st->have, &rule->required_bytes)) {
+        continue;
+      }
+      if (rule->regex_factors != NULL && !st->regex_hits[i]) {
+        continue;
+      }
+    }
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * 请求体读完：补测尾部缓冲与解码余量，BODY 的特殊字节位图与 AC/因子命中挂到 ctx
+ * - 预扫描：只交出预筛结果，规则仍由 detect 段（或线程池）按需在完整检测视图上匹配
+ * - 流式：结果交给 detect 段从 BODY 续跑；不能在窗口上判定的 REGEX 规则记为 WAF_BODY_DEFERRED，
+ *   在完整检测视图上匹配
+ */
+static waf_rc_e waf_body_stream_finish(waf_body_stream_t *st)
+{
+  ngx_http_waf_ctx_t *ctx = ngx_http_get_module_ctx(st->r, ngx_http_waf_module);
+  waf_rc_e rc = WAF_RC_CONTINUE;
+
+  if (st->tail_len) {
+    size_t start = (st->tail_len < st->tail_size) ? 0 : st->tail_pos;
+    size_t first = (st->tail_len < st->tail_size) ? st->tail_len : st->tail_size - start;
+    rc = waf_body_stream_decode(st, st->tail + start, first, 0);
+    if (rc == WAF_RC_CONTINUE) {
+      rc = waf_body_stream_decode(st, st->tail, st->tail_len - first, 0);
+    }
+  }
+  if (rc == WAF_RC_CONTINUE) {
+    rc = waf_body_stream_decode(st, NULL, 0, 1);
+  }
+
+  ctx->target_bytes[WAF_T_BODY] = st->have;
+  ctx->target_bytes_ready |= WAF_TARGET_BIT(WAF_T_BODY);
+  ctx->body_contains_hits = st->contains_hits;
+  ctx->body_regex_hits = st->regex_hits;
+  if (st->prescan) {
+    ctx->body_view_needed = waf_body_stream_needs_view(st);
+    return rc;
+  }
+
+  waf_compiled_rule_t **rules = st->bucket->elts;
+  for (ngx_uint_t i = 0; i < st->bucket->nelts; i++) {
+    if (rules[i] != NULL && rules[i]->match == WAF_MATCH_REGEX &&
+        !waf_body_stream_windowed(st, rules[i])) {
+      st->matched[i] = WAF_BODY_DEFERRED;
+    }
+  }
+
+  ctx->body_matched = st->matched;
+  ctx->body_limits = st->limits;
+  ctx->body_stream_done = 1;
+  return rc;
+}
+
+/* 分配检测状态：流式另需各规则的命中/限额表，预扫描另需固定大小的小写分段缓冲 */
+static waf_body_stream_t *waf_body_stream_new(ngx_http_request_t *r, ngx_http_waf_main_conf_t *mcf,
+                                              ngx_http_waf_loc_conf_t *lcf, ngx_flag_t prescan)
+{
+  waf_compiled_snapshot_t *snap = lcf->compiled;
+  ngx_array_t *bucket = snap->buckets[WAF_PHASE_DETECT][WAF_T_BODY];
+  ngx_uint_t n = bucket->nelts;
+
+  ngx_uint_t cut = n;
+  ngx_flag_t lower = 0;
+  waf_compiled_rule_t **rules = bucket->elts;
+  for (ngx_uint_t i = 0; i < n; i++) {
+    if (rules[i] == NULL || waf_match_is_structural(rules[i]->match)) {
+      continue;
+    }
+    if (rules[i]->action == WAF_ACT_BYPASS && cut == n) {
+      cut = i;
+    }
+    lower |= (rules[i]->transform & WAF_TF_LOWERCASE) ? 1 : 0;
+  }
+
+  waf_body_stream_t *st = ngx_pcalloc(r->pool, sizeof(waf_body_stream_t));
+  if (st == NULL) {
+    return NULL;
+  }
+  ngx_array_t *cg = snap->contains_groups[WAF_PHASE_DETECT][WAF_T_BODY];
+  ngx_array_t *rg = snap->regex_groups[WAF_PHASE_DETECT][WAF_T_BODY];
+  st->r = r;
+  st->mcf = mcf;
+  st->lcf = lcf;
+  st->bucket = bucket;
+  st->prescan = prescan;
+  st->cut = cut;
+  st->form = waf_body_is_form(r);
+  st->lower = lower;
+  st->contains_hits = ngx_pcalloc(r->pool, n);
+  st->regex_hits = ngx_pcalloc(r->pool, n);
+  st->contains_state = ngx_pcalloc(r->pool, (cg ? cg->nelts : 1) * sizeof(uint32_t));
+  st->regex_state = ngx_pcalloc(r->pool, (rg ? rg->nelts : 1) * sizeof(uint32_t));
+  if (st->contains_hits == NULL || st->regex_hits == NULL || st->contains_state == NULL ||
+      st->regex_state == NULL) {
+    return NULL;
+  }
+  if (prescan) {
+    if (lower && (st->low = ngx_pnalloc(r->pool, WAF_BODY_PIECE)) == NULL) {
+      return NULL;
+    }
+  } else {
+    st->matched = ngx_pcalloc(r->pool, n);
+    st->limits = ngx_pcalloc(r->pool, n);
+    if (st->matched == NULL || st->limits == NULL) {
+      return NULL;
+    }
+  }
+  if (lcf->inspect_limit) {
+    st->limited = 1;
+    st->tail_size = lcf->inspect_body_tail;
+    st->head = lcf->inspect_limit - st->tail_size;
+    if (st->tail_size && (st->tail = ngx_pnalloc(r->pool, st->tail_size)) == NULL) {
+      return NULL;
+    }
+  }
+  return st;
+}
+
+/*
+ * 按需启用流式检测（waf_body_stream on）：BODY 桶须可流式（见 body_streamable），边读边测
+ * 长度未知（chunked）时 BODY LENGTH 规则需要完整请求体，仍整体检测
+ */
+static ngx_int_t waf_body_stream_init(ngx_http_request_t *r, ngx_http_waf_main_conf_t *mcf,
+                                      ngx_http_waf_loc_conf_t *lcf, ngx_http_waf_ctx_t *ctx)
+{
+  if (lcf == NULL || lcf->compiled == NULL || !lcf->compiled->body_streamable ||
+      !lcf->body_stream || r->request_body != NULL) {
+    return NGX_DECLINED;
+  }
+  ngx_array_t *bucket = lcf->compiled->buckets[WAF_PHASE_DETECT][WAF_T_BODY];
+  waf_compiled_rule_t **rules = bucket->elts;
+  for (ngx_uint_t i = 0; i < bucket->nelts; i++) {
+    if (rules[i] != NULL && waf_match_is_structural(rules[i]->match) &&
+        r->headers_in.content_length_n < 0) {
+      return NGX_DECLINED;
+    }
+  }
 
-    ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
-                  "waf-debug: uri_allow check rule=%ui matchedPre=%ui negate=%ui matchedFinal=%ui action=%ui",
-                  (ngx_uint_t)rule->id, matched_pre, (ngx_uint_t)rule->negate, matched, (ngx_uint_t)rule->action);
+  waf_body_stream_t *st = waf_body_stream_new(r, mcf, lcf, 0);
+  if (st == NULL) {
+    return NGX_ERROR;
+  }
+  ctx->body_stream = st;
+  return NGX_OK;
+}
 
-    if (!matched) {
+/* 预扫描的前提：BODY 桶有 AC 分组，且各分组只扫描默认视图或其小写变体（逐字节变换，可分段） */
+static ngx_flag_t waf_body_chain_eligible(waf_compiled_snapshot_t *snap)
+{
+  ngx_array_t *sets[2] = {snap->contains_groups[WAF_PHASE_DETECT][WAF_T_BODY],
+                          snap->regex_groups[WAF_PHASE_DETECT][WAF_T_BODY]};
+  ngx_uint_t groups = 0;
+  for (ngx_uint_t k = 0; k < 2; k++) {
+    if (sets[k] == NULL) {
       continue;
     }
-
-    /* 命中uri_allow规则：BYPASS */
-    if (rule->action == WAF_ACT_BYPASS) {
-      waf_event_details_t det = {0};
-      det.target_tag = "uri";
-      det.negate = rule->negate;
-      det.rule_tags = rule->tags;
-      waf_final_action_type_e hint = WAF_FINAL_ACTION_TYPE_BYPASS_BY_URI_WHITELIST;
-      return waf_enforce_bypass(r, mcf, lcf, ctx, rule->id, &det, &hint);
+    waf_ac_group_t *g = sets[k]->elts;
+    for (ngx_uint_t j = 0; j < sets[k]->nelts; j++) {
+      if (g[j].transform & ~WAF_TF_LOWERCASE) {
+        return 0;
+      }
     }
+    groups += sets[k]->nelts;
   }
-
-  return WAF_RC_CONTINUE;
+  return groups > 0;
 }
 
-static waf_rc_e waf_stage_detect_bundle(ngx_http_request_t *r, ngx_http_waf_main_conf_t *mcf,
-                                        ngx_http_waf_loc_conf_t *lcf, ngx_http_waf_ctx_t *ctx)
+/*
+ * 已读完的多段请求体（多个内存缓冲或内存 + 临时文件）：沿 ngx_chain_t 就地预扫描，不拼接连续副本
+ * - 特殊字节位图与 CONTAINS/因子 AC 直接在各段上推进（状态跨段延续），文件段只读 mmap，
+ *   失败时按 64k 分段读入；小写副本与 form 解码只经过 WAF_BODY_PIECE 大小的缓冲
+ * - 结果挂到 ctx：CONTAINS 规则直接得出结论，REGEX/EXACT 只有通过预筛时才构建完整检测视图
+ * - 不执行窗口化的 REGEX（仅 waf_body_stream on 的流式检测使用），也不占用 ctx->body_stream，
+ *   线程池卸载照常可用；单段请求体仍走 waf_ctx_body（零拷贝引用或整体 mmap）
+ */
+static ngx_int_t waf_body_chain_scan(ngx_http_request_t *r, ngx_http_waf_main_conf_t *mcf,
+                                     ngx_http_waf_loc_conf_t *lcf, ngx_http_waf_ctx_t *ctx)
 {
-  /* 最小实现：遍历 detect 段 buckets，支持
-   * URI/ARGS_COMBINED/ARGS_NAME/ARGS_VALUE/HEADER 的 CONTAINS/REGEX 匹配 */
-  if (lcf == NULL || lcf->compiled == NULL) {
-    return WAF_RC_CONTINUE;
+  if (ctx->body_stream != NULL || ctx->body_matched != NULL || ctx->body_regex_hits != NULL ||
+      ctx->body_collected || r->request_body == NULL || lcf == NULL || lcf->compiled == NULL) {
+    return NGX_DECLINED;
+  }
+  ngx_array_t *bucket = lcf->compiled->buckets[WAF_PHASE_DETECT][WAF_T_BODY];
+  if (bucket == NULL || bucket->nelts == 0 || !waf_body_chain_eligible(lcf->compiled)) {
+    return NGX_DECLINED;
+  }
+  ngx_uint_t parts = 0;
+  for (ngx_chain_t *c = r->request_body->bufs; c != NULL; c = c->next) {
+    ngx_buf_t *b = c->buf;
+    if (b != NULL && ((ngx_buf_in_memory(b) && b->last > b->pos) ||
+                      (b->in_file && b->file_last > b->file_pos))) {
+      parts++;
+    }
+  }
+  if (parts < 2) {
+    return NGX_DECLINED;
   }
 
-  waf_compiled_snapshot_t *snap = lcf->compiled;
-
-  /* 工具函数已在文件顶部以 C 形式定义，直接调用 */
-
-  /* decode 缓存：避免对 ARGS_COMBINED 多次解码 */
-  ngx_str_t cached_args_combined = ngx_null_string;
-  ngx_uint_t cached_args_ready = 0;
-  ngx_int_t cached_args_rc = NGX_ERROR;
-
-  /* 遍历 detect 段各 target 的桶 */
-  for (ngx_uint_t target = 0; target <= WAF_T_HEADER; target++) {
-    ngx_array_t *bucket = snap->buckets[WAF_PHASE_DETECT][target];
-    if (bucket == NULL || bucket->nelts == 0)
+  waf_body_stream_t *st = waf_body_stream_new(r, mcf, lcf, 1);
+  if (st == NULL) {
+    return NGX_ERROR;
+  }
+  u_char *chunk = NULL;
+  for (ngx_chain_t *c = r->request_body->bufs; c != NULL; c = c->next) {
+    ngx_buf_t *b = c->buf;
+    if (b == NULL) {
       continue;
-
-    waf_compiled_rule_t **rules = bucket->elts;
-    for (ngx_uint_t i = 0; i < bucket->nelts; i++) {
-      waf_compiled_rule_t *rule = rules[i];
-      if (rule == NULL)
-        continue;
-
-      ngx_uint_t matched = 0;
-
-      switch (rule->target) {
-        case WAF_T_URI: {
-          ngx_str_t subj = r->uri;
-          if (rule->match == WAF_MATCH_CONTAINS) {
-            ngx_str_t *pats = rule->patterns ? rule->patterns->elts : NULL;
-            if (pats) {
-              for (ngx_uint_t k = 0; k < rule->patterns->nelts; k++) {
-                if (ngx_http_waf_contains_ci(&subj, &pats[k], rule->caseless)) {
-                  matched = 1;
-                  break;
-                }
-              }
-            }
-          } else if (rule->match == WAF_MATCH_EXACT) {
-            ngx_str_t *pats = rule->patterns ? rule->patterns->elts : NULL;
-            if (pats) {
-              for (ngx_uint_t k = 0; k < rule->patterns->nelts; k++) {
-                if (ngx_http_waf_equals_ci(&subj, &pats[k], rule->caseless)) {
-                  matched = 1;
-                  break;
-                }
-              }
-            }
-          } else if (rule->match == WAF_MATCH_REGEX) {
-            matched = ngx_http_waf_regex_any_match(rule->compiled_regexes, &subj);
-          }
-          break;
-        }
-
-        case WAF_T_ARGS_COMBINED: {
-          if (!cached_args_ready) {
-            cached_args_rc = ngx_http_waf_get_decoded_args_combined(r, &cached_args_combined);
-            cached_args_ready = 1;
-          }
-          if (cached_args_rc != NGX_OK || cached_args_combined.len == 0) {
-            matched = 0;
-            break;
-          }
-          ngx_str_t subj = cached_args_combined;
-          if (rule->match == WAF_MATCH_CONTAINS) {
-            ngx_str_t *pats = rule->patterns ? rule->patterns->elts : NULL;
-            if (pats) {
-              for (ngx_uint_t k = 0; k < rule->patterns->nelts; k++) {
-                if (ngx_http_waf_contains_ci(&subj, &pats[k], rule->caseless)) {
-                  matched = 1;
-                  break;
-                }
-              }
-            }
-          } else if (rule->match == WAF_MATCH_EXACT) {
-            ngx_str_t *pats = rule->patterns ? rule->patterns->elts : NULL;
-            if (pats) {
-              for (ngx_uint_t k = 0; k < rule->patterns->nelts; k++) {
-                if (ngx_http_waf_equals_ci(&subj, &pats[k], rule->caseless)) {
-                  matched = 1;
-                  break;
-                }
-              }
-            }
-          } else if (rule->match == WAF_MATCH_REGEX) {
-            matched = ngx_http_waf_regex_any_match(rule->compiled_regexes, &subj);
-          }
-          break;
-        }
-
-        case WAF_T_ARGS_NAME: {
-          ngx_str_t subj = r->args;
-          if (rule->match == WAF_MATCH_EXACT) {
-            matched = ngx_http_waf_args_iter_exact(&subj, /*match_name=*/1, rule->caseless,
-                                                   rule->patterns, r->pool);
-          } else {
-            matched = ngx_http_waf_args_iter_match(&subj, /*match_name=*/1, rule->caseless,
-                                                   rule->patterns, rule->compiled_regexes,
-                                                   (rule->match == WAF_MATCH_REGEX), r->pool);
-          }
-          break;
-        }
-
-        case WAF_T_ARGS_VALUE: {
-          ngx_str_t subj = r->args;
-          if (rule->match == WAF_MATCH_EXACT) {
-            matched = ngx_http_waf_args_iter_exact(&subj, /*match_name=*/0, rule->caseless,
-                                                   rule->patterns, r->pool);
-          } else {
-            matched = ngx_http_waf_args_iter_match(&subj, /*match_name=*/0, rule->caseless,
-                                                   rule->patterns, rule->compiled_regexes,
-                                                   (rule->match == WAF_MATCH_REGEX), r->pool);
-          }
-          break;
-        }
-
-        case WAF_T_HEADER: {
-          /* 缺失的 HEADER 视为空串以参与匹配（支持 ^$ 白名单 + negate 逻辑） */
-          ngx_str_t hv;
-          if (!ngx_http_waf_get_header(r, &rule->header_name, &hv)) {
-            hv.data = (u_char *)"";
-            hv.len = 0;
-          }
-          if (rule->match == WAF_MATCH_CONTAINS) {
-            ngx_str_t *pats = rule->patterns ? rule->patterns->elts : NULL;
-            if (pats) {
-              for (ngx_uint_t k = 0; k < rule->patterns->nelts; k++) {
-                if (ngx_http_waf_contains_ci(&hv, &pats[k], rule->caseless)) {
-                  matched = 1;
-                  break;
-                }
-              }
-            }
-          } else if (rule->match == WAF_MATCH_EXACT) {
-            ngx_str_t *pats = rule->patterns ? rule->patterns->elts : NULL;
-            if (pats) {
-              for (ngx_uint_t k = 0; k < rule->patterns->nelts; k++) {
-                if (ngx_http_waf_equals_ci(&hv, &pats[k], rule->caseless)) {
-                  matched = 1;
-                  break;
-                }
-              }
-            }
-          } else if (rule->match == WAF_MATCH_REGEX) {
-            matched = ngx_http_waf_regex_any_match(rule->compiled_regexes, &hv);
-            /* 特判：空串与 ^$ */
-            if (!matched && hv.len == 0 && rule->patterns && rule->patterns->nelts > 0) {
-              ngx_str_t *pats = rule->patterns->elts;
-              for (ngx_uint_t k = 0; k < rule->patterns->nelts; k++) {
-                if (pats[k].len == 2 && pats[k].data && pats[k].data[0] == '^' && pats[k].data[1] == '$') {
-                  matched = 1;
-                  break;
-                }
-              }
-            }
-          }
-          break;
-        }
-
-        case WAF_T_CLIENT_IP: {
-          /* CLIENT_IP 匹配由专门阶段处理（IP allow/deny），此处跳过 */
-          matched = 0;
-          break;
+    }
+    waf_rc_e wrc = WAF_RC_CONTINUE;
+    if (ngx_buf_in_memory(b)) {
+      wrc = waf_body_stream_raw(st, b->pos, (size_t)(b->last - b->pos));
+    } else if (b->in_file && b->file_last > b->file_pos) {
+      if (r->request_body->temp_file == NULL) {
+        return NGX_ERROR;
+      }
+      ngx_file_t *file = &r->request_body->temp_file->file;
+      size_t sz = (size_t)(b->file_last - b->file_pos);
+      u_char *mapped = ngx_http_waf_map_file(r->pool, file, b->file_pos, sz);
+      if (mapped != NULL) {
+        wrc = waf_body_stream_raw(st, mapped, sz);
+      } else {
+        if (chunk == NULL && (chunk = ngx_pnalloc(r->pool, 65536)) == NULL) {
+          return NGX_ERROR;
         }
-
-        case WAF_T_BODY: {
-          ngx_str_t body;
-          if (r->request_body == NULL || r->request_body->bufs == NULL) {
-            matched = 0;
-            break;
-          }
-          if (ngx_http_waf_collect_request_body(r, &body) != NGX_OK) {
-            ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
-                          "waf: collect_request_body failed; treat as empty BODY");
-            matched = 0;
-            break;
-          }
-          ngx_str_t body_view = body;
-          if (r->headers_in.content_type &&
-              r->headers_in.content_type->value.len >=
-                  sizeof("application/x-www-form-urlencoded") - 1 &&
-              ngx_strncasecmp(r->headers_in.content_type->value.data,
-                              (u_char *)"application/x-www-form-urlencoded",
-                              sizeof("application/x-www-form-urlencoded") - 1) == 0) {
-            ngx_str_t decoded_body;
-            if (ngx_http_waf_decode_form_urlencoded(r->pool, &body, &decoded_body) == NGX_OK) {
-              body_view = decoded_body;
-            }
-          }
-          if (rule->match == WAF_MATCH_CONTAINS) {
-            ngx_str_t *pats = rule->patterns ? rule->patterns->elts : NULL;
-            if (pats) {
-              for (ngx_uint_t k = 0; k < rule->patterns->nelts; k++) {
-                if (ngx_http_waf_contains_ci(&body_view, &pats[k], rule->caseless)) {
-                  matched = 1;
-                  break;
-                }
-              }
-            }
-          } else if (rule->match == WAF_MATCH_EXACT) {
-            ngx_str_t *pats = rule->patterns ? rule->patterns->elts : NULL;
-            if (pats) {
-              for (ngx_uint_t k = 0; k < rule->patterns->nelts; k++) {
-                if (ngx_http_waf_equals_ci(&body_view, &pats[k], rule->caseless)) {
-                  matched = 1;
-                  break;
-                }
-              }
-            }
-          } else if (rule->match == WAF_MATCH_REGEX) {
-            matched = ngx_http_waf_regex_any_match(rule->compiled_regexes, &body_view);
+        for (off_t off = b->file_pos; off < b->file_last && wrc == WAF_RC_CONTINUE;) {
+          size_t want = (size_t)ngx_min(b->file_last - off, 65536);
+          ssize_t n = ngx_read_file(file, chunk, want, off);
+          if (n <= 0) {
+            return NGX_ERROR;
           }
-          break;
-        }
-
-        default: {
-          matched = 0;
-          break;
+          wrc = waf_body_stream_raw(st, chunk, (size_t)n);
+          off += n;
         }
       }
+    }
+    if (wrc != WAF_RC_CONTINUE) {
+      return NGX_ERROR;
+    }
+  }
+  return waf_body_stream_finish(st) == WAF_RC_ERROR ? NGX_ERROR : NGX_OK;
+}
 
-      /* 应用 negate */
-      if (rule->negate) {
-        matched = matched ? 0 : 1;
-      }
+static ngx_http_request_body_filter_pt ngx_http_waf_next_request_body_filter;
 
-      if (!matched) {
-        continue;
-      }
+/* 请求体过滤器：每块新到的数据先过流式检测，拦截时直接返回状态码终止读取 */
+static ngx_int_t ngx_http_waf_request_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
+{
+  ngx_http_waf_ctx_t *ctx = ngx_http_get_module_ctx(r, ngx_http_waf_module);
+  if (ctx == NULL || ctx->body_stream == NULL || ctx->body_stream_done) {
+    return ngx_http_waf_next_request_body_filter(r, in);
+  }
 
-      /* 命中后执法：DENY/BYPASS/LOG */
-      switch (rule->action) {
-        case WAF_ACT_DENY: {
-          ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
-                        "waf-debug: enforce DENY rule=%ui target=%ui negate=%ui",
-                        (ngx_uint_t)rule->id, (ngx_uint_t)rule->target, (ngx_uint_t)rule->negate);
-          waf_event_details_t det = {0};
-          det.target_tag = (rule->target == WAF_T_URI)
-                                ? "uri"
-                                : (rule->target == WAF_T_ARGS_COMBINED)
-                                      ? "args"
-                                      : (rule->target == WAF_T_ARGS_NAME)
-                                            ? "argsName"
-                                      : (rule->target == WAF_T_ARGS_VALUE)
-                                                  ? "argsValue"
-                                                  : (rule->target == WAF_T_HEADER)
-                                                        ? (const char *)"header"
-                                                        : NULL;
-          det.negate = rule->negate;
-          det.rule_tags = rule->tags;
-
-          waf_rc_e rc = waf_enforce_block(r, mcf, lcf, ctx, NGX_HTTP_FORBIDDEN, rule->id,
-                                          (ngx_uint_t)(rule->score > 0 ? rule->score : 0), &det);
-          if (rc == WAF_RC_BLOCK || rc == WAF_RC_BYPASS || rc == WAF_RC_ERROR) {
-            return rc;
-          }
-          /* 继续遍历后续规则 */
-          break;
-        }
-        case WAF_ACT_BYPASS: {
-          ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
-                        "waf-debug: enforce BYPASS rule=%ui target=%ui negate=%ui",
-                        (ngx_uint_t)rule->id, (ngx_uint_t)rule->target, (ngx_uint_t)rule->negate);
-          waf_event_details_t det2 = {0};
-          det2.target_tag = (rule->target == WAF_T_URI)
-                                ? "uri"
-                                : (rule->target == WAF_T_ARGS_COMBINED)
-                                      ? "args"
-                                      : (rule->target == WAF_T_ARGS_NAME)
-                                            ? "argsName"
-                                            : (rule->target == WAF_T_ARGS_VALUE)
-                                                  ? "argsValue"
-                                                  : (rule->target == WAF_T_HEADER)
-                                                        ? (const char *)"header"
-                                                        : NULL;
-          det2.negate = rule->negate;
-          det2.rule_tags = rule->tags;
-          waf_final_action_type_e bypass_hint = WAF_FINAL_ACTION_TYPE_BYPASS_BY_URI_WHITELIST;
-
-          waf_rc_e rc = waf_enforce_bypass(r, mcf, lcf, ctx, rule->id, &det2, &bypass_hint);
-          if (rc == WAF_RC_BLOCK || rc == WAF_RC_BYPASS || rc == WAF_RC_ERROR) {
-            return rc;
-          }
-          /* 继续遍历后续规则 */
-          break;
-        }
-        case WAF_ACT_LOG:
-        default: {
-          ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
-                        "waf-debug: enforce LOG rule=%ui target=%ui negate=%ui",
-                        (ngx_uint_t)rule->id, (ngx_uint_t)rule->target, (ngx_uint_t)rule->negate);
-          waf_event_details_t det3 = {0};
-          det3.target_tag = (rule->target == WAF_T_URI)
-                                ? "uri"
-                                : (rule->target == WAF_T_ARGS_COMBINED)
-                                      ? "args"
-                                      : (rule->target == WAF_T_ARGS_NAME)
-                                            ? "argsName"
-                                            : (rule->target == WAF_T_ARGS_VALUE)
-                                                  ? "argsValue"
-                                                  : (rule->target == WAF_T_HEADER)
-                                                        ? (const char *)"header"
-                                                        : NULL;
-          det3.negate = rule->negate;
-          det3.rule_tags = rule->tags;
-
-          waf_enforce_log(r, mcf, lcf, ctx, rule->id,
-                          (ngx_uint_t)(rule->score > 0 ? rule->score : 0), &det3);
-          /* 继续遍历后续规则 */
-          break;
-        }
+  waf_body_stream_t *st = ctx->body_stream;
+  for (ngx_chain_t *cl = in; cl; cl = cl->next) {
+    ngx_buf_t *b = cl->buf;
+    waf_rc_e rc = WAF_RC_CONTINUE;
+    if (ngx_buf_in_memory(b) && b->last > b->pos) {
+      rc = waf_body_stream_raw(st, b->pos, (size_t)(b->last - b->pos));
+      if (rc == WAF_RC_CONTINUE) {
+        rc = waf_body_stream_settle(st);
       }
     }
+    if (rc == WAF_RC_CONTINUE && b->last_buf) {
+      rc = waf_body_stream_finish(st);
+    }
+    if (rc == WAF_RC_BLOCK) {
+      return ctx->final_status > 0 ? ctx->final_status : NGX_HTTP_FORBIDDEN;
+    }
+    if (rc == WAF_RC_ERROR) {
+      return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
   }
 
-  return WAF_RC_CONTINUE;
+  return ngx_http_waf_next_request_body_filter(r, in);
+}
+
+/*
+ * 阶段计划：merge 时按快照与开关只挑出有事可做的阶段（顺序即流水线顺序），
+ * 请求期不再逐段探测空桶；detect 段单独记录所需 target，以决定是否读请求体
+ */
+void ngx_http_waf_build_stage_plan(ngx_http_waf_loc_conf_t *lcf)
+{
+  waf_compiled_snapshot_t *snap = lcf->compiled;
+  ngx_uint_t n = 0;
+
+  if (snap != NULL && snap->targets[WAF_PHASE_IP_ALLOW] && snap->ip_index[WAF_PHASE_IP_ALLOW]) {
+    lcf->stages[n++] = waf_stage_ip_allow;
+  }
+  if (snap != NULL && snap->targets[WAF_PHASE_IP_BLOCK] && snap->ip_index[WAF_PHASE_IP_BLOCK]) {
+    lcf->stages[n++] = waf_stage_ip_deny;
+  }
+  if (lcf->dyn_block_enable) {
+    lcf->stages[n++] = waf_stage_reputation_base_add;
+  }
+  if (snap != NULL && (snap->targets[WAF_PHASE_URI_ALLOW] & WAF_TARGET_BIT(WAF_T_URI))) {
+    lcf->stages[n++] = waf_stage_uri_allow;
+  }
+  lcf->stage_count = n;
+  lcf->detect_targets = snap ? snap->targets[WAF_PHASE_DETECT] : 0;
 }
 
 static ngx_int_t ngx_http_waf_access_handler(ngx_http_request_t *r)
@@ -808,6 +2467,15 @@ static ngx_int_t ngx_http_waf_access_handler(ngx_http_request_t *r)
   WAF_FILTER_INTERNAL_REQUESTS(r);
   WAF_FILTER_SUBREQUESTS(r);
 
+  /* 获取配置句柄 */
+  ngx_http_waf_main_conf_t *mcf = ngx_http_get_module_main_conf(r, ngx_http_waf_module);
+  ngx_http_waf_loc_conf_t *lcf = ngx_http_get_module_loc_conf(r, ngx_http_waf_module);
+
+  /* waf off 或阶段计划为空（静态资源、健康检查等）：不分配 ctx，直接放行 */
+  if (lcf == NULL || !lcf->waf_enable || (lcf->stage_count == 0 && lcf->detect_targets == 0)) {
+    return NGX_DECLINED;
+  }
+
   /* 初始化请求态 ctx */
   ngx_http_waf_ctx_t *ctx = ngx_http_get_module_ctx(r, ngx_http_waf_module);
   if (ctx == NULL) {
@@ -819,29 +2487,37 @@ static ngx_int_t ngx_http_waf_access_handler(ngx_http_request_t *r)
     ngx_http_set_ctx(r, ctx, ngx_http_waf_module);
   }
 
-  /* 获取配置句柄 */
-  ngx_http_waf_main_conf_t *mcf = ngx_http_get_module_main_conf(r, ngx_http_waf_module);
-  ngx_http_waf_loc_conf_t *lcf = ngx_http_get_module_loc_conf(r, ngx_http_waf_module);
-
-  /* 检查waf on|off开关 */
-  if (lcf && !lcf->waf_enable) {
-    return NGX_DECLINED;
+  /* 与请求体无关的阶段按计划先执行 */
+  for (ngx_uint_t i = 0; i < lcf->stage_count; i++) {
+    WAF_STAGE(ctx, lcf->stages[i](r, mcf, lcf, ctx));
   }
 
-  /* 五段流水线（前四段与请求体无关，先执行） */
-  WAF_STAGE(ctx, waf_stage_ip_allow(r, mcf, lcf, ctx));
-  WAF_STAGE(ctx, waf_stage_ip_deny(r, mcf, lcf, ctx));
-  WAF_STAGE(ctx, waf_stage_reputation_base_add(r, mcf, lcf, ctx));
-  WAF_STAGE(ctx, waf_stage_uri_allow(r, mcf, lcf, ctx));
-
-  /* 是否需要读取请求体？GET/HEAD 或 content-length==0 则跳过读体，BODY 视为空串
+  /* 是否需要读取请求体？GET/HEAD、content-length==0 或 detect 段没有 BODY 规则则跳过读体，
+   * BODY 视为空串；请求体留给后续 handler/upstream 按 nginx 原生方式处理
    */
-  if ((r->method & (NGX_HTTP_GET | NGX_HTTP_HEAD)) || r->headers_in.content_length_n == 0) {
-    WAF_STAGE(ctx, waf_stage_detect_bundle(r, mcf, lcf, ctx));
+  if ((r->method & (NGX_HTTP_GET | NGX_HTTP_HEAD)) || r->headers_in.content_length_n == 0 ||
+      !(lcf->detect_targets & WAF_TARGET_BIT(WAF_T_BODY))) {
+    if (lcf->detect_targets) {
+      WAF_STAGE(ctx, waf_stage_detect_bundle(r, mcf, lcf, ctx));
+    }
     waf_action_finalize_allow(r, mcf, lcf, ctx);
     return NGX_DECLINED;
   }
 
+  /* 流式请求体检测：BODY 之前的 target 先行评估，BODY 起由请求体过滤器逐块检测后续跑 */
+  ngx_int_t srv = waf_body_stream_init(r, mcf, lcf, ctx);
+  if (srv == NGX_ERROR) {
+    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+  }
+  if (srv == NGX_OK) {
+    waf_rc_e pre = waf_stage_detect_bundle(r, mcf, lcf, ctx);
+    if (pre != WAF_RC_ASYNC) {
+      WAF_STAGE(ctx, pre);
+      waf_action_finalize_allow(r, mcf, lcf, ctx);
+      return NGX_DECLINED;
+    }
+  }
+
   /* 读取请求体，回调中完成检测与尾部 FINAL */
   ngx_int_t rc = ngx_http_read_client_request_body(
       r, (ngx_http_client_body_handler_pt)ngx_http_waf_post_read_body_handler);
@@ -869,6 +2545,16 @@ static ngx_int_t ngx_http_waf_postconfiguration(ngx_conf_t *cf)
   }
   *h = ngx_http_waf_access_handler;
 
+  /* 注册请求体过滤器（waf_body_stream 流式检测） */
+  ngx_http_waf_next_request_body_filter = ngx_http_top_request_body_filter;
+  ngx_http_top_request_body_filter = ngx_http_waf_request_body_filter;
+
+  /* 按 CPU 特性选定字符串匹配内核（master 中完成，worker fork 后继承） */
+  waf_simd_init(cf->log);
+
+  /* 规则快照去重统计 */
+  ngx_http_waf_snapshot_report(cf);
+
   /* 注册 $waf_* 变量 */
   if (ngx_http_waf_register_variables(cf) != NGX_OK) {
     return NGX_ERROR;
@@ -900,13 +2586,13 @@ ngx_module_t ngx_http_waf_module =
   NULL,                     /* init process */
   NULL,                     /* init thread */
   NULL,                     /* exit thread */
-  NULL,                     /* exit process */
+  waf_log_exit_process,     /* exit process */
   NULL,                     /* exit master */
   NGX_MODULE_V1_PADDING
 };
 /* clang-format on */
 
-/* 请求体读取完成后的回调：完成检测段与尾部 FINAL；若未早退，则推进到下一个相位
+/* 请求体读取完成后的回调（亦为 detect 段续跑入口）：完成检测段与尾部 FINAL；若未早退，则推进到下一个相位
  */
 static void ngx_http_waf_post_read_body_handler(ngx_http_request_t *r)
 {
@@ -919,7 +2605,34 @@ static void ngx_http_waf_post_read_body_handler(ngx_http_request_t *r)
     return;
   }
 
+  /* 过滤器未见到 last_buf（请求体由其他途径读完）时在此收尾 */
+  if (ctx->body_stream != NULL && !ctx->body_stream_done &&
+      waf_body_stream_finish(ctx->body_stream) == WAF_RC_ERROR) {
+    ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+    return;
+  }
+
+  /* 多段请求体沿缓冲链直接检测（不拼接） */
+  if (waf_body_chain_scan(r, mcf, lcf, ctx) == NGX_ERROR) {
+    ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+    return;
+  }
+
+#if (NGX_THREADS)
+  /* 大请求体的 BODY 匹配先卸载到线程池；完成后经写事件处理器回到这里 */
+  if (!ctx->body_offload_tried) {
+    ctx->body_offload_tried = 1;
+    if (waf_body_offload(r, lcf, ctx) == NGX_AGAIN) {
+      return;
+    }
+  }
+#endif
+
   waf_rc_e rc_stage = waf_stage_detect_bundle(r, mcf, lcf, ctx);
+  if (rc_stage == WAF_RC_ASYNC) {
+    /* 时间片用尽：续跑事件已投递，下一轮事件循环再回到这里 */
+    return;
+  }
   if (rc_stage == WAF_RC_BLOCK) {
     ngx_int_t http_status = ctx->final_status > 0 ? ctx->final_status : NGX_HTTP_FORBIDDEN;
     ngx_http_finalize_request(r, http_status);
@@ -931,6 +2644,7 @@ static void ngx_http_waf_post_read_body_handler(ngx_http_request_t *r)
   }
   if (rc_stage == WAF_RC_BYPASS) {
     /* BYPASS 已在 action 内完成日志最终落盘；继续后续相位 */
+    r->write_event_handler = ngx_http_core_run_phases;
     r->phase_handler++;
     ngx_http_core_run_phases(r);
     return;
@@ -938,6 +2652,21 @@ static void ngx_http_waf_post_read_body_handler(ngx_http_request_t *r)
 
   /* 未早退：ALLOW 最终落盘一次并推进 */
   waf_action_finalize_allow(r, mcf, lcf, ctx);
+  r->write_event_handler = ngx_http_core_run_phases;
   r->phase_handler++;
   ngx_http_core_run_phases(r);
 }
+
+/* detect 段续跑事件：恢复写事件处理器、归还让出时持有的引用计数，从断点继续并推进相位 */
+static void ngx_http_waf_detect_resume_handler(ngx_event_t *ev)
+{
+  ngx_http_request_t *r = ev->data;
+  ngx_connection_t *c = r->connection;
+  ngx_http_waf_ctx_t *ctx = ngx_http_get_module_ctx(r, ngx_http_waf_module);
+
+  ctx->detect_yielded = 0;
+  r->write_event_handler = ngx_http_core_run_phases;
+  r->main->count--;
+  ngx_http_waf_post_read_body_handler(r);
+  ngx_http_run_posted_requests(c);
+}
@@ -1,5 +1,6 @@
 #include "ngx_http_waf_utils.h"
 #include "ngx_http_waf_log.h"
+#include "ngx_http_waf_simd.h"
 /*
  * 初始化请求上下文（原 waf_log_init_ctx 的扩展版）
  */
@@ -38,62 +39,53 @@ static ngx_int_t ngx_http_waf_plus_to_space_and_unescape(ngx_pool_t *pool, const
  *  客户端IP获取（支持X-Forwarded-For）
  * ================================================================
  */
-ngx_uint_t waf_utils_get_client_ip(ngx_http_request_t *r, ngx_flag_t trust_xff)
-{
-  ngx_uint_t ip = 0;
 
-  /* 1. 尝试从X-Forwarded-For获取（trust_xff=on时） */
-  if (trust_xff) {
-    ngx_table_elt_t *xff = NULL;
-    ngx_list_part_t *part = &r->headers_in.headers.part;
-    ngx_table_elt_t *header = part->elts;
-
-    /* 遍历请求头查找X-Forwarded-For */
-    for (ngx_uint_t i = 0;; i++) {
-      if (i >= part->nelts) {
-        if (part->next == NULL) {
-          break;
-        }
-        part = part->next;
-        header = part->elts;
-        i = 0;
-      }
+/* 取 X-Forwarded-For 最左侧地址文本（已去除首尾空格）；不存在返回 0 */
+static ngx_uint_t waf_utils_xff_first(ngx_http_request_t *r, ngx_str_t *out)
+{
+  ngx_list_part_t *part = &r->headers_in.headers.part;
+  ngx_table_elt_t *header = part->elts;
 
-      if (header[i].key.len == 15 &&
-          ngx_strncasecmp(header[i].key.data, (u_char *)"X-Forwarded-For", 15) == 0) {
-        xff = &header[i];
-        break;
+  for (ngx_uint_t i = 0;; i++) {
+    if (i >= part->nelts) {
+      if (part->next == NULL) {
+        return 0;
       }
+      part = part->next;
+      header = part->elts;
+      i = 0;
     }
 
-    /* 解析XFF最左侧IP（格式："203.0.113.1, 192.168.1.1"） */
-    if (xff != NULL && xff->value.len > 0) {
-      u_char *p = xff->value.data;
-      u_char *end = p + xff->value.len;
+    if (header[i].key.len == 15 &&
+        ngx_strncasecmp(header[i].key.data, (u_char *)"X-Forwarded-For", 15) == 0) {
+      u_char *p = header[i].value.data;
+      u_char *end = p + header[i].value.len;
       u_char *comma = (u_char *)ngx_strlchr(p, end, ',');
-
-      ngx_str_t first_ip;
-      if (comma != NULL) {
-        first_ip.data = p;
-        first_ip.len = comma - p;
-      } else {
-        first_ip = xff->value;
-      }
-
-      /* 去除前后空格 */
-      while (first_ip.len > 0 && first_ip.data[0] == ' ') {
-        first_ip.data++;
-        first_ip.len--;
+      out->data = p;
+      out->len = (comma != NULL) ? (size_t)(comma - p) : header[i].value.len;
+      while (out->len > 0 && out->data[0] == ' ') {
+        out->data++;
+        out->len--;
       }
-      while (first_ip.len > 0 && first_ip.data[first_ip.len - 1] == ' ') {
-        first_ip.len--;
+      while (out->len > 0 && out->data[out->len - 1] == ' ') {
+        out->len--;
       }
+      return out->len > 0;
+    }
+  }
+}
 
-      /* 解析为IP（返回网络字节序） */
-      ip = waf_utils_parse_ip_str(&first_ip);
-      if (ip != 0) {
-        return ip; /* XFF解析成功 */
-      }
+ngx_uint_t waf_utils_get_client_ip(ngx_http_request_t *r, ngx_flag_t trust_xff)
+{
+  ngx_uint_t ip = 0;
+
+  /* 1. 尝试从X-Forwarded-For获取（trust_xff=on时，取最左侧IP） */
+  ngx_str_t first_ip;
+  if (trust_xff && waf_utils_xff_first(r, &first_ip)) {
+    /* 解析为IP（返回网络字节序） */
+    ip = waf_utils_parse_ip_str(&first_ip);
+    if (ip != 0) {
+      return ip; /* XFF解析成功 */
     }
   }
 
@@ -109,6 +101,58 @@ ngx_uint_t waf_utils_get_client_ip(ngx_http_request_t *r, ngx_flag_t trust_xff)
   return ip;
 }
 
+/*
+ * 获取客户端地址（IPv4/IPv6），语义同 waf_utils_get_client_ip：
+ * trust_xff 时优先 XFF 最左侧地址，否则/失败时回退 TCP 连接地址；
+ * IPv4-mapped IPv6 地址按 IPv4 处理
+ */
+void waf_utils_get_client_addr(ngx_http_request_t *r, ngx_flag_t trust_xff, waf_ip_addr_t *out)
+{
+  ngx_memzero(out, sizeof(*out));
+
+  ngx_str_t text;
+  if (trust_xff && waf_utils_xff_first(r, &text)) {
+    in_addr_t v4 = ngx_inet_addr(text.data, text.len);
+    if (v4 != INADDR_NONE) {
+      out->family = AF_INET;
+      ngx_memcpy(out->addr, &v4, 4);
+      return;
+    }
+#if (NGX_HAVE_INET6)
+    if (ngx_inet6_addr(text.data, text.len, out->addr) == NGX_OK) {
+      out->family = AF_INET6;
+      goto mapped;
+    }
+#endif
+  }
+
+  struct sockaddr *sa = r->connection->sockaddr;
+  if (sa->sa_family == AF_INET) {
+    out->family = AF_INET;
+    ngx_memcpy(out->addr, &((struct sockaddr_in *)sa)->sin_addr, 4);
+    return;
+  }
+#if (NGX_HAVE_INET6)
+  if (sa->sa_family == AF_INET6) {
+    out->family = AF_INET6;
+    ngx_memcpy(out->addr, ((struct sockaddr_in6 *)sa)->sin6_addr.s6_addr, 16);
+    goto mapped;
+  }
+#endif
+  return;
+
+#if (NGX_HAVE_INET6)
+mapped:
+  if (IN6_IS_ADDR_V4MAPPED((struct in6_addr *)out->addr)) {
+    u_char v4[4];
+    ngx_memcpy(v4, &out->addr[12], 4);
+    ngx_memzero(out->addr, sizeof(out->addr));
+    ngx_memcpy(out->addr, v4, 4);
+    out->family = AF_INET;
+  }
+#endif
+}
+
 /*
  * ================================================================
  *  IP格式转换工具
@@ -193,37 +237,13 @@ void ngx_http_waf_trim(ngx_str_t *s)
     s->data[new_len] = '\0';
 }
 
-/* 大小写可选子串查找 */
+/* 大小写可选子串查找（SIMD 内核，见 ngx_http_waf_simd.c） */
 ngx_uint_t ngx_http_waf_contains_ci(const ngx_str_t *hay, const ngx_str_t *needle,
                                     ngx_flag_t caseless)
 {
   if (hay == NULL || needle == NULL || hay->data == NULL || needle->data == NULL)
     return 0;
-  if (needle->len == 0)
-    return 1;
-  if (hay->len < needle->len)
-    return 0;
-  const u_char *h = hay->data;
-  const u_char *n = needle->data;
-  size_t hl = hay->len;
-  size_t nl = needle->len;
-  for (size_t i = 0; i + nl <= hl; i++) {
-    size_t j = 0;
-    for (; j < nl; j++) {
-      u_char hc = h[i + j];
-      u_char nc = n[j];
-      if (caseless) {
-        if (ngx_tolower(hc) != ngx_tolower(nc))
-          break;
-      } else {
-        if (hc != nc)
-          break;
-      }
-    }
-    if (j == nl)
-      return 1;
-  }
-  return 0;
+  return waf_simd_contains(hay->data, hay->len, needle->data, needle->len, caseless);
 }
 
 /* 统一解码后的完整 query 字符串视图（使用 r->pool 分配） */
@@ -234,7 +254,54 @@ ngx_int_t ngx_http_waf_get_decoded_args_combined(ngx_http_request_t *r, ngx_str_
   return ngx_http_waf_plus_to_space_and_unescape(r->pool, &r->args, out);
 }
 
-/* 收集请求体为连续内存（支持内存缓冲与临时文件，NUL 结尾） */
+/* 只读映射的解除（pool cleanup） */
+typedef struct {
+  void *addr;
+  size_t len;
+  ngx_log_t *log;
+} waf_file_map_t;
+
+static void waf_file_unmap(void *data)
+{
+  waf_file_map_t *m = data;
+  if (munmap(m->addr, m->len) == -1) {
+    ngx_log_error(NGX_LOG_ALERT, m->log, ngx_errno, "waf: munmap(%uz) failed", m->len);
+  }
+}
+
+u_char *ngx_http_waf_map_file(ngx_pool_t *pool, ngx_file_t *file, off_t offset, size_t size)
+{
+  if (pool == NULL || file == NULL || size == 0)
+    return NULL;
+
+  off_t aligned = offset - offset % (off_t)ngx_pagesize;
+  size_t len = size + (size_t)(offset - aligned);
+
+  ngx_pool_cleanup_t *cln = ngx_pool_cleanup_add(pool, sizeof(waf_file_map_t));
+  if (cln == NULL)
+    return NULL;
+
+  void *addr = mmap(NULL, len, PROT_READ, MAP_SHARED, file->fd, aligned);
+  if (addr == MAP_FAILED) {
+    ngx_log_error(NGX_LOG_WARN, file->log, ngx_errno, "waf: mmap(\"%V\", %uz) failed", &file->name,
+                  len);
+    return NULL;
+  }
+
+  waf_file_map_t *m = cln->data;
+  m->addr = addr;
+  m->len = len;
+  m->log = file->log;
+  cln->handler = waf_file_unmap;
+  return (u_char *)addr + (offset - aligned);
+}
+
+/*
+ * 收集请求体为连续内存（支持内存缓冲与临时文件）
+ * - 单个内存缓冲：直接引用，零拷贝
+ * - 整体落在临时文件：只读 mmap，不复制进 pool（映射失败时回退为读文件）
+ * - 其余多段组合：拷贝拼接（NUL 结尾）；前两种情形结果不保证以 '\0' 结尾
+ */
 ngx_int_t ngx_http_waf_collect_request_body(ngx_http_request_t *r, ngx_str_t *body_str)
 {
   if (r == NULL || body_str == NULL)
@@ -243,16 +310,46 @@ ngx_int_t ngx_http_waf_collect_request_body(ngx_http_request_t *r, ngx_str_t *bo
     return NGX_ERROR;
 
   ngx_chain_t *cl = r->request_body->bufs;
+  ngx_buf_t *only = NULL;
+  ngx_uint_t parts = 0;
   size_t total = 0;
   for (ngx_chain_t *c = cl; c != NULL; c = c->next) {
     if (c->buf == NULL)
       continue;
+    size_t sz = 0;
     if (ngx_buf_in_memory(c->buf)) {
       if (c->buf->last > c->buf->pos)
-        total += (size_t)(c->buf->last - c->buf->pos);
+        sz = (size_t)(c->buf->last - c->buf->pos);
     } else if (c->buf->in_file) {
       if (c->buf->file_last > c->buf->file_pos)
-        total += (size_t)(c->buf->file_last - c->buf->file_pos);
+        sz = (size_t)(c->buf->file_last - c->buf->file_pos);
+    }
+    if (sz) {
+      total += sz;
+      only = c->buf;
+      parts++;
+    }
+  }
+
+  if (parts == 0) {
+    body_str->data = (u_char *)"";
+    body_str->len = 0;
+    return NGX_OK;
+  }
+  if (parts == 1) {
+    if (ngx_buf_in_memory(only)) {
+      body_str->data = only->pos;
+      body_str->len = total;
+      return NGX_OK;
+    }
+    if (r->request_body->temp_file == NULL)
+      return NGX_ERROR;
+    u_char *mapped =
+        ngx_http_waf_map_file(r->pool, &r->request_body->temp_file->file, only->file_pos, total);
+    if (mapped != NULL) {
+      body_str->data = mapped;
+      body_str->len = total;
+      return NGX_OK;
     }
   }
 
@@ -297,30 +394,21 @@ ngx_int_t ngx_http_waf_decode_form_urlencoded(ngx_pool_t *pool, const ngx_str_t
   return ngx_http_waf_plus_to_space_and_unescape(pool, in, out);
 }
 
-/* 大小写可选的全等比较（等长逐字节） */
+/* 大小写可选的全等比较（SIMD 内核） */
 ngx_uint_t ngx_http_waf_equals_ci(const ngx_str_t *a, const ngx_str_t *b, ngx_flag_t caseless)
 {
   if (a == NULL || b == NULL || a->data == NULL || b->data == NULL)
     return 0;
   if (a->len != b->len)
     return 0;
-  const u_char *pa = a->data;
-  const u_char *pb = b->data;
-  for (size_t i = 0; i < a->len; i++) {
-    u_char ca = pa[i];
-    u_char cb = pb[i];
-    if (caseless) {
-      if (ngx_tolower(ca) != ngx_tolower(cb))
-        return 0;
-    } else {
-      if (ca != cb)
-        return 0;
-    }
-  }
-  return 1;
+  return waf_simd_equals(a->data, b->data, a->len, caseless);
 }
 
-/* 将 '+' 转为空格并进行一次 URL 解码（%XX） */
+/*
+ * '+' 转空格并做一次 URL 解码（%XX），单遍完成
+ * - 不含 '%'/'+' 时零拷贝指向输入（结果不保证以 '\0' 结尾）
+ * - 否则一次分配，SIMD 定位转义后整段复制干净片段
+ */
 static ngx_int_t ngx_http_waf_plus_to_space_and_unescape(ngx_pool_t *pool, const ngx_str_t *in,
                                                          ngx_str_t *out)
 {
@@ -332,33 +420,54 @@ static ngx_int_t ngx_http_waf_plus_to_space_and_unescape(ngx_pool_t *pool, const
     out->len = 0;
     return NGX_OK;
   }
-  u_char *tmp = ngx_pnalloc(pool, in->len);
-  if (tmp == NULL)
-    return NGX_ERROR;
-  for (size_t i = 0; i < in->len; i++) {
-    tmp[i] = (in->data[i] == '+') ? ' ' : in->data[i];
+  if (waf_simd_find2(in->data, in->len, '%', '+') == in->len) {
+    *out = *in;
+    return NGX_OK;
   }
   u_char *dst = ngx_pnalloc(pool, in->len + 1);
   if (dst == NULL)
     return NGX_ERROR;
-  u_char *dst_ptr = dst;
-  u_char *src_ptr = tmp;
-  ngx_unescape_uri(&dst_ptr, &src_ptr, in->len, 0);
   out->data = dst;
-  out->len = (size_t)(dst_ptr - dst);
+  out->len = waf_simd_url_decode(dst, in->data, in->len, 1, NULL);
   out->data[out->len] = '\0';
   return NGX_OK;
 }
 
-/* 遍历 query args，按 name/value 精确匹配（大小写可选） */
-ngx_uint_t ngx_http_waf_args_iter_exact(const ngx_str_t *args, ngx_flag_t match_name,
-                                        ngx_flag_t caseless, ngx_array_t *patterns,
-                                        ngx_pool_t *pool)
+/* 参数片段解码：不含 '%'/'+' 时零拷贝指向原缓冲，否则 +→空格 与 %XX 解码到 pool */
+static ngx_int_t ngx_http_waf_arg_decode(ngx_pool_t *pool, const u_char *start, const u_char *end,
+                                         ngx_str_t *out)
 {
-  if (args == NULL || args->data == NULL || args->len == 0 || patterns == NULL)
-    return 0;
-  if (pool == NULL)
-    return 0; /* 禁止回退到全局池，要求调用方传入请求池 */
+  ngx_str_t raw;
+  raw.data = (u_char *)start;
+  raw.len = (size_t)(end - start);
+  return ngx_http_waf_plus_to_space_and_unescape(pool, &raw, out);
+}
+
+/* 解析 query 为参数表（ngx_array_t(waf_arg_t)），切分规则与逐规则遍历时一致 */
+ngx_int_t ngx_http_waf_parse_args(ngx_pool_t *pool, const ngx_str_t *args, ngx_array_t **out,
+                                  waf_args_stats_t *stats)
+{
+  if (pool == NULL || args == NULL || out == NULL)
+    return NGX_ERROR;
+  if (stats)
+    ngx_memzero(stats, sizeof(*stats));
+
+  ngx_uint_t n = 1;
+  if (args->data != NULL) {
+    for (size_t i = 0; i < args->len; i++) {
+      if (args->data[i] == '&')
+        n++;
+    }
+  }
+
+  ngx_array_t *tbl = ngx_array_create(pool, n, sizeof(waf_arg_t));
+  if (tbl == NULL)
+    return NGX_ERROR;
+  *out = tbl;
+
+  if (args->data == NULL || args->len == 0)
+    return NGX_OK;
+
   const u_char *p = args->data;
   const u_char *end = args->data + args->len;
   while (p < end) {
@@ -380,42 +489,215 @@ ngx_uint_t ngx_http_waf_args_iter_exact(const ngx_str_t *args, ngx_flag_t match_
       p = (name_end < end && *name_end == '&') ? name_end + 1 : name_end;
     }
 
-    ngx_str_t raw;
-    raw.len = match_name ? (size_t)(name_end - name_start)
-                         : (size_t)((value_end && value_start) ? (value_end - value_start) : 0);
-    raw.data = (u_char *)(match_name ? name_start : (value_start ? value_start : NULL));
-    if (raw.data == NULL)
-      continue;
+    if (stats) {
+      stats->name_max = ngx_max(stats->name_max, (size_t)(name_end - name_start));
+      if (value_start != NULL)
+        stats->value_max = ngx_max(stats->value_max, (size_t)(value_end - value_start));
+    }
 
-    ngx_str_t decoded;
-    if (ngx_http_waf_plus_to_space_and_unescape(pool, &raw, &decoded) != NGX_OK) {
-      continue;
+    waf_arg_t *arg = ngx_array_push(tbl);
+    if (arg == NULL)
+      return NGX_ERROR;
+    ngx_memzero(arg, sizeof(waf_arg_t));
+
+    if (ngx_http_waf_arg_decode(pool, name_start, name_end, &arg->name) != NGX_OK)
+      return NGX_ERROR;
+    if (value_start != NULL) {
+      if (ngx_http_waf_arg_decode(pool, value_start, value_end, &arg->value) != NGX_OK)
+        return NGX_ERROR;
+      arg->has_value = 1;
     }
+  }
+  return NGX_OK;
+}
 
-    ngx_str_t *pats = patterns->elts;
-    for (ngx_uint_t i = 0; i < patterns->nelts; i++) {
-      if (ngx_http_waf_equals_ci(&decoded, &pats[i], caseless)) {
-        return 1;
-      }
+/* 取参数表中的 name 或 value（无 '=' 的参数没有 value，返回 NULL） */
+static const ngx_str_t *ngx_http_waf_arg_subject(const waf_arg_t *arg, ngx_flag_t match_name)
+{
+  if (match_name)
+    return &arg->name;
+  return arg->has_value ? &arg->value : NULL;
+}
+
+/* 遍历参数表，按 name/value 精确匹配（EXACT 哈希集合，大小写语义由集合决定） */
+ngx_uint_t ngx_http_waf_args_iter_exact(const ngx_array_t *args, ngx_flag_t match_name,
+                                        const waf_strset_t *set)
+{
+  if (args == NULL || args->nelts == 0 || set == NULL)
+    return 0;
+  const waf_arg_t *arg = args->elts;
+  for (ngx_uint_t k = 0; k < args->nelts; k++) {
+    const ngx_str_t *subj = ngx_http_waf_arg_subject(&arg[k], match_name);
+    if (subj != NULL && waf_strset_contains(set, subj)) {
+      return 1;
     }
   }
   return 0;
 }
 
+/*
+ * 带限额的单次正则执行：返回 >= 0 命中，NGX_REGEX_NO_MATCHED 未命中，NGX_DECLINED 限额触达，
+ * 其余负值为执行错误（按未命中处理）
+ * - PCRE2：match context 与 match data 取自执行状态（默认为每 worker 惰性创建的一份），
+ *   限额变化时才重新设置
+ * - PCRE1：以规则自带 pcre_extra 的副本附加 match_limit / match_limit_recursion（可重入）
+ */
+#if (NGX_PCRE2)
+
+struct waf_regex_exec_s {
+  pcre2_match_context *mctx;
+  pcre2_match_data *mdata;
+  uint32_t default_match, default_depth;
+  uint32_t cur_match, cur_depth;
+};
+
+static waf_regex_exec_t waf_regex_worker_exec;
+
+static void waf_regex_exec_free(void *data)
+{
+  waf_regex_exec_t *x = data;
+  if (x->mctx) {
+    pcre2_match_context_free(x->mctx);
+    x->mctx = NULL;
+  }
+  if (x->mdata) {
+    pcre2_match_data_free(x->mdata);
+    x->mdata = NULL;
+  }
+}
+
+static ngx_int_t waf_regex_exec_init(waf_regex_exec_t *x)
+{
+  x->mctx = pcre2_match_context_create(NULL);
+  x->mdata = pcre2_match_data_create(1, NULL);
+  if (x->mctx == NULL || x->mdata == NULL) {
+    waf_regex_exec_free(x);
+    return NGX_ERROR;
+  }
+  pcre2_config(PCRE2_CONFIG_MATCHLIMIT, &x->default_match);
+  pcre2_config(PCRE2_CONFIG_DEPTHLIMIT, &x->default_depth);
+  x->cur_match = x->default_match;
+  x->cur_depth = x->default_depth;
+  return NGX_OK;
+}
+
+waf_regex_exec_t *ngx_http_waf_regex_exec_create(ngx_pool_t *pool)
+{
+  ngx_pool_cleanup_t *cln = ngx_pool_cleanup_add(pool, sizeof(waf_regex_exec_t));
+  if (cln == NULL) {
+    return NULL;
+  }
+  waf_regex_exec_t *x = cln->data;
+  ngx_memzero(x, sizeof(*x));
+  if (waf_regex_exec_init(x) != NGX_OK) {
+    return NULL;
+  }
+  cln->handler = waf_regex_exec_free;
+  return x;
+}
+
+static ngx_int_t waf_regex_exec_limited(ngx_regex_t *re, const ngx_str_t *s,
+                                        const waf_regex_limits_t *lim)
+{
+  waf_regex_exec_t *x = lim->exec;
+  if (x == NULL) {
+    x = &waf_regex_worker_exec;
+    if (x->mctx == NULL && waf_regex_exec_init(x) != NGX_OK) {
+      return ngx_regex_exec(re, (ngx_str_t *)s, NULL, 0);
+    }
+  }
+
+  uint32_t ml = lim->match_limit ? (uint32_t)lim->match_limit : x->default_match;
+  uint32_t dl = lim->depth_limit ? (uint32_t)lim->depth_limit : x->default_depth;
+  if (ml != x->cur_match) {
+    pcre2_set_match_limit(x->mctx, ml);
+    x->cur_match = ml;
+  }
+  if (dl != x->cur_depth) {
+    pcre2_set_depth_limit(x->mctx, dl);
+    x->cur_depth = dl;
+  }
+
+  int rc = pcre2_match(re, s->data, s->len, 0, 0, x->mdata, x->mctx);
+  if (rc == PCRE2_ERROR_MATCHLIMIT || rc == PCRE2_ERROR_DEPTHLIMIT || rc == PCRE2_ERROR_HEAPLIMIT) {
+    return NGX_DECLINED;
+  }
+  return rc;
+}
+
+#else
+
+struct waf_regex_exec_s {
+  ngx_uint_t unused;
+};
+
+waf_regex_exec_t *ngx_http_waf_regex_exec_create(ngx_pool_t *pool)
+{
+  return ngx_pcalloc(pool, sizeof(waf_regex_exec_t));
+}
+
+static ngx_int_t waf_regex_exec_limited(ngx_regex_t *re, const ngx_str_t *s,
+                                        const waf_regex_limits_t *lim)
+{
+  pcre_extra extra;
+  int ovector[3];
+
+  if (re->extra) {
+    extra = *re->extra;
+  } else {
+    ngx_memzero(&extra, sizeof(extra));
+  }
+  if (lim->match_limit) {
+    extra.flags |= PCRE_EXTRA_MATCH_LIMIT;
+    extra.match_limit = (unsigned long)lim->match_limit;
+  }
+  if (lim->depth_limit) {
+    extra.flags |= PCRE_EXTRA_MATCH_LIMIT_RECURSION;
+    extra.match_limit_recursion = (unsigned long)lim->depth_limit;
+  }
+
+  int rc = pcre_exec(re->code, &extra, (const char *)s->data, (int)s->len, 0, 0, ovector, 3);
+  if (rc == PCRE_ERROR_MATCHLIMIT || rc == PCRE_ERROR_RECURSIONLIMIT) {
+    return NGX_DECLINED;
+  }
+  return rc;
+}
+
+#endif
+
 /* REGEX 任意命中 */
-ngx_uint_t ngx_http_waf_regex_any_match(ngx_array_t *regexes, const ngx_str_t *subject)
+ngx_uint_t ngx_http_waf_regex_any_match(ngx_array_t *regexes, const ngx_str_t *subject,
+                                        const waf_regex_limits_t *lim, ngx_uint_t *limit_hit)
 {
   if (regexes == NULL || subject == NULL || subject->data == NULL)
     return 0;
   if (subject->len == 0)
     return 0;
+
+  ngx_str_t subj = *subject;
+  ngx_uint_t hit = 0;
+  /* 自带执行状态（线程池任务）时不可走 ngx_regex_exec：PCRE2 下其 match data 为进程级共享 */
+  ngx_flag_t limited = lim && (lim->match_limit || lim->depth_limit || lim->exec);
+  if (lim && lim->max_bytes && subj.len > lim->max_bytes) {
+    subj.len = lim->max_bytes;
+    hit |= WAF_LIMIT_INSPECT;
+  }
+
   ngx_regex_t **regs = regexes->elts;
   for (ngx_uint_t i = 0; i < regexes->nelts; i++) {
     if (regs[i] == NULL)
       continue;
-    if (ngx_regex_exec(regs[i], (ngx_str_t *)subject, NULL, 0) >= 0) {
+    ngx_int_t rc = limited ? waf_regex_exec_limited(regs[i], &subj, lim)
+                           : ngx_regex_exec(regs[i], &subj, NULL, 0);
+    if (rc >= 0) {
       return 1;
     }
+    if (rc == NGX_DECLINED) {
+      hit |= WAF_LIMIT_PCRE;
+    }
+  }
+  if (limit_hit) {
+    *limit_hit |= hit;
   }
   return 0;
 }
@@ -443,59 +725,223 @@ ngx_uint_t ngx_http_waf_get_header(ngx_http_request_t *r, const ngx_str_t *name,
   return 0;
 }
 
-/* 遍历 query args 进行匹配 */
-ngx_uint_t ngx_http_waf_args_iter_match(const ngx_str_t *args, ngx_flag_t match_name,
+/* 遍历参数表进行匹配（contains/regex） */
+ngx_uint_t ngx_http_waf_args_iter_match(const ngx_array_t *args, ngx_flag_t match_name,
                                         ngx_flag_t caseless, ngx_array_t *patterns,
                                         ngx_array_t *regexes, ngx_flag_t is_regex,
-                                        ngx_pool_t *pool)
+                                        const waf_regex_limits_t *lim, ngx_uint_t *limit_hit)
 {
-  if (args == NULL || args->data == NULL || args->len == 0)
+  if (args == NULL || args->nelts == 0)
     return 0;
-  if (pool == NULL)
-    return 0; /* 禁止回退到全局池，要求调用方传入请求池 */
-  const u_char *p = args->data;
-  const u_char *end = args->data + args->len;
-  while (p < end) {
-    const u_char *name_start = p;
-    const u_char *name_end = p;
-    const u_char *value_start = NULL;
-    const u_char *value_end = NULL;
-
-    while (name_end < end && *name_end != '=' && *name_end != '&')
-      name_end++;
-    if (name_end < end && *name_end == '=') {
-      value_start = name_end + 1;
-      const u_char *q = value_start;
-      while (q < end && *q != '&')
-        q++;
-      value_end = q;
-      p = (q < end ? q + 1 : q);
-    } else {
-      p = (name_end < end && *name_end == '&') ? name_end + 1 : name_end;
-    }
-
-    /* 解码 subject（一次性 +→空格 与 %XX） */
-    ngx_str_t raw;
-    raw.len = match_name ? (size_t)(name_end - name_start)
-                         : (size_t)((value_end && value_start) ? (value_end - value_start) : 0);
-    raw.data = (u_char *)(match_name ? name_start : (value_start ? value_start : NULL));
-    if (raw.data == NULL)
-      continue;
-    ngx_str_t decoded;
-    if (ngx_http_waf_plus_to_space_and_unescape(pool, &raw, &decoded) != NGX_OK) {
+  const waf_arg_t *arg = args->elts;
+  ngx_uint_t hit = 0; /* 仅在整体未命中时上报限额触达 */
+  for (ngx_uint_t k = 0; k < args->nelts; k++) {
+    const ngx_str_t *subj = ngx_http_waf_arg_subject(&arg[k], match_name);
+    if (subj == NULL)
       continue;
-    }
 
     if (is_regex) {
-      if (ngx_http_waf_regex_any_match(regexes, &decoded))
+      if (ngx_http_waf_regex_any_match(regexes, subj, lim, &hit))
         return 1;
     } else if (patterns) {
       ngx_str_t *pats = patterns->elts;
       for (ngx_uint_t i = 0; i < patterns->nelts; i++) {
-        if (ngx_http_waf_contains_ci(&decoded, &pats[i], caseless))
+        if (ngx_http_waf_contains_ci(subj, &pats[i], caseless))
           return 1;
       }
     }
   }
+  if (limit_hit)
+    *limit_hit |= hit;
+  return 0;
+}
+
+/* 遍历参数表，逐个 name/value 做一次 AC 扫描（整桶 pattern 一遍完成） */
+void ngx_http_waf_args_iter_ac(const ngx_array_t *args, ngx_flag_t match_name, const waf_ac_t *ac,
+                               u_char *hits)
+{
+  if (args == NULL || args->nelts == 0 || ac == NULL || hits == NULL)
+    return;
+  const waf_arg_t *arg = args->elts;
+  for (ngx_uint_t k = 0; k < args->nelts; k++) {
+    const ngx_str_t *subj = ngx_http_waf_arg_subject(&arg[k], match_name);
+    if (subj == NULL)
+      continue;
+    waf_ac_scan(ac, subj->data, subj->len, hits);
+  }
+}
+
+/*
+ * ================================================================
+ *  目标变换（WAF_TF_*）
+ *  - 各步均不增长长度：首次需要改动时复制一份到 pool，之后原地处理
+ *  - 全部步骤均无需改动时零拷贝返回输入
+ * ================================================================
+ */
+
+static ngx_int_t waf_tf_own(ngx_pool_t *pool, ngx_str_t *cur, ngx_flag_t *owned)
+{
+  if (*owned)
+    return NGX_OK;
+  u_char *p = ngx_pnalloc(pool, cur->len + 1);
+  if (p == NULL)
+    return NGX_ERROR;
+  ngx_memcpy(p, cur->data, cur->len);
+  p[cur->len] = '\0';
+  cur->data = p;
+  *owned = 1;
+  return NGX_OK;
+}
+
+#define waf_tf_slash(c) ((c) == '/' || (c) == '\\')
+#define waf_tf_space(c) \
+  ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\n' || (c) == '\v' || (c) == '\f')
+
+/* 是否存在需要归一的路径形态：'\\'、'//'、以 '.' 开头的段 */
+static ngx_uint_t waf_tf_path_dirty(const u_char *p, size_t len)
+{
+  for (size_t i = 0; i < len; i++) {
+    if (p[i] == '\\')
+      return 1;
+    if (p[i] == '/' && i + 1 < len && (p[i + 1] == '/' || p[i + 1] == '.'))
+      return 1;
+    if (i == 0 && p[i] == '.')
+      return 1;
+  }
   return 0;
 }
+
+/* 原地路径归一，返回新长度 */
+static size_t waf_tf_normalize_path(u_char *buf, size_t len)
+{
+  u_char *s = buf, *end = buf + len, *d = buf;
+
+  while (s < end) {
+    u_char c = waf_tf_slash(*s) ? '/' : *s;
+    if (c == '/') {
+      if (d == buf || d[-1] != '/')
+        *d++ = '/';
+      s++;
+      continue;
+    }
+    if (c == '.' && (d == buf || d[-1] == '/')) {
+      size_t rest = (size_t)(end - s);
+      if (rest == 1 || waf_tf_slash(s[1])) {
+        s += (rest == 1) ? 1 : 2; /* "./" */
+        continue;
+      }
+      if (s[1] == '.' && (rest == 2 || waf_tf_slash(s[2]))) {
+        s += (rest == 2) ? 2 : 3; /* "../"：回退一段，不越过起点 */
+        if (d > buf + 1) {
+          d--;
+          while (d > buf && d[-1] != '/')
+            d--;
+        }
+        continue;
+      }
+    }
+    /* 普通段：复制到下一个分隔符 */
+    while (s < end && !waf_tf_slash(*s))
+      *d++ = *s++;
+  }
+  return (size_t)(d - buf);
+}
+
+ngx_int_t ngx_http_waf_transform(ngx_pool_t *pool, ngx_uint_t transform, const ngx_str_t *in,
+                                 ngx_str_t *out)
+{
+  if (in == NULL || out == NULL)
+    return NGX_ERROR;
+
+  ngx_str_t cur = *in;
+  ngx_flag_t owned = 0;
+  if (cur.data == NULL || cur.len == 0 || transform == 0) {
+    *out = cur;
+    return NGX_OK;
+  }
+
+  ngx_uint_t passes = (transform & WAF_TF_DOUBLE_DECODE) ? 2 : (transform & WAF_TF_URL_DECODE) ? 1 : 0;
+  for (ngx_uint_t k = 0; k < passes; k++) {
+    if (waf_simd_find2(cur.data, cur.len, '%', '%') == cur.len)
+      break;
+    /* 首次解码直接写入新缓冲，其后原地解码 */
+    u_char *dst = cur.data;
+    if (!owned) {
+      dst = ngx_pnalloc(pool, cur.len + 1);
+      if (dst == NULL)
+        return NGX_ERROR;
+      owned = 1;
+    }
+    cur.len = waf_simd_url_decode(dst, cur.data, cur.len, 0, NULL);
+    cur.data = dst;
+    cur.data[cur.len] = '\0';
+  }
+
+  if ((transform & WAF_TF_NORMALIZE_PATH) && waf_tf_path_dirty(cur.data, cur.len)) {
+    if (waf_tf_own(pool, &cur, &owned) != NGX_OK)
+      return NGX_ERROR;
+    cur.len = waf_tf_normalize_path(cur.data, cur.len);
+  }
+
+  if (transform & WAF_TF_COMPRESS_WS) {
+    size_t i = 0;
+    while (i < cur.len && !(waf_tf_space(cur.data[i]) &&
+                            (cur.data[i] != ' ' || (i + 1 < cur.len && waf_tf_space(cur.data[i + 1])))))
+      i++;
+    if (i < cur.len) {
+      if (waf_tf_own(pool, &cur, &owned) != NGX_OK)
+        return NGX_ERROR;
+      u_char *d = cur.data + i;
+      for (size_t j = i; j < cur.len; j++) {
+        if (waf_tf_space(cur.data[j])) {
+          if (d == cur.data || d[-1] != ' ')
+            *d++ = ' ';
+        } else {
+          *d++ = cur.data[j];
+        }
+      }
+      cur.len = (size_t)(d - cur.data);
+    }
+  }
+
+  if (transform & WAF_TF_LOWERCASE) {
+    size_t i = 0;
+    while (i < cur.len && !(cur.data[i] >= 'A' && cur.data[i] <= 'Z'))
+      i++;
+    if (i < cur.len) {
+      if (waf_tf_own(pool, &cur, &owned) != NGX_OK)
+        return NGX_ERROR;
+      for (; i < cur.len; i++)
+        cur.data[i] = ngx_tolower(cur.data[i]);
+    }
+  }
+
+  *out = cur;
+  return NGX_OK;
+}
+
+ngx_int_t ngx_http_waf_transform_args(ngx_pool_t *pool, ngx_uint_t transform,
+                                      const ngx_array_t *in, ngx_array_t **out)
+{
+  if (in == NULL || out == NULL)
+    return NGX_ERROR;
+
+  ngx_array_t *tbl = ngx_array_create(pool, in->nelts ? in->nelts : 1, sizeof(waf_arg_t));
+  if (tbl == NULL)
+    return NGX_ERROR;
+
+  const waf_arg_t *src = in->elts;
+  for (ngx_uint_t i = 0; i < in->nelts; i++) {
+    waf_arg_t *dst = ngx_array_push(tbl);
+    if (dst == NULL)
+      return NGX_ERROR;
+    *dst = src[i];
+    if (ngx_http_waf_transform(pool, transform, &src[i].name, &dst->name) != NGX_OK)
+      return NGX_ERROR;
+    if (src[i].has_value &&
+        ngx_http_waf_transform(pool, transform, &src[i].value, &dst->value) != NGX_OK)
+      return NGX_ERROR;
+  }
+  *out = tbl;
+  return NGX_OK;
+}
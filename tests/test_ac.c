@@ -0,0 +1,135 @@
+#include "waf_test.h"
+
+#include "ngx_http_waf_ac.h"
+
+/*
+ * Aho-Corasick 对照测试：逐 pattern 朴素查找得到 hits[] 与输出次数，
+ * 与整段扫描、任意两段切分以及逐字节的分块扫描结果逐一比较。
+ */
+
+#define WAF_TEST_AC_MAX 8
+
+typedef struct {
+  const char *pattern;
+  ngx_uint_t slot;
+} waf_test_ac_pattern_t;
+
+typedef struct {
+  ngx_flag_t caseless;
+  waf_test_ac_pattern_t patterns[WAF_TEST_AC_MAX];
+  const char *subjects[WAF_TEST_AC_MAX];
+} waf_test_ac_case_t;
+
+static waf_test_ac_case_t waf_test_ac_cases[] = {
+    {0,
+     {{"he", 0}, {"she", 1}, {"his", 2}, {"hers", 3}},
+     {"ushers", "ahishers", "HERS", "h", "", "shehishers", NULL}},
+    {1,
+     {{"select", 0}, {"union", 1}, {"UNION ALL", 2}},
+     {"UnIoN aLl SeLeCt", "unio nselect", "UNIONALL", "xx", NULL}},
+    /* 多个 pattern 共用槽位（同一规则的多个 pattern） */
+    {0, {{"abc", 0}, {"bcd", 0}, {"x", 1}}, {"abcd", "bcx", "xbc", NULL}},
+    /* 自身重叠与互为后缀 */
+    {0, {{"aa", 0}, {"aaa", 1}, {"a", 2}}, {"aaaaa", "ba", "", NULL}},
+    /* 相同 pattern 属于不同规则 */
+    {0, {{"dup", 0}, {"dup", 1}, {"up", 2}}, {"dupdup", "du p", NULL}},
+    /* 非 ASCII 字节不参与大小写折叠 */
+    {1, {{"\xc3\x89t\xc3\xa9", 0}, {"\xff\xfe", 1}}, {"\xc3\x89T\xc3\xa9", "\xc3\xa9t\xc3\xa9", "a\xff\xfe", NULL}},
+    /* caseless 折叠只作用于字母 */
+    {1, {{"<ScRiPt", 0}, {"[A-Z]", 1}, {"@", 2}}, {"<SCRIPT [a-z]", "{A-Z}", "`", NULL}},
+    {0, {{"<ScRiPt", 0}, {"[A-Z]", 1}}, {"<SCRIPT [a-z]", "<ScRiPt [A-Z]", NULL}},
+};
+
+/* 对照实现：每个 pattern 在 subject 中出现（可重叠）的次数之和 */
+static ngx_uint_t waf_test_ac_expect(const waf_test_ac_case_t *tc, ngx_uint_t npats,
+                                     const u_char *s, size_t len, u_char *hits)
+{
+  ngx_uint_t n = 0;
+  for (ngx_uint_t i = 0; i < npats; i++) {
+    const u_char *p = (const u_char *)tc->patterns[i].pattern;
+    size_t plen = ngx_strlen(p);
+    for (size_t off = 0; off + plen <= len; off++) {
+      if (waf_test_contains(s + off, plen, p, plen, tc->caseless)) {
+        hits[tc->patterns[i].slot] = 1;
+        n++;
+      }
+    }
+  }
+  return n;
+}
+
+static void waf_test_ac_case(ngx_pool_t *pool, ngx_uint_t ci, const waf_test_ac_case_t *tc)
+{
+  waf_ac_pattern_t pats[WAF_TEST_AC_MAX];
+  ngx_uint_t npats = 0, nslots = 0;
+  for (; npats < WAF_TEST_AC_MAX && tc->patterns[npats].pattern; npats++) {
+    pats[npats].pattern = WAF_TEST_STR(tc->patterns[npats].pattern);
+    pats[npats].slot = tc->patterns[npats].slot;
+    pats[npats].rule_id = ci;
+    pats[npats].pattern_index = npats;
+    nslots = ngx_max(nslots, tc->patterns[npats].slot + 1);
+  }
+
+  waf_ac_t *ac = waf_ac_compile(pool, &waf_test_log, pats, npats, tc->caseless);
+  WAF_TEST_CHECK(ac != NULL, "case %lu: compile failed", (unsigned long)ci);
+  if (ac == NULL)
+    return;
+  WAF_TEST_CHECK(ac->nslots == nslots, "case %lu: nslots %lu, want %lu", (unsigned long)ci,
+                 (unsigned long)ac->nslots, (unsigned long)nslots);
+
+  for (ngx_uint_t si = 0; si < WAF_TEST_AC_MAX && tc->subjects[si]; si++) {
+    const u_char *s = (const u_char *)tc->subjects[si];
+    size_t len = ngx_strlen(s);
+
+    u_char want[WAF_TEST_AC_MAX], got[WAF_TEST_AC_MAX];
+    ngx_memzero(want, sizeof(want));
+    ngx_memzero(got, sizeof(got));
+    ngx_uint_t want_n = waf_test_ac_expect(tc, npats, s, len, want);
+
+    ngx_uint_t n = waf_ac_scan(ac, s, len, got);
+    WAF_TEST_CHECK(n == want_n && ngx_memcmp(got, want, nslots) == 0,
+                   "case %lu \"%s\": scan outputs %lu, want %lu", (unsigned long)ci,
+                   tc->subjects[si], (unsigned long)n, (unsigned long)want_n);
+
+    /* 两段切分：跨边界的 pattern 与整段扫描一样命中 */
+    for (size_t cut = 0; cut <= len; cut++) {
+      uint32_t state = 0;
+      ngx_memzero(got, sizeof(got));
+      n = waf_ac_scan_stream(ac, s, cut, got, &state);
+      n += waf_ac_scan_stream(ac, s + cut, len - cut, got, &state);
+      WAF_TEST_CHECK(n == want_n && ngx_memcmp(got, want, nslots) == 0,
+                     "case %lu \"%s\": split at %lu outputs %lu, want %lu", (unsigned long)ci,
+                     tc->subjects[si], (unsigned long)cut, (unsigned long)n,
+                     (unsigned long)want_n);
+    }
+
+    /* 逐字节 */
+    uint32_t state = 0;
+    ngx_memzero(got, sizeof(got));
+    n = 0;
+    for (size_t k = 0; k < len; k++) {
+      n += waf_ac_scan_stream(ac, s + k, 1, got, &state);
+    }
+    WAF_TEST_CHECK(n == want_n && ngx_memcmp(got, want, nslots) == 0,
+                   "case %lu \"%s\": bytewise outputs %lu, want %lu", (unsigned long)ci,
+                   tc->subjects[si], (unsigned long)n, (unsigned long)want_n);
+  }
+}
+
+int main(void)
+{
+  waf_test_init();
+  ngx_pool_t *pool = waf_test_pool();
+
+  for (ngx_uint_t i = 0; i < WAF_TEST_NELTS(waf_test_ac_cases); i++) {
+    waf_test_ac_case(pool, i, &waf_test_ac_cases[i]);
+  }
+
+  /* 空 pattern 拒绝编译 */
+  waf_ac_pattern_t empty = {ngx_string(""), 0, 0, 0};
+  WAF_TEST_CHECK(waf_ac_compile(pool, &waf_test_log, &empty, 1, 0) == NULL,
+                 "empty pattern compiled");
+
+  ngx_destroy_pool(pool);
+  return waf_test_done("test_ac");
+}
@@ -0,0 +1,180 @@
+#include "waf_test.h"
+
+#include "ngx_http_waf_compiler.h"
+#include "ngx_http_waf_ipindex.h"
+
+/*
+ * CIDR 基数树索引对照测试：按桶序逐条规则、逐个 CIDR 判定（含 negate）得到
+ * “首条判定命中”的下标，与 waf_ip_index_lookup 的结果比较。
+ */
+
+#define WAF_TEST_IP_MAX 8
+
+typedef struct {
+  ngx_flag_t negate;
+  const char *cidrs[WAF_TEST_IP_MAX]; /* 全为 NULL 表示非 CIDR 规则（compiled_cidrs == NULL） */
+} waf_test_ip_rule_t;
+
+typedef struct {
+  waf_test_ip_rule_t rules[WAF_TEST_IP_MAX];
+  ngx_uint_t nrules;
+  const char *addrs[16];
+} waf_test_ip_case_t;
+
+static waf_test_ip_case_t waf_test_ip_cases[] = {
+    /* 最小下标传播：更长前缀的下标更大时，仍返回覆盖它的更短前缀 */
+    {{{0, {"10.1.0.0/16"}}, {0, {"10.0.0.0/8"}}, {0, {"10.1.2.0/24"}}},
+     3,
+     {"10.1.2.3", "10.2.0.1", "10.1.255.255", "11.0.0.1", "0.0.0.0", NULL}},
+    {{{0, {"10.0.0.0/8", "192.168.1.1"}},
+      {0, {"10.1.0.0/16"}},
+      {0, {"192.168.0.0/16", "10.0.0.0/8"}},
+      {1, {"172.16.0.0/12"}},
+      {0, {"0.0.0.0/0"}}},
+     5,
+     {"10.1.0.1", "192.168.1.1", "192.168.1.2", "172.16.5.5", "172.32.0.1", "8.8.8.8",
+      "::1", NULL}},
+    /* 取反规则位于最前：地址不在其成员中即命中 */
+    {{{1, {"127.0.0.1", "::1"}}, {0, {"0.0.0.0/0", "::/0"}}},
+     2,
+     {"127.0.0.1", "127.0.0.2", "::1", "::2", NULL}},
+    /* IPv6 与混合地址族 */
+    {{{0, {NULL}},
+      {0, {"2001:db8::/32"}},
+      {1, {"::1", "10.0.0.0/8"}},
+      {0, {"fe80::/10", "2001:db8:1::/48"}},
+      {0, {"2001:db8:1:2::1"}}},
+     5,
+     {"2001:db8::1", "2001:db8:1:2::1", "::1", "fe80::1", "febf::1", "fec0::1", "10.9.9.9",
+      "11.0.0.1", NULL}},
+    /* 同一前缀在多条规则中重复 */
+    {{{0, {"192.0.2.0/24"}}, {0, {"192.0.2.0/24", "198.51.100.7"}}},
+     2,
+     {"192.0.2.200", "198.51.100.7", "198.51.100.8", NULL}},
+};
+
+static void waf_test_ip_parse(const char *text, waf_ip_addr_t *addr)
+{
+  ngx_memzero(addr, sizeof(*addr));
+  if (inet_pton(AF_INET, text, addr->addr) == 1) {
+    addr->family = AF_INET;
+  } else if (inet_pton(AF_INET6, text, addr->addr) == 1) {
+    addr->family = AF_INET6;
+  }
+}
+
+static ngx_uint_t waf_test_ip_in(const ngx_cidr_t *c, const waf_ip_addr_t *addr)
+{
+  if (c->family != addr->family)
+    return 0;
+  if (c->family == AF_INET) {
+    uint32_t a;
+    ngx_memcpy(&a, addr->addr, sizeof(a));
+    return (a & c->u.in.mask) == c->u.in.addr;
+  }
+  for (ngx_uint_t i = 0; i < 16; i++) {
+    if ((addr->addr[i] & c->u.in6.mask.s6_addr[i]) != c->u.in6.addr.s6_addr[i])
+      return 0;
+  }
+  return 1;
+}
+
+static ngx_uint_t waf_test_ip_expect(ngx_array_t *bucket, const waf_ip_addr_t *addr)
+{
+  if (addr->family == 0)
+    return WAF_IP_INDEX_NONE;
+  waf_compiled_rule_t **rules = bucket->elts;
+  for (ngx_uint_t i = 0; i < bucket->nelts; i++) {
+    if (rules[i]->compiled_cidrs == NULL)
+      continue;
+    ngx_cidr_t *c = rules[i]->compiled_cidrs->elts;
+    ngx_uint_t in = 0;
+    for (ngx_uint_t k = 0; !in && k < rules[i]->compiled_cidrs->nelts; k++) {
+      in = waf_test_ip_in(&c[k], addr);
+    }
+    if (in != (ngx_uint_t)rules[i]->negate)
+      return i;
+  }
+  return WAF_IP_INDEX_NONE;
+}
+
+static ngx_array_t *waf_test_ip_bucket(ngx_pool_t *pool, const waf_test_ip_case_t *tc)
+{
+  ngx_array_t *bucket = ngx_array_create(pool, tc->nrules, sizeof(waf_compiled_rule_t *));
+  if (bucket == NULL)
+    return NULL;
+
+  for (ngx_uint_t i = 0; i < tc->nrules; i++) {
+    waf_compiled_rule_t **slot = ngx_array_push(bucket);
+    waf_compiled_rule_t *rule = ngx_pcalloc(pool, sizeof(waf_compiled_rule_t));
+    if (slot == NULL || rule == NULL)
+      return NULL;
+    *slot = rule;
+    rule->match = WAF_MATCH_CIDR;
+    rule->negate = tc->rules[i].negate;
+    if (tc->rules[i].cidrs[0] == NULL)
+      continue;
+
+    rule->compiled_cidrs = ngx_array_create(pool, WAF_TEST_IP_MAX, sizeof(ngx_cidr_t));
+    if (rule->compiled_cidrs == NULL)
+      return NULL;
+    for (ngx_uint_t k = 0; k < WAF_TEST_IP_MAX && tc->rules[i].cidrs[k]; k++) {
+      ngx_cidr_t *c = ngx_array_push(rule->compiled_cidrs);
+      ngx_str_t text = WAF_TEST_STR(tc->rules[i].cidrs[k]);
+      if (c == NULL)
+        return NULL;
+      ngx_memzero(c, sizeof(*c));
+      if (ngx_ptocidr(&text, c) != NGX_OK) {
+        fprintf(stderr, "bad cidr in table: %s\n", tc->rules[i].cidrs[k]);
+        exit(2);
+      }
+    }
+  }
+  return bucket;
+}
+
+static void waf_test_ip_case(ngx_pool_t *pool, ngx_uint_t ci, const waf_test_ip_case_t *tc)
+{
+  ngx_array_t *bucket = waf_test_ip_bucket(pool, tc);
+  ngx_int_t rc = NGX_ERROR;
+  waf_ip_index_t *idx = bucket ? waf_ip_index_build(pool, &waf_test_log, bucket, &rc) : NULL;
+  WAF_TEST_CHECK(idx != NULL && rc == NGX_OK, "case %lu: build failed", (unsigned long)ci);
+  if (idx == NULL)
+    return;
+
+  for (ngx_uint_t ai = 0; ai < WAF_TEST_NELTS(tc->addrs) && tc->addrs[ai]; ai++) {
+    waf_ip_addr_t addr;
+    waf_test_ip_parse(tc->addrs[ai], &addr);
+    ngx_uint_t want = waf_test_ip_expect(bucket, &addr);
+    ngx_uint_t got = waf_ip_index_lookup(idx, &addr);
+    WAF_TEST_CHECK(got == want, "case %lu %s: lookup %ld, want %ld", (unsigned long)ci,
+                   tc->addrs[ai], (long)got, (long)want);
+  }
+
+  /* 无效地址不命中任何规则（包括取反规则） */
+  waf_ip_addr_t none;
+  ngx_memzero(&none, sizeof(none));
+  WAF_TEST_CHECK(waf_ip_index_lookup(idx, &none) == WAF_IP_INDEX_NONE,
+                 "case %lu: invalid address matched", (unsigned long)ci);
+}
+
+int main(void)
+{
+  waf_test_init();
+  ngx_pool_t *pool = waf_test_pool();
+
+  for (ngx_uint_t i = 0; i < WAF_TEST_NELTS(waf_test_ip_cases); i++) {
+    waf_test_ip_case(pool, i, &waf_test_ip_cases[i]);
+  }
+
+  /* 桶内没有 CIDR 规则：返回 NULL 且 rc = NGX_OK */
+  waf_test_ip_case_t empty = {{{0, {NULL}}}, 1, {NULL}};
+  ngx_array_t *bucket = waf_test_ip_bucket(pool, &empty);
+  ngx_int_t rc = NGX_ERROR;
+  WAF_TEST_CHECK(bucket && waf_ip_index_build(pool, &waf_test_log, bucket, &rc) == NULL &&
+                     rc == NGX_OK,
+                 "bucket without cidr rules");
+
+  ngx_destroy_pool(pool);
+  return waf_test_done("test_ipindex");
+}
@@ -0,0 +1,118 @@
+#include "waf_test.h"
+
+#include "ngx_http_waf_log.h"
+
+/*
+ * JSONL 字符串转义对照测试
+ *  - 合法 UTF-8：输出须与 yyjson 默认写出（yyjson_mut_val_write，flg=0）逐字节一致
+ *  - 非法 UTF-8：yyjson 拒绝写出，按表中期望（每个非法字节替换为 �）比较
+ *  - 两类输出都须能被 yyjson_read 解析回期望字符串
+ */
+
+typedef struct {
+  const char *in;
+  size_t len;          /* 0 表示按 strlen（用例含 NUL 时显式给出） */
+  const char *invalid; /* 非 NULL：输入含非法 UTF-8，期望的转义结果（不含引号） */
+  const char *decoded; /* invalid 用例解析回的字符串 */
+} waf_test_json_case_t;
+
+static waf_test_json_case_t waf_test_json_cases[] = {
+    {"", 0, NULL, NULL},
+    {"plain ascii /path?x=1", 0, NULL, NULL},
+    {"quote\" backslash\\ slash/", 0, NULL, NULL},
+    {"\b\f\n\r\t", 0, NULL, NULL},
+    {"\x01\x02\x1f\x7f", 0, NULL, NULL},
+    {"nul\0byte", 8, NULL, NULL},
+    {"\xc3\xa9t\xc3\xa9 \xe4\xb8\xad\xe6\x96\x87 \xf0\x9f\x98\x80", 0, NULL, NULL},
+    {"\xc2\x80\xdf\xbf\xe0\xa0\x80\xef\xbf\xbf\xf0\x90\x80\x80\xf4\x8f\xbf\xbf", 0, NULL, NULL},
+    {"<script>alert('x')</script>", 0, NULL, NULL},
+    /* 非法序列 */
+    {"a\xff" "b", 0, "a\\ufffdb", "a\xef\xbf\xbd" "b"},
+    {"\x80", 0, "\\ufffd", "\xef\xbf\xbd"},
+    {"\xc0\xaf", 0, "\\ufffd\\ufffd", "\xef\xbf\xbd\xef\xbf\xbd"},
+    {"\xc3", 0, "\\ufffd", "\xef\xbf\xbd"},
+    {"\xc3(", 0, "\\ufffd(", "\xef\xbf\xbd("},
+    {"\xe0\x80\xaf", 0, "\\ufffd\\ufffd\\ufffd", "\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd"},
+    {"\xed\xa0\x80", 0, "\\ufffd\\ufffd\\ufffd", "\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd"},
+    {"\xf4\x90\x80\x80", 0, "\\ufffd\\ufffd\\ufffd\\ufffd",
+     "\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd"},
+    {"\xe4\xb8", 0, "\\ufffd\\ufffd", "\xef\xbf\xbd\xef\xbf\xbd"},
+    {"ok\xe4\xb8\xad\xe4\xb8\"", 0, "ok\xe4\xb8\xad\\ufffd\\ufffd\\\"",
+     "ok\xe4\xb8\xad\xef\xbf\xbd\xef\xbf\xbd\""},
+};
+
+static void waf_test_json_case(ngx_uint_t ci, const waf_test_json_case_t *tc)
+{
+  const u_char *in = (const u_char *)tc->in;
+  size_t len = tc->len ? tc->len : ngx_strlen(in);
+
+  u_char buf[512];
+  buf[0] = '"';
+  u_char *p = waf_log_json_escape(buf + 1, in, len);
+  *p++ = '"';
+  size_t out_len = (size_t)(p - buf);
+  WAF_TEST_CHECK(out_len <= len * 6 + 2, "case %lu: output exceeds len * 6", (unsigned long)ci);
+
+  const u_char *decoded = in;
+  size_t decoded_len = len;
+
+  if (tc->invalid == NULL) {
+    yyjson_mut_doc *doc = yyjson_mut_doc_new(NULL);
+    yyjson_mut_val *val = yyjson_mut_strn(doc, tc->in, len);
+    size_t want_len = 0;
+    char *want = yyjson_mut_val_write(val, 0, &want_len);
+    WAF_TEST_CHECK(want != NULL, "case %lu: yyjson rejected valid input", (unsigned long)ci);
+    if (want) {
+      WAF_TEST_CHECK(want_len == out_len && ngx_memcmp(want, buf, out_len) == 0,
+                     "case %lu: escape %.*s, yyjson %s", (unsigned long)ci, (int)out_len, buf,
+                     want);
+      free(want);
+    }
+    yyjson_mut_doc_free(doc);
+  } else {
+    size_t want_len = ngx_strlen(tc->invalid);
+    WAF_TEST_CHECK(want_len + 2 == out_len && ngx_memcmp(buf + 1, tc->invalid, want_len) == 0,
+                   "case %lu: escape %.*s, want \"%s\"", (unsigned long)ci, (int)out_len, buf,
+                   tc->invalid);
+    decoded = (const u_char *)tc->decoded;
+    decoded_len = ngx_strlen(decoded);
+  }
+
+  yyjson_doc *doc = yyjson_read((const char *)buf, out_len, 0);
+  yyjson_val *root = yyjson_doc_get_root(doc);
+  WAF_TEST_CHECK(root && yyjson_is_str(root) && yyjson_get_len(root) == decoded_len &&
+                     ngx_memcmp(yyjson_get_str(root), decoded, decoded_len) == 0,
+                 "case %lu: output does not parse back", (unsigned long)ci);
+  yyjson_doc_free(doc);
+}
+
+int main(void)
+{
+  waf_test_init();
+
+  for (ngx_uint_t i = 0; i < WAF_TEST_NELTS(waf_test_json_cases); i++) {
+    waf_test_json_case(i, &waf_test_json_cases[i]);
+  }
+
+  /* 全部单字节：0x00-0x7f 与 yyjson 一致，0x80-0xff 单独出现时均非法 */
+  for (ngx_uint_t c = 0; c < 256; c++) {
+    u_char in = (u_char)c;
+    u_char buf[16];
+    size_t n = (size_t)(waf_log_json_escape(buf, &in, 1) - buf);
+    if (c >= 0x80) {
+      WAF_TEST_CHECK(n == 6 && ngx_memcmp(buf, "\\ufffd", 6) == 0, "byte 0x%02lx",
+                     (unsigned long)c);
+      continue;
+    }
+    yyjson_mut_doc *doc = yyjson_mut_doc_new(NULL);
+    size_t want_len = 0;
+    char *want = yyjson_mut_val_write(yyjson_mut_strn(doc, (const char *)&in, 1), 0, &want_len);
+    WAF_TEST_CHECK(want && want_len == n + 2 && ngx_memcmp(want + 1, buf, n) == 0,
+                   "byte 0x%02lx: escape %.*s, yyjson %s", (unsigned long)c, (int)n, buf,
+                   want ? want : "(null)");
+    free(want);
+    yyjson_mut_doc_free(doc);
+  }
+
+  return waf_test_done("test_json_escape");
+}
@@ -0,0 +1,155 @@
+#include "waf_test.h"
+
+#include "ngx_http_waf_compiler.h"
+
+#if !(NGX_PCRE2)
+#error "tests/test_regex.c requires nginx built with PCRE2"
+#endif
+
+/*
+ * 正则静态分析对照测试：以 PCRE2 的实际匹配结果校验
+ *  - 字面量因子：PCRE2 命中的 subject 必须包含至少一个因子（预筛不得漏报）
+ *  - stream_width：PCRE2 命中的匹配长度不得超过该宽度（流式窗口不得截断匹配）
+ * 表中 factors / width 给出的期望值额外锁定已知行为（如 {,m} 与 \Q..\E 的处理）。
+ */
+
+#define WAF_TEST_ANY ((size_t)-1)
+
+typedef struct {
+  const char *pattern;
+  ngx_flag_t caseless; /* 规则级 caseless */
+  ngx_int_t factors;   /* 1：必须提取到因子；0：必须为 NULL；-1：不作要求 */
+  size_t width;        /* 期望 stream_width（0 表示不可窗口判定）；WAF_TEST_ANY 不检查 */
+  const char *subjects[8];
+} waf_test_regex_case_t;
+
+static waf_test_regex_case_t waf_test_regex_cases[] = {
+    {"<script", 0, 1, 7, {"<script>", "x<SCRIPT", "<scrip", NULL}},
+    {"<script", 1, 1, 7, {"x<SCRIPT", "<ScRiPt src", NULL}},
+    {"union\\s+select", 1, 1, 0, {"UNION  SELECT", "union\tselect 1", "unionselect", NULL}},
+    {"(?i)select\\s{1,3}from", 0, 1, 13, {"SELECT FROM", "select\t\t\tFrom", "selectfrom", NULL}},
+    {"foo|barbaz", 0, 1, 6, {"xfoo", "barbaz", "bar baz", NULL}},
+    {"(?:foo|barbaz){2}", 0, 1, 12, {"foofoo", "barbazfoo", "foo", NULL}},
+    {"[ab]cd|efg", 0, 1, 3, {"acd", "bcd", "xefg", "cd", NULL}},
+    {"x[a-z]{3,5}y", 0, -1, 7, {"xabcy", "xabcdey", "xaby", NULL}},
+    {"a.{0,10}b", 0, -1, 12, {"ab", "a0123456789b", "a01234567890b", NULL}},
+    {"\\x41\\x{42}C", 0, 1, 3, {"ABC", "abc", NULL}},
+    {"a(?#comment)b", 0, 1, 2, {"ab", "a b", NULL}},
+    {"etc/passwd?", 0, 1, 10, {"/etc/passwd", "/etc/passw", NULL}},
+    /* \Q..\E：量词只作用于最后一个引用字节 */
+    {"a\\Qbc\\E?d", 0, 1, 4, {"abd", "abcd", "acd", "ad", NULL}},
+    {"\\Qa.b\\E+", 0, 1, 0, {"a.b", "a.bbb", "axb", NULL}},
+    {"x\\Q\\E*y", 0, -1, WAF_TEST_ANY, {"xy", "y", NULL}},
+    /* {,m}：PCRE2 10.43 之前为字面量，之后为量词；两种语义下都不得漏报 */
+    {"ab{,1}c", 0, 0, 0, {"ab{,1}c", "ac", "abc", NULL}},
+    {"ab{ 1 }c", 0, 0, 0, {"ab{ 1 }c", "abc", NULL}},
+    {"ab{2}c", 0, 1, 4, {"abbc", "abc", NULL}},
+    {"ab{2,}c", 0, 1, 0, {"abbc", "abbbbbc", NULL}},
+    /* 锚点、环视、反向引用与取反语义：不可窗口判定 */
+    {"^admin", 0, 1, 0, {"admin", "xadmin", NULL}},
+    {"passwd$", 0, 1, 0, {"/etc/passwd", "passwd ", NULL}},
+    {"(?=ab)abc", 0, -1, 0, {"abc", NULL}},
+    {"(a)\\1bc", 0, -1, 0, {"aabc", NULL}},
+    {"\\bselect\\b", 1, 1, 0, {"Select 1", "selected", NULL}},
+    /* 无法提取因子 */
+    {".*", 0, 0, 0, {"", "anything", NULL}},
+    {"a?|b", 0, 0, 1, {"", "b", NULL}},
+    {"[0-9]+", 0, 0, 0, {"123", NULL}},
+};
+
+/* PCRE2 对照：返回匹配长度，未命中返回 -1 */
+static ngx_int_t waf_test_pcre(const char *pattern, ngx_flag_t caseless, const char *subject)
+{
+  int err;
+  PCRE2_SIZE off;
+  pcre2_code *re = pcre2_compile((PCRE2_SPTR)pattern, PCRE2_ZERO_TERMINATED,
+                                 caseless ? PCRE2_CASELESS : 0, &err, &off, NULL);
+  if (re == NULL) {
+    fprintf(stderr, "pcre2_compile failed: %s\n", pattern);
+    exit(2);
+  }
+  pcre2_match_data *md = pcre2_match_data_create_from_pattern(re, NULL);
+  ngx_int_t rc = pcre2_match(re, (PCRE2_SPTR)subject, ngx_strlen(subject), 0, 0, md, NULL);
+  ngx_int_t len = -1;
+  if (rc >= 0) {
+    PCRE2_SIZE *ov = pcre2_get_ovector_pointer(md);
+    len = (ngx_int_t)(ov[1] - ov[0]);
+  }
+  pcre2_match_data_free(md);
+  pcre2_code_free(re);
+  return len;
+}
+
+static void waf_test_regex_case(ngx_pool_t *pool, const waf_test_regex_case_t *tc)
+{
+  ngx_str_t pattern = WAF_TEST_STR(tc->pattern);
+  ngx_flag_t factors_caseless = tc->caseless;
+  ngx_array_t *factors = waf_regex_extract_factors(pool, &pattern, &factors_caseless);
+
+  if (tc->factors >= 0) {
+    WAF_TEST_CHECK((factors != NULL) == (tc->factors == 1), "factors(%s): got %s", tc->pattern,
+                   factors ? "a set" : "NULL");
+  }
+
+  waf_compiled_rule_t rule;
+  ngx_memzero(&rule, sizeof(rule));
+  rule.match = WAF_MATCH_REGEX;
+  rule.caseless = tc->caseless;
+  rule.patterns = ngx_array_create(pool, 1, sizeof(ngx_str_t));
+  ngx_str_t *slot = rule.patterns ? ngx_array_push(rule.patterns) : NULL;
+  if (slot == NULL) {
+    fprintf(stderr, "out of memory\n");
+    exit(2);
+  }
+  *slot = pattern;
+  waf_precompile_stream_width(&rule);
+
+  if (tc->width != WAF_TEST_ANY) {
+    WAF_TEST_CHECK(rule.stream_width == tc->width, "stream_width(%s): got %lu, want %lu",
+                   tc->pattern, (unsigned long)rule.stream_width, (unsigned long)tc->width);
+  }
+
+  /* negate 规则在窗口上未命中不代表整体未命中 */
+  rule.negate = 1;
+  waf_precompile_stream_width(&rule);
+  WAF_TEST_CHECK(rule.stream_width == 0, "stream_width(%s, negate): got %lu", tc->pattern,
+                 (unsigned long)rule.stream_width);
+  rule.negate = 0;
+  waf_precompile_stream_width(&rule);
+
+  for (ngx_uint_t i = 0; i < WAF_TEST_NELTS(tc->subjects) && tc->subjects[i]; i++) {
+    const char *s = tc->subjects[i];
+    ngx_int_t len = waf_test_pcre(tc->pattern, tc->caseless, s);
+    if (len < 0)
+      continue;
+
+    if (factors != NULL) {
+      ngx_uint_t found = 0;
+      ngx_str_t *f = factors->elts;
+      for (ngx_uint_t k = 0; !found && k < factors->nelts; k++) {
+        found = waf_test_contains((u_char *)s, ngx_strlen(s), f[k].data, f[k].len,
+                                  factors_caseless);
+      }
+      WAF_TEST_CHECK(found, "factors(%s) miss PCRE match on \"%s\"", tc->pattern, s);
+    }
+
+    if (rule.stream_width != 0) {
+      WAF_TEST_CHECK((size_t)len <= rule.stream_width,
+                     "stream_width(%s)=%lu shorter than PCRE match %ld on \"%s\"", tc->pattern,
+                     (unsigned long)rule.stream_width, (long)len, s);
+    }
+  }
+}
+
+int main(void)
+{
+  waf_test_init();
+  ngx_pool_t *pool = waf_test_pool();
+
+  for (ngx_uint_t i = 0; i < WAF_TEST_NELTS(waf_test_regex_cases); i++) {
+    waf_test_regex_case(pool, &waf_test_regex_cases[i]);
+  }
+
+  ngx_destroy_pool(pool);
+  return waf_test_done("test_regex");
+}
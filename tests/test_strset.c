@@ -0,0 +1,109 @@
+#include "waf_test.h"
+
+#include "ngx_http_waf_strset.h"
+
+/*
+ * EXACT 字符串集合对照测试：逐元素线性比较为对照，覆盖去重、空串、
+ * 长度不同的前缀以及大量元素下的探测链。
+ */
+
+#define WAF_TEST_SET_MAX 8
+
+typedef struct {
+  ngx_flag_t caseless;
+  const char *elems[WAF_TEST_SET_MAX];
+  const char *queries[WAF_TEST_SET_MAX];
+} waf_test_set_case_t;
+
+static waf_test_set_case_t waf_test_set_cases[] = {
+    {0, {"GET", "POST", "PUT"}, {"GET", "get", "POS", "POST ", "PUT", "", NULL}},
+    {1, {"GET", "post"}, {"get", "PoSt", "POSTS", "GE", NULL}},
+    {0, {"dup", "dup", "DUP"}, {"dup", "DUP", "Dup", NULL}},
+    {1, {"dup", "DUP"}, {"dUp", "du", NULL}},
+    {0, {"", "a"}, {"", "a", "b", NULL}},
+    {1, {"\xc3\x89t\xc3\xa9", "/admin"}, {"\xc3\x89T\xc3\xa9", "\xc3\xa9t\xc3\xa9", "/ADMIN", NULL}},
+};
+
+static ngx_uint_t waf_test_set_expect(const waf_test_set_case_t *tc, const ngx_str_t *q)
+{
+  for (ngx_uint_t i = 0; i < WAF_TEST_SET_MAX && tc->elems[i]; i++) {
+    size_t len = ngx_strlen(tc->elems[i]);
+    if (len == q->len && waf_test_contains(q->data, q->len, (u_char *)tc->elems[i], len,
+                                           tc->caseless))
+      return 1;
+  }
+  return 0;
+}
+
+static void waf_test_set_case(ngx_pool_t *pool, ngx_uint_t ci, const waf_test_set_case_t *tc)
+{
+  ngx_array_t *elems = ngx_array_create(pool, WAF_TEST_SET_MAX, sizeof(ngx_str_t));
+  for (ngx_uint_t i = 0; elems && i < WAF_TEST_SET_MAX && tc->elems[i]; i++) {
+    ngx_str_t *e = ngx_array_push(elems);
+    if (e == NULL)
+      elems = NULL;
+    else
+      *e = WAF_TEST_STR(tc->elems[i]);
+  }
+  waf_strset_t *set = elems ? waf_strset_create(pool, elems, tc->caseless) : NULL;
+  WAF_TEST_CHECK(set != NULL, "case %lu: create failed", (unsigned long)ci);
+  if (set == NULL)
+    return;
+
+  for (ngx_uint_t qi = 0; qi < WAF_TEST_SET_MAX && tc->queries[qi]; qi++) {
+    ngx_str_t q = WAF_TEST_STR(tc->queries[qi]);
+    ngx_uint_t want = waf_test_set_expect(tc, &q);
+    WAF_TEST_CHECK(waf_strset_contains(set, &q) == want, "case %lu: contains(\"%s\") != %lu",
+                   (unsigned long)ci, tc->queries[qi], (unsigned long)want);
+  }
+}
+
+/* 大集合：装载因子上限附近的探测链，caseless 下按折叠去重 */
+static void waf_test_set_large(ngx_pool_t *pool, ngx_flag_t caseless)
+{
+  ngx_uint_t n = 1000;
+  ngx_array_t *elems = ngx_array_create(pool, n, sizeof(ngx_str_t));
+  for (ngx_uint_t i = 0; elems && i < n; i++) {
+    ngx_str_t *e = ngx_array_push(elems);
+    u_char *buf = ngx_pnalloc(pool, 32);
+    if (e == NULL || buf == NULL) {
+      elems = NULL;
+      break;
+    }
+    e->data = buf;
+    e->len = ngx_sprintf(buf, "%s%ui", (i & 1) ? "Key" : "key", i / 2) - buf;
+  }
+  waf_strset_t *set = elems ? waf_strset_create(pool, elems, caseless) : NULL;
+  WAF_TEST_CHECK(set != NULL, "large(caseless=%ld): create failed", (long)caseless);
+  if (set == NULL)
+    return;
+  WAF_TEST_CHECK(set->nelts == (caseless ? n / 2 : n), "large(caseless=%ld): nelts %lu",
+                 (long)caseless, (unsigned long)set->nelts);
+
+  u_char buf[32];
+  for (ngx_uint_t i = 0; i < n; i++) {
+    ngx_str_t q = {ngx_sprintf(buf, "KEY%ui", i) - buf, buf};
+    ngx_uint_t want = caseless && i < n / 2;
+    WAF_TEST_CHECK(waf_strset_contains(set, &q) == want, "large(caseless=%ld): KEY%lu",
+                   (long)caseless, (unsigned long)i);
+    q.len = ngx_sprintf(buf, "key%ui", i) - buf;
+    want = i < n / 2;
+    WAF_TEST_CHECK(waf_strset_contains(set, &q) == want, "large(caseless=%ld): key%lu",
+                   (long)caseless, (unsigned long)i);
+  }
+}
+
+int main(void)
+{
+  waf_test_init();
+  ngx_pool_t *pool = waf_test_pool();
+
+  for (ngx_uint_t i = 0; i < WAF_TEST_NELTS(waf_test_set_cases); i++) {
+    waf_test_set_case(pool, i, &waf_test_set_cases[i]);
+  }
+  waf_test_set_large(pool, 0);
+  waf_test_set_large(pool, 1);
+
+  ngx_destroy_pool(pool);
+  return waf_test_done("test_strset");
+}
@@ -0,0 +1,185 @@
+#include "waf_test.h"
+
+#include "ngx_http_waf_simd.h"
+
+/*
+ * waf_simd_url_decode 对照测试：以 ngx_unescape_uri(type=0) 为准
+ *  - plus 为真时，先把 '+' 替换为空格再交给 ngx_unescape_uri（'+' 不会出现在合法转义内）
+ *  - 每个用例分别在标量内核（waf_simd_init 之前）与 CPU 选定的向量内核下执行，
+ *    并覆盖原地解码（dst == src）与不同起始对齐
+ *  - 分块解码（consumed 协议，流式/链式 form 视图所用）：任意一处、两处切分的结果
+ *    都必须与整体解码逐字节一致
+ *  - 链式预扫描：长请求体按缓冲边界与 8k 分段切分，转义跨越两种边界时结果不变
+ */
+
+/* 与 ngx_http_waf_module.c 的 WAF_BODY_PIECE 一致 */
+#define WAF_TEST_URL_PIECE 8192
+#define WAF_TEST_URL_LONG (3 * WAF_TEST_URL_PIECE)
+
+static const char *waf_test_url_cases[] = {
+    "",
+    "plain",
+    "a+b",
+    "%41%42%43",
+    "%4a%4A%4g",
+    "%",
+    "%4",
+    "abc%",
+    "abc%2",
+    "%%41",
+    "%zz%41",
+    "%+41",
+    "%4+1",
+    "%2B+%20",
+    "100%25+sure",
+    "%00%ff%FF%80",
+    "/path/to%2Fresource?x=%3Cscript%3E",
+    "%u0041%",
+    "%%%%%%",
+    "++++",
+    /* 跨越 16/32 字节向量块的转义与未转义片段 */
+    "0123456789abcdef0123456789abcdef%3c0123456789abcdef0123456789%3E+end",
+    "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa%41aaaaaaaaaaaaaaaaaaaaaaaaaaaaaa+%4",
+    "union%20select%201,2,3%2D%2D+-",
+    /* 第二个 '%' 已作为前一个转义的非法首位被消费，不得在块边界重新开启转义 */
+    "a%%41",
+    "%%2e%%2e%%2f",
+    "x%%%41%",
+    "%2%41",
+    "%%%2B+",
+};
+
+static size_t waf_test_url_expect(const u_char *src, size_t len, ngx_flag_t plus, u_char *out)
+{
+  u_char tmp[256];
+  ngx_memcpy(tmp, src, len);
+  if (plus) {
+    for (size_t i = 0; i < len; i++) {
+      if (tmp[i] == '+')
+        tmp[i] = ' ';
+    }
+  }
+  u_char *s = tmp, *d = out;
+  ngx_unescape_uri(&d, &s, len, 0);
+  return (size_t)(d - out);
+}
+
+/* 分块解码：在 cuts 处切分 src，未消费的块尾与下一块拼接后继续（末块按完整输入解码） */
+static size_t waf_test_url_chunked(const u_char *src, size_t len, const size_t *cuts,
+                                   ngx_uint_t ncuts, ngx_flag_t plus, u_char *out)
+{
+  static u_char buf[WAF_TEST_URL_LONG + 2];
+  size_t carry = 0, o = 0, start = 0;
+
+  for (ngx_uint_t k = 0; k <= ncuts; k++) {
+    size_t end = (k < ncuts) ? cuts[k] : len;
+    ngx_memcpy(buf + carry, src + start, end - start);
+    size_t n = carry + end - start, used = n;
+    size_t w = waf_simd_url_decode(buf, buf, n, plus, (k < ncuts) ? &used : NULL);
+    WAF_TEST_CHECK(n - used <= 2, "chunk left %lu undecoded bytes", (unsigned long)(n - used));
+    ngx_memcpy(out + o, buf, w);
+    o += w;
+    carry = n - used;
+    ngx_memmove(buf, buf + used, carry);
+    start = end;
+  }
+  return o;
+}
+
+static void waf_test_url_splits(const char *kernel, const u_char *src, size_t len,
+                                ngx_flag_t plus, const u_char *want, size_t want_len)
+{
+  u_char got[256];
+  size_t cuts[2];
+
+  for (cuts[0] = 0; cuts[0] <= len; cuts[0]++) {
+    size_t n = waf_test_url_chunked(src, len, cuts, 1, plus, got);
+    WAF_TEST_CHECK(n == want_len && ngx_memcmp(got, want, n) == 0,
+                   "%s: decode(\"%s\", plus=%ld) split at %lu differs", kernel,
+                   (const char *)src, (long)plus, (unsigned long)cuts[0]);
+
+    for (cuts[1] = cuts[0]; cuts[1] <= len; cuts[1]++) {
+      n = waf_test_url_chunked(src, len, cuts, 2, plus, got);
+      WAF_TEST_CHECK(n == want_len && ngx_memcmp(got, want, n) == 0,
+                     "%s: decode(\"%s\", plus=%ld) split at %lu,%lu differs", kernel,
+                     (const char *)src, (long)plus, (unsigned long)cuts[0],
+                     (unsigned long)cuts[1]);
+    }
+  }
+}
+
+/*
+ * 模拟 waf_body_chain_scan：请求体由 head 字节的内存缓冲与其后的文件段组成，
+ * 文件段再按 8k 分段解码；转义放在两种边界前后各个位置
+ */
+static void waf_test_url_chain(const char *kernel)
+{
+  static const char *escapes[] = {"%%41", "%2e", "%%%2B", "%4+1", "+%2"};
+  static u_char src[WAF_TEST_URL_LONG], want[WAF_TEST_URL_LONG], got[WAF_TEST_URL_LONG];
+  const size_t head = 5000;
+
+  for (ngx_uint_t e = 0; e < WAF_TEST_NELTS(escapes); e++) {
+    size_t elen = ngx_strlen(escapes[e]);
+
+    for (size_t shift = 0; shift <= elen; shift++) {
+      size_t cuts[3] = {head, head + WAF_TEST_URL_PIECE, head + 2 * WAF_TEST_URL_PIECE};
+      size_t len = head + 2 * WAF_TEST_URL_PIECE + 100;
+
+      ngx_memset(src, 'a', len);
+      for (ngx_uint_t k = 0; k < 3; k++) {
+        ngx_memcpy(src + cuts[k] - shift, escapes[e], elen);
+      }
+
+      size_t want_len = waf_simd_url_decode(want, src, len, 1, NULL);
+      size_t n = waf_test_url_chunked(src, len, cuts, 3, 1, got);
+      WAF_TEST_CHECK(n == want_len && ngx_memcmp(got, want, n) == 0,
+                     "%s: chained decode(\"%s\", shift=%lu) differs", kernel, escapes[e],
+                     (unsigned long)shift);
+    }
+  }
+}
+
+static void waf_test_url_run(const char *kernel)
+{
+  for (ngx_uint_t i = 0; i < WAF_TEST_NELTS(waf_test_url_cases); i++) {
+    const u_char *src = (const u_char *)waf_test_url_cases[i];
+    size_t len = ngx_strlen(src);
+
+    for (ngx_flag_t plus = 0; plus <= 1; plus++) {
+      u_char want[256], got[256 + 64];
+      size_t want_len = waf_test_url_expect(src, len, plus, want);
+
+      size_t n = waf_simd_url_decode(got, src, len, plus, NULL);
+      WAF_TEST_CHECK(n == want_len && ngx_memcmp(got, want, n) == 0,
+                     "%s: decode(\"%s\", plus=%ld) differs from ngx_unescape_uri", kernel,
+                     (const char *)src, (long)plus);
+
+      /* 原地解码 */
+      for (size_t align = 0; align < 32; align += 7) {
+        u_char *buf = got + align;
+        ngx_memcpy(buf, src, len);
+        n = waf_simd_url_decode(buf, buf, len, plus, NULL);
+        WAF_TEST_CHECK(n == want_len && ngx_memcmp(buf, want, n) == 0,
+                       "%s: in-place decode(\"%s\", plus=%ld, align=%lu) differs", kernel,
+                       (const char *)src, (long)plus, (unsigned long)align);
+      }
+
+      waf_test_url_splits(kernel, src, len, plus, want, want_len);
+    }
+  }
+
+  waf_test_url_chain(kernel);
+}
+
+int main(void)
+{
+  waf_test_init();
+
+  waf_test_url_run("scalar");
+  waf_simd_init(&waf_test_log);
+  if (ngx_strcmp(waf_simd_kernel_name(), "scalar") != 0) {
+    waf_test_url_run(waf_simd_kernel_name());
+  }
+
+  return waf_test_done("test_url_decode");
+}
@@ -0,0 +1,91 @@
+#ifndef NGX_HTTP_WAF_TEST_H
+#define NGX_HTTP_WAF_TEST_H
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+#include <stdio.h>
+
+/*
+ * ================================================================
+ *  单元测试公共设施（tests/ 下各测试程序共用，仅头文件）
+ *  - 测试程序链接已配置并编译的 nginx objs（见 tests/Makefile），不启动 cycle
+ *  - waf_test_init 只初始化 pool / 日志依赖的全局量
+ *  - WAF_TEST_CHECK 失败时打印位置与说明并计数，main 以 waf_test_done 的结果退出
+ * ================================================================
+ */
+
+#define WAF_TEST_NELTS(a) (sizeof(a) / sizeof((a)[0]))
+
+/* 以 C 字符串构造 ngx_str_t（测试表内的字面量均以 NUL 结尾） */
+#define WAF_TEST_STR(s) ((ngx_str_t){ngx_strlen(s), (u_char *)(s)})
+
+static ngx_uint_t waf_test_checks;
+static ngx_uint_t waf_test_failures;
+static ngx_log_t waf_test_log;
+static ngx_open_file_t waf_test_log_file;
+
+#define WAF_TEST_CHECK(cond, ...)                                                                  \
+  do {                                                                                             \
+    waf_test_checks++;                                                                             \
+    if (!(cond)) {                                                                                 \
+      waf_test_failures++;                                                                         \
+      fprintf(stderr, "%s:%d: FAIL: ", __FILE__, __LINE__);                                        \
+      fprintf(stderr, __VA_ARGS__);                                                                \
+      fputc('\n', stderr);                                                                         \
+    }                                                                                              \
+  } while (0)
+
+static ngx_inline void waf_test_init(void)
+{
+  ngx_pagesize = getpagesize();
+  ngx_cacheline_size = NGX_CPU_CACHE_LINE;
+  for (ngx_uint_t n = ngx_pagesize; n >>= 1; ngx_pagesize_shift++) {
+    /* void */
+  }
+  (void)ngx_strerror_init();
+  ngx_time_init();
+
+  waf_test_log_file.fd = ngx_stderr;
+  waf_test_log.file = &waf_test_log_file;
+  waf_test_log.log_level = NGX_LOG_WARN;
+}
+
+static ngx_inline ngx_pool_t *waf_test_pool(void)
+{
+  ngx_pool_t *pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, &waf_test_log);
+  if (pool == NULL) {
+    fprintf(stderr, "out of memory\n");
+    exit(2);
+  }
+  return pool;
+}
+
+/* ASCII 大小写折叠下 hay 是否包含 needle（对照实现，逐位置比较） */
+static ngx_inline ngx_uint_t waf_test_contains(const u_char *hay, size_t hay_len,
+                                               const u_char *needle, size_t needle_len,
+                                               ngx_flag_t caseless)
+{
+  if (needle_len == 0)
+    return 1;
+  for (size_t i = 0; i + needle_len <= hay_len; i++) {
+    size_t k = 0;
+    while (k < needle_len && (caseless ? ngx_tolower(hay[i + k]) == ngx_tolower(needle[k])
+                                       : hay[i + k] == needle[k])) {
+      k++;
+    }
+    if (k == needle_len)
+      return 1;
+  }
+  return 0;
+}
+
+/* 打印汇总并返回进程退出码 */
+static ngx_inline int waf_test_done(const char *name)
+{
+  fprintf(stderr, "%s: %lu checks, %lu failed\n", name, (unsigned long)waf_test_checks,
+          (unsigned long)waf_test_failures);
+  return waf_test_failures ? 1 : 0;
+}
+
+#endif /* NGX_HTTP_WAF_TEST_H */